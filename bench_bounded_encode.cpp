@@ -0,0 +1,99 @@
+// Compares encoding X90IO through the regular MsgPackSerializable encoder
+// against the straight-line StraightLineSerializable path and the raw
+// unchecked encode_bounded().
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "x90_msg.h"
+
+namespace
+{
+
+// X90IO without the straight-line encoder
+class PlainIO : public MsgPackSerializable<PlainIO>
+{
+public:
+  serialization::fixed_string<15> name;
+  std::variant<bool, double> data;
+  static constexpr auto get_fields()
+  {
+    using namespace serialization;
+    return std::make_tuple(make_field("name", &PlainIO::name), make_field("data", &PlainIO::data));
+  }
+};
+
+template<typename IO>
+std::vector<IO> make_ios(size_t count)
+{
+  std::vector<IO> ios(count);
+  for (size_t i = 0; i < count; ++i) {
+    ios[i].name = "IO" + std::to_string(i % 100);
+    if (i % 2 == 0) {
+      ios[i].data = (i % 4) == 0;
+    } else {
+      ios[i].data = static_cast<double>(i) * 12.5;
+    }
+  }
+  return ios;
+}
+
+// Encodes every object into one writer per pass; returns ns per object
+template<typename IO>
+double run(const char * label, const std::vector<IO> & ios, size_t passes, std::vector<char> & buffer)
+{
+  size_t bytes = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t pass = 0; pass < passes; ++pass) {
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer.data(), buffer.size());
+    for (const IO & io : ios) {
+      io.serialize(&writer);
+    }
+    bytes += mpack_writer_buffer_used(&writer);
+    if (mpack_writer_destroy(&writer) != mpack_ok) {
+      std::fprintf(stderr, "%s: encoding failed\n", label);
+      std::exit(1);
+    }
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  const double ns = elapsed.count() * 1e9 / static_cast<double>(passes * ios.size());
+  std::printf("%-28s %8.1f ns/obj %8.1f MB/s\n", label, ns, static_cast<double>(bytes) / elapsed.count() / 1e6);
+  return ns;
+}
+
+}  // namespace
+
+int main(int argc, char ** argv)
+{
+  const size_t passes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000;
+  const size_t count = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000;
+
+  const std::vector<PlainIO> plain = make_ios<PlainIO>(count);
+  const std::vector<X90IO> straight = make_ios<X90IO>(count);
+  std::vector<char> buffer(count * serialization::max_encoded_size_v<X90IO>);
+
+  const double base = run("MsgPackSerializable", plain, passes, buffer);
+  const double line = run("StraightLineSerializable", straight, passes, buffer);
+
+  // The encoder alone, without the virtual call and writer reservation
+  size_t bytes = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t pass = 0; pass < passes; ++pass) {
+    char * p = buffer.data();
+    for (const X90IO & io : straight) {
+      p += serialization::encode_bounded(p, io);
+    }
+    bytes += static_cast<size_t>(p - buffer.data());
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  const double raw = elapsed.count() * 1e9 / static_cast<double>(passes * count);
+  std::printf("%-28s %8.1f ns/obj %8.1f MB/s\n", "encode_bounded", raw, static_cast<double>(bytes) / elapsed.count() / 1e6);
+
+  std::printf("straight-line speedup: %.1fx (encode_bounded alone %.1fx)\n", base / line, base / raw);
+  return 0;
+}
@@ -0,0 +1,111 @@
+// Compares decoding X90Msg through the mpack reader against parsing it
+// into an mpack_tree_t and decoding from the nodes.
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "x90_msg.h"
+#include "include/mpack_node_backend.h"
+
+namespace
+{
+
+X90Msg make_message(size_t groups)
+{
+  X90Msg msg;
+  msg.endpoint_id = "Endpoint123";
+  msg.current_time = 1622547800;
+  for (size_t g = 0; g < groups; ++g) {
+    X90IOGroup group;
+    group.name = "Group" + std::to_string(g);
+    group.time_recorded = 1622547800 + g;
+    group.is_fail = (g % 3) == 0;
+    for (int i = 0; i < 6; ++i) {
+      X90IO io;
+      io.name = "IO" + std::to_string(i);
+      if (i % 2 == 0) {
+        io.data = (i % 4) == 0;
+      } else {
+        io.data = i * 12.5;
+      }
+      group.ios.push_back(io);
+    }
+    group.errors.push_back(X90Error("Error" + std::to_string(g), "Type1", "Error message"));
+    group.set_status(X90Status::WARN);
+    msg.io_groups.push_back(group);
+  }
+  return msg;
+}
+
+template<typename Fn>
+void run(const char * label, size_t iterations, size_t bytes, Fn && fn)
+{
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    fn();
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  std::printf(
+    "%-28s %10.0f ns/msg %8.1f MB/s\n", label,
+    elapsed.count() * 1e9 / static_cast<double>(iterations),
+    static_cast<double>(bytes * iterations) / elapsed.count() / 1e6);
+}
+
+}  // namespace
+
+int main(int argc, char ** argv)
+{
+  const size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000;
+  const size_t groups = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 16;
+
+  static std::array<char, 1 << 20> buffer;
+  const X90Msg source = make_message(groups);
+  const size_t size = Serializable::to_msgpack(buffer, source);
+  if (size == 0) {
+    std::fprintf(stderr, "Message does not fit the buffer\n");
+    return 1;
+  }
+  std::printf("%zu groups, %zu bytes per message\n", groups, size);
+
+  run("reader", iterations, size, [&]() {
+      mpack_reader_t reader;
+      mpack_reader_init_data(&reader, buffer.data(), size);
+      X90Msg msg;
+      msg.deserialize(&reader);
+      mpack_reader_destroy(&reader);
+    });
+
+  run("tree, fresh pool", iterations, size, [&]() {
+      serialization::MessageTree tree;
+      tree.parse(buffer.data(), size);
+      X90Msg msg;
+      tree.decode(msg);
+    });
+
+  serialization::MessageTree reused;
+  run("tree, reused pool", iterations, size, [&]() {
+      reused.parse(buffer.data(), size);
+      X90Msg msg;
+      reused.decode(msg);
+    });
+
+  run("tree, parse only", iterations, size, [&]() {
+      reused.parse(buffer.data(), size);
+    });
+
+  run("tree, lookup CurrentTime", iterations, size, [&]() {
+      reused.parse(buffer.data(), size);
+      uint64_t time = 0;
+      reused.decode(reused.find(reused.root(), "CurrentTime"), time);
+    });
+
+  run("tree, 4-thread IOGroups", iterations / 10 + 1, size, [&]() {
+      reused.parse(buffer.data(), size);
+      std::vector<X90IOGroup> groups_out;
+      reused.parallel_decode({"IOGroups"}, groups_out, 4);
+    });
+
+  return 0;
+}
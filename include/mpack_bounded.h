@@ -0,0 +1,573 @@
+#ifndef MPACK_BOUNDED_H
+#define MPACK_BOUNDED_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <variant>
+
+#include "mpack/mpack.h"
+#include "mpack_fixed_string.h"
+#include "mpack_serialize_typehandlers.h"
+#include "mpack_serializer.h"
+#include "mpack_small_vector.h"
+
+namespace serialization
+{
+
+// max_encoded_size_v of a type whose encoding has no fixed upper bound
+constexpr size_t kUnbounded = std::numeric_limits<size_t>::max();
+
+namespace bounded_detail
+{
+
+constexpr size_t str_header_size(size_t n)
+{
+  return n <= 31 ? 1 : n <= UINT8_MAX ? 2 : n <= UINT16_MAX ? 3 : 5;
+}
+
+constexpr size_t array_header_size(size_t n)
+{
+  return n <= 15 ? 1 : n <= UINT16_MAX ? 3 : 5;
+}
+
+constexpr size_t ext_header_size(size_t n)
+{
+  return (n == 1 || n == 2 || n == 4 || n == 8 || n == 16) ? 2 :
+         n <= UINT8_MAX ? 3 : n <= UINT16_MAX ? 4 : 6;
+}
+
+constexpr size_t map_header_size(size_t n) { return array_header_size(n); }
+
+constexpr size_t add(size_t a, size_t b)
+{
+  return a == kUnbounded || b == kUnbounded ? kUnbounded : a + b;
+}
+
+constexpr size_t mul(size_t a, size_t n)
+{
+  return a == kUnbounded ? kUnbounded : a * n;
+}
+
+constexpr size_t max(size_t a, size_t b) { return a > b ? a : b; }
+
+// Unchecked stores producing the same bytes as the mpack writer
+
+inline char * put_u8(char * p, uint8_t value)
+{
+  *p = static_cast<char>(value);
+  return p + 1;
+}
+
+template<size_t Bytes>
+inline char * put_be(char * p, uint8_t lead, uint64_t value)
+{
+  p[0] = static_cast<char>(lead);
+  for (size_t i = 0; i < Bytes; ++i) {
+    p[1 + i] = static_cast<char>(value >> (8 * (Bytes - 1 - i)));
+  }
+  return p + 1 + Bytes;
+}
+
+inline char * put_uint(char * p, uint64_t value)
+{
+  if (value <= 127) {
+    return put_u8(p, static_cast<uint8_t>(value));
+  } else if (value <= UINT8_MAX) {
+    return put_be<1>(p, 0xcc, value);
+  } else if (value <= UINT16_MAX) {
+    return put_be<2>(p, 0xcd, value);
+  } else if (value <= UINT32_MAX) {
+    return put_be<4>(p, 0xce, value);
+  }
+  return put_be<8>(p, 0xcf, value);
+}
+
+inline char * put_int(char * p, int64_t value)
+{
+  if (value > 127) {
+    return put_uint(p, static_cast<uint64_t>(value));
+  } else if (value >= -32) {
+    return put_u8(p, static_cast<uint8_t>(value));
+  } else if (value >= INT8_MIN) {
+    return put_be<1>(p, 0xd0, static_cast<uint64_t>(value));
+  } else if (value >= INT16_MIN) {
+    return put_be<2>(p, 0xd1, static_cast<uint64_t>(value));
+  } else if (value >= INT32_MIN) {
+    return put_be<4>(p, 0xd2, static_cast<uint64_t>(value));
+  }
+  return put_be<8>(p, 0xd3, static_cast<uint64_t>(value));
+}
+
+inline char * put_float(char * p, float value)
+{
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return put_be<4>(p, 0xca, bits);
+}
+
+inline char * put_double(char * p, double value)
+{
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return put_be<8>(p, 0xcb, bits);
+}
+
+inline char * put_str_header(char * p, uint32_t n)
+{
+  if (n <= 31) {
+    return put_u8(p, static_cast<uint8_t>(0xa0 | n));
+  } else if (n <= UINT8_MAX) {
+    return put_be<1>(p, 0xd9, n);
+  } else if (n <= UINT16_MAX) {
+    return put_be<2>(p, 0xda, n);
+  }
+  return put_be<4>(p, 0xdb, n);
+}
+
+inline char * put_str(char * p, const char * data, size_t n)
+{
+  p = put_str_header(p, static_cast<uint32_t>(n));
+  std::memcpy(p, data, n);
+  return p + n;
+}
+
+inline char * put_array_header(char * p, uint32_t n)
+{
+  if (n <= 15) {
+    return put_u8(p, static_cast<uint8_t>(0x90 | n));
+  } else if (n <= UINT16_MAX) {
+    return put_be<2>(p, 0xdc, n);
+  }
+  return put_be<4>(p, 0xdd, n);
+}
+
+inline char * put_map_header(char * p, uint32_t n)
+{
+  if (n <= 15) {
+    return put_u8(p, static_cast<uint8_t>(0x80 | n));
+  } else if (n <= UINT16_MAX) {
+    return put_be<2>(p, 0xde, n);
+  }
+  return put_be<4>(p, 0xdf, n);
+}
+
+inline char * put_ext(char * p, int8_t type, const char * data, uint32_t n)
+{
+  switch (n) {
+    case 1: p = put_u8(p, 0xd4); break;
+    case 2: p = put_u8(p, 0xd5); break;
+    case 4: p = put_u8(p, 0xd6); break;
+    case 8: p = put_u8(p, 0xd7); break;
+    case 16: p = put_u8(p, 0xd8); break;
+    default:
+      if (n <= UINT8_MAX) {
+        p = put_be<1>(p, 0xc7, n);
+      } else if (n <= UINT16_MAX) {
+        p = put_be<2>(p, 0xc8, n);
+      } else {
+        p = put_be<4>(p, 0xc9, n);
+      }
+  }
+  p = put_u8(p, static_cast<uint8_t>(type));
+  std::memcpy(p, data, n);
+  return p + n;
+}
+
+// Same choices as write_compact_double
+inline char * put_compact_double(char * p, double value)
+{
+  const bool integral = is_int64_exact(value);
+  if (integral && value >= -2147483648.0 && value < 4294967296.0) {
+    return put_int(p, static_cast<int64_t>(value));
+  } else if (is_float32_exact(value)) {
+    return put_float(p, static_cast<float>(value));
+  } else if (integral) {
+    return value < 0 ? put_int(p, static_cast<int64_t>(value)) :
+           put_uint(p, static_cast<uint64_t>(value));
+  }
+  return put_double(p, value);
+}
+
+// Compile-time forms of put_map_header and put_str_header, for pre-encoded key tables
+constexpr size_t put_be_constexpr(char * p, uint8_t lead, uint32_t value, size_t bytes)
+{
+  p[0] = static_cast<char>(lead);
+  for (size_t i = 0; i < bytes; ++i) {
+    p[1 + i] = static_cast<char>(value >> (8 * (bytes - 1 - i)));
+  }
+  return 1 + bytes;
+}
+
+constexpr size_t put_map_header_constexpr(char * p, uint32_t n)
+{
+  return n <= 15 ? put_be_constexpr(p, static_cast<uint8_t>(0x80 | n), 0, 0) :
+         n <= UINT16_MAX ? put_be_constexpr(p, 0xde, n, 2) : put_be_constexpr(p, 0xdf, n, 4);
+}
+
+constexpr size_t put_str_header_constexpr(char * p, uint32_t n)
+{
+  return n <= 31 ? put_be_constexpr(p, static_cast<uint8_t>(0xa0 | n), 0, 0) :
+         n <= UINT8_MAX ? put_be_constexpr(p, 0xd9, n, 1) :
+         n <= UINT16_MAX ? put_be_constexpr(p, 0xda, n, 2) : put_be_constexpr(p, 0xdb, n, 4);
+}
+
+// Same choices as write_compact_float
+inline char * put_compact_float(char * p, float value)
+{
+  if (value > -2147483648.0f && value < 2147483648.0f && std::trunc(value) == value &&
+    !(value == 0.0f && std::signbit(value)))
+  {
+    return put_int(p, static_cast<int64_t>(value));
+  }
+  return put_float(p, value);
+}
+
+}  // namespace bounded_detail
+
+/**
+ * Writer for types whose encoding has a compile-time upper bound.
+ * Specializations provide max_size and write(p, value, flags), which stores
+ * the msgpack bytes at p without any capacity check and returns the end.
+ * The output is byte-identical to the TypeHandler with the same flags.
+ */
+template<typename T, typename = void>
+struct BoundedWriter
+{
+  static constexpr size_t max_size = kUnbounded;
+};
+
+template<typename T>
+inline constexpr size_t max_encoded_size_v = BoundedWriter<T>::max_size;
+
+template<typename T>
+inline constexpr bool is_bounded_v = max_encoded_size_v<T> != kUnbounded;
+
+template<>
+struct BoundedWriter<bool>
+{
+  static constexpr size_t max_size = 1;
+
+  static char * write(char * p, bool value, uint32_t)
+  {
+    return bounded_detail::put_u8(p, value ? 0xc3 : 0xc2);
+  }
+};
+
+template<typename T>
+struct BoundedWriter<T, std::enable_if_t<std::is_integral_v<T>&& !std::is_same_v<T, bool>>>
+{
+  static constexpr size_t max_size = 1 + sizeof(T);
+
+  static char * write(char * p, T value, uint32_t flags)
+  {
+    if (flags & EncodeFixedWidth) {
+      return bounded_detail::put_be<sizeof(T)>(p, fixed_width_lead<T>(), static_cast<uint64_t>(value));
+    }
+    if constexpr (std::is_unsigned_v<T>) {
+      return bounded_detail::put_uint(p, static_cast<uint64_t>(value));
+    } else {
+      return bounded_detail::put_int(p, static_cast<int64_t>(value));
+    }
+  }
+};
+
+template<typename T>
+struct BoundedWriter<T, std::enable_if_t<std::is_floating_point_v<T>>>
+{
+  static constexpr size_t max_size = std::is_same_v<T, double> ? 9 : 5;
+
+  static char * write(char * p, T value, uint32_t flags)
+  {
+    // double keeps float64; other floating types go through float32 like their handler
+    if constexpr (std::is_same_v<T, double>) {
+      return (flags & EncodeCompactFloat) ? bounded_detail::put_compact_double(p, value) :
+             bounded_detail::put_double(p, value);
+    } else {
+      return (flags & EncodeCompactFloat) ?
+             bounded_detail::put_compact_float(p, static_cast<float>(value)) :
+             bounded_detail::put_float(p, static_cast<float>(value));
+    }
+  }
+};
+
+template<size_t N>
+struct BoundedWriter<MsgPackExtension<N>>
+{
+  static constexpr size_t max_size = bounded_detail::ext_header_size(N) + N;
+
+  static char * write(char * p, const MsgPackExtension<N> & value, uint32_t)
+  {
+    return bounded_detail::put_ext(p, value.type, value.buffer, N);
+  }
+};
+
+template<size_t N>
+struct BoundedWriter<fixed_string<N>>
+{
+  static constexpr size_t max_size = bounded_detail::str_header_size(N) + N;
+
+  static char * write(char * p, const fixed_string<N> & value, uint32_t)
+  {
+    return bounded_detail::put_str(p, value.data(), value.size());
+  }
+};
+
+template<typename T, size_t N>
+struct BoundedWriter<std::array<T, N>>
+{
+  static constexpr size_t max_size = bounded_detail::add(
+    bounded_detail::array_header_size(N), bounded_detail::mul(max_encoded_size_v<T>, N));
+
+  static char * write(char * p, const std::array<T, N> & value, uint32_t flags)
+  {
+    p = bounded_detail::put_array_header(p, N);
+    for (const auto & item : value) {
+      p = BoundedWriter<T>::write(p, item, flags);
+    }
+    return p;
+  }
+};
+
+template<typename T, size_t N>
+struct BoundedWriter<inline_vector<T, N, false>>
+{
+  static constexpr size_t max_size = bounded_detail::add(
+    bounded_detail::array_header_size(N), bounded_detail::mul(max_encoded_size_v<T>, N));
+
+  static char * write(char * p, const inline_vector<T, N, false> & value, uint32_t flags)
+  {
+    p = bounded_detail::put_array_header(p, static_cast<uint32_t>(value.size()));
+    for (const auto & item : value) {
+      p = BoundedWriter<T>::write(p, item, flags);
+    }
+    return p;
+  }
+};
+
+template<typename U>
+struct BoundedWriter<std::optional<U>>
+{
+  static constexpr size_t max_size = bounded_detail::max(1, max_encoded_size_v<U>);
+
+  static char * write(char * p, const std::optional<U> & value, uint32_t flags)
+  {
+    return value ? BoundedWriter<U>::write(p, *value, flags) : bounded_detail::put_u8(p, 0xc0);
+  }
+};
+
+template<typename ... Types>
+struct BoundedWriter<std::variant<Types...>>
+{
+  static constexpr size_t max_size = std::max({max_encoded_size_v<Types>...});
+
+  static char * write(char * p, const std::variant<Types...> & value, uint32_t flags)
+  {
+    flags = TypeHandler<std::variant<Types...>>::alternative_flags(value.index(), flags);
+    return std::visit(
+      [p, flags](const auto & v) {
+        return BoundedWriter<std::decay_t<decltype(v)>>::write(p, v, flags);
+      }, value);
+  }
+};
+
+template<typename ... Types>
+struct BoundedWriter<TaggedVariant<Types...>>
+{
+  static_assert(sizeof...(Types) <= 128, "Index must fit a positive fixint");
+
+  static constexpr size_t max_size =
+    bounded_detail::add(2, std::max({max_encoded_size_v<Types>...}));
+
+  static char * write(char * p, const TaggedVariant<Types...> & value, uint32_t flags)
+  {
+    p = bounded_detail::put_array_header(p, 2);
+    p = bounded_detail::put_u8(p, static_cast<uint8_t>(value.index()));
+    // The index already disambiguates, so flags pass through unchanged as
+    // in TypeHandler<TaggedVariant>
+    return std::visit(
+      [p, flags](const auto & v) {
+        return BoundedWriter<std::decay_t<decltype(v)>>::write(p, v, flags);
+      }, value.as_variant());
+  }
+};
+
+// Reflected types: the field map written by MsgPackSerializable. The map
+// header and every key are encoded at compile time into one table, so each
+// key is a fixed-size copy the compiler turns into a few immediate stores.
+template<typename T>
+struct BoundedWriter<T, std::enable_if_t<is_reflected_v<T>>>
+{
+private:
+  static constexpr auto kFields = T::get_fields();
+  static constexpr size_t kFieldCount = std::tuple_size_v<decltype(kFields)>;
+
+  static_assert(kFieldCount > 0, "Reflected type has no fields");
+
+  template<size_t I>
+  static constexpr size_t name_length()
+  {
+    return std::char_traits<char>::length(std::get<I>(kFields).name);
+  }
+
+  // Offsets in kKeys of the bytes written before field I; key 0 carries the map header
+  template<size_t I>
+  static constexpr size_t key_begin()
+  {
+    if constexpr (I == 0) {
+      return 0;
+    } else {
+      return key_end<I - 1>();
+    }
+  }
+
+  template<size_t I>
+  static constexpr size_t key_end()
+  {
+    return key_begin<I>() + (I == 0 ? bounded_detail::map_header_size(kFieldCount) : 0) +
+           bounded_detail::str_header_size(name_length<I>()) + name_length<I>();
+  }
+
+  static constexpr auto make_keys()
+  {
+    std::array<char, key_end<kFieldCount - 1>()> keys{};
+    size_t pos = bounded_detail::put_map_header_constexpr(keys.data(), kFieldCount);
+    std::apply(
+      [&keys, &pos](const auto & ... field) {
+        ((pos += bounded_detail::put_str_header_constexpr(
+          keys.data() + pos, static_cast<uint32_t>(std::char_traits<char>::length(field.name))),
+        pos = copy_name(keys.data() + pos, field.name) - keys.data()), ...);
+      }, kFields);
+    return keys;
+  }
+
+  static constexpr char * copy_name(char * p, const char * name)
+  {
+    while (*name != '\0') {
+      *p++ = *name++;
+    }
+    return p;
+  }
+
+  static constexpr auto kKeys = make_keys();
+
+  template<size_t I>
+  static char * put_field(char * p, const T & value, uint32_t flags)
+  {
+    constexpr size_t begin = key_begin<I>();
+    constexpr size_t size = key_end<I>() - begin;
+    std::memcpy(p, kKeys.data() + begin, size);
+    return BoundedWriter<field_member_t<decltype(std::get<I>(kFields))>>::write(
+      p + size, value.*(std::get<I>(kFields).member_ptr), flags | std::get<I>(kFields).flags);
+  }
+
+  template<size_t... I>
+  static char * put_fields(char * p, const T & value, uint32_t flags, std::index_sequence<I...>)
+  {
+    ((p = put_field<I>(p, value, flags)), ...);
+    return p;
+  }
+
+  static constexpr size_t compute_max_size()
+  {
+    return std::apply(
+      [](const auto & ... field) {
+        size_t total = bounded_detail::map_header_size(kFieldCount);
+        ((total = bounded_detail::add(
+          total,
+          bounded_detail::add(
+            bounded_detail::str_header_size(std::char_traits<char>::length(field.name)) +
+            std::char_traits<char>::length(field.name),
+            max_encoded_size_v<field_member_t<decltype(field)>>))), ...);
+        return total;
+      }, kFields);
+  }
+
+public:
+  static constexpr size_t max_size = compute_max_size();
+
+  static char * write(char * p, const T & value, uint32_t flags)
+  {
+    return put_fields(p, value, flags, std::make_index_sequence<kFieldCount>{});
+  }
+};
+
+// Encodes a bounded value without capacity checks; out must hold
+// max_encoded_size_v<T> bytes. Returns the number of bytes written.
+template<typename T>
+size_t encode_bounded(char * out, const T & value, uint32_t flags = EncodeDefault)
+{
+  static_assert(is_bounded_v<T>, "Type has no compile-time bound on its encoded size");
+  return static_cast<size_t>(BoundedWriter<T>::write(out, value, flags) - out);
+}
+
+// Buffer large enough for any value of T
+template<typename T>
+using bounded_buffer = std::array<char, max_encoded_size_v<T>>;
+
+// Encodes into a statically sized buffer; the size check happens at compile time
+template<typename T, size_t N>
+size_t to_msgpack(std::array<char, N> & buffer, const T & value, uint32_t flags = EncodeDefault)
+{
+  static_assert(is_bounded_v<T>, "Type has no compile-time bound on its encoded size");
+  static_assert(N >= max_encoded_size_v<T>, "Buffer is smaller than max_encoded_size_v<T>");
+  return encode_bounded(buffer.data(), value, flags);
+}
+
+// Writes a bounded value straight into space reserved in the writer's
+// buffer, bypassing the per-element mpack calls. Returns false, writing
+// nothing, when writer_reserve() cannot hand out max_encoded_size_v<T>
+// bytes; the caller then falls back to the TypeHandler path.
+template<typename T>
+bool write_bounded(mpack_writer_t * writer, const T & value, uint32_t flags = EncodeDefault)
+{
+  static_assert(is_bounded_v<T>, "Type has no compile-time bound on its encoded size");
+  char * out = writer_reserve(writer, max_encoded_size_v<T>);
+  if (out == nullptr) {
+    return false;
+  }
+  writer_commit(writer, static_cast<size_t>(BoundedWriter<T>::write(out, value, flags) - out));
+  return true;
+}
+
+}  // namespace serialization
+
+/**
+ * MsgPackSerializable whose encoder is the straight-line BoundedWriter:
+ * constant key bytes and unchecked value stores into space reserved once
+ * in the writer's buffer. Output is byte-identical to MsgPackSerializable.
+ * Meant for small fixed-schema types; every field must be bounded.
+ * Falls back to the regular encoder near the end of the buffer and when a
+ * session dictionary is in use. Not for use inside mpack_build_map/array.
+ */
+template<typename Derived>
+class StraightLineSerializable : public MsgPackSerializable<Derived>
+{
+protected:
+  using MsgPackSerializable<Derived>::do_serialize;
+
+  void do_serialize(
+    mpack_writer_t * writer,
+    const serialization::EncodeContext & ctx) const override
+  {
+    static_assert(
+      serialization::is_bounded_v<Derived>,
+      "StraightLineSerializable needs every field to have a bounded encoding");
+
+    if (ctx.dictionary == nullptr &&
+      serialization::write_bounded(writer, static_cast<const Derived &>(*this), ctx.flags))
+    {
+      return;
+    }
+    MsgPackSerializable<Derived>::do_serialize(writer, ctx);
+  }
+};
+
+#endif  // MPACK_BOUNDED_H
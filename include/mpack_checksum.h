@@ -0,0 +1,301 @@
+#ifndef MPACK_CHECKSUM_H
+#define MPACK_CHECKSUM_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "mpack/mpack.h"
+#include "mpack_serializer.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MPACK_CRC32C_X86 1
+#include <immintrin.h>
+#else
+#define MPACK_CRC32C_X86 0
+#endif
+
+namespace serialization
+{
+
+namespace crc32c_detail
+{
+
+// Slicing-by-8 tables for the reflected Castagnoli polynomial
+inline const std::array<std::array<uint32_t, 256>, 8> & tables()
+{
+  static const auto kTables = []() {
+      std::array<std::array<uint32_t, 256>, 8> t{};
+      for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+          crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1u)));
+        }
+        t[0][i] = crc;
+      }
+      for (uint32_t i = 0; i < 256; ++i) {
+        for (size_t k = 1; k < 8; ++k) {
+          t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+        }
+      }
+      return t;
+    }();
+  return kTables;
+}
+
+// Optionally copies to dest while checksumming; dest may be null
+inline uint32_t update_software(uint32_t crc, char * dest, const uint8_t * s, size_t size)
+{
+  const auto & t = tables();
+  while (size >= 8) {
+    uint64_t word;
+    std::memcpy(&word, s, sizeof(word));
+    if (dest != nullptr) {
+      std::memcpy(dest, &word, sizeof(word));
+      dest += 8;
+    }
+    const uint32_t low = static_cast<uint32_t>(word) ^ crc;
+    const uint32_t high = static_cast<uint32_t>(word >> 32);
+    crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^ t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^
+      t[3][high & 0xff] ^ t[2][(high >> 8) & 0xff] ^ t[1][(high >> 16) & 0xff] ^ t[0][high >> 24];
+    s += 8;
+    size -= 8;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    if (dest != nullptr) {
+      dest[i] = static_cast<char>(s[i]);
+    }
+    crc = (crc >> 8) ^ t[0][(crc ^ s[i]) & 0xff];
+  }
+  return crc;
+}
+
+#if MPACK_CRC32C_X86
+
+__attribute__((target("sse4.2")))
+inline uint32_t update_sse42(uint32_t crc, char * dest, const uint8_t * s, size_t size)
+{
+#if defined(__x86_64__)
+  uint64_t crc64 = crc;
+  while (size >= 8) {
+    uint64_t word;
+    std::memcpy(&word, s, sizeof(word));
+    if (dest != nullptr) {
+      std::memcpy(dest, &word, sizeof(word));
+      dest += 8;
+    }
+    crc64 = _mm_crc32_u64(crc64, word);
+    s += 8;
+    size -= 8;
+  }
+  crc = static_cast<uint32_t>(crc64);
+#endif
+  while (size >= 4) {
+    uint32_t word;
+    std::memcpy(&word, s, sizeof(word));
+    if (dest != nullptr) {
+      std::memcpy(dest, &word, sizeof(word));
+      dest += 4;
+    }
+    crc = _mm_crc32_u32(crc, word);
+    s += 4;
+    size -= 4;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    if (dest != nullptr) {
+      dest[i] = static_cast<char>(s[i]);
+    }
+    crc = _mm_crc32_u8(crc, s[i]);
+  }
+  return crc;
+}
+
+#endif  // MPACK_CRC32C_X86
+
+using UpdateFn = uint32_t (*)(uint32_t, char *, const uint8_t *, size_t);
+
+// Hardware CRC32 when the CPU has SSE4.2, chosen once per process
+inline UpdateFn update()
+{
+  static const UpdateFn fn = []() -> UpdateFn {
+#if MPACK_CRC32C_X86
+      if (__builtin_cpu_supports("sse4.2")) {
+        return &update_sse42;
+      }
+#endif
+      return &update_software;
+    }();
+  return fn;
+}
+
+constexpr uint32_t kPolynomial = 0x82f63b78u;
+
+// a * b modulo the polynomial, bit-reflected as the CRC register is
+inline uint32_t multiply(uint32_t a, uint32_t b)
+{
+  uint32_t product = 0;
+  for (uint32_t m = 1u << 31; m != 0; m >>= 1) {
+    if (a & m) {
+      product ^= b;
+    }
+    b = (b >> 1) ^ (kPolynomial & (0u - (b & 1u)));
+  }
+  return product;
+}
+
+// x^(8 * bytes) modulo the polynomial, by squaring
+inline uint32_t shift_bytes(uint64_t bytes)
+{
+  uint32_t result = 1u << 31;  // x^0
+  uint32_t power = 1u << 23;   // x^8
+  for (; bytes != 0; bytes >>= 1) {
+    if (bytes & 1) {
+      result = multiply(power, result);
+    }
+    power = multiply(power, power);
+  }
+  return result;
+}
+
+}  // namespace crc32c_detail
+
+// CRC32C (Castagnoli) of the bytes. Pass the previous result as crc to
+// continue a checksum over several pieces.
+inline uint32_t crc32c(const char * data, size_t size, uint32_t crc = 0)
+{
+  return ~crc32c_detail::update()(~crc, nullptr, reinterpret_cast<const uint8_t *>(data), size);
+}
+
+// Copies size bytes to dest and returns their CRC32C in the same pass
+inline uint32_t crc32c_copy(char * dest, const char * src, size_t size, uint32_t crc = 0)
+{
+  return ~crc32c_detail::update()(~crc, dest, reinterpret_cast<const uint8_t *>(src), size);
+}
+
+// CRC32C of A followed by B, from crc32c(A), crc32c(B) and B's length. Lets
+// a payload be checksummed as it is produced, before what precedes it is known.
+inline uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t size_b)
+{
+  return crc32c_detail::multiply(crc32c_detail::shift_bytes(size_b), crc_a) ^ crc_b;
+}
+
+/**
+ * Length-prefixed frame with an integrity check:
+ *   [uint32 little-endian length | kChecksumFlag][uint32 little-endian CRC32C][payload]
+ * The CRC covers the length word and the payload. Plain frames are
+ * [uint32 length][payload] with the flag clear, so readers of this format
+ * accept both and a corrupted record is found without decoding it.
+ */
+struct ChecksumFrame
+{
+  static constexpr size_t kHeaderSize = 8;
+  static constexpr size_t kPlainHeaderSize = 4;
+  static constexpr uint32_t kChecksumFlag = 1u << 31;
+  static constexpr uint32_t kMaxPayload = kChecksumFlag - 1;
+
+  static void store_u32(char * out, uint32_t value)
+  {
+    for (size_t i = 0; i < 4; ++i) {
+      out[i] = static_cast<char>(value >> (8 * i));
+    }
+  }
+
+  static uint32_t load_u32(const char * in)
+  {
+    uint32_t value = 0;
+    for (size_t i = 0; i < 4; ++i) {
+      value |= static_cast<uint32_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+    }
+    return value;
+  }
+
+  static bool has_checksum(uint32_t length_word) { return (length_word & kChecksumFlag) != 0; }
+  static uint32_t payload_size(uint32_t length_word) { return length_word & ~kChecksumFlag; }
+
+  // Header bytes implied by the first length word of a frame
+  static size_t header_size(uint32_t length_word)
+  {
+    return has_checksum(length_word) ? kHeaderSize : kPlainHeaderSize;
+  }
+
+  // Fills the header in front of a payload already stored after it
+  static void seal(char * frame, size_t payload)
+  {
+    const uint32_t length_word = static_cast<uint32_t>(payload) | kChecksumFlag;
+    store_u32(frame, length_word);
+    const uint32_t crc = crc32c(frame + kHeaderSize, payload, crc32c(frame, 4));
+    store_u32(frame + 4, crc);
+  }
+
+  // Fills the header in front of a payload whose own CRC32C is already known
+  static void seal_with(char * frame, size_t payload, uint32_t payload_crc)
+  {
+    const uint32_t length_word = static_cast<uint32_t>(payload) | kChecksumFlag;
+    store_u32(frame, length_word);
+    store_u32(frame + 4, crc32c_combine(crc32c(frame, 4), payload_crc, payload));
+  }
+
+  // Writes header and payload to frame, checksumming during the copy
+  static void seal_copy(char * frame, const char * payload, size_t size)
+  {
+    const uint32_t length_word = static_cast<uint32_t>(size) | kChecksumFlag;
+    store_u32(frame, length_word);
+    const uint32_t crc = crc32c_copy(frame + kHeaderSize, payload, size, crc32c(frame, 4));
+    store_u32(frame + 4, crc);
+  }
+
+  // Checks a complete checksummed frame
+  static bool verify(const char * frame, size_t payload)
+  {
+    return crc32c(frame + kHeaderSize, payload, crc32c(frame, 4)) == load_u32(frame + 4);
+  }
+};
+
+namespace checksum_detail
+{
+
+constexpr size_t kChunkSize = 4096;
+
+struct CrcSink
+{
+  std::vector<char> * out;
+  uint32_t crc;
+};
+
+// Checksums each chunk as mpack hands it over, while it is still in cache
+inline void flush_callback(mpack_writer_t * writer, const char * buffer, size_t count)
+{
+  CrcSink * sink = static_cast<CrcSink *>(mpack_writer_context(writer));
+  sink->crc = crc32c(buffer, count, sink->crc);
+  sink->out->insert(sink->out->end(), buffer, buffer + count);
+}
+
+}  // namespace checksum_detail
+
+// Appends obj's encoding to out and returns its CRC32C, taken chunk by chunk
+// as the encoding is produced; pair with ChecksumFrame::seal_with(). On
+// failure out is left as it was.
+inline uint32_t encode_crc32c(const Serializable & obj, std::vector<char> & out, const EncodeContext & ctx)
+{
+  const size_t start = out.size();
+  char chunk[checksum_detail::kChunkSize];
+  checksum_detail::CrcSink sink{&out, 0};
+  mpack_writer_t writer;
+  mpack_writer_init(&writer, chunk, sizeof(chunk));
+  mpack_writer_set_context(&writer, &sink);
+  mpack_writer_set_flush(&writer, &checksum_detail::flush_callback);
+
+  obj.serialize(&writer, ctx);
+
+  if (mpack_writer_destroy(&writer) != mpack_ok) {
+    out.resize(start);
+    throw std::runtime_error("An error occurred encoding the data");
+  }
+  return sink.crc;
+}
+
+}  // namespace serialization
+#endif  // MPACK_CHECKSUM_H
@@ -0,0 +1,626 @@
+#ifndef MPACK_COLUMNAR_H
+#define MPACK_COLUMNAR_H
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mpack/mpack.h"
+#include "mpack_io_detail.h"
+#include "mpack_serialize_typehandlers.h"
+#include "mpack_serializer.h"
+
+namespace serialization
+{
+
+/**
+ * Columnar archive of reflected messages.
+ *
+ * Every leaf field becomes a column named by its dotted field path, e.g.
+ * "IOGroups.IOs.data". A field holding a sequence of reflected objects becomes
+ * a child table: its elements get one row each, and a "<path>.#parent" column
+ * records the row of the object that contained them. Row numbers are global
+ * per table, starting at 0 for the first message in the file.
+ *
+ * Messages are grouped into blocks. Each column of a block is stored as one
+ * contiguous chunk of msgpack values with min/max statistics, so a scan
+ * reads only the chunks of the columns it asks for and can skip blocks by
+ * their statistics.
+ *
+ * File layout: the column chunks block by block, then a msgpack footer
+ *   [version, [column names], [[[offset, length, count, stats] per column] per block]]
+ * and a trailer of the footer offset (uint64 little endian) and "MPC1".
+ */
+constexpr uint32_t kColumnarVersion = 1;
+constexpr char kColumnarMagic[4] = {'M', 'P', 'C', '1'};
+constexpr size_t kFooterOffsetSize = 8;   // little-endian footer offset before the magic
+constexpr size_t kMinChunkEntrySize = 5;  // [offset, length, count, nil] with fixint values
+
+// Min/max of the ordered values in one column chunk
+struct ColumnStats
+{
+  using Value = TaggedVariant<int64_t, uint64_t, double, std::string>;
+
+  // False when the chunk holds no ordered values or mixes kinds of values
+  bool valid = false;
+  Value min;
+  Value max;
+
+  // Whether a numeric value in [lo, hi] may be present; compared as double
+  bool may_overlap(double lo, double hi) const
+  {
+    if (!valid || std::holds_alternative<std::string>(min)) {
+      return !valid;
+    }
+    return as_double(min) <= hi && as_double(max) >= lo;
+  }
+
+  // Whether the string s may be present
+  bool may_contain(std::string_view s) const
+  {
+    if (!valid || !std::holds_alternative<std::string>(min)) {
+      return !valid;
+    }
+    return std::get<std::string>(min) <= s && s <= std::get<std::string>(max);
+  }
+
+private:
+  static double as_double(const Value & v)
+  {
+    return std::visit(
+      [](const auto & x) -> double {
+        if constexpr (std::is_arithmetic_v<std::decay_t<decltype(x)>>) {
+          return static_cast<double>(x);
+        } else {
+          return 0.0;
+        }
+      }, v.as_variant());
+  }
+};
+
+namespace columnar_detail
+{
+
+// Sequences of reflected objects are stored as child tables
+template<typename T, typename = void>
+struct is_reflected_sequence : std::false_type {};
+
+template<typename T>
+struct is_reflected_sequence<T, std::void_t<typename T::value_type,
+  decltype(std::declval<const T &>().begin()), decltype(std::declval<const T &>().end())>>
+  : is_reflected<typename T::value_type> {};
+
+// Number of columns a reflected type shreds into
+template<typename T>
+constexpr size_t column_count();
+
+template<typename M>
+constexpr size_t field_column_count()
+{
+  if constexpr (is_reflected_sequence<M>::value) {
+    return 1 + column_count<typename M::value_type>();
+  } else {
+    return 1;
+  }
+}
+
+template<typename T>
+constexpr size_t column_count()
+{
+  return std::apply(
+    [](const auto & ... field) {
+      return (size_t{0} + ... + field_column_count<field_member_t<decltype(field)>>());
+    }, T::get_fields());
+}
+
+// Accumulates ColumnStats one typed value at a time
+class StatsBuilder
+{
+public:
+  template<typename V>
+  void add(const V & value)
+  {
+    if constexpr (std::is_same_v<V, bool>) {
+      // Not ordered in any useful sense
+    } else if constexpr (std::is_integral_v<V> && std::is_signed_v<V>) {
+      update<0>(static_cast<int64_t>(value));
+    } else if constexpr (std::is_integral_v<V>) {
+      update<1>(static_cast<uint64_t>(value));
+    } else if constexpr (std::is_floating_point_v<V>) {
+      if (!std::isnan(value)) {
+        update<2>(static_cast<double>(value));
+      }
+    } else if constexpr (std::is_convertible_v<const V &, std::string_view>) {
+      update<3>(std::string_view(value));
+    } else if constexpr (is_variant<V>::value) {
+      std::visit([this](const auto & v) {add(v);}, value);
+    }
+  }
+
+  ColumnStats finish()
+  {
+    ColumnStats stats;
+    stats.valid = seen_ && !mixed_;
+    if (stats.valid) {
+      stats.min = std::move(min_);
+      stats.max = std::move(max_);
+    }
+    seen_ = false;
+    mixed_ = false;
+    return stats;
+  }
+
+private:
+  template<typename V>
+  struct is_variant : std::false_type {};
+
+  template<typename ... Types>
+  struct is_variant<std::variant<Types...>>: std::true_type {};
+
+  template<size_t K, typename V>
+  void update(const V & value)
+  {
+    if (mixed_) {
+      return;
+    }
+    if (!seen_) {
+      min_.template emplace<K>(value);
+      max_.template emplace<K>(value);
+      seen_ = true;
+    } else if (min_.index() != K) {
+      mixed_ = true;
+    } else {
+      auto & lo = std::get<K>(min_);
+      auto & hi = std::get<K>(max_);
+      if (value < lo) {
+        lo = value;
+      } else if (hi < value) {
+        hi = value;
+      }
+    }
+  }
+
+  bool seen_ = false;
+  bool mixed_ = false;
+  ColumnStats::Value min_;
+  ColumnStats::Value max_;
+};
+
+// Where a column chunk lives in the file
+struct ChunkInfo
+{
+  uint64_t offset = 0;
+  uint64_t length = 0;
+  uint64_t count = 0;
+  ColumnStats stats;
+};
+
+}  // namespace columnar_detail
+
+/**
+ * Shreds messages of type T into a columnar archive file.
+ * close() writes the footer; a file that was never closed cannot be read.
+ */
+template<typename T>
+class ColumnarWriter
+{
+  static_assert(is_reflected_v<T>, "ColumnarWriter needs a type with get_fields()");
+
+public:
+  explicit ColumnarWriter(std::string path, size_t rows_per_block = 4096)
+  : path_(std::move(path)), rows_per_block_(rows_per_block)
+  {
+    if (rows_per_block_ == 0) {
+      throw std::invalid_argument("ColumnarWriter needs at least one row per block");
+    }
+    columns_.reserve(columnar_detail::column_count<T>());
+    add_columns<T>("");
+
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+      io_detail::throw_errno("open", path_);
+    }
+  }
+
+  ColumnarWriter(const ColumnarWriter &) = delete;
+  ColumnarWriter & operator=(const ColumnarWriter &) = delete;
+
+  ~ColumnarWriter()
+  {
+    try {
+      close();
+    } catch (...) {
+      // Errors surface only through an explicit close()
+    }
+  }
+
+  void append(const T & msg)
+  {
+    shred(msg, 0, rows_++);
+    if (++block_rows_ == rows_per_block_) {
+      finish_block();
+    }
+  }
+
+  // Writes the last block and the footer, then closes the file
+  void close()
+  {
+    if (fd_ < 0) {
+      return;
+    }
+    if (block_rows_ > 0) {
+      finish_block();
+    }
+    write_footer();
+    if (::close(std::exchange(fd_, -1)) != 0) {
+      io_detail::throw_errno("close", path_);
+    }
+  }
+
+  // Total messages appended
+  uint64_t size() const { return rows_; }
+
+private:
+  // Values of one column for the current block, encoded as they arrive
+  struct Column
+  {
+    std::string name;
+    mpack_writer_t writer;
+    char buffer[4096];
+    std::vector<char> chunk;
+    uint64_t block_count = 0;
+    uint64_t total = 0;
+    columnar_detail::StatsBuilder stats;
+    std::vector<columnar_detail::ChunkInfo> chunks;
+
+    explicit Column(std::string n)
+    : name(std::move(n))
+    {
+      mpack_writer_init(&writer, buffer, sizeof(buffer));
+      mpack_writer_set_context(&writer, this);
+      mpack_writer_set_flush(&writer, &Column::flush);
+    }
+
+    ~Column() { mpack_writer_destroy(&writer); }
+
+    template<typename V>
+    void append(const V & value)
+    {
+      write_value(&writer, value, EncodeContext{});
+      stats.add(value);
+      ++block_count;
+      ++total;
+    }
+
+    static void flush(mpack_writer_t * w, const char * data, size_t count)
+    {
+      auto * column = static_cast<Column *>(mpack_writer_context(w));
+      column->chunk.insert(column->chunk.end(), data, data + count);
+    }
+  };
+
+  template<typename U>
+  void add_columns(const std::string & prefix)
+  {
+    std::apply(
+      [&](const auto & ... field) {
+        (add_field_columns<field_member_t<decltype(field)>>(prefix + field.name), ...);
+      }, U::get_fields());
+  }
+
+  template<typename M>
+  void add_field_columns(const std::string & path)
+  {
+    if constexpr (columnar_detail::is_reflected_sequence<M>::value) {
+      columns_.push_back(std::make_unique<Column>(path + ".#parent"));
+      add_columns<typename M::value_type>(path + ".");
+    } else {
+      columns_.push_back(std::make_unique<Column>(path));
+    }
+  }
+
+  // Appends the fields of obj, row `row` of its table, to the columns from `column` on
+  template<typename U>
+  void shred(const U & obj, size_t column, uint64_t row)
+  {
+    std::apply(
+      [&](const auto & ... field) {
+        (shred_field(obj.*(field.member_ptr), column, row), ...);
+      }, U::get_fields());
+  }
+
+  template<typename M>
+  void shred_field(const M & value, size_t & column, uint64_t row)
+  {
+    if constexpr (columnar_detail::is_reflected_sequence<M>::value) {
+      using Element = typename M::value_type;
+      Column & parent = *columns_[column];
+      for (const Element & element : value) {
+        const uint64_t child_row = parent.total;
+        parent.append(row);
+        shred(element, column + 1, child_row);
+      }
+      column += columnar_detail::field_column_count<M>();
+    } else {
+      columns_[column++]->append(value);
+    }
+  }
+
+  void finish_block()
+  {
+    for (auto & column : columns_) {
+      mpack_writer_flush_message(&column->writer);
+      if (mpack_writer_error(&column->writer) != mpack_ok) {
+        throw std::runtime_error("An error occurred encoding column " + column->name);
+      }
+      columnar_detail::ChunkInfo info;
+      info.offset = offset_;
+      info.length = column->chunk.size();
+      info.count = column->block_count;
+      info.stats = column->stats.finish();
+      column->chunks.push_back(std::move(info));
+
+      io_detail::write_all(fd_, column->chunk.data(), column->chunk.size(), path_);
+      offset_ += column->chunk.size();
+      column->chunk.clear();
+      column->block_count = 0;
+    }
+    block_rows_ = 0;
+  }
+
+  void write_footer()
+  {
+    char * data = nullptr;
+    size_t size = 0;
+    mpack_writer_t writer;
+    mpack_writer_init_growable(&writer, &data, &size);
+
+    const size_t blocks = columns_.empty() ? 0 : columns_.front()->chunks.size();
+    mpack_start_array(&writer, 3);
+    mpack_write_uint(&writer, kColumnarVersion);
+    mpack_start_array(&writer, static_cast<uint32_t>(columns_.size()));
+    for (const auto & column : columns_) {
+      write_value(&writer, column->name, EncodeContext{});
+    }
+    mpack_finish_array(&writer);
+    mpack_start_array(&writer, static_cast<uint32_t>(blocks));
+    for (size_t b = 0; b < blocks; ++b) {
+      mpack_start_array(&writer, static_cast<uint32_t>(columns_.size()));
+      for (const auto & column : columns_) {
+        const columnar_detail::ChunkInfo & info = column->chunks[b];
+        mpack_start_array(&writer, 4);
+        mpack_write_u64(&writer, info.offset);
+        mpack_write_u64(&writer, info.length);
+        mpack_write_u64(&writer, info.count);
+        if (info.stats.valid) {
+          mpack_start_array(&writer, 2);
+          write_value(&writer, info.stats.min, EncodeContext{});
+          write_value(&writer, info.stats.max, EncodeContext{});
+          mpack_finish_array(&writer);
+        } else {
+          mpack_write_nil(&writer);
+        }
+        mpack_finish_array(&writer);
+      }
+      mpack_finish_array(&writer);
+    }
+    mpack_finish_array(&writer);
+    mpack_finish_array(&writer);
+
+    if (mpack_writer_destroy(&writer) != mpack_ok) {
+      std::free(data);
+      throw std::runtime_error("An error occurred encoding the columnar footer");
+    }
+
+    char trailer[kFooterOffsetSize + sizeof(kColumnarMagic)];
+    io_detail::store_le(trailer, offset_, kFooterOffsetSize);
+    std::memcpy(trailer + kFooterOffsetSize, kColumnarMagic, sizeof(kColumnarMagic));
+    try {
+      io_detail::write_all(fd_, data, size, path_);
+      io_detail::write_all(fd_, trailer, sizeof(trailer), path_);
+    } catch (...) {
+      std::free(data);
+      throw;
+    }
+    std::free(data);
+  }
+
+  std::string path_;
+  size_t rows_per_block_;
+  int fd_ = -1;
+  uint64_t offset_ = 0;
+  uint64_t rows_ = 0;
+  size_t block_rows_ = 0;
+  std::vector<std::unique_ptr<Column>> columns_;
+};
+
+/**
+ * Reads individual columns of an archive written by ColumnarWriter.
+ * The file is mapped; only the chunks of the requested columns are decoded.
+ */
+class ColumnarReader
+{
+public:
+  explicit ColumnarReader(const std::string & path)
+  : file_(path)
+  {
+    const size_t trailer_size = kFooterOffsetSize + sizeof(kColumnarMagic);
+    if (file_.size() < trailer_size ||
+      std::memcmp(file_.data() + file_.size() - sizeof(kColumnarMagic), kColumnarMagic,
+      sizeof(kColumnarMagic)) != 0)
+    {
+      throw std::runtime_error("Not a columnar archive: " + path);
+    }
+    const uint64_t footer = io_detail::load_le(
+      file_.data() + file_.size() - trailer_size, kFooterOffsetSize);
+    if (footer > file_.size() - trailer_size) {
+      throw std::runtime_error("Columnar footer offset out of range: " + path);
+    }
+    read_footer(file_.data() + footer, file_.size() - trailer_size - footer);
+  }
+
+  size_t column_count() const { return names_.size(); }
+  const std::string & column_name(size_t column) const { return names_.at(column); }
+
+  // Index of the column with the given dotted path
+  size_t column(std::string_view name) const
+  {
+    for (size_t i = 0; i < names_.size(); ++i) {
+      if (names_[i] == name) {
+        return i;
+      }
+    }
+    throw std::out_of_range("No such column: " + std::string(name));
+  }
+
+  size_t block_count() const { return blocks_.size(); }
+
+  // Rows the column holds in a block
+  uint64_t row_count(size_t column, size_t block) const { return chunk(column, block).count; }
+
+  const ColumnStats & stats(size_t column, size_t block) const { return chunk(column, block).stats; }
+
+  // Calls fn(row, value) for every value of a column in one block
+  template<typename V, typename Fn>
+  void scan(size_t column, size_t block, Fn && fn) const
+  {
+    const columnar_detail::ChunkInfo & info = chunk(column, block);
+    if (info.offset + info.length > file_.size()) {
+      throw std::runtime_error("Column chunk out of range");
+    }
+
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, file_.data() + info.offset, info.length);
+
+    uint64_t row = first_rows_[block][column];
+    V value{};
+    for (uint64_t i = 0; i < info.count; ++i) {
+      read_value(&reader, value, DecodeContext{});
+      if (mpack_reader_error(&reader) != mpack_ok) {
+        break;
+      }
+      fn(row++, value);
+    }
+
+    if (mpack_reader_destroy(&reader) != mpack_ok) {
+      throw std::runtime_error("An error occurred decoding the data");
+    }
+  }
+
+  // Calls fn(row, value) for every value of a column
+  template<typename V, typename Fn>
+  void scan(size_t column, Fn && fn) const
+  {
+    for (size_t block = 0; block < blocks_.size(); ++block) {
+      scan<V>(column, block, fn);
+    }
+  }
+
+  // Appends every value of a column to out, in row order
+  template<typename V>
+  void read_column(size_t column, std::vector<V> & out) const
+  {
+    uint64_t total = 0;
+    for (size_t block = 0; block < blocks_.size(); ++block) {
+      total += row_count(column, block);
+    }
+    out.reserve(out.size() + total);
+    scan<V>(column, [&out](uint64_t, const V & value) {out.push_back(value);});
+  }
+
+private:
+  const columnar_detail::ChunkInfo & chunk(size_t column, size_t block) const
+  {
+    return blocks_.at(block).at(column);
+  }
+
+  void read_footer(const char * data, size_t size)
+  {
+    const uint64_t data_offset = static_cast<uint64_t>(data - file_.data());
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, size);
+
+    if (mpack_expect_array(&reader) != 3 || mpack_expect_u32(&reader) != kColumnarVersion) {
+      throw std::runtime_error("Unsupported columnar archive version");
+    }
+    // The counts are untrusted: a name takes at least one byte and a block
+    // entry at least one byte plus kMinChunkEntrySize per column, so the
+    // footer size bounds both before anything is allocated
+    const uint32_t name_count = mpack_expect_array(&reader);
+    if (name_count > mpack_reader_remaining(&reader, nullptr)) {
+      throw std::runtime_error("Columnar footer lists more columns than it holds");
+    }
+    names_.resize(name_count);
+    for (auto & name : names_) {
+      read_value(&reader, name, DecodeContext{});
+    }
+
+    const uint32_t block_count = mpack_expect_array(&reader);
+    if (block_count > mpack_reader_remaining(&reader, nullptr) /
+      (1 + kMinChunkEntrySize * names_.size()))
+    {
+      throw std::runtime_error("Columnar footer lists more blocks than it holds");
+    }
+    blocks_.resize(block_count);
+    first_rows_.resize(blocks_.size());
+    std::vector<uint64_t> rows(names_.size(), 0);
+    for (size_t b = 0; b < blocks_.size(); ++b) {
+      if (mpack_expect_array(&reader) != names_.size()) {
+        throw std::runtime_error("Columnar block does not list every column");
+      }
+      blocks_[b].resize(names_.size());
+      first_rows_[b] = rows;
+      for (size_t c = 0; c < names_.size(); ++c) {
+        columnar_detail::ChunkInfo & info = blocks_[b][c];
+        if (mpack_expect_array(&reader) != 4) {
+          throw std::runtime_error("Malformed columnar chunk entry");
+        }
+        info.offset = mpack_expect_u64(&reader);
+        info.length = mpack_expect_u64(&reader);
+        info.count = mpack_expect_u64(&reader);
+        // Chunks lie before the footer and hold at least one byte per value
+        if (info.offset > data_offset || info.length > data_offset - info.offset ||
+          info.count > info.length)
+        {
+          throw std::runtime_error("Columnar chunk out of range");
+        }
+        if (mpack_peek_tag(&reader).type == mpack_type_nil) {
+          mpack_expect_nil(&reader);
+        } else {
+          if (mpack_expect_array(&reader) != 2) {
+            throw std::runtime_error("Malformed columnar statistics");
+          }
+          read_value(&reader, info.stats.min, DecodeContext{});
+          read_value(&reader, info.stats.max, DecodeContext{});
+          info.stats.valid = true;
+        }
+        rows[c] += info.count;
+      }
+    }
+
+    if (mpack_reader_destroy(&reader) != mpack_ok) {
+      throw std::runtime_error("An error occurred decoding the columnar footer");
+    }
+  }
+
+  io_detail::MappedFile file_;
+  std::vector<std::string> names_;
+  std::vector<std::vector<columnar_detail::ChunkInfo>> blocks_;
+  std::vector<std::vector<uint64_t>> first_rows_;  // first row of each chunk in its table
+};
+
+}  // namespace serialization
+#endif  // MPACK_COLUMNAR_H
@@ -0,0 +1,224 @@
+#ifndef MPACK_CONTENT_HASH_H
+#define MPACK_CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "mpack/mpack.h"
+#include "mpack_serializer.h"
+
+namespace serialization
+{
+
+/**
+ * Streaming XXH64: a fast non-cryptographic 64-bit hash whose result does
+ * not depend on how the input is split across update() calls. Good for
+ * deduplication and cache keys, not for anything an attacker controls.
+ */
+class ContentHasher
+{
+public:
+  explicit ContentHasher(uint64_t seed = 0)
+  : seed_(seed)
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    acc_[0] = seed_ + kPrime1 + kPrime2;
+    acc_[1] = seed_ + kPrime2;
+    acc_[2] = seed_;
+    acc_[3] = seed_ - kPrime1;
+    total_ = 0;
+    buffered_ = 0;
+  }
+
+  void update(const char * data, size_t size)
+  {
+    total_ += size;
+    if (buffered_ + size < kStripe) {
+      std::memcpy(buffer_ + buffered_, data, size);
+      buffered_ += size;
+      return;
+    }
+    if (buffered_ > 0) {
+      const size_t fill = kStripe - buffered_;
+      std::memcpy(buffer_ + buffered_, data, fill);
+      consume(buffer_);
+      data += fill;
+      size -= fill;
+      buffered_ = 0;
+    }
+    while (size >= kStripe) {
+      consume(data);
+      data += kStripe;
+      size -= kStripe;
+    }
+    std::memcpy(buffer_, data, size);
+    buffered_ = size;
+  }
+
+  // Hash of everything passed to update() since the last reset()
+  uint64_t digest() const
+  {
+    uint64_t h;
+    if (total_ >= kStripe) {
+      h = rotl(acc_[0], 1) + rotl(acc_[1], 7) + rotl(acc_[2], 12) + rotl(acc_[3], 18);
+      for (uint64_t acc : acc_) {
+        h = (h ^ round(0, acc)) * kPrime1 + kPrime4;
+      }
+    } else {
+      h = seed_ + kPrime5;
+    }
+    h += total_;
+
+    const char * p = buffer_;
+    size_t left = buffered_;
+    for (; left >= 8; p += 8, left -= 8) {
+      h ^= round(0, load64(p));
+      h = rotl(h, 27) * kPrime1 + kPrime4;
+    }
+    if (left >= 4) {
+      h ^= load32(p) * kPrime1;
+      h = rotl(h, 23) * kPrime2 + kPrime3;
+      p += 4;
+      left -= 4;
+    }
+    for (; left > 0; ++p, --left) {
+      h ^= static_cast<unsigned char>(*p) * kPrime5;
+      h = rotl(h, 11) * kPrime1;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+  }
+
+  static uint64_t hash(const char * data, size_t size, uint64_t seed = 0)
+  {
+    ContentHasher hasher(seed);
+    hasher.update(data, size);
+    return hasher.digest();
+  }
+
+private:
+  static constexpr size_t kStripe = 32;
+  static constexpr uint64_t kPrime1 = 0x9e3779b185ebca87ull;
+  static constexpr uint64_t kPrime2 = 0xc2b2ae3d27d4eb4full;
+  static constexpr uint64_t kPrime3 = 0x165667b19e3779f9ull;
+  static constexpr uint64_t kPrime4 = 0x85ebca77c2b2ae63ull;
+  static constexpr uint64_t kPrime5 = 0x27d4eb2f165667c5ull;
+
+  static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+  static uint64_t round(uint64_t acc, uint64_t input)
+  {
+    acc += input * kPrime2;
+    return rotl(acc, 31) * kPrime1;
+  }
+
+  // Little-endian loads, as the reference implementation reads its input
+  static uint64_t load64(const char * p)
+  {
+    uint64_t value = 0;
+    for (size_t i = 0; i < 8; ++i) {
+      value |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+    }
+    return value;
+  }
+
+  static uint64_t load32(const char * p)
+  {
+    uint64_t value = 0;
+    for (size_t i = 0; i < 4; ++i) {
+      value |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+    }
+    return value;
+  }
+
+  void consume(const char * stripe)
+  {
+    for (size_t i = 0; i < 4; ++i) {
+      acc_[i] = round(acc_[i], load64(stripe + 8 * i));
+    }
+  }
+
+  uint64_t seed_;
+  uint64_t acc_[4];
+  uint64_t total_;
+  char buffer_[kStripe];
+  size_t buffered_;
+};
+
+namespace content_hash_detail
+{
+
+constexpr size_t kChunkSize = 4096;
+
+struct HashSink
+{
+  ContentHasher hasher;
+  std::vector<char> * out;
+};
+
+// Hashes each chunk as mpack hands it over, while it is still in cache
+inline void flush_callback(mpack_writer_t * writer, const char * buffer, size_t count)
+{
+  HashSink * sink = static_cast<HashSink *>(mpack_writer_context(writer));
+  sink->hasher.update(buffer, count);
+  if (sink->out != nullptr) {
+    sink->out->insert(sink->out->end(), buffer, buffer + count);
+  }
+}
+
+inline uint64_t encode(const Serializable & obj, std::vector<char> * out, const EncodeContext & ctx)
+{
+  if (ctx.dictionary != nullptr) {
+    throw std::runtime_error("Content hashing needs an encoding without a session dictionary");
+  }
+  const size_t start = out != nullptr ? out->size() : 0;
+  char chunk[kChunkSize];
+  HashSink sink{ContentHasher(), out};
+  mpack_writer_t writer;
+  mpack_writer_init(&writer, chunk, sizeof(chunk));
+  mpack_writer_set_context(&writer, &sink);
+  mpack_writer_set_flush(&writer, &flush_callback);
+
+  obj.serialize(&writer, ctx);
+
+  if (mpack_writer_destroy(&writer) != mpack_ok) {
+    if (out != nullptr) {
+      out->resize(start);
+    }
+    throw std::runtime_error("An error occurred encoding the data");
+  }
+  return sink.hasher.digest();
+}
+
+}  // namespace content_hash_detail
+
+// Hash of obj's encoding, computed through a small stack buffer without
+// keeping the bytes. Equal objects hash equally under EncodeCanonical.
+inline uint64_t content_hash(const Serializable & obj, const EncodeContext & ctx = EncodeContext{EncodeCanonical})
+{
+  return content_hash_detail::encode(obj, nullptr, ctx);
+}
+
+// Appends obj's encoding to out and returns its content_hash() from the
+// same pass over the bytes. On failure out is left as it was.
+inline uint64_t encode_hashed(
+  const Serializable & obj, std::vector<char> & out,
+  const EncodeContext & ctx = EncodeContext{EncodeCanonical})
+{
+  return content_hash_detail::encode(obj, &out, ctx);
+}
+
+}  // namespace serialization
+#endif  // MPACK_CONTENT_HASH_H
@@ -0,0 +1,113 @@
+#ifndef MPACK_DICTIONARY_STREAM_H
+#define MPACK_DICTIONARY_STREAM_H
+
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+
+#include "mpack/mpack.h"
+#include "mpack_serializer.h"
+#include "mpack_string_dictionary.h"
+
+namespace serialization
+{
+
+/**
+ * Encodes a stream of messages sharing one string dictionary.
+ * Messages must be decoded in the order they were encoded, by a
+ * DictionaryStreamDecoder built with the same parameters. Each side
+ * records a message's strings once it is complete (see StringDictionary).
+ */
+class DictionaryStreamEncoder
+{
+public:
+  explicit DictionaryStreamEncoder(
+    size_t min_length = 4, size_t max_entries = 65536,
+    int8_t ext_type = StringDictionary::kDefaultExtType)
+  : dictionary_(min_length, max_entries, ext_type) {}
+
+  // Returns the encoded size, or 0 if the buffer was too small.
+  // A failed message leaves the dictionary as it was.
+  size_t encode(char * buffer, size_t size, const Serializable & obj, uint32_t flags = EncodeDefault)
+  {
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, buffer, size);
+    try {
+      obj.serialize(&writer, EncodeContext{flags, &dictionary_});
+    } catch (...) {
+      mpack_writer_destroy(&writer);
+      throw;
+    }
+
+    size_t actual_size = mpack_writer_buffer_used(&writer);
+    if (mpack_writer_destroy(&writer) != mpack_ok) {
+      return 0;
+    }
+    dictionary_.record_message(buffer, actual_size);
+    return actual_size;
+  }
+
+  template<size_t N>
+  size_t encode(std::array<char, N> & buffer, const Serializable & obj, uint32_t flags = EncodeDefault)
+  {
+    return encode(buffer.data(), buffer.size(), obj, flags);
+  }
+
+  // Starts a new session; the decoder must be reset at the same point
+  void reset() { dictionary_.clear(); }
+
+  const StringDictionary & dictionary() const { return dictionary_; }
+
+private:
+  StringDictionary dictionary_;
+};
+
+/**
+ * Decodes messages produced by a DictionaryStreamEncoder, in order.
+ */
+class DictionaryStreamDecoder
+{
+public:
+  explicit DictionaryStreamDecoder(
+    size_t min_length = 4, size_t max_entries = 65536,
+    int8_t ext_type = StringDictionary::kDefaultExtType)
+  : dictionary_(min_length, max_entries, ext_type) {}
+
+  // Throws on malformed input; a failed message leaves the dictionary as it was
+  void decode(const char * data, size_t size, Serializable & obj, StringInterner * interner = nullptr)
+  {
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, size);
+    try {
+      DecodeContext ctx;
+      ctx.interner = interner;
+      ctx.dictionary = &dictionary_;
+      obj.deserialize(&reader, ctx);
+    } catch (...) {
+      mpack_reader_destroy(&reader);
+      throw;
+    }
+
+    const size_t used = size - mpack_reader_remaining(&reader, nullptr);
+    if (mpack_reader_destroy(&reader) != mpack_ok) {
+      throw std::runtime_error("An error occurred decoding the data");
+    }
+    dictionary_.record_message(data, used);
+  }
+
+  template<size_t N>
+  void decode(const std::array<char, N> & buffer, Serializable & obj, StringInterner * interner = nullptr)
+  {
+    decode(buffer.data(), buffer.size(), obj, interner);
+  }
+
+  void reset() { dictionary_.clear(); }
+
+  const StringDictionary & dictionary() const { return dictionary_; }
+
+private:
+  StringDictionary dictionary_;
+};
+
+}  // namespace serialization
+#endif  // MPACK_DICTIONARY_STREAM_H
@@ -0,0 +1,257 @@
+#ifndef MPACK_FD_WRITER_H
+#define MPACK_FD_WRITER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "mpack/mpack.h"
+#include "mpack_checksum.h"
+#include "mpack_serializer.h"
+
+namespace serialization
+{
+
+/**
+ * Encodes messages straight into a buffer that mpack flushes to a file
+ * descriptor, so back-to-back messages leave in a few large write() calls
+ * with no intermediate copy.
+ *
+ * Buffered bytes are written when the buffer fills, on flush(), and per
+ * FlushPolicy once flush_bytes are pending or the oldest pending message
+ * is max_delay old. The delay is checked on each write and by
+ * flush_if_due(), which an idle caller should run periodically.
+ * A message larger than the buffer is streamed through it in pieces.
+ *
+ * The descriptor is not owned. Not thread safe.
+ */
+class FdWriter
+{
+public:
+  struct FlushPolicy
+  {
+    size_t buffer_bytes = 64 * 1024;
+    size_t flush_bytes = 32 * 1024;  // flush once this much is pending
+    std::chrono::steady_clock::duration max_delay = std::chrono::milliseconds(50);
+  };
+
+  explicit FdWriter(int fd)
+  : FdWriter(fd, FlushPolicy{}) {}
+
+  FdWriter(int fd, const FlushPolicy & policy)
+  : fd_(fd), policy_(policy), buffer_(std::max<size_t>(policy.buffer_bytes, 64))
+  {
+    mpack_writer_init(&writer_, buffer_.data(), buffer_.size());
+    mpack_writer_set_context(&writer_, this);
+    mpack_writer_set_flush(&writer_, &FdWriter::flush_callback);
+  }
+
+  FdWriter(const FdWriter &) = delete;
+  FdWriter & operator=(const FdWriter &) = delete;
+
+  // Writes out what is still buffered; errors are dropped, call flush() to see them
+  ~FdWriter() { mpack_writer_destroy(&writer_); }
+
+  // Encodes obj as the next message
+  void write(const Serializable & obj, const EncodeContext & ctx = EncodeContext{})
+  {
+    obj.serialize(&writer_, ctx);
+    message_written();
+  }
+
+  // Appends an already encoded message. Payloads that do not fit the
+  // buffer go out in one writev() together with the buffered bytes.
+  void write_raw(const char * data, size_t size)
+  {
+    if (size <= mpack_writer_buffer_left(&writer_)) {
+      mpack_write_object_bytes(&writer_, data, size);
+    } else {
+      tail_ = data;
+      tail_size_ = size;
+      if (mpack_writer_buffer_used(&writer_) > 0) {
+        mpack_writer_flush_message(&writer_);
+      } else if (mpack_writer_error(&writer_) == mpack_ok && !send(nullptr, 0)) {
+        mpack_writer_flag_error(&writer_, mpack_error_io);
+      }
+      tail_ = nullptr;
+      tail_size_ = 0;
+    }
+    message_written();
+  }
+
+  // Encodes obj as a ChecksumFrame frame, for a LengthPrefixed StreamDecoder.
+  // The CRC is taken chunk by chunk while obj is encoded.
+  void write_framed(const Serializable & obj, const EncodeContext & ctx = EncodeContext{})
+  {
+    staging_.clear();
+    const uint32_t crc = encode_crc32c(obj, staging_, ctx);
+    if (staging_.size() > ChecksumFrame::kMaxPayload) {
+      throw std::runtime_error("Message exceeds the 2 GiB frame limit");
+    }
+    char header[ChecksumFrame::kHeaderSize];
+    ChecksumFrame::seal_with(header, staging_.size(), crc);
+    mpack_write_object_bytes(&writer_, header, sizeof(header));
+    write_raw(staging_.data(), staging_.size());
+  }
+
+  // Appends an already encoded message as a ChecksumFrame frame. The CRC is
+  // taken while the payload is copied into the buffer.
+  void write_framed(const char * data, size_t size)
+  {
+    if (size > ChecksumFrame::kMaxPayload) {
+      throw std::runtime_error("Message exceeds the 2 GiB frame limit");
+    }
+    const size_t frame_size = ChecksumFrame::kHeaderSize + size;
+    if (frame_size > mpack_writer_buffer_left(&writer_) && frame_size <= buffer_.size() &&
+      mpack_writer_buffer_used(&writer_) > 0)
+    {
+      mpack_writer_flush_message(&writer_);
+    }
+    if (char * frame = writer_reserve(&writer_, frame_size)) {
+      ChecksumFrame::seal_copy(frame, data, size);
+      writer_commit(&writer_, frame_size);
+      message_written();
+      return;
+    }
+
+    // Too large for the buffer: send the header, then the payload in place
+    char header[ChecksumFrame::kHeaderSize];
+    ChecksumFrame::store_u32(header, static_cast<uint32_t>(size) | ChecksumFrame::kChecksumFlag);
+    ChecksumFrame::store_u32(header + 4, crc32c(data, size, crc32c(header, 4)));
+    mpack_write_object_bytes(&writer_, header, sizeof(header));
+    write_raw(data, size);
+  }
+
+  // Writes every buffered byte to the descriptor
+  void flush()
+  {
+    if (mpack_writer_buffer_used(&writer_) > 0) {
+      mpack_writer_flush_message(&writer_);
+    }
+    check();
+    pending_ = false;
+  }
+
+  // Applies the time part of the policy; returns true if it flushed
+  bool flush_if_due()
+  {
+    if (pending_ && std::chrono::steady_clock::now() - first_pending_ >= policy_.max_delay) {
+      flush();
+      return true;
+    }
+    return false;
+  }
+
+  size_t buffered() { return mpack_writer_buffer_used(&writer_); }
+  uint64_t messages() const { return messages_; }
+  uint64_t bytes_written() const { return bytes_written_; }
+  uint64_t write_calls() const { return write_calls_; }
+
+private:
+  void message_written()
+  {
+    check();
+    ++messages_;
+
+    const size_t used = mpack_writer_buffer_used(&writer_);
+    if (used == 0) {
+      pending_ = false;
+      return;
+    }
+    if (!pending_) {
+      pending_ = true;
+      first_pending_ = std::chrono::steady_clock::now();
+    }
+    if (used >= policy_.flush_bytes) {
+      flush();
+    } else {
+      flush_if_due();
+    }
+  }
+
+  void check()
+  {
+    if (mpack_writer_error(&writer_) != mpack_ok) {
+      if (errno_ != 0) {
+        throw std::runtime_error(std::string("write: ") + std::strerror(errno_));
+      }
+      throw std::runtime_error("An error occurred encoding the data");
+    }
+  }
+
+  // Called by mpack when the buffer fills or on flush; must not throw
+  static void flush_callback(mpack_writer_t * writer, const char * buffer, size_t count)
+  {
+    FdWriter * self = static_cast<FdWriter *>(mpack_writer_context(writer));
+    if (!self->send(buffer, count)) {
+      mpack_writer_flag_error(writer, mpack_error_io);
+    }
+  }
+
+  // Writes buffer and then any pending raw tail, retrying short writes
+  bool send(const char * buffer, size_t count)
+  {
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<char *>(buffer);
+    iov[0].iov_len = count;
+    iov[1].iov_base = const_cast<char *>(tail_);
+    iov[1].iov_len = tail_size_;
+    tail_ = nullptr;
+    tail_size_ = 0;
+
+    struct iovec * next = iov;
+    int remaining = 2;
+    while (remaining > 0) {
+      if (next->iov_len == 0) {
+        ++next;
+        --remaining;
+        continue;
+      }
+      ssize_t n = ::writev(fd_, next, remaining);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        errno_ = errno;
+        return false;
+      }
+      ++write_calls_;
+      bytes_written_ += static_cast<uint64_t>(n);
+      size_t done = static_cast<size_t>(n);
+      while (remaining > 0 && done >= next->iov_len) {
+        done -= next->iov_len;
+        ++next;
+        --remaining;
+      }
+      if (remaining > 0) {
+        next->iov_base = static_cast<char *>(next->iov_base) + done;
+        next->iov_len -= done;
+      }
+    }
+    return true;
+  }
+
+  int fd_;
+  FlushPolicy policy_;
+  std::vector<char> buffer_;
+  std::vector<char> staging_;  // payload of write_framed(obj) while it is checksummed
+  mpack_writer_t writer_;
+  const char * tail_ = nullptr;
+  size_t tail_size_ = 0;
+  bool pending_ = false;
+  std::chrono::steady_clock::time_point first_pending_;
+  int errno_ = 0;
+  uint64_t messages_ = 0;
+  uint64_t bytes_written_ = 0;
+  uint64_t write_calls_ = 0;
+};
+
+}  // namespace serialization
+#endif  // MPACK_FD_WRITER_H
@@ -0,0 +1,172 @@
+#ifndef MPACK_FIXED_STRING_H
+#define MPACK_FIXED_STRING_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "mpack_serialize_typehandlers.h"
+
+namespace serialization
+{
+
+/**
+ * String of at most N chars stored inline, always null terminated.
+ * Trivially copyable and never allocates; assigning a longer string throws
+ * std::length_error.
+ */
+template<size_t N>
+class fixed_string
+{
+public:
+  using size_type = std::conditional_t<(N <= UINT8_MAX), uint8_t,
+      std::conditional_t<(N <= UINT16_MAX), uint16_t, uint32_t>>;
+
+  fixed_string() = default;
+  explicit fixed_string(const char * s) { assign(std::string_view(s)); }
+  explicit fixed_string(std::string_view s) { assign(s); }
+  explicit fixed_string(const std::string & s) { assign(std::string_view(s)); }
+
+  fixed_string & operator=(const char * s) { return assign(std::string_view(s)); }
+  fixed_string & operator=(std::string_view s) { return assign(s); }
+  fixed_string & operator=(const std::string & s) { return assign(std::string_view(s)); }
+
+  fixed_string & assign(std::string_view s)
+  {
+    std::memcpy(resize(s.size()), s.data(), s.size());
+    return *this;
+  }
+
+  // Sets the length and returns the buffer to fill; the contents are unspecified
+  char * resize(size_t length)
+  {
+    if (length > N) {
+      throw std::length_error("fixed_string capacity exceeded");
+    }
+    length_ = static_cast<size_type>(length);
+    data_[length] = '\0';
+    return data_;
+  }
+
+  static constexpr size_t capacity() { return N; }
+  size_t size() const { return length_; }
+  size_t length() const { return length_; }
+  bool empty() const { return length_ == 0; }
+  void clear() { resize(0); }
+
+  const char * data() const { return data_; }
+  const char * c_str() const { return data_; }
+  char & operator[](size_t i) { return data_[i]; }
+  const char & operator[](size_t i) const { return data_[i]; }
+  const char * begin() const { return data_; }
+  const char * end() const { return data_ + length_; }
+
+  std::string_view view() const { return std::string_view(data_, length_); }
+  operator std::string_view() const { return view(); }
+  std::string str() const { return std::string(data_, length_); }
+
+  friend bool operator==(const fixed_string & a, std::string_view b) { return a.view() == b; }
+  friend bool operator!=(const fixed_string & a, std::string_view b) { return a.view() != b; }
+  friend bool operator==(const fixed_string & a, const char * b) { return a.view() == b; }
+  friend bool operator!=(const fixed_string & a, const char * b) { return a.view() != b; }
+  friend bool operator==(const fixed_string & a, const fixed_string & b) { return a.view() == b.view(); }
+  friend bool operator!=(const fixed_string & a, const fixed_string & b) { return a.view() != b.view(); }
+  friend bool operator<(const fixed_string & a, const fixed_string & b) { return a.view() < b.view(); }
+
+  friend std::ostream & operator<<(std::ostream & os, const fixed_string & s)
+  {
+    return os << s.view();
+  }
+
+private:
+  char data_[N + 1] = {};
+  size_type length_ = 0;
+};
+
+template<size_t N>
+struct is_string_like<fixed_string<N>>: std::true_type {};
+
+// Specialization for fixed_string
+template<size_t N>
+struct TypeHandler<fixed_string<N>>
+{
+  static constexpr TypeTag tag = TypeTag::String;
+
+  static void write(mpack_writer_t * writer, const fixed_string<N> & value)
+  {
+    mpack_write_str(writer, value.data(), static_cast<uint32_t>(value.size()));
+  }
+
+  static void write(
+    mpack_writer_t * writer, const fixed_string<N> & value,
+    const EncodeContext & ctx)
+  {
+    write_str(writer, value.data(), value.size(), ctx);
+  }
+
+  static void read(mpack_reader_t * reader, fixed_string<N> & value, const DecodeContext & ctx)
+  {
+    if (ctx.dictionary == nullptr) {
+      read(reader, value);
+      check_utf8(value.data(), value.size(), ctx);
+      return;
+    }
+    if (const std::string * ref = read_dictionary_str(reader, mpack_peek_tag(reader), ctx)) {
+      if (ref->size() > N) {
+        throw std::runtime_error("String exceeds fixed_string capacity");
+      }
+      value.assign(*ref);
+      return;
+    }
+    read(reader, value);
+    check_utf8(value.data(), value.size(), ctx);
+  }
+
+  static void read(mpack_reader_t * reader, fixed_string<N> & value)
+  {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (tag.type != mpack_type_str) {
+      throw std::runtime_error("Expected string type");
+    }
+    // One length check, then the bytes go straight into the inline buffer
+    if (tag.v.l > N) {
+      throw std::runtime_error("String exceeds fixed_string capacity");
+    }
+    mpack_read_bytes(reader, value.resize(tag.v.l), tag.v.l);
+    mpack_done_str(reader);
+  }
+
+  static void read(mpack_node_t node, fixed_string<N> & value, const DecodeContext & ctx)
+  {
+    if (mpack_node_type(node) != mpack_type_str) {
+      throw std::runtime_error("Expected string type");
+    }
+    const size_t length = mpack_node_strlen(node);
+    if (length > N) {
+      throw std::runtime_error("String exceeds fixed_string capacity");
+    }
+    std::memcpy(value.resize(length), mpack_node_str(node), length);
+    check_utf8(value.data(), value.size(), ctx);
+  }
+};
+
+}  // namespace serialization
+
+namespace std
+{
+template<size_t N>
+struct hash<serialization::fixed_string<N>>
+{
+  size_t operator()(const serialization::fixed_string<N> & s) const noexcept
+  {
+    return hash<string_view>()(s.view());
+  }
+};
+}  // namespace std
+
+#endif  // MPACK_FIXED_STRING_H
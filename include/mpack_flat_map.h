@@ -0,0 +1,269 @@
+#ifndef MPACK_FLAT_MAP_H
+#define MPACK_FLAT_MAP_H
+
+#include <algorithm>
+#include <functional>
+#include <initializer_list>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "mpack_serialize_typehandlers.h"
+
+namespace serialization
+{
+
+/**
+ * Sorted-vector map: contiguous iteration and binary-search lookup.
+ * Inserting in the middle is O(n); bulk construction through replace() is
+ * O(n) when the entries are already sorted and O(n log n) otherwise.
+ */
+template<typename K, typename V, typename Compare = std::less<K>>
+class flat_map
+{
+public:
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = std::pair<K, V>;
+  using key_compare = Compare;
+  using container_type = std::vector<value_type>;
+  using size_type = typename container_type::size_type;
+  using iterator = typename container_type::iterator;
+  using const_iterator = typename container_type::const_iterator;
+
+  flat_map() = default;
+
+  flat_map(std::initializer_list<value_type> init)
+  {
+    replace(container_type(init));
+  }
+
+  iterator begin() { return entries_.begin(); }
+  iterator end() { return entries_.end(); }
+  const_iterator begin() const { return entries_.begin(); }
+  const_iterator end() const { return entries_.end(); }
+  const_iterator cbegin() const { return entries_.cbegin(); }
+  const_iterator cend() const { return entries_.cend(); }
+
+  bool empty() const { return entries_.empty(); }
+  size_type size() const { return entries_.size(); }
+  size_type capacity() const { return entries_.capacity(); }
+  void reserve(size_type n) { entries_.reserve(n); }
+  void clear() { entries_.clear(); }
+
+  iterator lower_bound(const K & key)
+  {
+    return std::lower_bound(entries_.begin(), entries_.end(), key, KeyLess{compare_});
+  }
+
+  const_iterator lower_bound(const K & key) const
+  {
+    return std::lower_bound(entries_.begin(), entries_.end(), key, KeyLess{compare_});
+  }
+
+  iterator find(const K & key)
+  {
+    auto it = lower_bound(key);
+    return it != entries_.end() && !compare_(key, it->first) ? it : entries_.end();
+  }
+
+  const_iterator find(const K & key) const
+  {
+    auto it = lower_bound(key);
+    return it != entries_.end() && !compare_(key, it->first) ? it : entries_.end();
+  }
+
+  bool contains(const K & key) const { return find(key) != end(); }
+  size_type count(const K & key) const { return contains(key) ? 1 : 0; }
+
+  V & at(const K & key)
+  {
+    auto it = find(key);
+    if (it == end()) {
+      throw std::out_of_range("flat_map::at: key not found");
+    }
+    return it->second;
+  }
+
+  const V & at(const K & key) const
+  {
+    auto it = find(key);
+    if (it == end()) {
+      throw std::out_of_range("flat_map::at: key not found");
+    }
+    return it->second;
+  }
+
+  V & operator[](const K & key) { return try_emplace(key).first->second; }
+
+  template<typename ... Args>
+  std::pair<iterator, bool> try_emplace(const K & key, Args && ... args)
+  {
+    auto it = lower_bound(key);
+    if (it != entries_.end() && !compare_(key, it->first)) {
+      return {it, false};
+    }
+    it = entries_.emplace(
+      it, std::piecewise_construct, std::forward_as_tuple(key),
+      std::forward_as_tuple(std::forward<Args>(args)...));
+    return {it, true};
+  }
+
+  std::pair<iterator, bool> insert(const value_type & kv) { return try_emplace(kv.first, kv.second); }
+
+  template<typename M>
+  std::pair<iterator, bool> insert_or_assign(const K & key, M && value)
+  {
+    auto result = try_emplace(key, std::forward<M>(value));
+    if (!result.second) {
+      result.first->second = std::forward<M>(value);
+    }
+    return result;
+  }
+
+  iterator erase(const_iterator pos) { return entries_.erase(pos); }
+
+  size_type erase(const K & key)
+  {
+    auto it = find(key);
+    if (it == end()) {
+      return 0;
+    }
+    entries_.erase(it);
+    return 1;
+  }
+
+  // Takes the underlying vector, leaving the map empty; pairs with replace()
+  container_type extract() &&
+  {
+    container_type out = std::move(entries_);
+    entries_.clear();
+    return out;
+  }
+
+  // Adopts the entries, sorting only if they are not already in key order.
+  // For repeated keys the last entry wins, matching the map handlers.
+  void replace(container_type && entries)
+  {
+    entries_ = std::move(entries);
+    const KeyLess less{compare_};
+    for (size_type i = 1; i < entries_.size(); ++i) {
+      if (!less(entries_[i - 1], entries_[i])) {
+        sort_unique();
+        return;
+      }
+    }
+  }
+
+  const container_type & entries() const { return entries_; }
+
+  friend bool operator==(const flat_map & a, const flat_map & b) { return a.entries_ == b.entries_; }
+  friend bool operator!=(const flat_map & a, const flat_map & b) { return !(a == b); }
+
+private:
+  struct KeyLess
+  {
+    const Compare & compare;
+
+    bool operator()(const value_type & a, const value_type & b) const
+    {
+      return compare(a.first, b.first);
+    }
+
+    bool operator()(const value_type & a, const K & b) const { return compare(a.first, b); }
+  };
+
+  void sort_unique()
+  {
+    const KeyLess less{compare_};
+    std::stable_sort(entries_.begin(), entries_.end(), less);
+
+    // Keep the last of each run of equal keys
+    size_type out = 0;
+    for (size_type i = 0; i < entries_.size(); ++i) {
+      if (i + 1 < entries_.size() && !less(entries_[i], entries_[i + 1])) {
+        continue;
+      }
+      if (out != i) {
+        entries_[out] = std::move(entries_[i]);
+      }
+      ++out;
+    }
+    entries_.erase(entries_.begin() + out, entries_.end());
+  }
+
+  container_type entries_;
+  Compare compare_;
+};
+
+// Specialization for flat_map
+template<typename K, typename V, typename Compare>
+struct TypeHandler<flat_map<K, V, Compare>>
+{
+  static constexpr TypeTag tag = TypeTag::Map;
+
+  static void write(mpack_writer_t * writer, const flat_map<K, V, Compare> & m)
+  {
+    write(writer, m, EncodeContext{});
+  }
+
+  static void write(
+    mpack_writer_t * writer, const flat_map<K, V, Compare> & m,
+    const EncodeContext & ctx)
+  {
+    mpack_start_map(writer, m.size());
+    for (const auto & kv : m) {
+      write_value(writer, kv.first, ctx);
+      write_value(writer, kv.second, ctx);
+    }
+    mpack_finish_map(writer);
+  }
+
+  static void read(mpack_reader_t * reader, flat_map<K, V, Compare> & result)
+  {
+    read(reader, result, DecodeContext{});
+  }
+
+  static void read(
+    mpack_reader_t * reader, flat_map<K, V, Compare> & result,
+    const DecodeContext & ctx)
+  {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (tag.type != mpack_type_map) {
+      throw std::runtime_error("Expected map");
+    }
+
+    // Decode into the existing storage, then sort only if needed
+    auto entries = std::move(result).extract();
+    entries.clear();
+    entries.reserve(reserve_limit(reader, tag.v.n, 2));
+    for (uint32_t i = 0; i < tag.v.n && mpack_reader_error(reader) == mpack_ok; ++i) {
+      auto & kv = entries.emplace_back();
+      read_value(reader, kv.first, ctx);
+      read_value(reader, kv.second, ctx);
+    }
+    result.replace(std::move(entries));
+  }
+
+  static void read(
+    mpack_node_t node, flat_map<K, V, Compare> & result,
+    const DecodeContext & ctx)
+  {
+    if (mpack_node_type(node) != mpack_type_map) {
+      throw std::runtime_error("Expected map");
+    }
+
+    const size_t count = mpack_node_map_count(node);
+    auto entries = std::move(result).extract();
+    entries.clear();
+    entries.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+      read_value(mpack_node_map_key_at(node, i), entries[i].first, ctx);
+      read_value(mpack_node_map_value_at(node, i), entries[i].second, ctx);
+    }
+    result.replace(std::move(entries));
+  }
+};
+
+}  // namespace serialization
+#endif  // MPACK_FLAT_MAP_H
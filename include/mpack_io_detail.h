@@ -0,0 +1,141 @@
+#ifndef MPACK_IO_DETAIL_H
+#define MPACK_IO_DETAIL_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// File and byte-order helpers shared by the on-disk formats
+// (MessageLogWriter/Reader, ColumnarWriter/Reader)
+namespace serialization
+{
+namespace io_detail
+{
+
+[[noreturn]] inline void throw_errno(const char * what, const std::string & path)
+{
+  throw std::runtime_error(std::string(what) + " " + path + ": " + std::strerror(errno));
+}
+
+inline void store_le(char * out, uint64_t value, size_t bytes)
+{
+  for (size_t i = 0; i < bytes; ++i) {
+    out[i] = static_cast<char>(value >> (8 * i));
+  }
+}
+
+inline uint64_t load_le(const char * in, size_t bytes)
+{
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; ++i) {
+    value |= static_cast<uint64_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+  }
+  return value;
+}
+
+inline void write_all(int fd, const char * data, size_t size, const std::string & path)
+{
+  while (size > 0) {
+    ssize_t n = ::write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw_errno("write", path);
+    }
+    data += n;
+    size -= static_cast<size_t>(n);
+  }
+}
+
+inline bool read_at(int fd, char * data, size_t size, uint64_t offset)
+{
+  while (size > 0) {
+    ssize_t n = ::pread(fd, data, size, static_cast<off_t>(offset));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= static_cast<size_t>(n);
+    offset += static_cast<uint64_t>(n);
+  }
+  return true;
+}
+
+// Read-only shared mapping of a whole file; empty files are not mapped
+class MappedFile
+{
+public:
+  MappedFile() = default;
+
+  explicit MappedFile(const std::string & path)
+  {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw_errno("open", path);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw_errno("stat", path);
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+      void * data = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+      if (data == MAP_FAILED) {
+        ::close(fd);
+        throw_errno("mmap", path);
+      }
+      data_ = static_cast<const char *>(data);
+    }
+    ::close(fd);
+  }
+
+  MappedFile(MappedFile && other) noexcept
+  : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+  MappedFile & operator=(MappedFile && other) noexcept
+  {
+    if (this != &other) {
+      unmap();
+      data_ = std::exchange(other.data_, nullptr);
+      size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile & operator=(const MappedFile &) = delete;
+
+  ~MappedFile() { unmap(); }
+
+  const char * data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  void unmap()
+  {
+    if (data_ != nullptr) {
+      ::munmap(const_cast<char *>(data_), size_);
+      data_ = nullptr;
+    }
+  }
+
+  const char * data_ = nullptr;
+  size_t size_ = 0;
+};
+
+}  // namespace io_detail
+}  // namespace serialization
+#endif  // MPACK_IO_DETAIL_H
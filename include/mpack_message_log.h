@@ -0,0 +1,421 @@
+#ifndef MPACK_MESSAGE_LOG_H
+#define MPACK_MESSAGE_LOG_H
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mpack/mpack.h"
+#include "mpack_checksum.h"
+#include "mpack_io_detail.h"
+#include "mpack_serializer.h"
+
+/**
+ * Append-only log of msgpack records split into segment files.
+ *
+ * Each segment is a pair of files named after the index of its first record:
+ *   <first>.log  frames of [uint32 little-endian payload length][payload],
+ *                or ChecksumFrame frames when the writer has checksums on
+ *   <first>.idx  one uint64 little-endian offset per frame in the .log
+ * The writer appends the frame before its index entry, so a crash can only
+ * leave unindexed or torn frames at the tail; reopening the log repairs both.
+ * The reader maps segments read-only and decodes records in place, and
+ * verifies the CRC32C of checksummed frames before handing them out.
+ */
+namespace serialization
+{
+
+namespace log_detail
+{
+
+constexpr size_t kFrameHeaderSize = ChecksumFrame::kPlainHeaderSize;
+constexpr size_t kMaxFrameHeaderSize = ChecksumFrame::kHeaderSize;
+constexpr size_t kIndexEntrySize = 8;
+
+inline std::string segment_path(const std::string & directory, uint64_t first, const char * ext)
+{
+  char name[32];
+  std::snprintf(name, sizeof(name), "%020" PRIu64 "%s", first, ext);
+  return (std::filesystem::path(directory) / name).string();
+}
+
+// First record indexes of the segments in a directory, ascending
+inline std::vector<uint64_t> list_segments(const std::string & directory)
+{
+  std::vector<uint64_t> firsts;
+  for (const auto & entry : std::filesystem::directory_iterator(directory)) {
+    const std::filesystem::path & path = entry.path();
+    const std::string stem = path.stem().string();
+    if (path.extension() != ".log" || stem.size() != 20 ||
+      stem.find_first_not_of("0123456789") != std::string::npos)
+    {
+      continue;
+    }
+    firsts.push_back(std::stoull(stem));
+  }
+  std::sort(firsts.begin(), firsts.end());
+  return firsts;
+}
+
+// End of the frame at offset if it lies within log_size and passes its
+// checksum, or 0 for a torn or corrupted frame
+inline uint64_t frame_end(int fd, uint64_t offset, uint64_t log_size, std::vector<char> & buffer)
+{
+  char header[kMaxFrameHeaderSize];
+  if (offset + kFrameHeaderSize > log_size || !io_detail::read_at(fd, header, kFrameHeaderSize, offset)) {
+    return 0;
+  }
+  const uint32_t word = ChecksumFrame::load_u32(header);
+  const uint64_t end = offset + ChecksumFrame::header_size(word) + ChecksumFrame::payload_size(word);
+  if (end > log_size) {
+    return 0;
+  }
+  if (ChecksumFrame::has_checksum(word)) {
+    buffer.resize(static_cast<size_t>(end - offset));
+    if (!io_detail::read_at(fd, buffer.data(), buffer.size(), offset) ||
+      !ChecksumFrame::verify(buffer.data(), ChecksumFrame::payload_size(word)))
+    {
+      return 0;
+    }
+  }
+  return end;
+}
+
+}  // namespace log_detail
+
+/**
+ * Appends records to the newest segment, starting a new one once it exceeds
+ * segment_bytes. Reopening a directory resumes after its last complete record.
+ * With checksum set, records are written as ChecksumFrame frames; the CRC is
+ * taken chunk by chunk while the record is encoded, or during the copy for
+ * append_raw(). Recovery then also drops corrupted tail frames.
+ * Not thread safe; use one writer per directory.
+ */
+class MessageLogWriter
+{
+public:
+  explicit MessageLogWriter(
+    std::string directory, uint64_t segment_bytes = 64ull << 20,
+    bool checksum = false)
+  : directory_(std::move(directory)), segment_bytes_(segment_bytes), checksum_(checksum), scratch_(4096)
+  {
+    std::filesystem::create_directories(directory_);
+    std::vector<uint64_t> segments = log_detail::list_segments(directory_);
+    open_segment(segments.empty() ? 0 : segments.back());
+  }
+
+  MessageLogWriter(const MessageLogWriter &) = delete;
+  MessageLogWriter & operator=(const MessageLogWriter &) = delete;
+
+  ~MessageLogWriter() { close_segment(); }
+
+  // Encodes obj as the next record and returns its index
+  uint64_t append(const Serializable & obj, const EncodeContext & ctx = EncodeContext{})
+  {
+    using log_detail::kMaxFrameHeaderSize;
+
+    if (checksum_) {
+      // Encoded after the reserved frame header and checksummed on the way
+      scratch_.resize(kMaxFrameHeaderSize);
+      const uint32_t crc = encode_crc32c(obj, scratch_, ctx);
+      const size_t used = scratch_.size() - kMaxFrameHeaderSize;
+      if (used <= ChecksumFrame::kMaxPayload) {
+        ChecksumFrame::seal_with(scratch_.data(), used, crc);
+      }
+      return append_frame(used);
+    }
+
+    // Encode after a reserved frame header, growing the reused buffer if needed
+    for (;;) {
+      mpack_writer_t writer;
+      mpack_writer_init(&writer, scratch_.data() + kMaxFrameHeaderSize, scratch_.size() - kMaxFrameHeaderSize);
+      obj.serialize(&writer, ctx);
+      size_t used = mpack_writer_buffer_used(&writer);
+      mpack_error_t error = mpack_writer_destroy(&writer);
+      if (error == mpack_ok) {
+        return append_frame(used);
+      }
+      if (error != mpack_error_too_big) {
+        throw std::runtime_error("An error occurred encoding the record");
+      }
+      scratch_.resize(scratch_.size() * 2);
+    }
+  }
+
+  // Appends an already encoded payload and returns its index
+  uint64_t append_raw(const char * data, size_t size)
+  {
+    if (scratch_.size() < log_detail::kMaxFrameHeaderSize + size) {
+      scratch_.resize(log_detail::kMaxFrameHeaderSize + size);
+    }
+    if (checksum_ && size <= ChecksumFrame::kMaxPayload) {
+      ChecksumFrame::seal_copy(scratch_.data(), data, size);
+    } else {
+      std::memcpy(scratch_.data() + log_detail::kMaxFrameHeaderSize, data, size);
+    }
+    return append_frame(size);
+  }
+
+  // Makes every appended record durable
+  void sync()
+  {
+    if (::fdatasync(log_fd_) != 0) {
+      io_detail::throw_errno("fdatasync", log_path_);
+    }
+    if (::fdatasync(idx_fd_) != 0) {
+      io_detail::throw_errno("fdatasync", idx_path_);
+    }
+  }
+
+  // Number of records in the log, including those from earlier sessions
+  uint64_t size() const { return next_index_; }
+
+  const std::string & directory() const { return directory_; }
+
+private:
+  // Writes the frame whose payload starts at kMaxFrameHeaderSize in
+  // scratch_; checksummed frames were already sealed by the caller
+  uint64_t append_frame(size_t payload_size)
+  {
+    if (payload_size > ChecksumFrame::kMaxPayload) {
+      throw std::runtime_error("Record exceeds the 2 GiB frame limit");
+    }
+    const size_t header_size = checksum_ ? ChecksumFrame::kHeaderSize : log_detail::kFrameHeaderSize;
+    const size_t frame_size = header_size + payload_size;
+    if (segment_size_ > 0 && segment_size_ + frame_size > segment_bytes_) {
+      close_segment();
+      open_segment(next_index_);
+    }
+
+    char * frame = scratch_.data() + log_detail::kMaxFrameHeaderSize - header_size;
+    if (!checksum_) {
+      io_detail::store_le(frame, payload_size, log_detail::kFrameHeaderSize);
+    }
+    io_detail::write_all(log_fd_, frame, frame_size, log_path_);
+
+    char entry[log_detail::kIndexEntrySize];
+    io_detail::store_le(entry, segment_size_, sizeof(entry));
+    io_detail::write_all(idx_fd_, entry, sizeof(entry), idx_path_);
+
+    segment_size_ += frame_size;
+    return next_index_++;
+  }
+
+  void open_segment(uint64_t first)
+  {
+    segment_first_ = first;
+    log_path_ = log_detail::segment_path(directory_, first, ".log");
+    idx_path_ = log_detail::segment_path(directory_, first, ".idx");
+    log_fd_ = ::open(log_path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (log_fd_ < 0) {
+      io_detail::throw_errno("open", log_path_);
+    }
+    idx_fd_ = ::open(idx_path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (idx_fd_ < 0) {
+      io_detail::throw_errno("open", idx_path_);
+    }
+    recover();
+  }
+
+  // Drops torn frames and index entries, and indexes complete frames the
+  // previous writer appended but did not get to index
+  void recover()
+  {
+    using log_detail::kIndexEntrySize;
+
+    struct stat log_stat, idx_stat;
+    if (::fstat(log_fd_, &log_stat) != 0 || ::fstat(idx_fd_, &idx_stat) != 0) {
+      io_detail::throw_errno("stat", log_path_);
+    }
+    const uint64_t log_size = static_cast<uint64_t>(log_stat.st_size);
+    uint64_t count = static_cast<uint64_t>(idx_stat.st_size) / kIndexEntrySize;
+
+    // End of the last indexed frame that lies entirely within the log
+    std::vector<char> frame;
+    uint64_t end = 0;
+    while (count > 0) {
+      char bytes[kIndexEntrySize];
+      if (io_detail::read_at(idx_fd_, bytes, sizeof(bytes), (count - 1) * kIndexEntrySize)) {
+        const uint64_t offset = io_detail::load_le(bytes, sizeof(bytes));
+        end = log_detail::frame_end(log_fd_, offset, log_size, frame);
+        if (end != 0) {
+          break;
+        }
+      }
+      --count;
+    }
+
+    if (::ftruncate(idx_fd_, static_cast<off_t>(count * kIndexEntrySize)) != 0) {
+      io_detail::throw_errno("truncate", idx_path_);
+    }
+    ::lseek(idx_fd_, 0, SEEK_END);
+
+    // Index complete frames written after the last entry
+    for (;;) {
+      const uint64_t frame_end = log_detail::frame_end(log_fd_, end, log_size, frame);
+      if (frame_end == 0) {
+        break;
+      }
+      char entry[kIndexEntrySize];
+      io_detail::store_le(entry, end, sizeof(entry));
+      io_detail::write_all(idx_fd_, entry, sizeof(entry), idx_path_);
+      ++count;
+      end = frame_end;
+    }
+
+    if (::ftruncate(log_fd_, static_cast<off_t>(end)) != 0) {
+      io_detail::throw_errno("truncate", log_path_);
+    }
+    ::lseek(log_fd_, 0, SEEK_END);
+
+    segment_size_ = end;
+    next_index_ = segment_first_ + count;
+  }
+
+  void close_segment()
+  {
+    if (log_fd_ >= 0) {
+      ::close(log_fd_);
+      log_fd_ = -1;
+    }
+    if (idx_fd_ >= 0) {
+      ::close(idx_fd_);
+      idx_fd_ = -1;
+    }
+  }
+
+  std::string directory_;
+  uint64_t segment_bytes_;
+  bool checksum_;
+  std::vector<char> scratch_;  // room for the frame header, then the encoded payload
+  std::string log_path_;
+  std::string idx_path_;
+  int log_fd_ = -1;
+  int idx_fd_ = -1;
+  uint64_t segment_first_ = 0;
+  uint64_t segment_size_ = 0;
+  uint64_t next_index_ = 0;
+};
+
+/**
+ * Random access and replay over the segments of a log directory.
+ * Records are decoded straight from the mapped files; views returned by
+ * record() stay valid until the next refresh() or destruction.
+ */
+class MessageLogReader
+{
+public:
+  explicit MessageLogReader(std::string directory)
+  : directory_(std::move(directory))
+  {
+    refresh();
+  }
+
+  // Remaps the directory to pick up records appended since the last call
+  void refresh()
+  {
+    std::vector<Segment> segments;
+    for (uint64_t first : log_detail::list_segments(directory_)) {
+      Segment segment;
+      segment.first = first;
+      // Map the index first: every frame it lists is already in the log
+      segment.idx = io_detail::MappedFile(log_detail::segment_path(directory_, first, ".idx"));
+      segment.log = io_detail::MappedFile(log_detail::segment_path(directory_, first, ".log"));
+      segment.count = segment.idx.size() / log_detail::kIndexEntrySize;
+      segments.push_back(std::move(segment));
+    }
+    segments_ = std::move(segments);
+  }
+
+  // Index one past the last record
+  uint64_t size() const
+  {
+    return segments_.empty() ? 0 : segments_.back().first + segments_.back().count;
+  }
+
+  // Index of the oldest record still on disk
+  uint64_t first() const { return segments_.empty() ? 0 : segments_.front().first; }
+
+  // Encoded payload of record i
+  std::string_view record(uint64_t index) const
+  {
+    using log_detail::kFrameHeaderSize;
+
+    auto it = std::upper_bound(
+      segments_.begin(), segments_.end(), index,
+      [](uint64_t i, const Segment & s) {return i < s.first;});
+    if (it == segments_.begin() || index - std::prev(it)->first >= std::prev(it)->count) {
+      throw std::out_of_range("Message log record not found");
+    }
+    const Segment & segment = *std::prev(it);
+    const uint64_t offset = io_detail::load_le(
+      segment.idx.data() + (index - segment.first) * log_detail::kIndexEntrySize,
+      log_detail::kIndexEntrySize);
+    if (offset + kFrameHeaderSize > segment.log.size()) {
+      throw std::runtime_error("Message log index points past the segment");
+    }
+    const char * frame = segment.log.data() + offset;
+    const uint32_t word = ChecksumFrame::load_u32(frame);
+    const size_t header_size = ChecksumFrame::header_size(word);
+    const uint32_t length = ChecksumFrame::payload_size(word);
+    if (offset + header_size + length > segment.log.size()) {
+      throw std::runtime_error("Message log record is truncated");
+    }
+    if (ChecksumFrame::has_checksum(word) && !ChecksumFrame::verify(frame, length)) {
+      throw std::runtime_error("Message log record failed its checksum");
+    }
+    return std::string_view(frame + header_size, length);
+  }
+
+  // Decodes record i into obj
+  void read(uint64_t index, Serializable & obj, const DecodeContext & ctx = DecodeContext{}) const
+  {
+    std::string_view payload = record(index);
+
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, payload.data(), payload.size());
+
+    obj.deserialize(&reader, ctx);
+
+    if (mpack_reader_destroy(&reader) != mpack_ok) {
+      throw std::runtime_error("An error occurred decoding the data");
+    }
+  }
+
+  // Calls fn(index, payload) for every record from index `from` on
+  template<typename Fn>
+  void replay(Fn && fn, uint64_t from = 0) const
+  {
+    for (uint64_t i = std::max(from, first()); i < size(); ++i) {
+      fn(i, record(i));
+    }
+  }
+
+private:
+  struct Segment
+  {
+    uint64_t first = 0;
+    uint64_t count = 0;
+    io_detail::MappedFile log;
+    io_detail::MappedFile idx;
+  };
+
+  std::string directory_;
+  std::vector<Segment> segments_;
+};
+
+}  // namespace serialization
+#endif  // MPACK_MESSAGE_LOG_H
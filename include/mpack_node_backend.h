@@ -0,0 +1,232 @@
+#ifndef MPACK_NODE_BACKEND_H
+#define MPACK_NODE_BACKEND_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "mpack/mpack.h"
+#include "mpack_patch.h"
+#include "mpack_serialize_typehandlers.h"
+#include "mpack_serializer.h"
+#include "mpack_stream_reader.h"
+
+namespace serialization
+{
+
+/**
+ * A message parsed once into an mpack_tree_t, decoded through the node
+ * overloads of the TypeHandlers. The node pool is kept between parses, so
+ * a reused MessageTree stops allocating once it has seen its largest message.
+ * Lookups by key go through the parsed map instead of re-reading the stream,
+ * and the same tree can be decoded into several objects. Reflected types
+ * look their fields up by name with mpack_node_map_str_optional().
+ *
+ * The tree points into the parsed buffer, which must outlive it.
+ * Dictionary references (see StringDictionary) are not supported.
+ */
+class MessageTree
+{
+public:
+  explicit MessageTree(size_t initial_nodes = 256)
+  : pool_(std::max<size_t>(initial_nodes, 1)) {}
+
+  MessageTree(const MessageTree &) = delete;
+  MessageTree & operator=(const MessageTree &) = delete;
+
+  ~MessageTree() { release(); }
+
+  // Parses one message, growing the node pool until it fits
+  void parse(const char * data, size_t size)
+  {
+    for (;;) {
+      release();
+      mpack_tree_init_pool(&tree_, data, size, pool_.data(), pool_.size());
+      mpack_tree_parse(&tree_);
+      parsed_ = true;
+      data_ = data;
+
+      mpack_error_t error = mpack_tree_error(&tree_);
+      if (error == mpack_ok) {
+        return;
+      }
+      if (error != mpack_error_too_big) {
+        release();
+        throw std::runtime_error("An error occurred parsing the data");
+      }
+      pool_.resize(pool_.size() * 2);
+    }
+  }
+
+  mpack_node_t root()
+  {
+    check_parsed();
+    return mpack_tree_root(&tree_);
+  }
+
+  // Value stored under key in a map node; check with mpack_node_is_missing()
+  mpack_node_t find(mpack_node_t map, const char * key)
+  {
+    return mpack_node_map_str_optional(map, key, std::strlen(key));
+  }
+
+  // Decodes the whole message into obj; the tree stays valid for other consumers
+  template<typename T>
+  void decode(T & obj, const DecodeContext & ctx = DecodeContext{})
+  {
+    decode(root(), obj, ctx);
+  }
+
+  // Decodes a sub-tree into obj
+  template<typename T>
+  void decode(mpack_node_t node, T & obj, const DecodeContext & ctx = DecodeContext{})
+  {
+    read_value(node, obj, ctx);
+    if (mpack_tree_error(&tree_) != mpack_ok) {
+      throw std::runtime_error("An error occurred decoding the data");
+    }
+  }
+
+  // Decodes the array found under path, a list of map keys from the root,
+  // using up to `threads` threads that each take a contiguous range of
+  // elements. The elements are found in the parsed bytes with a
+  // MessageScanner, and each worker parses its own into a tree of its own,
+  // so workers share nothing but the input buffer.
+  template<typename T>
+  void parallel_decode(
+    const FieldPatcher::Path & path, std::vector<T> & out, size_t threads,
+    const DecodeContext & ctx = DecodeContext{})
+  {
+    const char * data = data_;
+    const size_t size = this->size();
+    FieldPatcher locator({path});
+    locator.locate(data, size);
+    if (locator.sites(0).size() != 1) {
+      throw std::runtime_error("Path does not name exactly one value");
+    }
+
+    // Element boundaries; each scanned element lies within the message, so
+    // the count from the header is checked before anything is allocated
+    size_t pos = locator.sites(0).front();
+    const uint64_t count = array_header(data, size, pos);
+    std::vector<size_t> starts;
+    starts.reserve(std::min<uint64_t>(count, size - pos) + 1);
+    MessageScanner scanner;
+    for (uint64_t i = 0; i < count; ++i) {
+      starts.push_back(pos);
+      scanner.reset();
+      const size_t length = pos < size ? scanner.scan(data + pos, size - pos) : 0;
+      if (length == 0) {
+        throw std::runtime_error("Array is truncated");
+      }
+      pos += length;
+    }
+    starts.push_back(pos);
+
+    out.clear();
+    out.resize(count);
+    threads = std::max<size_t>(1, std::min<size_t>(threads, count));
+    std::vector<std::thread> workers;
+    std::vector<std::exception_ptr> errors(threads);
+    const size_t per_thread = (count + threads - 1) / threads;
+
+    for (size_t t = 0; t < threads; ++t) {
+      const size_t begin = std::min<size_t>(count, t * per_thread);
+      const size_t end = std::min<size_t>(count, begin + per_thread);
+      workers.emplace_back(
+        [data, &starts, &out, &ctx, &errors, t, begin, end]() {
+          try {
+            MessageTree local;
+            for (size_t i = begin; i < end; ++i) {
+              local.parse(data + starts[i], starts[i + 1] - starts[i]);
+              local.decode(out[i], ctx);
+            }
+          } catch (...) {
+            errors[t] = std::current_exception();
+          }
+        });
+    }
+    for (std::thread & worker : workers) {
+      worker.join();
+    }
+    for (const std::exception_ptr & error : errors) {
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }
+  }
+
+  // Number of bytes the last parse consumed
+  size_t size()
+  {
+    check_parsed();
+    return mpack_tree_size(&tree_);
+  }
+
+  mpack_tree_t * tree() { return &tree_; }
+
+  // Nodes the pool holds, i.e. the largest message parsed so far
+  size_t pool_capacity() const { return pool_.size(); }
+
+  // Shrinks the pool to at most max_nodes, dropping the parsed message
+  void trim(size_t max_nodes)
+  {
+    release();
+    if (pool_.size() > max_nodes) {
+      pool_.resize(std::max<size_t>(max_nodes, 1));
+      pool_.shrink_to_fit();
+    }
+  }
+
+private:
+  // Element count of the array whose header starts at pos, which is
+  // advanced past the header
+  static uint64_t array_header(const char * data, size_t size, size_t & pos)
+  {
+    const uint8_t lead = static_cast<uint8_t>(data[pos]);
+    if ((lead & 0xf0) == 0x90) {
+      ++pos;
+      return lead & 0x0f;
+    }
+    if (lead != 0xdc && lead != 0xdd) {
+      throw std::runtime_error("Expected array");
+    }
+    const size_t bytes = lead == 0xdc ? 2 : 4;
+    if (size - pos - 1 < bytes) {
+      throw std::runtime_error("Array is truncated");
+    }
+    uint64_t count = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+      count = (count << 8) | static_cast<uint8_t>(data[pos + 1 + i]);
+    }
+    pos += 1 + bytes;
+    return count;
+  }
+
+  void check_parsed()
+  {
+    if (!parsed_) {
+      throw std::logic_error("MessageTree has not parsed a message");
+    }
+  }
+
+  void release()
+  {
+    if (parsed_) {
+      mpack_tree_destroy(&tree_);
+      parsed_ = false;
+    }
+  }
+
+  std::vector<mpack_node_data_t> pool_;
+  mpack_tree_t tree_;
+  const char * data_ = nullptr;  // buffer of the parsed message
+  bool parsed_ = false;
+};
+
+}  // namespace serialization
+#endif  // MPACK_NODE_BACKEND_H
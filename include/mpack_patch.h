@@ -0,0 +1,262 @@
+#ifndef MPACK_PATCH_H
+#define MPACK_PATCH_H
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "mpack_stream_reader.h"
+
+namespace serialization
+{
+
+/**
+ * Rewrites fields of an encoded message in place. Fields written with
+ * EncodeFixedWidth keep their size whatever their value, so changing one
+ * is a few stores into the buffer instead of a decode and re-encode.
+ *
+ * Paths are lists of map keys, with "*" standing for every element of an
+ * array, e.g. {"IOGroups", "*", "TimeRecorded"}. locate() finds every
+ * registered path in one scan of the message; the offsets stay valid for
+ * as long as the buffer's layout does, so a buffer patched repeatedly is
+ * scanned once. Only sized integers (0xcc-0xcf, 0xd0-0xd3) and float64
+ * (0xcb) can be patched; anything else at a path throws. Messages are not
+ * fixed-width by default: the sender opts in by encoding with
+ * EncodeContext{EncodeFixedWidth} or by tagging the fields concerned.
+ *
+ * Keys are matched as plain strings, so locate() finds nothing under a key
+ * written as a session dictionary reference (see StringDictionary). A
+ * message inside a ChecksumFrame must be resealed with ChecksumFrame::seal()
+ * after patching, or its CRC no longer verifies.
+ */
+class FieldPatcher
+{
+public:
+  using Path = std::vector<std::string>;
+
+  explicit FieldPatcher(std::vector<Path> paths)
+  : paths_(std::move(paths)), sites_(paths_.size()) {}
+
+  // Offsets of each path's fields in data, replacing earlier results
+  void locate(const char * data, size_t size)
+  {
+    for (std::vector<size_t> & sites : sites_) {
+      sites.clear();
+    }
+    std::vector<size_t> active(paths_.size());
+    for (size_t i = 0; i < active.size(); ++i) {
+      active[i] = i;
+    }
+    const uint8_t * bytes = reinterpret_cast<const uint8_t *>(data);
+    walk(bytes, size, 0, 0, active);
+  }
+
+  // Offsets found for a path by the last locate()
+  const std::vector<size_t> & sites(size_t path) const { return sites_.at(path); }
+
+  // Sets every field at the path; the value must fit the field's width
+  void patch_uint(char * data, size_t path, uint64_t value) const
+  {
+    for (size_t offset : sites(path)) {
+      patch_uint_at(data, offset, value);
+    }
+  }
+
+  void patch_int(char * data, size_t path, int64_t value) const
+  {
+    for (size_t offset : sites(path)) {
+      patch_int_at(data, offset, value);
+    }
+  }
+
+  void patch_double(char * data, size_t path, double value) const
+  {
+    for (size_t offset : sites(path)) {
+      patch_double_at(data, offset, value);
+    }
+  }
+
+  static void patch_uint_at(char * data, size_t offset, uint64_t value)
+  {
+    const uint8_t lead = static_cast<uint8_t>(data[offset]);
+    if (lead >= 0xcc && lead <= 0xcf) {
+      const size_t bytes = size_t{1} << (lead - 0xcc);
+      if (bytes < 8 && value >> (8 * bytes) != 0) {
+        throw std::runtime_error("Patched value does not fit the field");
+      }
+      store_be(data + offset + 1, value, bytes);
+    } else if (lead >= 0xd0 && lead <= 0xd3) {
+      if (value > static_cast<uint64_t>(INT64_MAX)) {
+        throw std::runtime_error("Patched value does not fit the field");
+      }
+      patch_int_at(data, offset, static_cast<int64_t>(value));
+    } else {
+      throw std::runtime_error("Patched field is not a fixed-width integer");
+    }
+  }
+
+  static void patch_int_at(char * data, size_t offset, int64_t value)
+  {
+    const uint8_t lead = static_cast<uint8_t>(data[offset]);
+    if (lead >= 0xd0 && lead <= 0xd3) {
+      const size_t bytes = size_t{1} << (lead - 0xd0);
+      if (bytes < 8) {
+        const int64_t limit = int64_t{1} << (8 * bytes - 1);
+        if (value < -limit || value >= limit) {
+          throw std::runtime_error("Patched value does not fit the field");
+        }
+      }
+      store_be(data + offset + 1, static_cast<uint64_t>(value), bytes);
+    } else if (lead >= 0xcc && lead <= 0xcf) {
+      if (value < 0) {
+        throw std::runtime_error("Patched value does not fit the field");
+      }
+      patch_uint_at(data, offset, static_cast<uint64_t>(value));
+    } else {
+      throw std::runtime_error("Patched field is not a fixed-width integer");
+    }
+  }
+
+  static void patch_double_at(char * data, size_t offset, double value)
+  {
+    if (static_cast<uint8_t>(data[offset]) != 0xcb) {
+      throw std::runtime_error("Patched field is not a float64");
+    }
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    store_be(data + offset + 1, bits, 8);
+  }
+
+private:
+  static void store_be(char * p, uint64_t value, size_t bytes)
+  {
+    for (size_t i = 0; i < bytes; ++i) {
+      p[i] = static_cast<char>(value >> (8 * (bytes - 1 - i)));
+    }
+  }
+
+  static uint64_t load_be(const uint8_t * p, size_t bytes)
+  {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+      value = (value << 8) | p[i];
+    }
+    return value;
+  }
+
+  // End of the object at pos
+  static size_t skip(const uint8_t * data, size_t size, size_t pos)
+  {
+    MessageScanner scanner;
+    const size_t length = scanner.scan(reinterpret_cast<const char *>(data) + pos, size - pos);
+    if (length == 0) {
+      throw std::runtime_error("Patched message is truncated");
+    }
+    return pos + length;
+  }
+
+  // Header size and element count of the map or array at pos, or 0 if
+  // the object there is neither
+  static size_t container(const uint8_t * data, size_t size, size_t pos, bool & is_map, uint64_t & count)
+  {
+    const uint8_t lead = data[pos];
+    const bool is_fix = lead >= 0x80 && lead <= 0x9f;
+    if (!is_fix && (lead < 0xdc || lead > 0xdf)) {
+      return 0;
+    }
+    const size_t header = MessageScanner::header_size(lead);
+    if (size - pos < header) {
+      throw std::runtime_error("Patched message is truncated");
+    }
+    is_map = lead <= 0x8f || lead >= 0xde;
+    count = is_fix ? lead & 0x0f : load_be(data + pos + 1, header - 1);
+    return header;
+  }
+
+  // The string at pos, or an empty view with a null data() if it is none
+  static std::string_view key(const uint8_t * data, size_t size, size_t pos)
+  {
+    const uint8_t lead = data[pos];
+    size_t header;
+    uint64_t length;
+    if (lead >= 0xa0 && lead <= 0xbf) {
+      header = 1;
+      length = lead & 0x1f;
+    } else if (lead >= 0xd9 && lead <= 0xdb) {
+      header = MessageScanner::header_size(lead);
+      if (size - pos < header) {
+        throw std::runtime_error("Patched message is truncated");
+      }
+      length = load_be(data + pos + 1, header - 1);
+    } else {
+      return std::string_view();
+    }
+    if (size - pos - header < length) {
+      throw std::runtime_error("Patched message is truncated");
+    }
+    return std::string_view(reinterpret_cast<const char *>(data) + pos + header, length);
+  }
+
+  // Records the object at pos for paths ending at depth and descends for
+  // the others; active holds the paths whose first depth segments match.
+  // Returns the end of the object, so each byte is scanned once.
+  size_t walk(const uint8_t * data, size_t size, size_t pos, size_t depth, const std::vector<size_t> & active)
+  {
+    if (pos >= size) {
+      throw std::runtime_error("Patched message is truncated");
+    }
+    std::vector<size_t> deeper;
+    for (size_t path : active) {
+      if (paths_[path].size() == depth) {
+        sites_[path].push_back(pos);
+      } else {
+        deeper.push_back(path);
+      }
+    }
+    if (deeper.empty()) {
+      return skip(data, size, pos);
+    }
+
+    bool is_map = false;
+    uint64_t count = 0;
+    const size_t header = container(data, size, pos, is_map, count);
+    if (header == 0) {
+      return skip(data, size, pos);
+    }
+    pos += header;
+    std::vector<size_t> matching;
+    for (uint64_t i = 0; i < count; ++i) {
+      if (pos >= size) {
+        throw std::runtime_error("Patched message is truncated");
+      }
+      matching.clear();
+      if (is_map) {
+        const std::string_view name = key(data, size, pos);
+        for (size_t path : deeper) {
+          if (name.data() != nullptr && paths_[path][depth] == name) {
+            matching.push_back(path);
+          }
+        }
+        pos = skip(data, size, pos);
+      } else {
+        for (size_t path : deeper) {
+          if (paths_[path][depth] == "*") {
+            matching.push_back(path);
+          }
+        }
+      }
+      pos = matching.empty() ? skip(data, size, pos) : walk(data, size, pos, depth + 1, matching);
+    }
+    return pos;
+  }
+
+  std::vector<Path> paths_;
+  std::vector<std::vector<size_t>> sites_;
+};
+
+}  // namespace serialization
+#endif  // MPACK_PATCH_H
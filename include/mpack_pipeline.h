@@ -0,0 +1,491 @@
+#ifndef MPACK_PIPELINE_H
+#define MPACK_PIPELINE_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "mpack/mpack.h"
+#include "mpack_serializer.h"
+#include "mpack_thread_context.h"
+
+namespace serialization
+{
+
+/**
+ * Thread pool where each worker owns a deque of tasks. A worker runs its
+ * newest task first and, when its deque is empty, steals the oldest task
+ * of another worker, so tasks spawned while running a task stay on the
+ * thread whose caches hold their data until someone is idle.
+ *
+ * Tasks submitted from a worker go to that worker's deque; tasks from other
+ * threads are spread round-robin. Idle workers sleep and are woken only
+ * when work arrives. The destructor runs every queued task before joining.
+ */
+class WorkStealingPool
+{
+public:
+  using Task = std::function<void()>;
+
+  explicit WorkStealingPool(size_t threads = std::thread::hardware_concurrency())
+  {
+    threads = std::max<size_t>(threads, 1);
+    for (size_t i = 0; i < threads; ++i) {
+      workers_.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+      threads_.emplace_back([this, i]() { run(i); });
+    }
+  }
+
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool & operator=(const WorkStealingPool &) = delete;
+
+  ~WorkStealingPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread & thread : threads_) {
+      thread.join();
+    }
+  }
+
+  size_t size() const { return workers_.size(); }
+
+  void submit(Task task)
+  {
+    const size_t index = current_pool() == this ?
+      current_index() : next_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+    {
+      Worker & worker = *workers_[index];
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      worker.tasks.push_back(std::move(task));
+    }
+
+    // Paired with run(): a worker counts itself as sleeping before it
+    // checks queued_, so one of the two sides always sees the other
+    queued_.fetch_add(1);
+    if (sleeping_.load() > 0) {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      wake_.notify_one();
+    }
+  }
+
+private:
+  struct Worker
+  {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  static WorkStealingPool * & current_pool()
+  {
+    thread_local WorkStealingPool * pool = nullptr;
+    return pool;
+  }
+
+  static size_t & current_index()
+  {
+    thread_local size_t index = 0;
+    return index;
+  }
+
+  bool take(size_t self, Task & task)
+  {
+    {
+      Worker & own = *workers_[self];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < workers_.size(); ++i) {
+      Worker & victim = *workers_[(self + i) % workers_.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.tasks.empty()) {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void run(size_t self)
+  {
+    current_pool() = this;
+    current_index() = self;
+
+    Task task;
+    for (;;) {
+      if (take(self, task)) {
+        queued_.fetch_sub(1);
+        task();
+        task = nullptr;
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      sleeping_.fetch_add(1);
+      wake_.wait(lock, [this]() { return queued_.load() > 0 || stopping_; });
+      sleeping_.fetch_sub(1);
+      if (stopping_ && queued_.load() == 0) {
+        return;
+      }
+    }
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::atomic<size_t> next_{0};
+  std::atomic<size_t> queued_{0};
+  std::atomic<size_t> sleeping_{0};
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+};
+
+/**
+ * Encoded messages stored back to back in one buffer, so a batch moves
+ * between stages as a unit and reaches a sink as one contiguous write.
+ */
+class MessageBatch
+{
+public:
+  void append(const char * data, size_t size)
+  {
+    bytes_.insert(bytes_.end(), data, data + size);
+    ends_.push_back(bytes_.size());
+  }
+
+  void append(std::string_view message) { append(message.data(), message.size()); }
+
+  std::string_view operator[](size_t i) const
+  {
+    const size_t begin = i == 0 ? 0 : ends_[i - 1];
+    return std::string_view(bytes_.data() + begin, ends_[i] - begin);
+  }
+
+  size_t size() const { return ends_.size(); }
+  bool empty() const { return ends_.empty(); }
+
+  // All messages, concatenated
+  const char * data() const { return bytes_.data(); }
+  size_t bytes() const { return bytes_.size(); }
+
+  void clear()
+  {
+    bytes_.clear();
+    ends_.clear();
+  }
+
+private:
+  std::vector<char> bytes_;
+  std::vector<size_t> ends_;
+};
+
+/**
+ * Decode -> transform -> encode -> sink pipeline over a WorkStealingPool.
+ *
+ * push() collects encoded messages into batches of Options::batch_size,
+ * the unit every stage schedules. Each stage has a bounded input queue;
+ * a stage starts a pool task for its oldest queued batch only while the
+ * next stage's queue, counting the batches it is already working on, is
+ * below Options::queue_capacity. A slow stage therefore fills its own
+ * queue, stalls the stages before it and finally blocks push(), so every
+ * stage's memory stays bounded. The encode stage hands its batches to a
+ * reorder queue from which the sink receives them one at a time, in push
+ * order, on whichever worker completes the next batch due. push() also
+ * blocks while Options::max_batches_in_flight batches are between it and
+ * the sink, which bounds the reorder queue behind a slow batch.
+ *
+ * A stage task submits the next stage's task from its worker, so the pool
+ * usually runs it right away on the same thread, with the batch still in
+ * cache, and idle workers steal queued stages from busy ones.
+ *
+ * The first exception thrown by a stage or the sink is rethrown by the
+ * next push(), flush() or finish(); later batches are dropped.
+ * Any number of producers may push() concurrently; messages are batched in
+ * the order they acquire the pipeline's lock. push() is meant for threads
+ * outside the pool: a worker blocked in it cannot run the batches it waits
+ * for. Batches are decoded and encoded on many workers at once, so the
+ * contexts in Options cannot carry a session dictionary.
+ */
+template<typename T>
+class Pipeline
+{
+public:
+  using Transform = std::function<bool(T &)>;
+  using Sink = std::function<void(const MessageBatch &)>;
+
+  struct Options
+  {
+    size_t batch_size = 64;
+    size_t queue_capacity = 0;  // batches per stage queue; 0: the pool size
+    size_t max_batches_in_flight = 0;  // 0: four times queue_capacity
+    DecodeContext decode;
+    EncodeContext encode;
+  };
+
+  Pipeline(WorkStealingPool & pool, Transform transform, Sink sink)
+  : Pipeline(pool, std::move(transform), std::move(sink), Options{}) {}
+
+  Pipeline(WorkStealingPool & pool, Transform transform, Sink sink, const Options & options)
+  : pool_(pool), transform_(std::move(transform)), sink_(std::move(sink)), options_(options)
+  {
+    options_.batch_size = std::max<size_t>(options_.batch_size, 1);
+    if (options_.queue_capacity == 0) {
+      options_.queue_capacity = pool.size();
+    }
+    if (options_.max_batches_in_flight == 0) {
+      options_.max_batches_in_flight = 4 * options_.queue_capacity;
+    }
+    if (options_.encode.dictionary != nullptr || options_.decode.dictionary != nullptr) {
+      throw std::invalid_argument("Pipeline contexts cannot share a session dictionary");
+    }
+  }
+
+  Pipeline(const Pipeline &) = delete;
+  Pipeline & operator=(const Pipeline &) = delete;
+
+  // Waits for queued batches; errors are dropped, call finish() to see them
+  ~Pipeline()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return in_flight_ == 0; });
+  }
+
+  // Adds one encoded message; blocks while the decode queue is full
+  void push(const char * data, size_t size)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    rethrow();
+    input_.append(data, size);
+    if (input_.size() >= options_.batch_size) {
+      submit_input(lock);
+    }
+  }
+
+  void push(std::string_view message) { push(message.data(), message.size()); }
+
+  // Sends the partial batch on its way
+  void flush()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    submit_input(lock);
+  }
+
+  // Flushes and waits until the sink has received every batch
+  void finish()
+  {
+    flush();
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this]() { return in_flight_ == 0; });
+    rethrow();
+  }
+
+private:
+  enum Stage
+  {
+    kDecode,
+    kTransform,
+    kEncode,
+    kStageCount,
+  };
+
+  // One batch on its way through the stages
+  struct Work
+  {
+    uint64_t sequence;
+    MessageBatch input;
+    std::vector<T> objects;
+    MessageBatch output;
+  };
+
+  // Queues input_ for the decode stage once it has room; called with mutex_
+  // held through lock. Another producer may take input_ while this one
+  // waits, leaving nothing to submit.
+  void submit_input(std::unique_lock<std::mutex> & lock)
+  {
+    rethrow();
+    if (input_.empty()) {
+      return;
+    }
+    done_.wait(
+      lock, [this]() {
+        return (queues_[kDecode].size() < options_.queue_capacity &&
+        in_flight_ < options_.max_batches_in_flight) || error_;
+      });
+    rethrow();
+    if (input_.empty()) {
+      return;
+    }
+    auto work = std::make_shared<Work>();
+    work->sequence = next_submit_++;
+    work->input = std::move(input_);
+    input_ = MessageBatch();
+    ++in_flight_;
+    queues_[kDecode].push_back(std::move(work));
+    schedule();
+  }
+
+  // Whether a stage may start another batch without overfilling the next
+  // queue; the encode stage feeds the reorder queue, bounded by the rest
+  bool has_room(Stage stage) const
+  {
+    return stage == kEncode ||
+           queues_[stage + 1].size() + running_[stage] < options_.queue_capacity;
+  }
+
+  // Starts every queued batch that has room, later stages first so the
+  // pipeline drains before it fills. Called with mutex_ held.
+  void schedule()
+  {
+    for (int s = kEncode; s >= kDecode; --s) {
+      const Stage stage = static_cast<Stage>(s);
+      while (!queues_[stage].empty() && has_room(stage)) {
+        std::shared_ptr<Work> work = std::move(queues_[stage].front());
+        queues_[stage].pop_front();
+        ++running_[stage];
+        pool_.submit([this, stage, work]() { run(stage, *work); finished(stage, work); });
+      }
+    }
+    done_.notify_all();
+  }
+
+  void run(Stage stage, Work & work)
+  {
+    if (failed()) {
+      return;
+    }
+    try {
+      ThreadContext & context = ThreadContext::local();
+      switch (stage) {
+        case kDecode:
+          work.objects.resize(work.input.size());
+          for (size_t i = 0; i < work.input.size(); ++i) {
+            const std::string_view message = work.input[i];
+            context.decode(message.data(), message.size(), work.objects[i], options_.decode);
+          }
+          work.input = MessageBatch();
+          break;
+        case kTransform:
+          // Returning false drops the message
+          work.objects.erase(
+            std::remove_if(
+              work.objects.begin(), work.objects.end(),
+              [this](T & obj) { return !transform_(obj); }),
+            work.objects.end());
+          break;
+        case kEncode:
+          for (const T & obj : work.objects) {
+            work.output.append(context.encode(obj, options_.encode));
+          }
+          work.objects.clear();
+          break;
+        default:
+          break;
+      }
+    } catch (...) {
+      fail(std::current_exception());
+    }
+  }
+
+  // Hands a batch to the next stage's queue, or after the encode stage to
+  // the reorder queue. The thread that completes the next batch due drains
+  // the reorder queue into the sink.
+  void finished(Stage stage, const std::shared_ptr<Work> & work)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    --running_[stage];
+    if (stage != kEncode) {
+      queues_[stage + 1].push_back(work);
+      schedule();
+      return;
+    }
+
+    ready_.emplace(work->sequence, std::move(work->output));
+    if (sink_running_) {
+      return;
+    }
+    sink_running_ = true;
+    while (!ready_.empty() && ready_.begin()->first == next_deliver_) {
+      MessageBatch next = std::move(ready_.begin()->second);
+      ready_.erase(ready_.begin());
+      const bool skip = error_ != nullptr;
+      lock.unlock();
+      if (!skip && !next.empty()) {
+        try {
+          sink_(next);
+        } catch (...) {
+          fail(std::current_exception());
+        }
+      }
+      lock.lock();
+      ++next_deliver_;
+      --in_flight_;
+      done_.notify_all();
+    }
+    sink_running_ = false;
+  }
+
+  bool failed()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_ != nullptr;
+  }
+
+  void fail(std::exception_ptr error)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_) {
+      error_ = error;
+    }
+    done_.notify_all();
+  }
+
+  // Called with mutex_ held
+  void rethrow()
+  {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+
+  WorkStealingPool & pool_;
+  Transform transform_;
+  Sink sink_;
+  Options options_;
+
+  std::mutex mutex_;
+  MessageBatch input_;  // producer side, filled by push()
+  std::condition_variable done_;
+  std::deque<std::shared_ptr<Work>> queues_[kStageCount];
+  size_t running_[kStageCount] = {};
+  std::map<uint64_t, MessageBatch> ready_;
+  std::exception_ptr error_;
+  size_t in_flight_ = 0;
+  uint64_t next_submit_ = 0;
+  uint64_t next_deliver_ = 0;
+  bool sink_running_ = false;
+};
+
+}  // namespace serialization
+#endif  // MPACK_PIPELINE_H
@@ -0,0 +1,393 @@
+#ifndef MPACK_RESUMABLE_H
+#define MPACK_RESUMABLE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "mpack/mpack.h"
+#include "mpack_serialize_typehandlers.h"
+#include "mpack_serializer.h"
+#include "mpack_small_vector.h"
+#include "mpack_stream_reader.h"
+
+namespace serialization
+{
+
+namespace resumable_detail
+{
+
+// Types decoded frame by frame; anything else is decoded whole once its
+// bytes have arrived
+template<typename T>
+struct is_resumable : std::bool_constant<is_reflected_v<T>> {};
+
+// Containers whose handler writes msgpack bin (std::vector<char>) are leaves
+template<typename T, typename = void>
+struct encodes_as_bin : std::false_type {};
+
+template<typename T>
+struct encodes_as_bin<T, std::enable_if_t<has_type_tag<T>::value>>
+  : std::bool_constant<TypeHandler<T>::tag == TypeTag::Binary> {};
+
+template<typename U, typename Alloc>
+struct is_resumable<std::vector<U, Alloc>>
+  : std::bool_constant<!std::is_same_v<U, bool>&& !encodes_as_bin<std::vector<U, Alloc>>::value> {};
+
+template<typename U, size_t N, bool CanSpill>
+struct is_resumable<inline_vector<U, N, CanSpill>>
+  : std::bool_constant<!encodes_as_bin<inline_vector<U, N, CanSpill>>::value> {};
+
+template<typename T>
+inline constexpr bool is_resumable_v = is_resumable<T>::value;
+
+}  // namespace resumable_detail
+
+/**
+ * Decoder that suspends when input runs out and resumes on the next feed()
+ * from the same field or element, without re-parsing what it has read.
+ *
+ * The state is an explicit stack of frames, one per reflected object or
+ * sequence being filled (std::vector and inline_vector elements included).
+ * Other values (scalars, strings, bin, variants, maps...) are decoded whole by
+ * their TypeHandler once a MessageScanner has seen all of their bytes; only
+ * the bytes of such a partially received value are kept between feeds.
+ * The memory per pending message is therefore the frame stack plus at most
+ * one leaf value, so one thread can drive many decoders from an event loop.
+ *
+ * Dictionary references (see StringDictionary) are not supported. After an
+ * exception the decoder must be restarted with start().
+ */
+class ResumableDecoder
+{
+public:
+  enum class Status
+  {
+    NeedMore,
+    Done,
+  };
+
+  ResumableDecoder() = default;
+
+  template<typename T>
+  explicit ResumableDecoder(T & target, const DecodeContext & ctx = DecodeContext{})
+  {
+    start(target, ctx);
+  }
+
+  // Begins decoding a new message into target, dropping any partial one
+  template<typename T>
+  void start(T & target, const DecodeContext & ctx = DecodeContext{})
+  {
+    static_assert(is_reflected_v<T>, "ResumableDecoder needs a type with get_fields()");
+    frames_.clear();
+    pending_.clear();
+    scanner_.reset();
+    ctx_ = ctx;
+    push(target);
+  }
+
+  // Consumes bytes until the message completes or input runs out. On Done,
+  // *consumed tells how many bytes of this chunk belonged to the message;
+  // the rest starts the next one. On NeedMore the whole chunk was taken.
+  Status feed(const char * data, size_t size, size_t * consumed = nullptr)
+  {
+    if (frames_.empty()) {
+      throw std::logic_error("ResumableDecoder has no message in progress");
+    }
+
+    const size_t held = pending_.size();
+    const char * base = data;
+    if (held > 0) {
+      pending_.insert(pending_.end(), data, data + size);
+      base = pending_.data();
+    }
+    cur_ = base;
+    end_ = base + held + size;
+
+    const Status status = run();
+    const size_t used = static_cast<size_t>(cur_ - base);
+
+    if (status == Status::Done) {
+      pending_.clear();
+      if (consumed != nullptr) {
+        *consumed = used - held;
+      }
+    } else {
+      // Keep only the bytes of the leaf value still waiting for input
+      if (held > 0) {
+        pending_.erase(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(used));
+      } else {
+        pending_.assign(base + used, end_);
+      }
+      if (consumed != nullptr) {
+        *consumed = size;
+      }
+    }
+    return status;
+  }
+
+  bool done() const { return frames_.empty(); }
+
+  // Bytes held for a partially received leaf value
+  size_t buffered() const { return pending_.size(); }
+
+  // Frames open in the current message
+  size_t depth() const { return frames_.size(); }
+
+private:
+  enum class Step
+  {
+    Suspend,   // needs more input; nothing of the current item was consumed
+    Complete,  // frame finished
+    Pushed,    // a child frame was pushed; resume the parent after it
+  };
+
+  struct Frame
+  {
+    void * target;
+    Step (* step)(ResumableDecoder &, Frame &);
+    uint32_t count = 0;
+    uint32_t index = 0;
+    int32_t field = kNeedKey;
+    bool started = false;
+  };
+
+  static constexpr int32_t kNeedKey = -1;
+  static constexpr int32_t kUnknownField = -2;
+
+  Status run()
+  {
+    while (!frames_.empty()) {
+      Frame & frame = frames_.back();
+      const Step step = frame.step(*this, frame);
+      if (step == Step::Suspend) {
+        return Status::NeedMore;
+      }
+      if (step == Step::Complete) {
+        frames_.pop_back();
+      }
+    }
+    return Status::Done;
+  }
+
+  template<typename V>
+  void push(V & target)
+  {
+    Frame frame;
+    frame.target = &target;
+    frame.step = &ResumableDecoder::step<V>;
+    frames_.push_back(frame);
+  }
+
+  template<typename V>
+  static Step step(ResumableDecoder & decoder, Frame & frame)
+  {
+    V & target = *static_cast<V *>(frame.target);
+    if constexpr (is_reflected_v<V>) {
+      return decoder.step_object(target, frame);
+    } else {
+      return decoder.step_sequence(target, frame);
+    }
+  }
+
+  // Reads a map or array header once all of its bytes are in
+  bool read_header(mpack_type_t type, uint32_t & count)
+  {
+    if (cur_ == end_) {
+      return false;
+    }
+    const size_t size = MessageScanner::header_size(static_cast<uint8_t>(*cur_));
+    if (static_cast<size_t>(end_ - cur_) < size) {
+      return false;
+    }
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, cur_, size);
+    mpack_tag_t tag = mpack_read_tag(&reader);
+    mpack_reader_destroy(&reader);
+    if (tag.type != type) {
+      throw std::runtime_error(type == mpack_type_map ? "Expected a map" : "Expected array");
+    }
+    count = tag.v.n;
+    cur_ += size;
+    return true;
+  }
+
+  // Size of the complete value at cur_, or 0 while it is still arriving
+  size_t complete_value()
+  {
+    return scanner_.scan(cur_, static_cast<size_t>(end_ - cur_));
+  }
+
+  template<typename V>
+  bool read_leaf(V & value)
+  {
+    const size_t size = complete_value();
+    if (size == 0) {
+      return false;
+    }
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, cur_, size);
+    read_value(&reader, value, ctx_);
+    if (mpack_reader_destroy(&reader) != mpack_ok) {
+      throw std::runtime_error("An error occurred decoding the data");
+    }
+    cur_ += size;
+    return true;
+  }
+
+  bool skip_leaf()
+  {
+    const size_t size = complete_value();
+    cur_ += size;
+    return size != 0;
+  }
+
+  // Reads one element into value: pushes a frame for resumable types,
+  // otherwise decodes it whole. The caller has already advanced its frame.
+  template<typename V>
+  Step read_element(V & value)
+  {
+    if constexpr (resumable_detail::is_resumable_v<V>) {
+      push(value);
+      return Step::Pushed;
+    } else {
+      return read_leaf(value) ? Step::Complete : Step::Suspend;
+    }
+  }
+
+  template<typename T>
+  Step step_object(T & target, Frame & frame)
+  {
+    constexpr auto fields = T::get_fields();
+    constexpr size_t field_count = std::tuple_size_v<decltype(fields)>;
+
+    if (!frame.started) {
+      if (!read_header(mpack_type_map, frame.count)) {
+        return Step::Suspend;
+      }
+      frame.started = true;
+    }
+
+    while (frame.index < frame.count) {
+      if (frame.field == kNeedKey) {
+        const size_t size = complete_value();
+        if (size == 0) {
+          return Step::Suspend;
+        }
+        frame.field = find_field(fields, std::string_view(cur_, size), std::make_index_sequence<field_count>{});
+        cur_ += size;
+      }
+
+      if (frame.field == kUnknownField) {
+        if (!skip_leaf()) {
+          return Step::Suspend;
+        }
+        frame.field = kNeedKey;
+        ++frame.index;
+        continue;
+      }
+
+      // Resumable fields push a frame, which may reallocate frames_, so the
+      // frame is advanced first and not touched afterwards
+      const int32_t field = frame.field;
+      if (is_resumable_field(fields, field, std::make_index_sequence<field_count>{})) {
+        frame.field = kNeedKey;
+        ++frame.index;
+        read_field(target, fields, field, std::make_index_sequence<field_count>{});
+        return Step::Pushed;
+      }
+      if (read_field(target, fields, field, std::make_index_sequence<field_count>{}) == Step::Suspend) {
+        return Step::Suspend;
+      }
+      frame.field = kNeedKey;
+      ++frame.index;
+    }
+    return Step::Complete;
+  }
+
+  // Matches an encoded str key against the field names
+  template<typename Fields, size_t... I>
+  static int32_t find_field(const Fields & fields, std::string_view encoded, std::index_sequence<I...>)
+  {
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, encoded.data(), encoded.size());
+    mpack_tag_t tag = mpack_read_tag(&reader);
+    mpack_reader_destroy(&reader);
+    if (tag.type != mpack_type_str) {
+      throw std::runtime_error("Expected string key in map");
+    }
+    const std::string_view key = encoded.substr(encoded.size() - tag.v.l);
+
+    int32_t match = kUnknownField;
+    ((match == kUnknownField && key == std::get<I>(fields).name ?
+    (match = static_cast<int32_t>(I)) : match), ...);
+    return match;
+  }
+
+  template<typename Fields, size_t... I>
+  static bool is_resumable_field(const Fields &, int32_t field, std::index_sequence<I...>)
+  {
+    return ((field == static_cast<int32_t>(I) &&
+           resumable_detail::is_resumable_v<field_member_t<std::tuple_element_t<I, Fields>>>) || ...);
+  }
+
+  template<typename T, typename Fields, size_t... I>
+  Step read_field(T & target, const Fields & fields, int32_t field, std::index_sequence<I...>)
+  {
+    Step step = Step::Complete;
+    ((field == static_cast<int32_t>(I) ?
+    (step = read_element(target.*(std::get<I>(fields).member_ptr)), 0) : 0), ...);
+    return step;
+  }
+
+  template<typename Sequence>
+  Step step_sequence(Sequence & target, Frame & frame)
+  {
+    if (!frame.started) {
+      if (!read_header(mpack_type_array, frame.count)) {
+        return Step::Suspend;
+      }
+      // The count is untrusted: reserve no more than the bytes at hand can
+      // hold and grow as elements arrive. Only the innermost frame is ever
+      // grown, so open frames never point into a reallocated buffer.
+      target.clear();
+      target.reserve(std::min<size_t>(frame.count, static_cast<size_t>(end_ - cur_)));
+      frame.started = true;
+    }
+
+    while (frame.index < frame.count) {
+      if (target.size() == frame.index) {
+        target.emplace_back();
+      }
+      auto & element = target[frame.index];
+      if constexpr (resumable_detail::is_resumable_v<std::decay_t<decltype(element)>>) {
+        ++frame.index;
+        push(element);
+        return Step::Pushed;
+      } else {
+        if (!read_leaf(element)) {
+          return Step::Suspend;
+        }
+        ++frame.index;
+      }
+    }
+    return Step::Complete;
+  }
+
+  std::vector<Frame> frames_;
+  std::vector<char> pending_;  // unconsumed bytes of the leaf value being received
+  MessageScanner scanner_;
+  DecodeContext ctx_;
+  const char * cur_ = nullptr;
+  const char * end_ = nullptr;
+};
+
+}  // namespace serialization
+#endif  // MPACK_RESUMABLE_H
@@ -1,7 +1,12 @@
 #ifndef MPACK_SERIALIZE_TYPEHANDLERS_H
 #define MPACK_SERIALIZE_TYPEHANDLERS_H
 
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <string>
 #include <array>
 #include <tuple>
@@ -13,6 +18,8 @@
 #include <map>
 #include <cstdint>
 #include "mpack/mpack.h"
+#include "mpack_string_dictionary.h"
+#include "mpack_utf8.h"
 
 template<size_t N>
 struct MsgPackExtension
@@ -79,9 +86,259 @@ enum class TypeTag
   Binary,
   Array,
   Map,
-  CustomObject
+  CustomObject,
+  Extension
 };
 
+// Opt-in encoding policies, combined with bitwise or. They only change which
+// msgpack representation is written; the readers accept every variant.
+enum EncodeFlags : uint32_t
+{
+  EncodeDefault = 0,
+  // Smallest lossless of int, float32 and float64. Not applied to a variant's
+  // float alternative when the compact form would decode as another one.
+  EncodeCompactFloat = 1u << 0,
+  // unordered_map entries in ascending key order, or by encoded key bytes
+  // for keys without operator<
+  EncodeSortedKeys = 1u << 1,
+  EncodeFixedWidth = 1u << 2,  // integers in the full width of their type, patchable in place
+  // Equal values always encode to the same bytes; use without a dictionary
+  EncodeCanonical = EncodeCompactFloat | EncodeSortedKeys,
+};
+
+// Encoding state threaded through the type handlers during a serialize call
+struct EncodeContext
+{
+  uint32_t flags = EncodeDefault;
+  StringDictionary * dictionary = nullptr;  // session dictionary for repeated strings
+};
+
+class StringInterner;
+
+// Opt-in decoding checks, combined with bitwise or
+enum DecodeFlags : uint32_t
+{
+  DecodeDefault = 0,
+  DecodeValidateUtf8 = 1u << 0,  // string fields must be well-formed UTF-8
+};
+
+// Decoding state threaded through the type handlers during a deserialize call
+struct DecodeContext
+{
+  StringInterner * interner = nullptr;  // table for InternedString fields, global if null
+  StringDictionary * dictionary = nullptr;  // session dictionary for repeated strings
+  uint32_t flags = DecodeDefault;
+};
+
+// Rejects a decoded string when the context asks for UTF-8 validation
+inline void check_utf8(const char * data, size_t length, const DecodeContext & ctx)
+{
+  if ((ctx.flags & DecodeValidateUtf8) != 0 && !utf8_valid(data, length)) {
+    throw std::runtime_error("String is not valid UTF-8");
+  }
+}
+
+// mpack has no public call that hands out buffer space, so writer_reserve()
+// and writer_commit() use the position/end pointers of mpack_writer_t. That
+// layout is the one mpack 1.x has; check it again before moving to 2.x.
+static_assert(
+  MPACK_VERSION_MAJOR == 1,
+  "writer_reserve() relies on the mpack 1.x layout of mpack_writer_t");
+
+// Returns size bytes of the writer's buffer to be stored into directly, or
+// nullptr when the writer has failed, the buffer lacks the room or write
+// tracking is compiled in; the caller then writes through mpack instead.
+// Pair with writer_commit(). Not for use inside mpack_build_map/array.
+inline char * writer_reserve(mpack_writer_t * writer, size_t size)
+{
+#if MPACK_WRITE_TRACKING
+  (void)writer;
+  (void)size;
+  return nullptr;
+#else
+  if (mpack_writer_error(writer) != mpack_ok || mpack_writer_buffer_left(writer) < size) {
+    return nullptr;
+  }
+  return writer->position;
+#endif
+}
+
+// Marks the first used bytes of the last writer_reserve() as written
+inline void writer_commit(mpack_writer_t * writer, size_t used)
+{
+  writer->position += used;
+}
+
+// Writes a string, as a reference when the session dictionary already holds it
+inline void write_str(
+  mpack_writer_t * writer, const char * data, size_t length,
+  const EncodeContext & ctx)
+{
+  if (ctx.dictionary != nullptr) {
+    const size_t index = ctx.dictionary->lookup(std::string_view(data, length));
+    if (index != StringDictionary::npos) {
+      write_dictionary_ref(writer, ctx.dictionary->ext_type(), index);
+      return;
+    }
+  }
+  mpack_write_str(writer, data, static_cast<uint32_t>(length));
+}
+
+// Whether a peeked tag is a reference into the session dictionary
+inline bool is_dictionary_ref(mpack_tag_t tag, const DecodeContext & ctx)
+{
+  return ctx.dictionary != nullptr && tag.type == mpack_type_ext &&
+         mpack_tag_ext_exttype(&tag) == ctx.dictionary->ext_type();
+}
+
+// Consumes the reference described by a peeked tag if it is one, returning its string
+inline const std::string * read_dictionary_str(
+  mpack_reader_t * reader, mpack_tag_t tag,
+  const DecodeContext & ctx)
+{
+  if (!is_dictionary_ref(tag, ctx)) {
+    return nullptr;
+  }
+  mpack_read_tag(reader);
+  return &ctx.dictionary->at(read_dictionary_ref(reader, tag));
+}
+
+// Discards the next value. Dictionary references are ext values and the
+// table grows per message (see StringDictionary), so nothing is recorded here.
+inline void skip_value(mpack_reader_t * reader, const DecodeContext &)
+{
+  mpack_discard(reader);
+}
+
+// Whether a double is an integer in [-2^63, 2^64); -0.0 must stay a float
+inline bool is_int64_exact(double value)
+{
+  return value >= -9223372036854775808.0 && value < 18446744073709551616.0 &&
+         std::trunc(value) == value && !(value == 0.0 && std::signbit(value));
+}
+
+// Whether a double survives narrowing to float32 bit for bit. Narrowing a
+// finite value outside the float range is undefined, so those never do.
+inline bool is_float32_exact(double value)
+{
+  if (!std::isinf(value) && std::fabs(value) > std::numeric_limits<float>::max()) {
+    return false;
+  }
+  const double widened = static_cast<double>(static_cast<float>(value));
+  return std::memcmp(&widened, &value, sizeof(double)) == 0;
+}
+
+// Writes a double as the smallest msgpack number that decodes to the same
+// bits: an integer of up to 5 bytes, else float32, else a 9-byte integer or
+// float64 (the same size)
+inline void write_compact_double(mpack_writer_t * writer, double value)
+{
+  const bool integral = is_int64_exact(value);
+  if (integral && value >= -2147483648.0 && value < 4294967296.0) {
+    mpack_write_int(writer, static_cast<int64_t>(value));
+  } else if (is_float32_exact(value)) {
+    mpack_write_float(writer, static_cast<float>(value));
+  } else if (integral) {
+    if (value < 0) {
+      mpack_write_int(writer, static_cast<int64_t>(value));
+    } else {
+      mpack_write_uint(writer, static_cast<uint64_t>(value));
+    }
+  } else {
+    mpack_write_double(writer, value);
+  }
+}
+
+// Sized msgpack type byte for an integer type, e.g. 0xcf for uint64_t
+template<typename T>
+constexpr uint8_t fixed_width_lead()
+{
+  static_assert(sizeof(T) <= 8, "Integers wider than 64 bits have no msgpack form");
+  const uint8_t base = std::is_unsigned_v<T> ? 0xcc : 0xd0;
+  return sizeof(T) == 1 ? base : sizeof(T) == 2 ? base + 1 : sizeof(T) == 4 ? base + 2 : base + 3;
+}
+
+// Writes an integer as the sized msgpack type matching T whatever its
+// value, so the field keeps its offset and size when patched later
+template<typename T>
+void write_fixed_int(mpack_writer_t * writer, T value)
+{
+  const uint64_t bits = static_cast<uint64_t>(value);
+  char bytes[1 + sizeof(T)];
+  bytes[0] = static_cast<char>(fixed_width_lead<T>());
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    bytes[1 + i] = static_cast<char>(bits >> (8 * (sizeof(T) - 1 - i)));
+  }
+  mpack_write_object_bytes(writer, bytes, sizeof(bytes));
+}
+
+// Reads an integer through mpack's accessor sized for T, which flags
+// mpack_error_type for values outside T's range. Both backends use these,
+// so they accept and reject the same input.
+template<typename T>
+T expect_sized_int(mpack_reader_t * reader)
+{
+  if constexpr (std::is_signed_v<T>) {
+    if constexpr (sizeof(T) == 1) {
+      return static_cast<T>(mpack_expect_i8(reader));
+    } else if constexpr (sizeof(T) == 2) {
+      return static_cast<T>(mpack_expect_i16(reader));
+    } else if constexpr (sizeof(T) == 4) {
+      return static_cast<T>(mpack_expect_i32(reader));
+    } else {
+      return static_cast<T>(mpack_expect_i64(reader));
+    }
+  } else {
+    if constexpr (sizeof(T) == 1) {
+      return static_cast<T>(mpack_expect_u8(reader));
+    } else if constexpr (sizeof(T) == 2) {
+      return static_cast<T>(mpack_expect_u16(reader));
+    } else if constexpr (sizeof(T) == 4) {
+      return static_cast<T>(mpack_expect_u32(reader));
+    } else {
+      return static_cast<T>(mpack_expect_u64(reader));
+    }
+  }
+}
+
+template<typename T>
+T node_sized_int(mpack_node_t node)
+{
+  if constexpr (std::is_signed_v<T>) {
+    if constexpr (sizeof(T) == 1) {
+      return static_cast<T>(mpack_node_i8(node));
+    } else if constexpr (sizeof(T) == 2) {
+      return static_cast<T>(mpack_node_i16(node));
+    } else if constexpr (sizeof(T) == 4) {
+      return static_cast<T>(mpack_node_i32(node));
+    } else {
+      return static_cast<T>(mpack_node_i64(node));
+    }
+  } else {
+    if constexpr (sizeof(T) == 1) {
+      return static_cast<T>(mpack_node_u8(node));
+    } else if constexpr (sizeof(T) == 2) {
+      return static_cast<T>(mpack_node_u16(node));
+    } else if constexpr (sizeof(T) == 4) {
+      return static_cast<T>(mpack_node_u32(node));
+    } else {
+      return static_cast<T>(mpack_node_u64(node));
+    }
+  }
+}
+
+// Writes a float as a fixint/int when that is no larger than float32, else as float32
+inline void write_compact_float(mpack_writer_t * writer, float value)
+{
+  if (value > -2147483648.0f && value < 2147483648.0f && std::trunc(value) == value &&
+    !(value == 0.0f && std::signbit(value)))
+  {
+    mpack_write_int(writer, static_cast<int64_t>(value));
+    return;
+  }
+  mpack_write_float(writer, value);
+}
+
 // Default handler for primitive types
 template<typename T, typename = void>
 struct TypeHandler
@@ -114,10 +371,53 @@ struct TypeHandler
     }
   }
 
+  static void write(mpack_writer_t * writer, const T & value, const EncodeContext & ctx)
+  {
+    if constexpr (std::is_integral_v<T>) {
+      if (ctx.flags & EncodeFixedWidth) {
+        write_fixed_int(writer, value);
+      } else {
+        write(writer, value);
+      }
+    } else if constexpr (std::is_floating_point_v<T>) {
+      if (ctx.flags & EncodeCompactFloat) {
+        write_compact_float(writer, static_cast<float>(value));
+      } else {
+        write(writer, value);
+      }
+    } else if constexpr (std::is_same_v<T, std::string>) {
+      write_str(writer, value.data(), value.size(), ctx);
+    } else if constexpr (is_string_like<T>::value) {
+      write_str(writer, value, strlen(value), ctx);
+    } else if constexpr (is_serializable_v<T>) {
+      value.serialize(writer, ctx);
+    } else {
+      write(writer, value);
+    }
+  }
+
+  static void read(mpack_reader_t * reader, T & value, const DecodeContext & ctx)
+  {
+    if constexpr (std::is_same_v<T, std::string>) {
+      if (ctx.dictionary != nullptr) {
+        if (const std::string * ref = read_dictionary_str(reader, mpack_peek_tag(reader), ctx)) {
+          value = *ref;
+          return;
+        }
+      }
+      read(reader, value);
+      check_utf8(value.data(), value.size(), ctx);
+    } else if constexpr (is_serializable_v<T>) {
+      value.deserialize(reader, ctx);
+    } else {
+      read(reader, value);
+    }
+  }
+
   static void read(mpack_reader_t * reader, T & value)
   {
     if constexpr (std::is_integral_v<T>) {
-      value = static_cast<T>(mpack_expect_int(reader));
+      value = expect_sized_int<T>(reader);
     } else if constexpr (std::is_floating_point_v<T>) {
       value = static_cast<T>(mpack_expect_float(reader));
     } else if constexpr (std::is_same_v<T, std::string>) {
@@ -146,88 +446,372 @@ struct TypeHandler
         "Type is not deserializable and does not match any known type");
     }
   }
+
+  static void read(mpack_node_t node, T & value, const DecodeContext & ctx)
+  {
+    if constexpr (std::is_integral_v<T>) {
+      value = node_sized_int<T>(node);
+    } else if constexpr (std::is_floating_point_v<T>) {
+      value = static_cast<T>(mpack_node_float(node));
+    } else if constexpr (std::is_same_v<T, std::string>) {
+      if (mpack_node_type(node) != mpack_type_str) {
+        throw std::runtime_error("Expected string type");
+      }
+      value.assign(mpack_node_str(node), mpack_node_strlen(node));
+      check_utf8(value.data(), value.size(), ctx);
+    } else if constexpr (is_serializable_v<T>) {
+      value.deserialize(node, ctx);
+    } else {
+      static_assert(
+        sizeof(T) == 0,
+        "Type is not deserializable and does not match any known type");
+    }
+  }
+};
+
+// Detects handlers that take an EncodeContext in addition to the writer
+template<typename T, typename = void>
+struct has_context_write : std::false_type {};
+
+template<typename T>
+struct has_context_write<T, std::void_t<decltype(TypeHandler<T>::write(
+    std::declval<mpack_writer_t *>(), std::declval<const T &>(),
+    std::declval<const EncodeContext &>()))>>: std::true_type {};
+
+// Writes a value through its TypeHandler, passing the context on when the handler uses it
+template<typename T>
+void write_value(mpack_writer_t * writer, const T & value, const EncodeContext & ctx)
+{
+  if constexpr (has_context_write<T>::value) {
+    TypeHandler<T>::write(writer, value, ctx);
+  } else {
+    TypeHandler<T>::write(writer, value);
+  }
+}
+
+// Detects handlers that declare the TypeTag they read
+template<typename T, typename = void>
+struct has_type_tag : std::false_type {};
+
+template<typename T>
+struct has_type_tag<T, std::void_t<decltype(TypeHandler<T>::tag)>>: std::true_type {};
+
+// Detects keys that EncodeSortedKeys can order
+template<typename T, typename = void>
+struct is_less_comparable : std::false_type {};
+
+template<typename T>
+struct is_less_comparable<T, std::void_t<decltype(std::declval<const T &>() < std::declval<const T &>())>>
+  : std::true_type {};
+
+// Whether a handler with the given tag reads a msgpack type as written
+constexpr bool tag_reads_exact(TypeTag tag, mpack_type_t type)
+{
+  switch (tag) {
+    case TypeTag::Nil: return type == mpack_type_nil;
+    case TypeTag::Bool: return type == mpack_type_bool;
+    case TypeTag::Integer: return type == mpack_type_int;
+    case TypeTag::UInt: return type == mpack_type_uint;
+    case TypeTag::Float:
+    case TypeTag::Double: return type == mpack_type_float || type == mpack_type_double;
+    case TypeTag::String: return type == mpack_type_str;
+    case TypeTag::Binary: return type == mpack_type_bin;
+    case TypeTag::Array: return type == mpack_type_array;
+    case TypeTag::Map:
+    case TypeTag::CustomObject: return type == mpack_type_map;
+    case TypeTag::Extension: return type == mpack_type_ext;
+    default: return false;
+  }
+}
+
+// Whether it also reads the type through a lossless conversion
+constexpr bool tag_reads_converted(TypeTag tag, mpack_type_t type)
+{
+  switch (tag) {
+    // mpack writes non-negative signed values as uint
+    case TypeTag::Integer: return type == mpack_type_uint;
+    // EncodeCompactFloat writes integral values as int/uint
+    case TypeTag::Float:
+    case TypeTag::Double: return type == mpack_type_int || type == mpack_type_uint;
+    default: return false;
+  }
+}
+
+template<typename ... Types>
+struct VariantReaders
+{
+  using Variant = std::variant<Types...>;
+  using ReadFn = void (*)(mpack_reader_t *, Variant &, const DecodeContext &);
+
+  // Decode in place, reusing the active alternative when it already matches
+  template<size_t I>
+  static void read_alternative(mpack_reader_t * reader, Variant & value, const DecodeContext & ctx)
+  {
+    if (value.index() != I) {
+      value.template emplace<I>();
+    }
+    read_value(reader, *std::get_if<I>(&value), ctx);
+  }
+
+  template<size_t... I>
+  static constexpr std::array<ReadFn, sizeof...(I)> make_readers(std::index_sequence<I...>)
+  {
+    return {&read_alternative<I>...};
+  }
+
+  static constexpr std::array<ReadFn, sizeof...(Types)> kReaders =
+    make_readers(std::index_sequence_for<Types...>{});
+
+  using NodeReadFn = void (*)(mpack_node_t, Variant &, const DecodeContext &);
+
+  template<size_t I>
+  static void read_node_alternative(mpack_node_t node, Variant & value, const DecodeContext & ctx)
+  {
+    if (value.index() != I) {
+      value.template emplace<I>();
+    }
+    read_value(node, *std::get_if<I>(&value), ctx);
+  }
+
+  template<size_t... I>
+  static constexpr std::array<NodeReadFn, sizeof...(I)> make_node_readers(std::index_sequence<I...>)
+  {
+    return {&read_node_alternative<I>...};
+  }
+
+  static constexpr std::array<NodeReadFn, sizeof...(Types)> kNodeReaders =
+    make_node_readers(std::index_sequence_for<Types...>{});
 };
 
-// Variadic template version
+// Detects handlers that take a DecodeContext in addition to the reader
+template<typename T, typename = void>
+struct has_context_read : std::false_type {};
+
+template<typename T>
+struct has_context_read<T, std::void_t<decltype(TypeHandler<T>::read(
+    std::declval<mpack_reader_t *>(), std::declval<T &>(),
+    std::declval<const DecodeContext &>()))>>: std::true_type {};
+
+// Reads a value through its TypeHandler, passing the context on when the handler uses it
+template<typename T>
+void read_value(mpack_reader_t * reader, T & value, const DecodeContext & ctx)
+{
+  if constexpr (has_context_read<T>::value) {
+    TypeHandler<T>::read(reader, value, ctx);
+  } else {
+    TypeHandler<T>::read(reader, value);
+  }
+}
+
+// Detects handlers that can read from a parsed mpack_tree_t node
+template<typename T, typename = void>
+struct has_node_read : std::false_type {};
+
+template<typename T>
+struct has_node_read<T, std::void_t<decltype(TypeHandler<T>::read(
+    std::declval<mpack_node_t>(), std::declval<T &>(),
+    std::declval<const DecodeContext &>()))>>: std::true_type {};
+
+// Reads a value from a node of a parsed tree. Type mismatches inside mpack's
+// node accessors flag the tree error rather than throwing; check the tree after.
+template<typename T>
+void read_value(mpack_node_t node, T & value, const DecodeContext & ctx)
+{
+  static_assert(has_node_read<T>::value, "TypeHandler has no mpack_node_t read");
+  TypeHandler<T>::read(node, value, ctx);
+}
+
+// Per-alternative readers for std::variant
 template<typename ... Types>
 struct TypeHandler<std::variant<Types...>>
 {
   static void write(mpack_writer_t * writer, const std::variant<Types...> & value)
   {
-    // Directly write the value
+    write(writer, value, EncodeContext{});
+  }
+
+  static void write(
+    mpack_writer_t * writer, const std::variant<Types...> & value,
+    const EncodeContext & ctx)
+  {
+    const EncodeContext alternative_ctx{alternative_flags(value.index(), ctx.flags), ctx.dictionary};
     std::visit(
-      [writer](const auto & v) {
-        using ValueType = std::decay_t<decltype(v)>;
-        TypeHandler<ValueType>::write(writer, v);
+      [writer, &alternative_ctx](const auto & v) {
+        write_value(writer, v, alternative_ctx);
       }, value);
   }
 
+  // EncodeCompactFloat may write a float alternative as an int or float32
+  // that decodes as another alternative, e.g. 3.0 in variant<int64_t,
+  // double>; such alternatives are written in full instead
+  static constexpr uint32_t alternative_flags(size_t index, uint32_t flags)
+  {
+    return index < sizeof...(Types) && !kCompactSafe[index] ? flags & ~uint32_t{EncodeCompactFloat} : flags;
+  }
+
   static void read(mpack_reader_t * reader, std::variant<Types...> & value)
   {
-    // Peek at the next tag
+    read(reader, value, DecodeContext{});
+  }
+
+  static void read(
+    mpack_reader_t * reader, std::variant<Types...> & value,
+    const DecodeContext & ctx)
+  {
+    // Peek at the next tag and jump straight to the alternative that reads it
     mpack_tag_t tag = mpack_peek_tag(reader);
+    // Dictionary references stand in for strings
+    const size_t type = static_cast<size_t>(
+      is_dictionary_ref(tag, ctx) ? mpack_type_str : tag.type);
+    const uint8_t index = type < kTypeCount ? kDispatch[type] : kNoMatch;
 
-    // Try to match with a type in the variant
-    bool matched = try_read_variant<0, Types...>(reader, value, tag);
+    if (index == kNoMatch) {
+      throw std::runtime_error("Could not match any variant type with the MessagePack tag");
+    }
+    VariantReaders<Types...>::kReaders[index](reader, value, ctx);
+  }
 
-    if (!matched) {
+  static void read(mpack_node_t node, std::variant<Types...> & value, const DecodeContext & ctx)
+  {
+    const size_t type = static_cast<size_t>(mpack_node_type(node));
+    const uint8_t index = type < kTypeCount ? kDispatch[type] : kNoMatch;
+
+    if (index == kNoMatch) {
       throw std::runtime_error("Could not match any variant type with the MessagePack tag");
     }
+    VariantReaders<Types...>::kNodeReaders[index](node, value, ctx);
   }
 
 private:
-  // Recursive template to try reading each variant type
-  template<size_t I, typename First, typename ... Rest>
-  static bool try_read_variant(
-    mpack_reader_t * reader, std::variant<Types...> & value,
-    const mpack_tag_t & tag)
+  static constexpr size_t kTypeCount = 16;  // covers every mpack_type_t value
+  static constexpr uint8_t kNoMatch = 0xff;
+  static_assert(sizeof...(Types) < kNoMatch, "Too many variant alternatives");
+
+  // Assign every msgpack type not yet claimed to the alternative at index if it reads it
+  template<typename T>
+  static constexpr void claim(
+    std::array<uint8_t, kTypeCount> & table, uint8_t index,
+    bool converted)
   {
-    if (can_read_as<First>(tag)) {
-      First val;
-      TypeHandler<First>::read(reader, val);
-      value = std::move(val);
-      return true;
+    if constexpr (has_type_tag<T>::value) {
+      for (size_t type = 0; type < kTypeCount; ++type) {
+        const auto mtype = static_cast<mpack_type_t>(type);
+        const bool reads = converted ?
+          tag_reads_converted(TypeHandler<T>::tag, mtype) :
+          tag_reads_exact(TypeHandler<T>::tag, mtype);
+        if (table[type] == kNoMatch && reads) {
+          table[type] = index;
+        }
+      }
     }
+  }
 
-    if constexpr (sizeof...(Rest) > 0) {
-      return try_read_variant<I + 1, Rest...>(reader, value, tag);
+  // First alternative wins; exact matches take priority over converting ones
+  static constexpr std::array<uint8_t, kTypeCount> make_dispatch()
+  {
+    std::array<uint8_t, kTypeCount> table{};
+    for (auto & entry : table) {
+      entry = kNoMatch;
     }
+    uint8_t index = 0;
+    (claim<Types>(table, index++, false), ...);
+    index = 0;
+    (claim<Types>(table, index++, true), ...);
+    return table;
+  }
 
-    return false;
+  static constexpr std::array<uint8_t, kTypeCount> kDispatch = make_dispatch();
+
+  // Float alternatives whose compact forms all dispatch back to themselves
+  template<typename T>
+  static constexpr bool compact_safe(uint8_t index)
+  {
+    return !std::is_floating_point_v<T> || (
+      kDispatch[mpack_type_int] == index && kDispatch[mpack_type_uint] == index &&
+      kDispatch[mpack_type_float] == index);
   }
 
-  // Base case for the recursion
-  template<size_t I>
-  static bool try_read_variant(
-    mpack_reader_t * reader, std::variant<Types...> & value,
-    const mpack_tag_t & tag)
+  template<size_t... I>
+  static constexpr std::array<bool, sizeof...(Types)> make_compact_safe(std::index_sequence<I...>)
   {
-    return false;
+    return {compact_safe<Types>(static_cast<uint8_t>(I))...};
   }
 
-  // Type matcher helper
-  template<typename T>
-  static bool can_read_as(const mpack_tag_t & tag)
-  {
-    if constexpr (std::is_same_v<T, bool>) {
-      return tag.type == mpack_type_bool;
-    } else if constexpr (std::is_integral_v<T>&& std::is_signed_v<T>) {
-      return tag.type == mpack_type_int;
-    } else if constexpr (std::is_integral_v<T>&& std::is_unsigned_v<T>) {
-      return tag.type == mpack_type_uint;
-    } else if constexpr (std::is_floating_point_v<T>) {
-      return tag.type == mpack_type_float || tag.type == mpack_type_double;
-    } else if constexpr (std::is_same_v<T, std::string>) {
-      return tag.type == mpack_type_str;
-    } else if constexpr (is_serializable_v<T>) {
-      // For serializable types, we often use maps
-      return tag.type == mpack_type_map;
+  static constexpr std::array<bool, sizeof...(Types)> kCompactSafe =
+    make_compact_safe(std::index_sequence_for<Types...>{});
+};
+
+// A std::variant written as a [index, value] array. Alternatives that share a
+// msgpack type (int32_t/int64_t, several Serializable kinds) stay distinct and
+// decoding dispatches on the index alone. Use as_variant() for std::visit.
+template<typename ... Types>
+class TaggedVariant : public std::variant<Types...>
+{
+public:
+  using std::variant<Types...>::variant;
+  using std::variant<Types...>::operator=;
+
+  const std::variant<Types...> & as_variant() const { return *this; }
+  std::variant<Types...> & as_variant() { return *this; }
+};
+
+template<typename ... Types>
+struct TypeHandler<TaggedVariant<Types...>>
+{
+  static constexpr TypeTag tag = TypeTag::Array;
+
+  static void write(mpack_writer_t * writer, const TaggedVariant<Types...> & value)
+  {
+    write(writer, value, EncodeContext{});
+  }
+
+  static void write(
+    mpack_writer_t * writer, const TaggedVariant<Types...> & value,
+    const EncodeContext & ctx)
+  {
+    mpack_start_array(writer, 2);
+    mpack_write_uint(writer, value.index());
+    std::visit(
+      [writer, &ctx](const auto & v) {
+        write_value(writer, v, ctx);
+      }, value.as_variant());
+    mpack_finish_array(writer);
+  }
+
+  static void read(mpack_reader_t * reader, TaggedVariant<Types...> & value)
+  {
+    read(reader, value, DecodeContext{});
+  }
+
+  static void read(
+    mpack_reader_t * reader, TaggedVariant<Types...> & value,
+    const DecodeContext & ctx)
+  {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (tag.type != mpack_type_array || tag.v.n != 2) {
+      throw std::runtime_error("Expected [index, value] array for tagged variant");
     }
-    // Add more type matchers as needed
-    return false;
+
+    const uint64_t index = mpack_expect_u64(reader);
+    if (index >= sizeof...(Types)) {
+      throw std::runtime_error("Tagged variant index out of range");
+    }
+    VariantReaders<Types...>::kReaders[index](reader, value, ctx);
   }
-};
 
+  static void read(mpack_node_t node, TaggedVariant<Types...> & value, const DecodeContext & ctx)
+  {
+    if (mpack_node_type(node) != mpack_type_array || mpack_node_array_length(node) != 2) {
+      throw std::runtime_error("Expected [index, value] array for tagged variant");
+    }
+
+    const uint64_t index = mpack_node_u64(mpack_node_array_at(node, 0));
+    if (index >= sizeof...(Types)) {
+      throw std::runtime_error("Tagged variant index out of range");
+    }
+    VariantReaders<Types...>::kNodeReaders[index](mpack_node_array_at(node, 1), value, ctx);
+  }
+};
 
 // Specialization for bool
 template<>
@@ -244,11 +828,18 @@ struct TypeHandler<bool>
   {
     value = mpack_expect_bool(reader);
   }
+
+  static void read(mpack_node_t node, bool & value, const DecodeContext &)
+  {
+    value = mpack_node_bool(node);
+  }
 };
 
 template<size_t N>
 struct TypeHandler<MsgPackExtension<N>>
 {
+  static constexpr TypeTag tag = TypeTag::Extension;
+
   static void write(mpack_writer_t * writer, const MsgPackExtension<N> & value)
   {
     mpack_write_ext(writer, value.type, value.buffer, N);
@@ -264,6 +855,19 @@ struct TypeHandler<MsgPackExtension<N>>
     mpack_read_bytes(reader, value.buffer, buf_size);
     value.type = returned_type;
   }
+
+  static void read(mpack_node_t node, MsgPackExtension<N> & value, const DecodeContext &)
+  {
+    if (mpack_node_type(node) != mpack_type_ext) {
+      throw std::runtime_error("Expected extension type");
+    }
+    const uint32_t buf_size = mpack_node_data_len(node);
+    if (buf_size > N) {
+      throw std::runtime_error("Buffer size is too small");
+    }
+    std::memcpy(value.buffer, mpack_node_data(node), buf_size);
+    value.type = mpack_node_exttype(node);
+  }
 };
 
 // Specialization for unsigned integers
@@ -277,9 +881,23 @@ struct TypeHandler<T, std::enable_if_t<std::is_unsigned_v<T>&& !std::is_same_v<T
     mpack_write_uint(writer, static_cast<uint64_t>(value));
   }
 
+  static void write(mpack_writer_t * writer, T value, const EncodeContext & ctx)
+  {
+    if (ctx.flags & EncodeFixedWidth) {
+      write_fixed_int(writer, value);
+    } else {
+      write(writer, value);
+    }
+  }
+
   static void read(mpack_reader_t * reader, T & value)
   {
-    value = static_cast<T>(mpack_expect_u32(reader));
+    value = expect_sized_int<T>(reader);
+  }
+
+  static void read(mpack_node_t node, T & value, const DecodeContext &)
+  {
+    value = node_sized_int<T>(node);
   }
 };
 
@@ -294,12 +912,26 @@ struct TypeHandler<double>
     mpack_write_double(writer, value);
   }
 
+  static void write(mpack_writer_t * writer, double value, const EncodeContext & ctx)
+  {
+    if (ctx.flags & EncodeCompactFloat) {
+      write_compact_double(writer, value);
+    } else {
+      mpack_write_double(writer, value);
+    }
+  }
+
+  // Accepts any msgpack number, so compact encodings decode bit-exact
   static void read(mpack_reader_t * reader, double & value)
   {
     value = mpack_expect_double(reader);
   }
-};
 
+  static void read(mpack_node_t node, double & value, const DecodeContext &)
+  {
+    value = mpack_node_double(node);
+  }
+};
 
 // Specialization for std::optional
 template<typename U>
@@ -308,15 +940,29 @@ struct TypeHandler<std::optional<U>>
   static constexpr TypeTag tag = TypeTag::Nil;
 
   static void write(mpack_writer_t * writer, const std::optional<U> & opt)
+  {
+    write(writer, opt, EncodeContext{});
+  }
+
+  static void write(
+    mpack_writer_t * writer, const std::optional<U> & opt,
+    const EncodeContext & ctx)
   {
     if (opt.has_value()) {
-      TypeHandler<U>::write(writer, *opt);
+      write_value(writer, *opt, ctx);
     } else {
       mpack_write_nil(writer);
     }
   }
 
   static void read(mpack_reader_t * reader, std::optional<U> & opt)
+  {
+    read(reader, opt, DecodeContext{});
+  }
+
+  static void read(
+    mpack_reader_t * reader, std::optional<U> & opt,
+    const DecodeContext & ctx)
   {
     mpack_tag_t tag = mpack_peek_tag(reader);
     if (tag.type == mpack_type_nil) {
@@ -326,7 +972,19 @@ struct TypeHandler<std::optional<U>>
       if (!opt.has_value()) {
         opt.emplace();
       }
-      TypeHandler<U>::read(reader, *opt);
+      read_value(reader, *opt, ctx);
+    }
+  }
+
+  static void read(mpack_node_t node, std::optional<U> & opt, const DecodeContext & ctx)
+  {
+    if (mpack_node_type(node) == mpack_type_nil) {
+      opt = std::nullopt;
+    } else {
+      if (!opt.has_value()) {
+        opt.emplace();
+      }
+      read_value(node, *opt, ctx);
     }
   }
 };
@@ -351,6 +1009,15 @@ struct TypeHandler<std::vector<char>>
     result.resize(tag.v.n);
     mpack_expect_bin_size_buf(reader, result.data(), result.size());
   }
+
+  static void read(mpack_node_t node, std::vector<char> & result, const DecodeContext &)
+  {
+    if (mpack_node_type(node) != mpack_type_bin) {
+      throw std::runtime_error("Expected binary data");
+    }
+    const char * data = mpack_node_data(node);
+    result.assign(data, data + mpack_node_data_len(node));
+  }
 };
 
 // Specialization for std::array
@@ -360,15 +1027,29 @@ struct TypeHandler<std::array<T, N>>
   static constexpr TypeTag tag = TypeTag::Array;
 
   static void write(mpack_writer_t * writer, const std::array<T, N> & arr)
+  {
+    write(writer, arr, EncodeContext{});
+  }
+
+  static void write(
+    mpack_writer_t * writer, const std::array<T, N> & arr,
+    const EncodeContext & ctx)
   {
     mpack_start_array(writer, N);
     for (const auto & item : arr) {
-      TypeHandler<T>::write(writer, item);
+      write_value(writer, item, ctx);
     }
     mpack_finish_array(writer);
   }
 
   static void read(mpack_reader_t * reader, std::array<T, N> & result)
+  {
+    read(reader, result, DecodeContext{});
+  }
+
+  static void read(
+    mpack_reader_t * reader, std::array<T, N> & result,
+    const DecodeContext & ctx)
   {
     mpack_tag_t tag = mpack_read_tag(reader);
     if (tag.type != mpack_type_array || tag.v.n != N) {
@@ -376,7 +1057,18 @@ struct TypeHandler<std::array<T, N>>
     }
 
     for (size_t i = 0; i < N; ++i) {
-      TypeHandler<T>::read(reader, result[i]);
+      read_value(reader, result[i], ctx);
+    }
+  }
+
+  static void read(mpack_node_t node, std::array<T, N> & result, const DecodeContext & ctx)
+  {
+    if (mpack_node_type(node) != mpack_type_array || mpack_node_array_length(node) != N) {
+      throw std::runtime_error("Expected array of specific size");
+    }
+
+    for (size_t i = 0; i < N; ++i) {
+      read_value(mpack_node_array_at(node, i), result[i], ctx);
     }
   }
 };
@@ -388,15 +1080,29 @@ struct TypeHandler<std::vector<T>>
   static constexpr TypeTag tag = TypeTag::Array;
 
   static void write(mpack_writer_t * writer, const std::vector<T> & vec)
+  {
+    write(writer, vec, EncodeContext{});
+  }
+
+  static void write(
+    mpack_writer_t * writer, const std::vector<T> & vec,
+    const EncodeContext & ctx)
   {
     mpack_start_array(writer, vec.size());
     for (const auto & item : vec) {
-      TypeHandler<T>::write(writer, item);
+      write_value(writer, item, ctx);
     }
     mpack_finish_array(writer);
   }
 
   static void read(mpack_reader_t * reader, std::vector<T> & result)
+  {
+    read(reader, result, DecodeContext{});
+  }
+
+  static void read(
+    mpack_reader_t * reader, std::vector<T> & result,
+    const DecodeContext & ctx)
   {
     mpack_tag_t tag = mpack_read_tag(reader);
     if (tag.type != mpack_type_array) {
@@ -405,11 +1111,33 @@ struct TypeHandler<std::vector<T>>
 
     result.resize(tag.v.n);
     for (uint32_t i = 0; i < tag.v.n; ++i) {
-      TypeHandler<T>::read(reader, result[i]);
+      read_value(reader, result[i], ctx);
+    }
+  }
+
+  static void read(mpack_node_t node, std::vector<T> & result, const DecodeContext & ctx)
+  {
+    if (mpack_node_type(node) != mpack_type_array) {
+      throw std::runtime_error("Expected array");
+    }
+
+    const size_t count = mpack_node_array_length(node);
+    result.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+      read_value(mpack_node_array_at(node, i), result[i], ctx);
     }
   }
 };
 
+// Upper bound for reserving a container from a decoded element count. The
+// count is untrusted, but each element needs at least min_bytes of input,
+// so the bytes the reader holds bound how many can actually follow. Loops
+// over such a count also stop at the first reader error.
+inline size_t reserve_limit(mpack_reader_t * reader, uint32_t count, size_t min_bytes)
+{
+  return std::min<size_t>(count, mpack_reader_remaining(reader, nullptr) / min_bytes);
+}
+
 // Specialization for std::unordered_map
 template<typename K, typename V>
 struct TypeHandler<std::unordered_map<K, V>>
@@ -418,27 +1146,199 @@ struct TypeHandler<std::unordered_map<K, V>>
 
   static void write(mpack_writer_t * writer, const std::unordered_map<K, V> & m)
   {
+    write(writer, m, EncodeContext{});
+  }
+
+  static void write(
+    mpack_writer_t * writer, const std::unordered_map<K, V> & m,
+    const EncodeContext & ctx)
+  {
+    if (ctx.flags & EncodeSortedKeys) {
+      write_sorted(writer, m, ctx);
+      return;
+    }
     mpack_start_map(writer, m.size());
     for (const auto & kv : m) {
-      TypeHandler<K>::write(writer, kv.first);
-      TypeHandler<V>::write(writer, kv.second);
+      write_value(writer, kv.first, ctx);
+      write_value(writer, kv.second, ctx);
     }
     mpack_finish_map(writer);
   }
 
   static void read(mpack_reader_t * reader, std::unordered_map<K, V> & result)
+  {
+    read(reader, result, DecodeContext{});
+  }
+
+  static void read(
+    mpack_reader_t * reader, std::unordered_map<K, V> & result,
+    const DecodeContext & ctx)
   {
     mpack_tag_t tag = mpack_read_tag(reader);
     if (tag.type != mpack_type_map) {
       throw std::runtime_error("Expected map");
     }
 
-    for (uint32_t i = 0; i < tag.v.n; ++i) {
+    result.clear();
+    result.reserve(reserve_limit(reader, tag.v.n, 2));
+    for (uint32_t i = 0; i < tag.v.n && mpack_reader_error(reader) == mpack_ok; ++i) {
+      K key;
+      read_value(reader, key, ctx);
+      // Decode the value straight into its node. A repeated key starts from
+      // a fresh value, so the last one wins rather than merging into it.
+      auto [it, inserted] = result.try_emplace(std::move(key));
+      if (!inserted) {
+        it->second = V();
+      }
+      read_value(reader, it->second, ctx);
+    }
+  }
+
+  static void read(mpack_node_t node, std::unordered_map<K, V> & result, const DecodeContext & ctx)
+  {
+    if (mpack_node_type(node) != mpack_type_map) {
+      throw std::runtime_error("Expected map");
+    }
+
+    const size_t count = mpack_node_map_count(node);
+    result.clear();
+    result.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      K key;
+      read_value(mpack_node_map_key_at(node, i), key, ctx);
+      auto [it, inserted] = result.try_emplace(std::move(key));
+      if (!inserted) {
+        it->second = V();
+      }
+      read_value(mpack_node_map_value_at(node, i), it->second, ctx);
+    }
+  }
+
+private:
+  using Entry = const typename std::unordered_map<K, V>::value_type *;
+
+  // Hash-table order depends on insertion history, so sort entry pointers.
+  // Keys without operator< are ordered by their encoded bytes instead.
+  static void write_sorted(
+    mpack_writer_t * writer, const std::unordered_map<K, V> & m,
+    const EncodeContext & ctx)
+  {
+    std::vector<Entry> entries;
+    entries.reserve(m.size());
+    if constexpr (is_less_comparable<K>::value) {
+      for (const auto & kv : m) {
+        entries.push_back(&kv);
+      }
+      std::sort(entries.begin(), entries.end(), [](Entry a, Entry b) { return a->first < b->first; });
+    } else {
+      std::vector<std::pair<std::string, Entry>> keyed;
+      keyed.reserve(m.size());
+      for (const auto & kv : m) {
+        keyed.emplace_back(encode_key(kv.first, ctx.flags), &kv);
+      }
+      std::sort(
+        keyed.begin(), keyed.end(),
+        [](const auto & a, const auto & b) { return a.first < b.first; });
+      for (const auto & key : keyed) {
+        entries.push_back(key.second);
+      }
+    }
+
+    mpack_start_map(writer, m.size());
+    for (Entry kv : entries) {
+      write_value(writer, kv->first, ctx);
+      write_value(writer, kv->second, ctx);
+    }
+    mpack_finish_map(writer);
+  }
+
+  // Key bytes used only for ordering; the dictionary is left out so the
+  // order does not depend on the session's history
+  static std::string encode_key(const K & key, uint32_t flags)
+  {
+    char * data = nullptr;
+    size_t size = 0;
+    mpack_writer_t key_writer;
+    mpack_writer_init_growable(&key_writer, &data, &size);
+    write_value(&key_writer, key, EncodeContext{flags});
+    if (mpack_writer_destroy(&key_writer) != mpack_ok) {
+      std::free(data);
+      throw std::runtime_error("An error occurred encoding a map key");
+    }
+    std::string bytes(data, size);
+    std::free(data);
+    return bytes;
+  }
+};
+
+// Specialization for std::map
+template<typename K, typename V>
+struct TypeHandler<std::map<K, V>>
+{
+  static constexpr TypeTag tag = TypeTag::Map;
+
+  static void write(mpack_writer_t * writer, const std::map<K, V> & m)
+  {
+    write(writer, m, EncodeContext{});
+  }
+
+  static void write(
+    mpack_writer_t * writer, const std::map<K, V> & m,
+    const EncodeContext & ctx)
+  {
+    mpack_start_map(writer, m.size());
+    for (const auto & kv : m) {
+      write_value(writer, kv.first, ctx);
+      write_value(writer, kv.second, ctx);
+    }
+    mpack_finish_map(writer);
+  }
+
+  static void read(mpack_reader_t * reader, std::map<K, V> & result)
+  {
+    read(reader, result, DecodeContext{});
+  }
+
+  static void read(
+    mpack_reader_t * reader, std::map<K, V> & result,
+    const DecodeContext & ctx)
+  {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (tag.type != mpack_type_map) {
+      throw std::runtime_error("Expected map");
+    }
+
+    result.clear();
+    for (uint32_t i = 0; i < tag.v.n && mpack_reader_error(reader) == mpack_ok; ++i) {
+      K key;
+      read_value(reader, key, ctx);
+      // Keys arrive sorted when written by this handler, so the end hint is amortized O(1)
+      const size_t before = result.size();
+      auto it = result.try_emplace(result.end(), std::move(key));
+      if (result.size() == before) {
+        it->second = V();  // repeated key: the last value wins
+      }
+      read_value(reader, it->second, ctx);
+    }
+  }
+
+  static void read(mpack_node_t node, std::map<K, V> & result, const DecodeContext & ctx)
+  {
+    if (mpack_node_type(node) != mpack_type_map) {
+      throw std::runtime_error("Expected map");
+    }
+
+    const size_t count = mpack_node_map_count(node);
+    result.clear();
+    for (size_t i = 0; i < count; ++i) {
       K key;
-      V value;
-      TypeHandler<K>::read(reader, key);
-      TypeHandler<V>::read(reader, value);
-      result[std::move(key)] = std::move(value);     // ATTENTION allocation will happen if key does not exist
+      read_value(mpack_node_map_key_at(node, i), key, ctx);
+      const size_t before = result.size();
+      auto it = result.try_emplace(result.end(), std::move(key));
+      if (result.size() == before) {
+        it->second = V();
+      }
+      read_value(mpack_node_map_value_at(node, i), it->second, ctx);
     }
   }
 };
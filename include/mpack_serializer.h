@@ -1,12 +1,18 @@
 #ifndef MPACK_SERIALIZER_H
 #define MPACK_SERIALIZER_H
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <tuple>
 #include <type_traits>
 
 
 #include "mpack/mpack.h"
+#include "mpack_serialize_typehandlers.h"
 
 // Serialization framework
 namespace serialization
@@ -18,6 +24,7 @@ struct Field
 {
   const char * name;
   MemberType T::* member_ptr;
+  uint32_t flags = EncodeDefault;  // EncodeFlags applied to this field only
 };
 
 // Helper to create field descriptors
@@ -27,6 +34,130 @@ constexpr auto make_field(const char * name, MemberType T::* member_ptr)
   return Field<T, MemberType>{name, member_ptr};
 }
 
+// Helper to create field descriptors with per-field encoding flags
+template<typename T, typename MemberType>
+constexpr auto make_field(const char * name, MemberType T::* member_ptr, uint32_t flags)
+{
+  return Field<T, MemberType>{name, member_ptr, flags};
+}
+
+// Detects types that describe their members through a static get_fields()
+template<typename T, typename = void>
+struct is_reflected : std::false_type {};
+
+template<typename T>
+struct is_reflected<T, std::void_t<decltype(T::get_fields())>>: std::true_type {};
+
+template<typename T>
+inline constexpr bool is_reflected_v = is_reflected<T>::value;
+
+// Member type described by a Field
+template<typename F>
+struct field_member;
+
+template<typename T, typename MemberType>
+struct field_member<Field<T, MemberType>>
+{
+  using type = MemberType;
+};
+
+template<typename F>
+using field_member_t = typename field_member<std::decay_t<F>>::type;
+
+// Length of the longest field name, for sizing key buffers at compile time
+template<typename Tuple>
+constexpr size_t max_field_name_length(const Tuple & fields)
+{
+  return std::apply(
+    [](const auto & ... field) {
+      size_t max_len = 0;
+      ((max_len = std::max(max_len, std::char_traits<char>::length(field.name))), ...);
+      return max_len;
+    }, fields);
+}
+
+// Reads a map of named fields, calling on_field(key) with the reader at the
+// value; on_field must read or skip it. Keys longer than MaxKeyLength cannot
+// name a field and are skipped together with their values.
+template<size_t MaxKeyLength, typename OnField>
+void read_fields(mpack_reader_t * reader, const DecodeContext & ctx, OnField && on_field)
+{
+  mpack_tag_t tag = mpack_read_tag(reader);
+  if (tag.type != mpack_type_map) {
+    throw std::runtime_error("Expected a map");
+  }
+
+  // Use stack-allocated buffer for field names
+  char key_buffer[MaxKeyLength + 1]; // +1 for null terminator
+
+  // Read all available fields
+  for (uint32_t i = 0; i < tag.v.n; ++i) {
+    // Read directly into our stack buffer with a size limit
+    mpack_tag_t key_tag = mpack_peek_tag(reader);
+
+    // A key seen earlier in the session may arrive as a dictionary reference
+    if (const std::string * ref = read_dictionary_str(reader, key_tag, ctx)) {
+      if (ref->size() > MaxKeyLength) {
+        skip_value(reader, ctx);
+        continue;
+      }
+      memcpy(key_buffer, ref->data(), ref->size());
+      key_buffer[ref->size()] = '\0';
+      on_field(static_cast<const char *>(key_buffer));
+      continue;
+    }
+
+    if (key_tag.type != mpack_type_str) {
+      throw std::runtime_error("Expected string key in map");
+    }
+
+    size_t key_length = key_tag.v.l;
+    if (key_length > MaxKeyLength) {
+      // Skip this key-value pair if the key is too long
+      skip_value(reader, ctx); // Skip the key
+      skip_value(reader, ctx); // Skip the value
+      continue;
+    }
+
+    // Consume the tag we peeked
+    mpack_read_tag(reader);
+
+    // Read the key into our buffer
+    mpack_read_bytes(reader, key_buffer, key_length);
+    key_buffer[key_length] = '\0'; // Null-terminate
+    mpack_done_str(reader);
+
+    // Process the field
+    on_field(static_cast<const char *>(key_buffer));
+  }
+}
+
+template<typename Fields, typename OnField, size_t... I>
+void find_fields(mpack_node_t node, const Fields & fields, OnField & on_field, std::index_sequence<I...>)
+{
+  (
+    [&]() {
+      const char * name = std::get<I>(fields).name;
+      mpack_node_t value = mpack_node_map_str_optional(node, name, strlen(name));
+      if (!mpack_node_is_missing(value)) {
+        on_field(std::integral_constant<size_t, I>{}, value);
+      }
+    }(), ...);
+}
+
+// Node form: looks each of the fields up by name in a parsed map and calls
+// on_field(index, value) for those present, index being an
+// std::integral_constant. Unknown keys are never visited; a key present
+// twice flags mpack_error_data. Dictionary references are not supported.
+template<typename Fields, typename OnField>
+void find_fields(mpack_node_t node, const Fields & fields, OnField && on_field)
+{
+  if (mpack_node_type(node) != mpack_type_map) {
+    throw std::runtime_error("Expected a map");
+  }
+  find_fields(node, fields, on_field, std::make_index_sequence<std::tuple_size_v<Fields>>{});
+}
+
 }  // namespace serialization
 
 /**
@@ -44,20 +175,45 @@ public:
     do_serialize(writer);
   }
 
+  void serialize(mpack_writer_t * writer, const serialization::EncodeContext & ctx) const
+  {
+    do_serialize(writer, ctx);
+  }
+
   void deserialize(mpack_reader_t * reader)
   {
     // Call implementation
     do_deserialize(reader);
   }
 
+  void deserialize(mpack_reader_t * reader, const serialization::DecodeContext & ctx)
+  {
+    do_deserialize(reader, ctx);
+  }
+
+  // Decodes from a node of a parsed mpack_tree_t; see MessageTree
+  void deserialize(mpack_node_t node, const serialization::DecodeContext & ctx = {})
+  {
+    do_deserialize(node, ctx);
+  }
+
   // Helper for serialization to buffer
   template<size_t N>
   static size_t to_msgpack(std::array<char, N> & buffer, const Serializable & obj)
+  {
+    return to_msgpack(buffer, obj, serialization::EncodeContext{});
+  }
+
+  // Helper for serialization to buffer with encoding flags, e.g. {EncodeCompactFloat}
+  template<size_t N>
+  static size_t to_msgpack(
+    std::array<char, N> & buffer, const Serializable & obj,
+    const serialization::EncodeContext & ctx)
   {
     mpack_writer_t writer;
     mpack_writer_init(&writer, buffer.data(), buffer.size());
 
-    obj.serialize(&writer);
+    obj.serialize(&writer, ctx);
 
     size_t actual_size = mpack_writer_buffer_used(&writer);
     if (mpack_writer_destroy(&writer) == mpack_ok) {
@@ -70,11 +226,20 @@ public:
   // Helper for deserialization from buffer
   template<size_t N>
   static void from_msgpack(const std::array<char, N> & buffer, Serializable & obj)
+  {
+    from_msgpack(buffer, obj, serialization::DecodeContext{});
+  }
+
+  // Helper for deserialization from buffer with decoding state, e.g. {&interner}
+  template<size_t N>
+  static void from_msgpack(
+    const std::array<char, N> & buffer, Serializable & obj,
+    const serialization::DecodeContext & ctx)
   {
     mpack_reader_t reader;
     mpack_reader_init_data(&reader, buffer.data(), buffer.size());
 
-    obj.deserialize(&reader);
+    obj.deserialize(&reader, ctx);
 
     if (mpack_reader_destroy(&reader) != mpack_ok) {
       throw std::runtime_error("An error occurred decoding the data");
@@ -85,6 +250,30 @@ protected:
   // These methods should be overridden by derived classes
   virtual void do_serialize(mpack_writer_t * writer) const = 0;
   virtual void do_deserialize(mpack_reader_t * reader) = 0;
+
+  // Overridden by implementations that honour encoding flags
+  virtual void do_serialize(
+    mpack_writer_t * writer,
+    const serialization::EncodeContext & /*ctx*/) const
+  {
+    do_serialize(writer);
+  }
+
+  // Overridden by implementations that use decoding state
+  virtual void do_deserialize(
+    mpack_reader_t * reader,
+    const serialization::DecodeContext & /*ctx*/)
+  {
+    do_deserialize(reader);
+  }
+
+  // Overridden by implementations that support the node backend
+  virtual void do_deserialize(
+    mpack_node_t /*node*/,
+    const serialization::DecodeContext & /*ctx*/)
+  {
+    throw std::runtime_error("Node decoding is not supported by this type");
+  }
 };
 
 /**
@@ -95,138 +284,124 @@ class MsgPackSerializable : public Serializable
 {
 protected:
   void do_serialize(mpack_writer_t * writer) const override
+  {
+    do_serialize(writer, serialization::EncodeContext{});
+  }
+
+  void do_serialize(
+    mpack_writer_t * writer,
+    const serialization::EncodeContext & ctx) const override
   {
     constexpr auto fields = Derived::get_fields();
     constexpr size_t field_count = std::tuple_size_v<decltype(fields)>;
 
     mpack_start_map(writer, field_count);
     // Compile-time iteration using index_sequence
-    serialize_fields(writer, fields, std::make_index_sequence<field_count>{});
+    serialize_fields(writer, ctx, fields, std::make_index_sequence<field_count>{});
 
     mpack_finish_map(writer);
   }
 
   void do_deserialize(mpack_reader_t * reader) override
   {
-    mpack_tag_t tag = mpack_read_tag(reader);
-    if (tag.type != mpack_type_map) {
-      throw std::runtime_error("Expected a map");
-    }
+    do_deserialize(reader, serialization::DecodeContext{});
+  }
 
+  void do_deserialize(
+    mpack_reader_t * reader,
+    const serialization::DecodeContext & ctx) override
+  {
     // Calculate max field name length at compile time
     constexpr auto fields = Derived::get_fields();
-    constexpr size_t max_field_name_length = calc_max_field_name_length(fields);
-
-    // Use stack-allocated buffer for field names
-    char key_buffer[max_field_name_length + 1]; // +1 for null terminator
-
-    // Read all available fields
-    for (uint32_t i = 0; i < tag.v.n; ++i) {
-      // Read directly into our stack buffer with a size limit
-      mpack_tag_t key_tag = mpack_peek_tag(reader);
-      if (key_tag.type != mpack_type_str) {
-        throw std::runtime_error("Expected string key in map");
-      }
-
-      size_t key_length = key_tag.v.l;
-      if (key_length > max_field_name_length) {
-        // Skip this key-value pair if the key is too long
-        mpack_discard(reader); // Skip the key
-        mpack_discard(reader); // Skip the value
-        continue;
-      }
-
-      // Consume the tag we peeked
-      mpack_read_tag(reader);
+    constexpr size_t max_field_name_length = serialization::max_field_name_length(fields);
 
-      // Read the key into our buffer
-      mpack_read_bytes(reader, key_buffer, key_length);
-      key_buffer[key_length] = '\0'; // Null-terminate
-
-      // Process the field
-      deserialize_field(reader, key_buffer);
-    }
-  }
-
-private:
-  // C++17 compatible constexpr function to calculate max field name length
-  template<typename Tuple>
-  static constexpr size_t calc_max_field_name_length(const Tuple & tuple)
-  {
-    return calc_max_field_name_length_impl(
-      tuple,
-      std::make_index_sequence<std::tuple_size_v<Tuple>>{});
+    serialization::read_fields<max_field_name_length>(
+      reader, ctx, [this, reader, &ctx](const char * key) {
+        deserialize_field(reader, ctx, key);
+      });
   }
 
-  template<typename Tuple, size_t... I>
-  static constexpr size_t calc_max_field_name_length_impl(
-    const Tuple & tuple,
-    std::index_sequence<I...>)
+  void do_deserialize(
+    mpack_node_t node,
+    const serialization::DecodeContext & ctx) override
   {
-    size_t max_len = 0;
-    ((max_len = std::max(max_len, strlen(std::get<I>(tuple).name))), ...);
-    return max_len;
+    constexpr auto fields = Derived::get_fields();
+    Derived * derived = static_cast<Derived *>(this);
+    serialization::find_fields(
+      node, fields, [derived, &fields, &ctx](auto index, mpack_node_t value) {
+        constexpr size_t I = decltype(index)::value;
+        serialization::read_value(value, derived->*(std::get<I>(fields).member_ptr), ctx);
+      });
   }
 
+private:
   // Helper for serialize: unpack tuple at compile time
   template<typename Tuple, size_t... I>
   void serialize_fields(
-    mpack_writer_t * writer, const Tuple & tuple,
-    std::index_sequence<I...>) const
+    mpack_writer_t * writer, const serialization::EncodeContext & ctx,
+    const Tuple & tuple, std::index_sequence<I...>) const
   {
     // Fold expression to handle all fields
-    (serialize_field(writer, std::get<I>(tuple)), ...);
+    (serialize_field(writer, ctx, std::get<I>(tuple)), ...);
   }
 
   // Serialize a single field
   template<typename T, typename MemberType>
   void serialize_field(
-    mpack_writer_t * writer,
+    mpack_writer_t * writer, const serialization::EncodeContext & ctx,
     const serialization::Field<T, MemberType> & field) const
   {
-    mpack_write_cstr(writer, field.name);
-    serialization::TypeHandler<MemberType>::write(
-      writer,
-      static_cast<const Derived *>(this)->*(field.member_ptr));
+    serialization::write_str(writer, field.name, strlen(field.name), ctx);
+    const MemberType & value = static_cast<const Derived *>(this)->*(field.member_ptr);
+    if (field.flags == serialization::EncodeDefault) {
+      serialization::write_value(writer, value, ctx);
+    } else {
+      serialization::EncodeContext field_ctx = ctx;
+      field_ctx.flags |= field.flags;
+      serialization::write_value(writer, value, field_ctx);
+    }
   }
 
   // Deserialize a specific field by name
-  void deserialize_field(mpack_reader_t * reader, const char * key)
+  void deserialize_field(
+    mpack_reader_t * reader, const serialization::DecodeContext & ctx,
+    std::string_view key)
   {
     constexpr auto fields = Derived::get_fields();
     deserialize_field_impl(
-      reader, key, fields,
+      reader, ctx, key, fields,
       std::make_index_sequence<std::tuple_size_v<decltype(fields)>>{});
   }
 
   // Implementation helper for deserialize_field
   template<typename Tuple, size_t... I>
   void deserialize_field_impl(
-    mpack_reader_t * reader, const char * key,
-    const Tuple & tuple, std::index_sequence<I...>)
+    mpack_reader_t * reader, const serialization::DecodeContext & ctx,
+    std::string_view key, const Tuple & tuple, std::index_sequence<I...>)
   {
     bool field_handled = false;
 
     // Using fold expression to try each field
-    ((try_deserialize_field(reader, key, std::get<I>(tuple), field_handled)), ...);
+    ((try_deserialize_field(reader, ctx, key, std::get<I>(tuple), field_handled)), ...);
 
     // If no field matched, skip the value
     if (!field_handled) {
-      mpack_discard(reader);
+      serialization::skip_value(reader, ctx);
     }
   }
 
   // Try to deserialize a particular field if the key matches
   template<typename T, typename MemberType>
   void try_deserialize_field(
-    mpack_reader_t * reader, const char * key,
-    const serialization::Field<T, MemberType> & field, bool & handled)
+    mpack_reader_t * reader, const serialization::DecodeContext & ctx,
+    std::string_view key, const serialization::Field<T, MemberType> & field, bool & handled)
   {
-    if (!handled && strcmp(key, field.name) == 0) {
+    if (!handled && key == field.name) {
       Derived * derived = static_cast<Derived *>(this);
-      serialization::TypeHandler<MemberType>::read(
+      serialization::read_value(
         reader,
-        derived->*(field.member_ptr)
+        derived->*(field.member_ptr),
+        ctx
       );
       handled = true;
     }
@@ -0,0 +1,331 @@
+#ifndef MPACK_SMALL_VECTOR_H
+#define MPACK_SMALL_VECTOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "mpack_serialize_typehandlers.h"
+
+namespace serialization
+{
+
+/**
+ * Vector with room for N elements inside the object itself.
+ * With CanSpill it moves to the heap once more than N elements are stored
+ * (small_vector); without it, growing past N throws std::length_error
+ * (static_vector). Use the aliases below rather than this template directly.
+ */
+template<typename T, size_t N, bool CanSpill>
+class inline_vector
+{
+  static_assert(N > 0, "inline_vector needs an inline capacity of at least one element");
+
+public:
+  using value_type = T;
+  using size_type = size_t;
+  using reference = T &;
+  using const_reference = const T &;
+  using pointer = T *;
+  using const_pointer = const T *;
+  using iterator = T *;
+  using const_iterator = const T *;
+
+  static constexpr size_t inline_capacity = N;
+
+  inline_vector() = default;
+
+  explicit inline_vector(size_t count) { resize(count); }
+
+  inline_vector(std::initializer_list<T> init)
+  {
+    reserve(init.size());
+    for (const auto & item : init) {
+      push_back(item);
+    }
+  }
+
+  inline_vector(const inline_vector & other)
+  {
+    reserve(other.size_);
+    std::uninitialized_copy(other.begin(), other.end(), data_);
+    size_ = other.size_;
+  }
+
+  inline_vector(inline_vector && other) noexcept(std::is_nothrow_move_constructible_v<T>)
+  {
+    take(std::move(other));
+  }
+
+  inline_vector & operator=(const inline_vector & other)
+  {
+    if (this != &other) {
+      clear();
+      reserve(other.size_);
+      std::uninitialized_copy(other.begin(), other.end(), data_);
+      size_ = other.size_;
+    }
+    return *this;
+  }
+
+  inline_vector & operator=(inline_vector && other) noexcept(std::is_nothrow_move_constructible_v<T>)
+  {
+    if (this != &other) {
+      clear();
+      release_heap();
+      take(std::move(other));
+    }
+    return *this;
+  }
+
+  ~inline_vector()
+  {
+    clear();
+    release_heap();
+  }
+
+  iterator begin() { return data_; }
+  iterator end() { return data_ + size_; }
+  const_iterator begin() const { return data_; }
+  const_iterator end() const { return data_ + size_; }
+
+  T * data() { return data_; }
+  const T * data() const { return data_; }
+  size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }
+  bool empty() const { return size_ == 0; }
+  // True while the elements live in the inline buffer
+  bool is_inline() const { return data_ == inline_data(); }
+
+  T & operator[](size_t i) { return data_[i]; }
+  const T & operator[](size_t i) const { return data_[i]; }
+  T & front() { return data_[0]; }
+  const T & front() const { return data_[0]; }
+  T & back() { return data_[size_ - 1]; }
+  const T & back() const { return data_[size_ - 1]; }
+
+  T & at(size_t i)
+  {
+    if (i >= size_) {
+      throw std::out_of_range("inline_vector::at: index out of range");
+    }
+    return data_[i];
+  }
+
+  const T & at(size_t i) const
+  {
+    if (i >= size_) {
+      throw std::out_of_range("inline_vector::at: index out of range");
+    }
+    return data_[i];
+  }
+
+  void reserve(size_t count)
+  {
+    if (count > capacity_) {
+      reallocate(count);
+    }
+  }
+
+  void resize(size_t count)
+  {
+    if (count < size_) {
+      std::destroy(data_ + count, data_ + size_);
+    } else if (count > size_) {
+      reserve(count);
+      std::uninitialized_value_construct(data_ + size_, data_ + count);
+    }
+    size_ = count;
+  }
+
+  void clear()
+  {
+    std::destroy(data_, data_ + size_);
+    size_ = 0;
+  }
+
+  template<typename ... Args>
+  T & emplace_back(Args && ... args)
+  {
+    if (size_ < capacity_) {
+      T * item = ::new (static_cast<void *>(data_ + size_)) T(std::forward<Args>(args)...);
+      ++size_;
+      return *item;
+    }
+    if constexpr (!CanSpill) {
+      throw std::length_error("static_vector capacity exceeded");
+    } else {
+      // Construct the new element first: the arguments may refer to current elements
+      const size_t count = grown_capacity(size_ + 1);
+      T * heap = std::allocator<T>().allocate(count);
+      try {
+        ::new (static_cast<void *>(heap + size_)) T(std::forward<Args>(args)...);
+      } catch (...) {
+        std::allocator<T>().deallocate(heap, count);
+        throw;
+      }
+      adopt(heap, count);
+      ++size_;
+      return data_[size_ - 1];
+    }
+  }
+
+  void push_back(const T & value) { emplace_back(value); }
+  void push_back(T && value) { emplace_back(std::move(value)); }
+
+  void pop_back()
+  {
+    --size_;
+    std::destroy_at(data_ + size_);
+  }
+
+  friend bool operator==(const inline_vector & a, const inline_vector & b)
+  {
+    return std::equal(a.begin(), a.end(), b.begin(), b.end());
+  }
+
+  friend bool operator!=(const inline_vector & a, const inline_vector & b) { return !(a == b); }
+
+private:
+  T * inline_data() { return reinterpret_cast<T *>(inline_storage_); }
+  const T * inline_data() const { return reinterpret_cast<const T *>(inline_storage_); }
+
+  size_t grown_capacity(size_t required) const
+  {
+    return std::max(required, capacity_ * 2);
+  }
+
+  // Moves the elements to a buffer holding count elements
+  void reallocate(size_t count)
+  {
+    if constexpr (!CanSpill) {
+      throw std::length_error("static_vector capacity exceeded");
+    } else {
+      adopt(std::allocator<T>().allocate(count), count);
+    }
+  }
+
+  // Moves the elements into heap, which then becomes the storage
+  void adopt(T * heap, size_t count)
+  {
+    std::uninitialized_move(data_, data_ + size_, heap);
+    std::destroy(data_, data_ + size_);
+    release_heap();
+    data_ = heap;
+    capacity_ = count;
+  }
+
+  void release_heap()
+  {
+    if (!is_inline()) {
+      std::allocator<T>().deallocate(data_, capacity_);
+      data_ = inline_data();
+      capacity_ = N;
+    }
+  }
+
+  // Requires this to be empty and inline
+  void take(inline_vector && other)
+  {
+    if (!other.is_inline()) {
+      data_ = other.data_;
+      capacity_ = other.capacity_;
+      size_ = other.size_;
+      other.data_ = other.inline_data();
+      other.capacity_ = N;
+      other.size_ = 0;
+      return;
+    }
+    std::uninitialized_move(other.begin(), other.end(), data_);
+    size_ = other.size_;
+    other.clear();
+  }
+
+  T * data_ = inline_data();
+  size_t size_ = 0;
+  size_t capacity_ = N;
+  alignas(T) unsigned char inline_storage_[N * sizeof(T)];
+};
+
+// Holds up to N elements inline and spills to the heap beyond that
+template<typename T, size_t N>
+using small_vector = inline_vector<T, N, true>;
+
+// Holds at most N elements, all inline; never allocates
+template<typename T, size_t N>
+using static_vector = inline_vector<T, N, false>;
+
+// Specialization for small_vector and static_vector
+template<typename T, size_t N, bool CanSpill>
+struct TypeHandler<inline_vector<T, N, CanSpill>>
+{
+  static constexpr TypeTag tag = TypeTag::Array;
+
+  static void write(mpack_writer_t * writer, const inline_vector<T, N, CanSpill> & vec)
+  {
+    write(writer, vec, EncodeContext{});
+  }
+
+  static void write(
+    mpack_writer_t * writer, const inline_vector<T, N, CanSpill> & vec,
+    const EncodeContext & ctx)
+  {
+    mpack_start_array(writer, vec.size());
+    for (const auto & item : vec) {
+      write_value(writer, item, ctx);
+    }
+    mpack_finish_array(writer);
+  }
+
+  static void read(mpack_reader_t * reader, inline_vector<T, N, CanSpill> & result)
+  {
+    read(reader, result, DecodeContext{});
+  }
+
+  static void read(
+    mpack_reader_t * reader, inline_vector<T, N, CanSpill> & result,
+    const DecodeContext & ctx)
+  {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (tag.type != mpack_type_array) {
+      throw std::runtime_error("Expected array");
+    }
+    if (!CanSpill && tag.v.n > N) {
+      throw std::runtime_error("Array exceeds static_vector capacity");
+    }
+
+    // Elements are decoded in place; up to N of them never touch the heap.
+    // The count is untrusted, so the heap part grows with the input read.
+    result.clear();
+    result.reserve(reserve_limit(reader, tag.v.n, 1));
+    for (uint32_t i = 0; i < tag.v.n && mpack_reader_error(reader) == mpack_ok; ++i) {
+      read_value(reader, result.emplace_back(), ctx);
+    }
+  }
+
+  static void read(
+    mpack_node_t node, inline_vector<T, N, CanSpill> & result,
+    const DecodeContext & ctx)
+  {
+    if (mpack_node_type(node) != mpack_type_array) {
+      throw std::runtime_error("Expected array");
+    }
+    const size_t count = mpack_node_array_length(node);
+    if (!CanSpill && count > N) {
+      throw std::runtime_error("Array exceeds static_vector capacity");
+    }
+
+    result.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+      read_value(mpack_node_array_at(node, i), result[i], ctx);
+    }
+  }
+};
+
+}  // namespace serialization
+#endif  // MPACK_SMALL_VECTOR_H
@@ -0,0 +1,322 @@
+#ifndef MPACK_SOA_H
+#define MPACK_SOA_H
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "mpack/mpack.h"
+#include "mpack_serialize_typehandlers.h"
+#include "mpack_serializer.h"
+
+namespace serialization
+{
+
+// Element type a SoA column stores for a field: bool becomes one byte per
+// value so loops over flags stay contiguous and vectorizable
+template<typename M>
+using soa_element_t = std::conditional_t<std::is_same_v<M, bool>, uint8_t, M>;
+
+/**
+ * Struct-of-arrays container for a reflected type T: one std::vector per
+ * field listed by T::get_fields(), all of the same length. Messages are
+ * decoded field by field straight into the columns, so no T is built.
+ * The wire format matches std::vector<T>: an array of field maps.
+ */
+template<typename T>
+class soa_vector
+{
+  static_assert(is_reflected_v<T>, "soa_vector needs a type with get_fields()");
+
+  static constexpr auto kFields = T::get_fields();
+  static constexpr size_t kFieldCount = std::tuple_size_v<decltype(kFields)>;
+
+  template<size_t I>
+  using member_t = field_member_t<std::tuple_element_t<I, decltype(kFields)>>;
+
+  template<typename Seq>
+  struct storage;
+
+  template<size_t... I>
+  struct storage<std::index_sequence<I...>>
+  {
+    using type = std::tuple<std::vector<soa_element_t<member_t<I>>>...>;
+  };
+
+public:
+  using columns_type = typename storage<std::make_index_sequence<kFieldCount>>::type;
+
+  static constexpr size_t field_count() { return kFieldCount; }
+
+  size_t size() const { return std::get<0>(columns_).size(); }
+  bool empty() const { return size() == 0; }
+
+  void clear()
+  {
+    for_each_column([](auto & column) {column.clear();});
+  }
+
+  void reserve(size_t n)
+  {
+    for_each_column([n](auto & column) {column.reserve(n);});
+  }
+
+  // Grows every column to n rows, default-constructing new values
+  void resize(size_t n)
+  {
+    for_each_column([n](auto & column) {column.resize(n);});
+  }
+
+  // Column of a field, by position in get_fields() or by member pointer,
+  // e.g. groups.get<&X90IOGroup::time_recorded>()
+  template<auto Key>
+  auto & get() { return std::get<column_index<Key>()>(columns_); }
+
+  template<auto Key>
+  const auto & get() const { return std::get<column_index<Key>()>(columns_); }
+
+  void push_back(const T & value)
+  {
+    push_back_impl(value, std::make_index_sequence<kFieldCount>{});
+  }
+
+  // Builds row i as an object
+  T at(size_t i) const
+  {
+    if (i >= size()) {
+      throw std::out_of_range("soa_vector::at: index out of range");
+    }
+    T value{};
+    assign_row(value, i, std::make_index_sequence<kFieldCount>{});
+    return value;
+  }
+
+  // Decodes one field map into a new row; absent fields keep their default value.
+  // A row that fails, by exception or by flagging the reader, is removed again.
+  void read_one(mpack_reader_t * reader, const DecodeContext & ctx = DecodeContext{})
+  {
+    const size_t row = size();
+    resize(row + 1);
+    try {
+      read_fields<max_field_name_length(kFields)>(
+        reader, ctx, [this, reader, &ctx, row](const char * key) {
+          read_field(reader, ctx, key, row, std::make_index_sequence<kFieldCount>{});
+        });
+    } catch (...) {
+      resize(row);
+      throw;
+    }
+    if (mpack_reader_error(reader) != mpack_ok) {
+      resize(row);
+    }
+  }
+
+  // Decodes one field map node of a parsed tree into a new row
+  void read_one(mpack_node_t node, const DecodeContext & ctx = DecodeContext{})
+  {
+    const size_t row = size();
+    resize(row + 1);
+    try {
+      find_fields(
+        node, kFields, [this, &ctx, row](auto index, mpack_node_t value) {
+          read_column<decltype(index)::value>(value, ctx, row);
+        });
+    } catch (...) {
+      resize(row);
+      throw;
+    }
+    if (mpack_node_error(node) != mpack_ok) {
+      resize(row);
+    }
+  }
+
+  // Decodes every message in a buffer of back-to-back field maps
+  void read_stream(const char * data, size_t size, const DecodeContext & ctx = DecodeContext{})
+  {
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, size);
+
+    const char * remaining = nullptr;
+    while (mpack_reader_remaining(&reader, &remaining) > 0 &&
+      mpack_reader_error(&reader) == mpack_ok)
+    {
+      read_one(&reader, ctx);
+    }
+
+    if (mpack_reader_destroy(&reader) != mpack_ok) {
+      throw std::runtime_error("An error occurred decoding the data");
+    }
+  }
+
+  // Encodes row i as a field map
+  void write_one(mpack_writer_t * writer, size_t i, const EncodeContext & ctx = EncodeContext{}) const
+  {
+    mpack_start_map(writer, kFieldCount);
+    write_row(writer, i, ctx, std::make_index_sequence<kFieldCount>{});
+    mpack_finish_map(writer);
+  }
+
+  const columns_type & columns() const { return columns_; }
+
+private:
+  template<auto Key>
+  static constexpr size_t column_index()
+  {
+    if constexpr (std::is_integral_v<decltype(Key)>) {
+      static_assert(Key < kFieldCount, "Field index out of range");
+      return static_cast<size_t>(Key);
+    } else {
+      return index_of<Key>();
+    }
+  }
+
+  template<auto Member, size_t I = 0>
+  static constexpr size_t index_of()
+  {
+    static_assert(I < kFieldCount, "Member is not listed in get_fields()");
+    if constexpr (std::is_same_v<decltype(Member), decltype(std::get<I>(kFields).member_ptr)>) {
+      if (std::get<I>(kFields).member_ptr == Member) {
+        return I;
+      }
+    }
+    if constexpr (I + 1 < kFieldCount) {
+      return index_of<Member, I + 1>();
+    } else {
+      return kFieldCount;
+    }
+  }
+
+  template<typename Fn>
+  void for_each_column(Fn && fn)
+  {
+    std::apply([&fn](auto & ... column) {(fn(column), ...);}, columns_);
+  }
+
+  template<size_t... I>
+  void push_back_impl(const T & value, std::index_sequence<I...>)
+  {
+    (std::get<I>(columns_).push_back(value.*(std::get<I>(kFields).member_ptr)), ...);
+  }
+
+  template<size_t... I>
+  void assign_row(T & value, size_t i, std::index_sequence<I...>) const
+  {
+    ((value.*(std::get<I>(kFields).member_ptr) =
+    static_cast<member_t<I>>(std::get<I>(columns_)[i])), ...);
+  }
+
+  template<size_t... I>
+  void read_field(
+    mpack_reader_t * reader, const DecodeContext & ctx, std::string_view key,
+    size_t row, std::index_sequence<I...>)
+  {
+    bool handled = false;
+    ((handled = handled || try_read_field<I>(reader, ctx, key, row)), ...);
+    if (!handled) {
+      skip_value(reader, ctx);
+    }
+  }
+
+  template<size_t I>
+  bool try_read_field(mpack_reader_t * reader, const DecodeContext & ctx, std::string_view key, size_t row)
+  {
+    if (key != std::get<I>(kFields).name) {
+      return false;
+    }
+    read_column<I>(reader, ctx, row);
+    return true;
+  }
+
+  // Source is a reader or a tree node
+  template<size_t I, typename Source>
+  void read_column(Source source, const DecodeContext & ctx, size_t row)
+  {
+    auto & slot = std::get<I>(columns_)[row];
+    if constexpr (std::is_same_v<member_t<I>, soa_element_t<member_t<I>>>) {
+      read_value(source, slot, ctx);
+    } else {
+      member_t<I> value{};
+      read_value(source, value, ctx);
+      slot = static_cast<soa_element_t<member_t<I>>>(value);
+    }
+  }
+
+  template<size_t... I>
+  void write_row(
+    mpack_writer_t * writer, size_t i, const EncodeContext & ctx,
+    std::index_sequence<I...>) const
+  {
+    ((write_str(writer, std::get<I>(kFields).name, strlen(std::get<I>(kFields).name), ctx),
+    write_field<I>(writer, i, ctx)), ...);
+  }
+
+  template<size_t I>
+  void write_field(mpack_writer_t * writer, size_t i, const EncodeContext & ctx) const
+  {
+    EncodeContext field_ctx = ctx;
+    field_ctx.flags |= std::get<I>(kFields).flags;
+    write_value(writer, static_cast<const member_t<I> &>(std::get<I>(columns_)[i]), field_ctx);
+  }
+
+  columns_type columns_;
+};
+
+// Specialization for soa_vector: same wire format as std::vector<T>
+template<typename T>
+struct TypeHandler<soa_vector<T>>
+{
+  static constexpr TypeTag tag = TypeTag::Array;
+
+  static void write(mpack_writer_t * writer, const soa_vector<T> & value)
+  {
+    write(writer, value, EncodeContext{});
+  }
+
+  static void write(mpack_writer_t * writer, const soa_vector<T> & value, const EncodeContext & ctx)
+  {
+    mpack_start_array(writer, static_cast<uint32_t>(value.size()));
+    for (size_t i = 0; i < value.size(); ++i) {
+      value.write_one(writer, i, ctx);
+    }
+    mpack_finish_array(writer);
+  }
+
+  static void read(mpack_reader_t * reader, soa_vector<T> & value)
+  {
+    read(reader, value, DecodeContext{});
+  }
+
+  static void read(mpack_reader_t * reader, soa_vector<T> & value, const DecodeContext & ctx)
+  {
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (tag.type != mpack_type_array) {
+      throw std::runtime_error("Expected array");
+    }
+    value.clear();
+    value.reserve(reserve_limit(reader, tag.v.n, 1));
+    for (uint32_t i = 0; i < tag.v.n && mpack_reader_error(reader) == mpack_ok; ++i) {
+      value.read_one(reader, ctx);
+    }
+  }
+
+  static void read(mpack_node_t node, soa_vector<T> & value, const DecodeContext & ctx)
+  {
+    if (mpack_node_type(node) != mpack_type_array) {
+      throw std::runtime_error("Expected array");
+    }
+    const size_t count = mpack_node_array_length(node);
+    value.clear();
+    value.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      value.read_one(mpack_node_array_at(node, i), ctx);
+    }
+  }
+};
+
+}  // namespace serialization
+#endif  // MPACK_SOA_H
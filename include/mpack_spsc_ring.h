@@ -0,0 +1,272 @@
+#ifndef MPACK_SPSC_RING_H
+#define MPACK_SPSC_RING_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include "mpack/mpack.h"
+#include "mpack_bounded.h"
+#include "mpack_serializer.h"
+
+namespace serialization
+{
+
+/**
+ * Bounded single-producer/single-consumer ring of encoded messages.
+ *
+ * The producer reserves space, encodes straight into the ring and commits;
+ * the consumer sees each message as one contiguous view and pops it. No
+ * locks and no allocation after construction: the only shared state is the
+ * two positions, each written by one side and cached by the other.
+ *
+ * Records are [uint32 length][payload] padded to 4 bytes. A record never
+ * wraps: when it does not fit before the end of the ring, the producer
+ * leaves a skip marker and starts it at offset 0. Messages of up to
+ * max_message_size(), half the capacity, therefore always fit once the
+ * consumer has caught up.
+ */
+class SpscRing
+{
+public:
+  static constexpr size_t kRecordHeaderSize = 4;
+
+  // capacity_bytes is rounded up to a power of two
+  explicit SpscRing(size_t capacity_bytes)
+  : buffer_(round_capacity(capacity_bytes)), mask_(buffer_.size() - 1) {}
+
+  SpscRing(const SpscRing &) = delete;
+  SpscRing & operator=(const SpscRing &) = delete;
+
+  size_t capacity() const { return buffer_.size(); }
+  size_t max_message_size() const { return buffer_.size() / 2 - kRecordHeaderSize; }
+
+  // Producer: space for a message of up to size bytes, or nullptr while the
+  // ring is too full. Finish with commit().
+  char * reserve(size_t size)
+  {
+    if (size > max_message_size()) {
+      throw std::runtime_error("Message exceeds the ring's maximum message size");
+    }
+    const size_t need = record_size(size);
+    const size_t offset = head_local_ & mask_;
+    const size_t contiguous = buffer_.size() - offset;
+    const size_t skip = need > contiguous ? contiguous : 0;
+    if (!has_room(skip + need)) {
+      return nullptr;
+    }
+    if (skip > 0) {
+      store_header(offset, kSkip);
+    }
+    reserved_ = head_local_ + skip;
+    reserved_size_ = size;
+    return buffer_.data() + (reserved_ & mask_) + kRecordHeaderSize;
+  }
+
+  // Producer: publishes the first size bytes of the last reservation
+  void commit(size_t size)
+  {
+    if (size > reserved_size_) {
+      throw std::runtime_error("Committed more than was reserved");
+    }
+    store_header(reserved_ & mask_, static_cast<uint32_t>(size));
+    head_local_ = reserved_ + record_size(size);
+    reserved_size_ = 0;
+    head_.store(head_local_, std::memory_order_release);
+  }
+
+  // Producer: encodes obj into the ring. Types with a compile-time size
+  // bound reserve exactly that; others are encoded into the free space and
+  // retried after the wrap if they did not fit before it. Returns false
+  // while the ring is too full.
+  template<typename T>
+  bool try_push(const T & obj, const EncodeContext & ctx = EncodeContext{})
+  {
+    if constexpr (is_bounded_v<T>) {
+      if (max_encoded_size_v<T> <= max_message_size()) {
+        char * data = reserve(max_encoded_size_v<T>);
+        return data != nullptr && encode_reserved(data, max_encoded_size_v<T>, obj, ctx);
+      }
+    }
+
+    const size_t offset = head_local_ & mask_;
+    const size_t before_end = std::min(payload_room(buffer_.size() - offset), max_message_size());
+    const size_t after_wrap = std::min(payload_room(offset), max_message_size());
+    refresh_tail();
+    const size_t free_bytes = buffer_.size() - static_cast<size_t>(head_local_ - tail_cached_);
+
+    // Largest reservations possible right now without and with the wrap
+    const size_t first = std::min(before_end, payload_room(free_bytes));
+    const size_t second = free_bytes > buffer_.size() - offset ?
+      std::min(after_wrap, payload_room(free_bytes - (buffer_.size() - offset))) : 0;
+    if (first > 0) {
+      char * data = reserve(first);
+      if (data != nullptr && encode_reserved(data, first, obj, ctx)) {
+        return true;
+      }
+    }
+    if (second > first) {
+      char * data = reserve(second);
+      if (data != nullptr && encode_reserved(data, second, obj, ctx)) {
+        return true;
+      }
+    }
+    if (free_bytes == buffer_.size()) {
+      throw std::runtime_error("Message exceeds the ring's maximum message size");
+    }
+    return false;
+  }
+
+  // Producer: copies an already encoded message
+  bool try_push_raw(const char * data, size_t size)
+  {
+    char * dest = reserve(size);
+    if (dest == nullptr) {
+      return false;
+    }
+    std::memcpy(dest, data, size);
+    commit(size);
+    return true;
+  }
+
+  // Consumer: the oldest message, or an empty view with a null data()
+  // pointer when there is none. Valid until pop().
+  std::string_view front()
+  {
+    for (;;) {
+      if (tail_local_ == head_cached_) {
+        head_cached_ = head_.load(std::memory_order_acquire);
+        if (tail_local_ == head_cached_) {
+          return std::string_view();
+        }
+      }
+      const size_t offset = tail_local_ & mask_;
+      const uint32_t length = load_header(offset);
+      if (length != kSkip) {
+        return std::string_view(buffer_.data() + offset + kRecordHeaderSize, length);
+      }
+      tail_local_ += buffer_.size() - offset;
+    }
+  }
+
+  // Consumer: releases the message returned by front()
+  void pop()
+  {
+    tail_local_ += record_size(load_header(tail_local_ & mask_));
+    tail_.store(tail_local_, std::memory_order_release);
+  }
+
+  // Consumer: calls on_message(std::string_view) for up to max_messages
+  // messages and releases their space once at the end. Returns the count.
+  template<typename OnMessage>
+  size_t drain(OnMessage && on_message, size_t max_messages = std::numeric_limits<size_t>::max())
+  {
+    size_t count = 0;
+    while (count < max_messages) {
+      const std::string_view message = front();
+      if (message.data() == nullptr) {
+        break;
+      }
+      on_message(message);
+      tail_local_ += record_size(message.size());
+      ++count;
+    }
+    tail_.store(tail_local_, std::memory_order_release);
+    return count;
+  }
+
+  // Either side: true if no committed message is waiting. Only exact when
+  // called by one of the two threads while the other is idle.
+  bool empty() const
+  {
+    return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire);
+  }
+
+private:
+  static constexpr uint32_t kSkip = std::numeric_limits<uint32_t>::max();
+
+  static size_t round_capacity(size_t bytes)
+  {
+    size_t capacity = 64;
+    while (capacity < bytes) {
+      capacity *= 2;
+    }
+    return capacity;
+  }
+
+  static size_t record_size(size_t payload)
+  {
+    return (kRecordHeaderSize + payload + 3) & ~size_t{3};
+  }
+
+  // Largest payload whose record fits in bytes
+  static size_t payload_room(size_t bytes)
+  {
+    return bytes < kRecordHeaderSize ? 0 : (bytes & ~size_t{3}) - kRecordHeaderSize;
+  }
+
+  bool has_room(size_t bytes)
+  {
+    if (head_local_ + bytes - tail_cached_ <= buffer_.size()) {
+      return true;
+    }
+    refresh_tail();
+    return head_local_ + bytes - tail_cached_ <= buffer_.size();
+  }
+
+  void refresh_tail() { tail_cached_ = tail_.load(std::memory_order_acquire); }
+
+  template<typename T>
+  bool encode_reserved(char * data, size_t size, const T & obj, const EncodeContext & ctx)
+  {
+    mpack_writer_t writer;
+    mpack_writer_init(&writer, data, size);
+    obj.serialize(&writer, ctx);
+    const size_t used = mpack_writer_buffer_used(&writer);
+    const mpack_error_t error = mpack_writer_destroy(&writer);
+    if (error == mpack_error_too_big) {
+      reserved_size_ = 0;  // the skip marker, if any, stays unpublished
+      return false;
+    }
+    if (error != mpack_ok) {
+      throw std::runtime_error("An error occurred encoding the data");
+    }
+    commit(used);
+    return true;
+  }
+
+  void store_header(size_t offset, uint32_t value)
+  {
+    std::memcpy(buffer_.data() + offset, &value, sizeof(value));
+  }
+
+  uint32_t load_header(size_t offset) const
+  {
+    uint32_t value;
+    std::memcpy(&value, buffer_.data() + offset, sizeof(value));
+    return value;
+  }
+
+  std::vector<char> buffer_;
+  size_t mask_;
+
+  // Producer side
+  alignas(64) std::atomic<uint64_t> head_{0};
+  uint64_t head_local_ = 0;
+  uint64_t tail_cached_ = 0;
+  uint64_t reserved_ = 0;
+  size_t reserved_size_ = 0;
+
+  // Consumer side
+  alignas(64) std::atomic<uint64_t> tail_{0};
+  uint64_t tail_local_ = 0;
+  uint64_t head_cached_ = 0;
+};
+
+}  // namespace serialization
+#endif  // MPACK_SPSC_RING_H
@@ -0,0 +1,386 @@
+#ifndef MPACK_STREAM_READER_H
+#define MPACK_STREAM_READER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+#include "mpack/mpack.h"
+#include "mpack_checksum.h"
+#include "mpack_serializer.h"
+
+namespace serialization
+{
+
+/**
+ * Finds the end of one msgpack object in a growing buffer without decoding
+ * it. Scanning is resumable: feed the same buffer again after more bytes
+ * were appended and it continues where it stopped.
+ */
+class MessageScanner
+{
+public:
+  // Returns the size of the object starting at data[0] once it is complete,
+  // or 0 if more bytes are needed. Throws on bytes that are not msgpack.
+  size_t scan(const char * data, size_t size)
+  {
+    const uint8_t * bytes = reinterpret_cast<const uint8_t *>(data);
+    while (remaining_ > 0) {
+      if (pos_ >= size) {
+        return 0;
+      }
+      const uint8_t lead = bytes[pos_];
+      const size_t header = header_size(lead);
+      if (size - pos_ < header) {
+        return 0;
+      }
+
+      uint64_t payload = 0;
+      uint64_t children = 0;
+      if (lead <= 0x7f || lead >= 0xe0) {
+        // fixint
+      } else if (lead <= 0x8f) {
+        children = 2u * (lead & 0x0f);
+      } else if (lead <= 0x9f) {
+        children = lead & 0x0f;
+      } else if (lead <= 0xbf) {
+        payload = lead & 0x1f;
+      } else {
+        const uint8_t * p = bytes + pos_ + 1;
+        switch (lead) {
+          case 0xc4: case 0xd9: payload = p[0]; break;
+          case 0xc5: case 0xda: payload = load_be(p, 2); break;
+          case 0xc6: case 0xdb: payload = load_be(p, 4); break;
+          case 0xc7: payload = p[0]; break;
+          case 0xc8: payload = load_be(p, 2); break;
+          case 0xc9: payload = load_be(p, 4); break;
+          case 0xd4: payload = 1; break;
+          case 0xd5: payload = 2; break;
+          case 0xd6: payload = 4; break;
+          case 0xd7: payload = 8; break;
+          case 0xd8: payload = 16; break;
+          case 0xdc: children = load_be(p, 2); break;
+          case 0xdd: children = load_be(p, 4); break;
+          case 0xde: children = 2 * load_be(p, 2); break;
+          case 0xdf: children = 2 * load_be(p, 4); break;
+          default: break;  // nil, bool, float, double, sized ints
+        }
+      }
+
+      // Payload bytes may extend past the buffer; pos_ then waits beyond size
+      pos_ += header + payload;
+      remaining_ += children;
+      --remaining_;
+    }
+
+    if (pos_ > size) {
+      return 0;
+    }
+    const size_t end = pos_;
+    reset();
+    return end;
+  }
+
+  void reset()
+  {
+    pos_ = 0;
+    remaining_ = 1;
+  }
+
+  // Bytes of the current object known so far
+  size_t scanned() const { return pos_; }
+
+  // Bytes of the type byte plus its length or value fields
+  static size_t header_size(uint8_t lead)
+  {
+    if (lead <= 0xbf || lead >= 0xe0) {
+      return 1;
+    }
+    static constexpr uint8_t kSizes[32] = {
+      1, 0, 1, 1,     // c0 nil, c1 never used, c2 false, c3 true
+      2, 3, 5,        // bin 8/16/32
+      3, 4, 6,        // ext 8/16/32
+      5, 9,           // float, double
+      2, 3, 5, 9,     // uint 8/16/32/64
+      2, 3, 5, 9,     // int 8/16/32/64
+      2, 2, 2, 2, 2,  // fixext 1/2/4/8/16
+      2, 3, 5,        // str 8/16/32
+      3, 5,           // array 16/32
+      3, 5,           // map 16/32
+    };
+    const size_t size = kSizes[lead - 0xc0];
+    if (size == 0) {
+      throw std::runtime_error("Invalid msgpack type byte 0xc1");
+    }
+    return size;
+  }
+
+private:
+  static uint64_t load_be(const uint8_t * p, size_t bytes)
+  {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+      value = (value << 8) | p[i];
+    }
+    return value;
+  }
+
+  size_t pos_ = 0;
+  uint64_t remaining_ = 1;
+};
+
+/**
+ * Splits a byte stream arriving in arbitrary fragments into whole messages.
+ * Boundaries come either from the msgpack structure itself or from a
+ * [uint32 little-endian length] prefix, the frame format of MessageLog.
+ * Length-prefixed streams may also carry ChecksumFrame frames; their CRC is
+ * verified before the message is handed out.
+ *
+ * Messages lying entirely inside a fed chunk are handed out in place; only
+ * a message split across chunks is copied into the internal buffer.
+ */
+class StreamDecoder
+{
+public:
+  enum class Framing
+  {
+    Structural,
+    LengthPrefixed,
+  };
+
+  static constexpr size_t kFrameHeaderSize = ChecksumFrame::kPlainHeaderSize;
+
+  explicit StreamDecoder(Framing framing = Framing::Structural, size_t max_message_bytes = 64u << 20)
+  : framing_(framing), max_message_bytes_(max_message_bytes) {}
+
+  // Calls on_message(std::string_view) for each message completed by this
+  // chunk. Views are valid only during the call. If on_message throws, its
+  // message counts as consumed and the rest of the chunk is kept, so the
+  // next feed() carries on with the following message. Errors in the
+  // framing itself (bad bytes, size limit, checksum) need a reset().
+  template<typename OnMessage>
+  void feed(const char * data, size_t size, OnMessage && on_message)
+  {
+    // Finish the message started by earlier chunks
+    if (!pending_.empty()) {
+      const size_t before = pending_.size();
+      pending_.insert(pending_.end(), data, data + size);
+      const size_t length = message_length(pending_.data(), pending_.size());
+      if (length == 0) {
+        check_limit(pending_.size());
+        return;
+      }
+      // Bytes after the message came from this chunk; continue there without copying
+      const size_t used = length - before;
+      try {
+        deliver(pending_.data(), length, on_message);
+      } catch (...) {
+        pending_.erase(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(length));
+        throw;
+      }
+      pending_.clear();
+      data += used;
+      size -= used;
+    }
+
+    while (size > 0) {
+      const size_t length = message_length(data, size);
+      if (length == 0) {
+        check_limit(size);
+        pending_.assign(data, data + size);
+        return;
+      }
+      try {
+        deliver(data, length, on_message);
+      } catch (...) {
+        pending_.assign(data + length, data + size);
+        throw;
+      }
+      data += length;
+      size -= length;
+    }
+  }
+
+  // Feeds a chunk and decodes every completed message into obj, calling
+  // on_decoded(obj) after each one
+  template<typename T, typename OnDecoded>
+  void feed(
+    const char * data, size_t size, T & obj, OnDecoded && on_decoded,
+    const DecodeContext & ctx = DecodeContext{})
+  {
+    feed(data, size, [&obj, &on_decoded, &ctx](std::string_view message) {
+        decode(message, obj, ctx);
+        on_decoded(obj);
+      });
+  }
+
+  static void decode(std::string_view message, Serializable & obj, const DecodeContext & ctx = DecodeContext{})
+  {
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, message.data(), message.size());
+
+    obj.deserialize(&reader, ctx);
+
+    if (mpack_reader_destroy(&reader) != mpack_ok) {
+      throw std::runtime_error("An error occurred decoding the data");
+    }
+  }
+
+  // Bytes held for an incomplete message
+  size_t buffered() const { return pending_.size(); }
+
+  // Drops any partial message, e.g. after the connection was reset
+  void reset()
+  {
+    pending_.clear();
+    scanner_.reset();
+  }
+
+private:
+  // Length of the frame at data, or 0 if incomplete
+  size_t message_length(const char * data, size_t size)
+  {
+    if (framing_ == Framing::Structural) {
+      const size_t length = scanner_.scan(data, size);
+      if (length == 0) {
+        check_limit(scanner_.scanned());
+      }
+      return length;
+    }
+    if (size < kFrameHeaderSize) {
+      return 0;
+    }
+    const uint32_t word = ChecksumFrame::load_u32(data);
+    const size_t header_size = ChecksumFrame::header_size(word);
+    const uint32_t length = ChecksumFrame::payload_size(word);
+    check_limit(length);
+    if (size < header_size || size - header_size < length) {
+      return 0;
+    }
+    if (ChecksumFrame::has_checksum(word) && !ChecksumFrame::verify(data, length)) {
+      throw std::runtime_error("Stream frame failed its checksum");
+    }
+    return header_size + length;
+  }
+
+  template<typename OnMessage>
+  void deliver(const char * data, size_t length, OnMessage & on_message)
+  {
+    if (framing_ == Framing::LengthPrefixed) {
+      const size_t header_size = ChecksumFrame::header_size(ChecksumFrame::load_u32(data));
+      on_message(std::string_view(data + header_size, length - header_size));
+    } else {
+      on_message(std::string_view(data, length));
+    }
+  }
+
+  void check_limit(uint64_t size) const
+  {
+    if (size > max_message_bytes_) {
+      throw std::runtime_error("Stream message exceeds the size limit");
+    }
+  }
+
+  Framing framing_;
+  size_t max_message_bytes_;
+  MessageScanner scanner_;
+  std::vector<char> pending_;
+};
+
+/**
+ * Blocking reader decoding messages from a file descriptor through mpack's
+ * fill callback: bytes are read into one buffer as the decoder needs them,
+ * so no framing is required. After a decode error the stream position is
+ * unknown and the reader stays failed.
+ */
+class FdReader
+{
+public:
+  explicit FdReader(int fd, size_t buffer_bytes = 64 * 1024)
+  : fd_(fd), buffer_(std::max<size_t>(buffer_bytes, 64))
+  {
+    mpack_reader_init(&reader_, buffer_.data(), buffer_.size(), 0);
+    mpack_reader_set_context(&reader_, this);
+    mpack_reader_set_fill(&reader_, &FdReader::fill_callback);
+  }
+
+  FdReader(const FdReader &) = delete;
+  FdReader & operator=(const FdReader &) = delete;
+
+  ~FdReader() { mpack_reader_destroy(&reader_); }
+
+  // Decodes the next message; returns false at end of stream between messages
+  bool read(Serializable & obj, const DecodeContext & ctx = DecodeContext{})
+  {
+    if (failed_) {
+      throw std::runtime_error("FdReader failed earlier");
+    }
+
+    const bool at_boundary = mpack_reader_remaining(&reader_, nullptr) == 0;
+    const uint64_t filled = bytes_read_;
+    try {
+      obj.deserialize(&reader_, ctx);
+    } catch (...) {
+      // Handlers throw on the empty tag they get at end of stream
+      failed_ = true;
+      if (mpack_reader_error(&reader_) == mpack_ok) {
+        throw;
+      }
+    }
+
+    if (mpack_reader_error(&reader_) != mpack_ok) {
+      failed_ = true;
+      if (eof_ && at_boundary && bytes_read_ == filled) {
+        return false;
+      }
+      if (errno_ != 0) {
+        throw std::runtime_error(std::string("read: ") + std::strerror(errno_));
+      }
+      throw std::runtime_error("An error occurred decoding the data");
+    }
+    return true;
+  }
+
+  uint64_t bytes_read() const { return bytes_read_; }
+
+private:
+  // Called by mpack when it needs more bytes; must not throw
+  static size_t fill_callback(mpack_reader_t * reader, char * buffer, size_t count)
+  {
+    FdReader * self = static_cast<FdReader *>(mpack_reader_context(reader));
+    for (;;) {
+      ssize_t n = ::read(self->fd_, buffer, count);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0) {
+        self->errno_ = errno;
+        mpack_reader_flag_error(reader, mpack_error_io);
+        return 0;
+      }
+      if (n == 0) {
+        self->eof_ = true;
+      }
+      self->bytes_read_ += static_cast<uint64_t>(n);
+      return static_cast<size_t>(n);
+    }
+  }
+
+  int fd_;
+  std::vector<char> buffer_;
+  mpack_reader_t reader_;
+  bool eof_ = false;
+  bool failed_ = false;
+  int errno_ = 0;
+  uint64_t bytes_read_ = 0;
+};
+
+}  // namespace serialization
+#endif  // MPACK_STREAM_READER_H
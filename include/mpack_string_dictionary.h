@@ -0,0 +1,182 @@
+#ifndef MPACK_STRING_DICTIONARY_H
+#define MPACK_STRING_DICTIONARY_H
+
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "mpack/mpack.h"
+
+namespace serialization
+{
+
+/**
+ * Session dictionary for repeated strings in a message stream.
+ *
+ * While a message is encoded, strings the table holds are written as an
+ * ext reference holding their index and all others as a normal str. The
+ * table only grows between messages, by one rule applied on both sides:
+ * record_message() takes the bytes of a complete message and, in wire
+ * order, adds every str value it contains (keys, fields, skipped or
+ * unknown values alike) that is at least min_length long and not yet in
+ * the table, until max_entries. Because the rule reads the bytes rather
+ * than following the code that wrote or read them, a string written by a
+ * raw mpack_write_str() in a custom handler is recorded exactly like one
+ * written through write_str(), and the tables stay identical as long as
+ * every message is recorded in order on both sides.
+ *
+ * A string first seen in a message is therefore written in full each time
+ * it occurs in that message; references start with the next message.
+ * Encoding never changes the table, so a failed or retried message needs
+ * no rollback. An instance serves one direction only.
+ */
+class StringDictionary
+{
+public:
+  static constexpr size_t npos = std::numeric_limits<size_t>::max();
+  static constexpr int8_t kDefaultExtType = 127;
+
+  explicit StringDictionary(
+    size_t min_length = 4, size_t max_entries = 65536,
+    int8_t ext_type = kDefaultExtType)
+  : min_length_(min_length), max_entries_(max_entries), ext_type_(ext_type)
+  {
+    if (max_entries_ > UINT32_MAX) {
+      throw std::invalid_argument("StringDictionary supports at most 2^32 entries");
+    }
+  }
+
+  // Encoder side: the index of s, or npos if the table does not hold it
+  size_t lookup(std::string_view s) const
+  {
+    auto it = index_.find(s);
+    return it != index_.end() ? it->second : npos;
+  }
+
+  // Adds every str value of one complete message, in wire order. Both
+  // sides call this once per message, after encoding or decoding it.
+  void record_message(const char * data, size_t size)
+  {
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, size);
+    std::string scratch;
+    uint64_t remaining = 1;
+    while (remaining > 0 && mpack_reader_error(&reader) == mpack_ok) {
+      mpack_tag_t tag = mpack_read_tag(&reader);
+      --remaining;
+      switch (tag.type) {
+        case mpack_type_str:
+          scratch.resize(tag.v.l);
+          mpack_read_bytes(&reader, &scratch[0], tag.v.l);
+          mpack_done_str(&reader);
+          if (mpack_reader_error(&reader) == mpack_ok) {
+            record(scratch);
+          }
+          break;
+        case mpack_type_bin:
+          mpack_skip_bytes(&reader, tag.v.l);
+          mpack_done_bin(&reader);
+          break;
+        case mpack_type_ext:
+          mpack_skip_bytes(&reader, tag.v.l);
+          mpack_done_ext(&reader);
+          break;
+        case mpack_type_array:
+          remaining += tag.v.n;
+          break;
+        case mpack_type_map:
+          remaining += 2 * static_cast<uint64_t>(tag.v.n);
+          break;
+        default:
+          break;
+      }
+    }
+    if (mpack_reader_destroy(&reader) != mpack_ok) {
+      throw std::runtime_error("Malformed message in string dictionary");
+    }
+  }
+
+  // Decoder side: the string for a reference read from the stream
+  const std::string & at(size_t index) const
+  {
+    if (index >= strings_.size()) {
+      throw std::runtime_error("Unknown string dictionary reference");
+    }
+    return strings_[index];
+  }
+
+  bool admits(std::string_view s) const
+  {
+    return s.size() >= min_length_ && strings_.size() < max_entries_;
+  }
+
+  // Drops entries added after the table had count entries
+  void truncate(size_t count)
+  {
+    while (strings_.size() > count) {
+      index_.erase(strings_.back());
+      strings_.pop_back();
+    }
+  }
+
+  void clear() { truncate(0); }
+  size_t size() const { return strings_.size(); }
+  int8_t ext_type() const { return ext_type_; }
+
+private:
+  void record(std::string_view s)
+  {
+    if (admits(s) && index_.find(s) == index_.end()) {
+      strings_.emplace_back(s);
+      index_.emplace(strings_.back(), static_cast<uint32_t>(strings_.size() - 1));
+    }
+  }
+
+  size_t min_length_;
+  size_t max_entries_;
+  int8_t ext_type_;
+  std::deque<std::string> strings_;  // stable addresses for the index keys
+  std::unordered_map<std::string_view, uint32_t> index_;
+};
+
+// Writes a reference as fixext 1, 2 or 4 holding the big-endian index
+inline void write_dictionary_ref(mpack_writer_t * writer, int8_t ext_type, size_t index)
+{
+  char bytes[4];
+  uint32_t length;
+  if (index <= UINT8_MAX) {
+    length = 1;
+  } else if (index <= UINT16_MAX) {
+    length = 2;
+  } else {
+    length = 4;
+  }
+  for (uint32_t i = 0; i < length; ++i) {
+    bytes[i] = static_cast<char>(index >> (8 * (length - 1 - i)));
+  }
+  mpack_write_ext(writer, ext_type, bytes, length);
+}
+
+// Reads the index of a reference whose ext tag has already been consumed
+inline size_t read_dictionary_ref(mpack_reader_t * reader, const mpack_tag_t & tag)
+{
+  const uint32_t length = tag.v.l;
+  if (length != 1 && length != 2 && length != 4) {
+    throw std::runtime_error("Malformed string dictionary reference");
+  }
+  unsigned char bytes[4];
+  mpack_read_bytes(reader, reinterpret_cast<char *>(bytes), length);
+  mpack_done_ext(reader);
+  size_t index = 0;
+  for (uint32_t i = 0; i < length; ++i) {
+    index = (index << 8) | bytes[i];
+  }
+  return index;
+}
+
+}  // namespace serialization
+#endif  // MPACK_STRING_DICTIONARY_H
@@ -0,0 +1,322 @@
+#ifndef MPACK_STRING_INTERN_H
+#define MPACK_STRING_INTERN_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mpack_serialize_typehandlers.h"
+
+namespace serialization
+{
+
+class StringInterner;
+
+/**
+ * Handle to an immutable string owned by a StringInterner.
+ * Handles from the same interner are equal exactly when their pointers are,
+ * and carry the hash computed once at interning time.
+ */
+class InternedString
+{
+public:
+  // Header stored in front of the null-terminated characters
+  struct Entry
+  {
+    size_t hash;
+    size_t length;
+
+    const char * data() const { return reinterpret_cast<const char *>(this + 1); }
+  };
+
+  // The empty string, shared by every interner
+  InternedString() : entry_(&empty_entry()) {}
+
+  std::string_view view() const { return std::string_view(entry_->data(), entry_->length); }
+  operator std::string_view() const { return view(); }
+  const char * c_str() const { return entry_->data(); }
+  const char * data() const { return entry_->data(); }
+  size_t size() const { return entry_->length; }
+  bool empty() const { return entry_->length == 0; }
+  size_t hash() const { return entry_->hash; }
+
+  friend bool operator==(InternedString a, InternedString b) { return a.entry_ == b.entry_; }
+  friend bool operator!=(InternedString a, InternedString b) { return a.entry_ != b.entry_; }
+
+  friend std::ostream & operator<<(std::ostream & os, InternedString s)
+  {
+    return os << s.view();
+  }
+
+private:
+  friend class StringInterner;
+
+  explicit InternedString(const Entry * entry) : entry_(entry) {}
+
+  static const Entry & empty_entry()
+  {
+    struct EmptyEntry
+    {
+      Entry header;
+      char terminator;
+    };
+    static const EmptyEntry empty{{std::hash<std::string_view>()(std::string_view()), 0}, '\0'};
+    return empty.header;
+  }
+
+  const Entry * entry_;
+};
+
+/**
+ * Table of distinct strings with a lock-free lookup for strings already present.
+ *
+ * Readers probe an open-addressing table of atomic entry pointers without
+ * locking. Misses take a mutex, insert, and grow the table by publishing a
+ * larger copy; retired tables stay alive until the interner is destroyed so
+ * concurrent readers never see freed memory. Entries are never removed, so
+ * memory grows with the number of distinct strings, not with message count.
+ */
+class StringInterner
+{
+public:
+  explicit StringInterner(size_t initial_capacity = 1024)
+  {
+    size_t capacity = 16;
+    while (capacity < initial_capacity) {
+      capacity *= 2;
+    }
+    tables_.push_back(std::make_unique<Table>(capacity));
+    table_.store(tables_.back().get(), std::memory_order_release);
+  }
+
+  StringInterner(const StringInterner &) = delete;
+  StringInterner & operator=(const StringInterner &) = delete;
+
+  // Returns the handle for s, adding it on first sight
+  InternedString intern(std::string_view s)
+  {
+    if (s.empty()) {
+      return InternedString();
+    }
+    const size_t hash = std::hash<std::string_view>()(s);
+    if (const auto * entry = lookup(table_.load(std::memory_order_acquire), s, hash)) {
+      return InternedString(entry);
+    }
+    return insert(s, hash);
+  }
+
+  // Lock-free; returns the empty handle if s was never interned
+  InternedString find(std::string_view s) const
+  {
+    const size_t hash = std::hash<std::string_view>()(s);
+    const auto * entry = lookup(table_.load(std::memory_order_acquire), s, hash);
+    return entry ? InternedString(entry) : InternedString();
+  }
+
+  // Number of distinct non-empty strings held
+  size_t size() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+  // Process-wide interner used when no DecodeContext::interner is given
+  static StringInterner & global()
+  {
+    static StringInterner interner;
+    return interner;
+  }
+
+private:
+  using Entry = InternedString::Entry;
+
+  struct Table
+  {
+    explicit Table(size_t capacity)
+    : mask(capacity - 1), slots(new std::atomic<const Entry *>[capacity])
+    {
+      for (size_t i = 0; i < capacity; ++i) {
+        slots[i].store(nullptr, std::memory_order_relaxed);
+      }
+    }
+
+    size_t mask;
+    std::unique_ptr<std::atomic<const Entry *>[]> slots;
+  };
+
+  static constexpr size_t kBlockSize = 64 * 1024;
+
+  static const Entry * lookup(const Table * table, std::string_view s, size_t hash)
+  {
+    for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+      const Entry * entry = table->slots[i].load(std::memory_order_acquire);
+      if (entry == nullptr) {
+        return nullptr;
+      }
+      if (entry->hash == hash && entry->length == s.size() &&
+        std::memcmp(entry->data(), s.data(), s.size()) == 0)
+      {
+        return entry;
+      }
+    }
+  }
+
+  static void place(Table * table, const Entry * entry)
+  {
+    size_t i = entry->hash & table->mask;
+    while (table->slots[i].load(std::memory_order_relaxed) != nullptr) {
+      i = (i + 1) & table->mask;
+    }
+    table->slots[i].store(entry, std::memory_order_release);
+  }
+
+  InternedString insert(std::string_view s, size_t hash)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Another thread may have added it since the lock-free probe
+    Table * table = table_.load(std::memory_order_relaxed);
+    if (const auto * entry = lookup(table, s, hash)) {
+      return InternedString(entry);
+    }
+
+    // Keep the load factor at or below one half
+    if ((entries_.size() + 1) * 2 > table->mask + 1) {
+      tables_.push_back(std::make_unique<Table>((table->mask + 1) * 2));
+      table = tables_.back().get();
+      for (const Entry * entry : entries_) {
+        place(table, entry);
+      }
+      table_.store(table, std::memory_order_release);
+    }
+
+    const Entry * entry = allocate(s, hash);
+    entries_.push_back(entry);
+    place(table, entry);
+    return InternedString(entry);
+  }
+
+  // Bump-allocates the entry and its characters from the current block
+  const Entry * allocate(std::string_view s, size_t hash)
+  {
+    const size_t align = alignof(Entry);
+    const size_t bytes = (sizeof(Entry) + s.size() + 1 + align - 1) & ~(align - 1);
+    char * memory;
+    if (bytes > kBlockSize / 4) {
+      blocks_.push_back(std::make_unique<char[]>(bytes));
+      memory = blocks_.back().get();
+    } else {
+      if (current_ == nullptr || block_used_ + bytes > kBlockSize) {
+        blocks_.push_back(std::make_unique<char[]>(kBlockSize));
+        current_ = blocks_.back().get();
+        block_used_ = 0;
+      }
+      memory = current_ + block_used_;
+      block_used_ += bytes;
+    }
+
+    auto * entry = new (memory) Entry{hash, s.size()};
+    char * chars = memory + sizeof(Entry);
+    std::memcpy(chars, s.data(), s.size());
+    chars[s.size()] = '\0';
+    return entry;
+  }
+
+  std::atomic<Table *> table_{nullptr};
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Table>> tables_;
+  std::vector<const Entry *> entries_;
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  char * current_ = nullptr;
+  size_t block_used_ = 0;
+};
+
+// Specialization for InternedString
+template<>
+struct TypeHandler<InternedString>
+{
+  static constexpr TypeTag tag = TypeTag::String;
+
+  static void write(mpack_writer_t * writer, InternedString value)
+  {
+    mpack_write_str(writer, value.data(), static_cast<uint32_t>(value.size()));
+  }
+
+  static void write(mpack_writer_t * writer, InternedString value, const EncodeContext & ctx)
+  {
+    write_str(writer, value.data(), value.size(), ctx);
+  }
+
+  static void read(mpack_reader_t * reader, InternedString & value)
+  {
+    read(reader, value, DecodeContext{});
+  }
+
+  static void read(mpack_reader_t * reader, InternedString & value, const DecodeContext & ctx)
+  {
+    StringInterner & interner = ctx.interner ? *ctx.interner : StringInterner::global();
+
+    if (ctx.dictionary != nullptr) {
+      if (const std::string * ref = read_dictionary_str(reader, mpack_peek_tag(reader), ctx)) {
+        value = interner.intern(*ref);
+        return;
+      }
+    }
+
+    mpack_tag_t tag = mpack_read_tag(reader);
+    if (tag.type != mpack_type_str) {
+      throw std::runtime_error("Expected string type");
+    }
+
+    // Hash the bytes where they sit in the reader buffer when possible
+    const size_t length = tag.v.l;
+    if (mpack_should_read_bytes_inplace(reader, length)) {
+      const char * bytes = mpack_read_bytes_inplace(reader, length);
+      if (mpack_reader_error(reader) != mpack_ok) {
+        return;
+      }
+      check_utf8(bytes, length, ctx);
+      value = interner.intern(std::string_view(bytes, length));
+    } else {
+      std::string bytes(length, '\0');
+      mpack_read_bytes(reader, &bytes[0], length);
+      if (mpack_reader_error(reader) != mpack_ok) {
+        return;
+      }
+      check_utf8(bytes.data(), length, ctx);
+      value = interner.intern(bytes);
+    }
+    mpack_done_str(reader);
+  }
+
+  static void read(mpack_node_t node, InternedString & value, const DecodeContext & ctx)
+  {
+    if (mpack_node_type(node) != mpack_type_str) {
+      throw std::runtime_error("Expected string type");
+    }
+    StringInterner & interner = ctx.interner ? *ctx.interner : StringInterner::global();
+    check_utf8(mpack_node_str(node), mpack_node_strlen(node), ctx);
+    value = interner.intern(std::string_view(mpack_node_str(node), mpack_node_strlen(node)));
+  }
+};
+
+}  // namespace serialization
+
+namespace std
+{
+template<>
+struct hash<serialization::InternedString>
+{
+  size_t operator()(serialization::InternedString s) const noexcept { return s.hash(); }
+};
+}  // namespace std
+
+#endif  // MPACK_STRING_INTERN_H
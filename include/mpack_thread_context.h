@@ -0,0 +1,165 @@
+#ifndef MPACK_THREAD_CONTEXT_H
+#define MPACK_THREAD_CONTEXT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include "mpack/mpack.h"
+#include "mpack_node_backend.h"
+#include "mpack_serializer.h"
+
+namespace serialization
+{
+
+/**
+ * Per-thread cache of the memory the encode and decode paths need: a
+ * growable output buffer, a scratch buffer and a MessageTree node pool.
+ * High-rate call sites go through ThreadContext::local() and reuse warm
+ * memory instead of allocating per message.
+ *
+ * A buffer may grow past its cap to fit one oversized message; it is freed
+ * the next time it is used, and trim() does the same for every buffer, so
+ * an idle thread keeps at most the capped amount.
+ * mpack_writer_t and mpack_reader_t are plain structs whose init is a few
+ * stores, so they are built on the stack around the cached buffers.
+ */
+class ThreadContext
+{
+public:
+  struct Limits
+  {
+    size_t initial_buffer_bytes = 4096;
+    size_t max_buffer_bytes = 1u << 20;  // per buffer, kept between calls
+    size_t max_tree_nodes = 1u << 16;
+  };
+
+  ThreadContext() = default;
+  explicit ThreadContext(const Limits & limits)
+  : limits_(limits) {}
+
+  ThreadContext(const ThreadContext &) = delete;
+  ThreadContext & operator=(const ThreadContext &) = delete;
+
+  // The calling thread's context
+  static ThreadContext & local()
+  {
+    thread_local ThreadContext context;
+    return context;
+  }
+
+  void set_limits(const Limits & limits)
+  {
+    limits_ = limits;
+    trim();
+  }
+
+  const Limits & limits() const { return limits_; }
+
+  // Encodes obj into the cached output buffer. The view stays valid until
+  // the next encode(), trim() or release() on this context.
+  std::string_view encode(const Serializable & obj, const EncodeContext & ctx = EncodeContext{})
+  {
+    prepare(output_);
+    for (;;) {
+      mpack_writer_t writer;
+      mpack_writer_init(&writer, output_.data(), output_.size());
+      obj.serialize(&writer, ctx);
+      size_t used = mpack_writer_buffer_used(&writer);
+      mpack_error_t error = mpack_writer_destroy(&writer);
+      if (error == mpack_ok) {
+        return std::string_view(output_.data(), used);
+      }
+      if (error != mpack_error_too_big) {
+        throw std::runtime_error("An error occurred encoding the data");
+      }
+      output_.resize(output_.size() * 2);
+    }
+  }
+
+  // Decodes one message with the reader backend
+  void decode(
+    const char * data, size_t size, Serializable & obj,
+    const DecodeContext & ctx = DecodeContext{})
+  {
+    mpack_reader_t reader;
+    mpack_reader_init_data(&reader, data, size);
+
+    obj.deserialize(&reader, ctx);
+
+    if (mpack_reader_destroy(&reader) != mpack_ok) {
+      throw std::runtime_error("An error occurred decoding the data");
+    }
+  }
+
+  // Parses a message into the cached node pool; see MessageTree
+  MessageTree & parse(const char * data, size_t size)
+  {
+    if (tree_.pool_capacity() > limits_.max_tree_nodes) {
+      tree_.trim(limits_.max_tree_nodes);
+    }
+    tree_.parse(data, size);
+    return tree_;
+  }
+
+  // At least size bytes of scratch memory, valid until the next scratch() call
+  char * scratch(size_t size)
+  {
+    prepare(scratch_);
+    if (scratch_.size() < size) {
+      scratch_.resize(size);
+    }
+    return scratch_.data();
+  }
+
+  // Frees every cached buffer that is over its cap
+  void trim()
+  {
+    shrink(output_, limits_.max_buffer_bytes);
+    shrink(scratch_, limits_.max_buffer_bytes);
+    tree_.trim(limits_.max_tree_nodes);
+  }
+
+  // Frees all cached memory
+  void release()
+  {
+    shrink(output_, 0);
+    shrink(scratch_, 0);
+    tree_.trim(1);
+  }
+
+  // Bytes currently held by the cached buffers and node pool
+  size_t retained_bytes() const
+  {
+    return output_.capacity() + scratch_.capacity() +
+           tree_.pool_capacity() * sizeof(mpack_node_data_t);
+  }
+
+private:
+  void prepare(std::vector<char> & buffer)
+  {
+    if (buffer.size() > limits_.max_buffer_bytes) {
+      shrink(buffer, limits_.max_buffer_bytes);
+    }
+    if (buffer.empty()) {
+      buffer.resize(std::max<size_t>(limits_.initial_buffer_bytes, 1));
+    }
+  }
+
+  static void shrink(std::vector<char> & buffer, size_t max_bytes)
+  {
+    if (buffer.capacity() > max_bytes) {
+      std::vector<char>().swap(buffer);
+    }
+  }
+
+  Limits limits_;
+  std::vector<char> output_;
+  std::vector<char> scratch_;
+  MessageTree tree_;
+};
+
+}  // namespace serialization
+#endif  // MPACK_THREAD_CONTEXT_H
@@ -0,0 +1,299 @@
+#ifndef MPACK_UTF8_H
+#define MPACK_UTF8_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MPACK_UTF8_X86 1
+#include <immintrin.h>
+#else
+#define MPACK_UTF8_X86 0
+#endif
+
+namespace serialization
+{
+
+namespace utf8_detail
+{
+
+// Byte-at-a-time check with an 8-byte ASCII skip; also finishes the SIMD tails
+inline bool validate_scalar(const uint8_t * s, size_t size)
+{
+  size_t i = 0;
+  while (i < size) {
+    if (i + 8 <= size) {
+      uint64_t word;
+      std::memcpy(&word, s + i, sizeof(word));
+      if ((word & 0x8080808080808080ull) == 0) {
+        i += 8;
+        continue;
+      }
+    }
+
+    const uint8_t lead = s[i];
+    if (lead < 0x80) {
+      ++i;
+      continue;
+    }
+
+    size_t length;
+    uint8_t low = 0x80;  // range of the first continuation byte
+    uint8_t high = 0xbf;
+    if (lead < 0xc2) {
+      return false;  // continuation byte or overlong two-byte lead
+    } else if (lead < 0xe0) {
+      length = 2;
+    } else if (lead < 0xf0) {
+      length = 3;
+      if (lead == 0xe0) {
+        low = 0xa0;  // overlong
+      } else if (lead == 0xed) {
+        high = 0x9f;  // surrogates
+      }
+    } else if (lead < 0xf5) {
+      length = 4;
+      if (lead == 0xf0) {
+        low = 0x90;  // overlong
+      } else if (lead == 0xf4) {
+        high = 0x8f;  // above U+10FFFF
+      }
+    } else {
+      return false;
+    }
+
+    if (size - i < length || s[i + 1] < low || s[i + 1] > high) {
+      return false;
+    }
+    for (size_t k = 2; k < length; ++k) {
+      if ((s[i + k] & 0xc0) != 0x80) {
+        return false;
+      }
+    }
+    i += length;
+  }
+  return true;
+}
+
+#if MPACK_UTF8_X86
+
+// Lookup-table validator of Keiser and Lemire, "Validating UTF-8 in less
+// than one instruction per byte" (2021). Each byte is classified from the
+// high nibble of the previous byte, its low nibble and the high nibble of
+// the current byte; a byte with no error bit set in all three is valid.
+// Continuation requirements two and three bytes after a lead are checked
+// separately, and a trailing incomplete sequence carries into the next block.
+enum : uint8_t
+{
+  kTooShort = 1 << 0,
+  kTooLong = 1 << 1,
+  kOverlong3 = 1 << 2,
+  kTooLarge = 1 << 3,
+  kSurrogate = 1 << 4,
+  kOverlong2 = 1 << 5,
+  kTooLarge1000 = 1 << 6,
+  kOverlong4 = 1 << 6,
+  kTwoConts = 1 << 7,
+  kCarry = kTooShort | kTooLong | kTwoConts,
+};
+
+#define MPACK_UTF8_BYTE_1_HIGH \
+  kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, \
+  kTwoConts, kTwoConts, kTwoConts, kTwoConts, \
+  kTooShort | kOverlong2, \
+  kTooShort, \
+  kTooShort | kOverlong3 | kSurrogate, \
+  kTooShort | kTooLarge | kTooLarge1000 | kOverlong4
+
+#define MPACK_UTF8_BYTE_1_LOW \
+  kCarry | kOverlong3 | kOverlong2 | kOverlong4, \
+  kCarry | kOverlong2, \
+  kCarry, \
+  kCarry, \
+  kCarry | kTooLarge, \
+  kCarry | kTooLarge | kTooLarge1000, \
+  kCarry | kTooLarge | kTooLarge1000, \
+  kCarry | kTooLarge | kTooLarge1000, \
+  kCarry | kTooLarge | kTooLarge1000, \
+  kCarry | kTooLarge | kTooLarge1000, \
+  kCarry | kTooLarge | kTooLarge1000, \
+  kCarry | kTooLarge | kTooLarge1000, \
+  kCarry | kTooLarge | kTooLarge1000, \
+  kCarry | kTooLarge | kTooLarge1000 | kSurrogate, \
+  kCarry | kTooLarge | kTooLarge1000, \
+  kCarry | kTooLarge | kTooLarge1000
+
+#define MPACK_UTF8_BYTE_2_HIGH \
+  kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, \
+  kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge1000 | kOverlong4, \
+  kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge, \
+  kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge, \
+  kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge, \
+  kTooShort, kTooShort, kTooShort, kTooShort
+
+// Set in the last bytes of a block when they start an unfinished sequence
+#define MPACK_UTF8_INCOMPLETE_MAX \
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, \
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1
+
+__attribute__((target("ssse3")))
+inline __m128i lookup_errors_ssse3(__m128i input, __m128i prev_input)
+{
+  const __m128i low_nibble = _mm_set1_epi8(0x0f);
+  const __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+  const __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+  const __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+
+  const __m128i byte_1_high = _mm_shuffle_epi8(
+    _mm_setr_epi8(MPACK_UTF8_BYTE_1_HIGH),
+    _mm_and_si128(_mm_srli_epi16(prev1, 4), low_nibble));
+  const __m128i byte_1_low = _mm_shuffle_epi8(
+    _mm_setr_epi8(MPACK_UTF8_BYTE_1_LOW),
+    _mm_and_si128(prev1, low_nibble));
+  const __m128i byte_2_high = _mm_shuffle_epi8(
+    _mm_setr_epi8(MPACK_UTF8_BYTE_2_HIGH),
+    _mm_and_si128(_mm_srli_epi16(input, 4), low_nibble));
+  const __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+  // Only 111_____ before two bytes or 1111____ before three reach 0x80
+  const __m128i must_be_cont = _mm_or_si128(
+    _mm_subs_epu8(prev2, _mm_set1_epi8(static_cast<char>(0xe0 - 0x80))),
+    _mm_subs_epu8(prev3, _mm_set1_epi8(static_cast<char>(0xf0 - 0x80))));
+  return _mm_xor_si128(_mm_and_si128(must_be_cont, _mm_set1_epi8(static_cast<char>(0x80))), special);
+}
+
+__attribute__((target("ssse3")))
+inline bool validate_ssse3(const uint8_t * s, size_t size)
+{
+  const __m128i incomplete_max = _mm_setr_epi8(MPACK_UTF8_INCOMPLETE_MAX);
+  __m128i error = _mm_setzero_si128();
+  __m128i prev_input = _mm_setzero_si128();
+  __m128i prev_incomplete = _mm_setzero_si128();
+
+  for (size_t i = 0; i < size; i += 16) {
+    __m128i input;
+    if (i + 16 <= size) {
+      input = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+    } else {
+      alignas(16) uint8_t tail[16] = {};
+      std::memcpy(tail, s + i, size - i);
+      input = _mm_load_si128(reinterpret_cast<const __m128i *>(tail));
+    }
+
+    if (_mm_movemask_epi8(input) == 0) {
+      // ASCII block: only an unfinished sequence from before can be wrong
+      error = _mm_or_si128(error, prev_incomplete);
+    } else {
+      error = _mm_or_si128(error, lookup_errors_ssse3(input, prev_input));
+      prev_incomplete = _mm_subs_epu8(input, incomplete_max);
+    }
+    prev_input = input;
+  }
+  error = _mm_or_si128(error, prev_incomplete);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xffff;
+}
+
+__attribute__((target("avx2")))
+inline __m256i lookup_errors_avx2(__m256i input, __m256i prev_input)
+{
+  const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+  // Upper half of prev_input joined with the lower half of input
+  const __m256i joined = _mm256_permute2x128_si256(prev_input, input, 0x21);
+  const __m256i prev1 = _mm256_alignr_epi8(input, joined, 15);
+  const __m256i prev2 = _mm256_alignr_epi8(input, joined, 14);
+  const __m256i prev3 = _mm256_alignr_epi8(input, joined, 13);
+
+  const __m256i byte_1_high = _mm256_shuffle_epi8(
+    _mm256_setr_epi8(MPACK_UTF8_BYTE_1_HIGH, MPACK_UTF8_BYTE_1_HIGH),
+    _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble));
+  const __m256i byte_1_low = _mm256_shuffle_epi8(
+    _mm256_setr_epi8(MPACK_UTF8_BYTE_1_LOW, MPACK_UTF8_BYTE_1_LOW),
+    _mm256_and_si256(prev1, low_nibble));
+  const __m256i byte_2_high = _mm256_shuffle_epi8(
+    _mm256_setr_epi8(MPACK_UTF8_BYTE_2_HIGH, MPACK_UTF8_BYTE_2_HIGH),
+    _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble));
+  const __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+  const __m256i must_be_cont = _mm256_or_si256(
+    _mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xe0 - 0x80))),
+    _mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xf0 - 0x80))));
+  return _mm256_xor_si256(
+    _mm256_and_si256(must_be_cont, _mm256_set1_epi8(static_cast<char>(0x80))), special);
+}
+
+__attribute__((target("avx2")))
+inline bool validate_avx2(const uint8_t * s, size_t size)
+{
+  const __m256i incomplete_max = _mm256_setr_epi8(
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    MPACK_UTF8_INCOMPLETE_MAX);
+  __m256i error = _mm256_setzero_si256();
+  __m256i prev_input = _mm256_setzero_si256();
+  __m256i prev_incomplete = _mm256_setzero_si256();
+
+  for (size_t i = 0; i < size; i += 32) {
+    __m256i input;
+    if (i + 32 <= size) {
+      input = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+    } else {
+      alignas(32) uint8_t tail[32] = {};
+      std::memcpy(tail, s + i, size - i);
+      input = _mm256_load_si256(reinterpret_cast<const __m256i *>(tail));
+    }
+
+    if (_mm256_movemask_epi8(input) == 0) {
+      error = _mm256_or_si256(error, prev_incomplete);
+    } else {
+      error = _mm256_or_si256(error, lookup_errors_avx2(input, prev_input));
+      prev_incomplete = _mm256_subs_epu8(input, incomplete_max);
+    }
+    prev_input = input;
+  }
+  error = _mm256_or_si256(error, prev_incomplete);
+  return _mm256_testz_si256(error, error) != 0;
+}
+
+#undef MPACK_UTF8_BYTE_1_HIGH
+#undef MPACK_UTF8_BYTE_1_LOW
+#undef MPACK_UTF8_BYTE_2_HIGH
+#undef MPACK_UTF8_INCOMPLETE_MAX
+
+#endif  // MPACK_UTF8_X86
+
+using ValidateFn = bool (*)(const uint8_t *, size_t);
+
+// Picks the widest implementation the CPU supports, once per process
+inline ValidateFn select_validator()
+{
+#if MPACK_UTF8_X86
+  if (__builtin_cpu_supports("avx2")) {
+    return &validate_avx2;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return &validate_ssse3;
+  }
+#endif
+  return &validate_scalar;
+}
+
+// Strings shorter than this skip the dispatch; most field values are
+inline constexpr size_t kSimdThreshold = 32;
+
+}  // namespace utf8_detail
+
+// True when the bytes are well-formed UTF-8: no overlong forms, surrogates,
+// code points above U+10FFFF or truncated sequences
+inline bool utf8_valid(const char * data, size_t size)
+{
+  const uint8_t * bytes = reinterpret_cast<const uint8_t *>(data);
+  if (size < utf8_detail::kSimdThreshold) {
+    return utf8_detail::validate_scalar(bytes, size);
+  }
+  static const utf8_detail::ValidateFn validate = utf8_detail::select_validator();
+  return validate(bytes, size);
+}
+
+}  // namespace serialization
+#endif  // MPACK_UTF8_H
@@ -0,0 +1,458 @@
+#ifndef MPACK_VALIDATOR_H
+#define MPACK_VALIDATOR_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "mpack/mpack.h"
+#include "mpack_serialize_typehandlers.h"
+#include "mpack_serializer.h"
+#include "mpack_stream_reader.h"
+
+namespace serialization
+{
+
+namespace validator_detail
+{
+
+// Containers whose elements are checked as value_type
+template<typename T, typename = void>
+struct is_sequence : std::false_type {};
+
+template<typename T>
+struct is_sequence<T, std::void_t<typename T::value_type>>
+: std::bool_constant<has_type_tag<T>::value && TypeHandler<T>::tag == TypeTag::Array> {};
+
+// Containers whose entries are checked as key_type -> mapped_type
+template<typename T, typename = void>
+struct is_keyed : std::false_type {};
+
+template<typename T>
+struct is_keyed<T, std::void_t<typename T::key_type, typename T::mapped_type>>
+: std::bool_constant<has_type_tag<T>::value && TypeHandler<T>::tag == TypeTag::Map> {};
+
+template<typename T>
+struct is_optional : std::false_type {};
+
+template<typename U>
+struct is_optional<std::optional<U>>: std::true_type {};
+
+template<typename T>
+struct is_variant : std::false_type {};
+
+template<typename ... Types>
+struct is_variant<std::variant<Types...>>: std::true_type {};
+
+}  // namespace validator_detail
+
+/**
+ * Checks untrusted input before it reaches the TypeHandlers: the buffer must
+ * hold exactly one well-formed msgpack value within the configured limits.
+ * validate_as<T>() also checks it against T's schema, so a message that
+ * passes decodes into T without type errors. Capacity limits such as those
+ * of fixed_string and static_vector are still enforced by the decoder.
+ *
+ * The structural pass is one forward walk over the headers with an explicit
+ * stack and no allocation. String, binary and extension bodies are skipped
+ * by their length, so their bytes are never read. Container counts must not
+ * exceed the bytes left, which rejects headers claiming billions of
+ * elements before a decoder tries to allocate them.
+ *
+ * Schema checks follow get_fields(), sequences, keyed maps, optionals and
+ * variants; other types are checked against their handler's TypeTag.
+ * Unknown keys are accepted as the decoders skip them. Dictionary
+ * references (see StringDictionary) do not match string fields.
+ */
+class MessageValidator
+{
+public:
+  static constexpr size_t kMaxDepthLimit = 256;
+
+  struct Limits
+  {
+    size_t max_bytes = 64u << 20;
+    size_t max_depth = 32;               // nested arrays and maps, at most kMaxDepthLimit
+    size_t max_string_bytes = 1u << 20;  // per str, bin or ext body
+    size_t max_entries = 1u << 20;       // per array or map
+  };
+
+  struct Result
+  {
+    const char * error = nullptr;  // null when the message is valid
+    size_t offset = 0;             // byte at which validation failed
+
+    explicit operator bool() const { return error == nullptr; }
+  };
+
+  MessageValidator() = default;
+  explicit MessageValidator(const Limits & limits)
+  : limits_(limits) {}
+
+  const Limits & limits() const { return limits_; }
+
+  Result validate(const char * data, size_t size) const
+  {
+    const uint8_t * begin = reinterpret_cast<const uint8_t *>(data);
+    const uint8_t * p = begin;
+    const uint8_t * end = begin + size;
+    if (size > limits_.max_bytes) {
+      return Result{"Message exceeds the size limit", 0};
+    }
+    const size_t max_depth = std::min(limits_.max_depth, kMaxDepthLimit);
+
+    // Values still to read in each open container; level 0 is the message
+    std::array<uint64_t, kMaxDepthLimit + 1> remaining;
+    size_t depth = 0;
+    remaining[0] = 1;
+
+    for (;;) {
+      if (remaining[depth] == 0) {
+        if (depth == 0) {
+          break;
+        }
+        --depth;
+        continue;
+      }
+      --remaining[depth];
+
+      const size_t offset = static_cast<size_t>(p - begin);
+      if (p == end) {
+        return Result{"Message is truncated", offset};
+      }
+      const uint8_t lead = *p;
+      // Fixints, nil and bools are whole in their type byte
+      if (lead <= 0x7f || lead >= 0xe0 || lead == 0xc0 || lead == 0xc2 || lead == 0xc3) {
+        ++p;
+        continue;
+      }
+      if (lead >= 0xa0 && lead <= 0xbf) {
+        // fixstr, the usual map key
+        const size_t length = lead & 0x1fu;
+        if (length > limits_.max_string_bytes) {
+          return Result{"String or binary exceeds the length limit", offset};
+        }
+        if (length >= static_cast<size_t>(end - p)) {
+          return Result{"Message is truncated", offset};
+        }
+        p += 1 + length;
+        continue;
+      }
+      if (lead == 0xc1) {
+        return Result{"Invalid msgpack type byte 0xc1", offset};
+      }
+      const Header header = read_header(p, end);
+      if (header.size == 0) {
+        return Result{"Message is truncated", offset};
+      }
+      p += header.size;
+
+      if (header.payload > 0) {
+        if (header.payload > limits_.max_string_bytes) {
+          return Result{"String or binary exceeds the length limit", offset};
+        }
+        if (header.payload > static_cast<uint64_t>(end - p)) {
+          return Result{"Message is truncated", offset};
+        }
+        p += header.payload;
+      }
+
+      if (header.children > 0) {
+        const uint64_t entries = header.type == mpack_type_map ? header.children / 2 : header.children;
+        if (entries > limits_.max_entries) {
+          return Result{"Container exceeds the entry limit", offset};
+        }
+        // Every value takes at least one byte
+        if (header.children > static_cast<uint64_t>(end - p)) {
+          return Result{"Container count exceeds the remaining bytes", offset};
+        }
+        if (depth == max_depth) {
+          return Result{"Message exceeds the depth limit", offset};
+        }
+        remaining[++depth] = header.children;
+      }
+    }
+
+    if (p != end) {
+      return Result{"Trailing bytes after the message", static_cast<size_t>(p - begin)};
+    }
+    return Result{};
+  }
+
+  // Structural validation plus a check against T's schema
+  template<typename T>
+  Result validate_as(const char * data, size_t size) const
+  {
+    Result result = validate(data, size);
+    if (!result) {
+      return result;
+    }
+    Cursor cursor{reinterpret_cast<const uint8_t *>(data), reinterpret_cast<const uint8_t *>(data)};
+    if (!check<T>(cursor)) {
+      result.error = cursor.error;
+      result.offset = static_cast<size_t>(cursor.error_at - cursor.begin);
+    }
+    return result;
+  }
+
+  // Throwing forms for callers that decode right after
+  void check(const char * data, size_t size) const { raise(validate(data, size)); }
+
+  template<typename T>
+  void check_as(const char * data, size_t size) const { raise(validate_as<T>(data, size)); }
+
+private:
+  struct Header
+  {
+    mpack_type_t type;
+    uint8_t size;       // header bytes including inline values; 0 if truncated
+    uint64_t payload;   // str, bin or ext body bytes
+    uint64_t children;  // values inside an array or map (keys and values)
+  };
+
+  static uint64_t load_be(const uint8_t * p, size_t bytes)
+  {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+      value = (value << 8) | p[i];
+    }
+    return value;
+  }
+
+  // Decodes the header at p; the type byte must not be 0xc1
+  static Header read_header(const uint8_t * p, const uint8_t * end)
+  {
+    const uint8_t lead = *p;
+    Header header{mpack_type_nil, static_cast<uint8_t>(MessageScanner::header_size(lead)), 0, 0};
+    if (static_cast<size_t>(end - p) < header.size) {
+      header.size = 0;
+      return header;
+    }
+    const uint8_t * q = p + 1;
+    if (lead <= 0x7f) {
+      header.type = mpack_type_uint;
+    } else if (lead <= 0x8f) {
+      header.type = mpack_type_map;
+      header.children = 2u * (lead & 0x0f);
+    } else if (lead <= 0x9f) {
+      header.type = mpack_type_array;
+      header.children = lead & 0x0f;
+    } else if (lead <= 0xbf) {
+      header.type = mpack_type_str;
+      header.payload = lead & 0x1f;
+    } else if (lead >= 0xe0) {
+      header.type = mpack_type_int;
+    } else {
+      switch (lead) {
+        case 0xc0: header.type = mpack_type_nil; break;
+        case 0xc2: case 0xc3: header.type = mpack_type_bool; break;
+        case 0xc4: case 0xc5: case 0xc6:
+          header.type = mpack_type_bin;
+          header.payload = load_be(q, header.size - 1u);
+          break;
+        case 0xc7: case 0xc8: case 0xc9:
+          header.type = mpack_type_ext;
+          header.payload = load_be(q, header.size - 2u);
+          break;
+        case 0xca: header.type = mpack_type_float; break;
+        case 0xcb: header.type = mpack_type_double; break;
+        case 0xcc: case 0xcd: case 0xce: case 0xcf: header.type = mpack_type_uint; break;
+        case 0xd0: case 0xd1: case 0xd2: case 0xd3:
+          // mpack reports non-negative signed encodings as uint
+          header.type = (*q & 0x80) ? mpack_type_int : mpack_type_uint;
+          break;
+        case 0xd4: case 0xd5: case 0xd6: case 0xd7: case 0xd8:
+          header.type = mpack_type_ext;
+          header.payload = size_t{1} << (lead - 0xd4);
+          break;
+        case 0xd9: case 0xda: case 0xdb:
+          header.type = mpack_type_str;
+          header.payload = load_be(q, header.size - 1u);
+          break;
+        case 0xdc: case 0xdd:
+          header.type = mpack_type_array;
+          header.children = load_be(q, header.size - 1u);
+          break;
+        case 0xde: case 0xdf:
+          header.type = mpack_type_map;
+          header.children = 2 * load_be(q, header.size - 1u);
+          break;
+        default: break;
+      }
+    }
+    return header;
+  }
+
+  // Walks a structurally valid message, so reads need no bounds checks
+  struct Cursor
+  {
+    const uint8_t * begin;
+    const uint8_t * p;
+    const char * error = nullptr;
+    const uint8_t * error_at = nullptr;
+
+    Header next() const { return read_header(p, p + 16); }
+
+    void skip()
+    {
+      const Header header = next();
+      if (header.children == 0) {
+        p += header.size + header.payload;
+        return;
+      }
+      MessageScanner scanner;
+      p += scanner.scan(reinterpret_cast<const char *>(p), std::numeric_limits<size_t>::max() - 1);
+    }
+
+    bool fail(const char * message, const uint8_t * at)
+    {
+      error = message;
+      error_at = at;
+      return false;
+    }
+  };
+
+  template<typename T>
+  static bool check(Cursor & cursor)
+  {
+    using namespace validator_detail;
+    const uint8_t * at = cursor.p;
+
+    if constexpr (is_reflected_v<T>) {
+      return check_object<T>(cursor);
+    } else if constexpr (is_optional<T>::value) {
+      if (cursor.next().type == mpack_type_nil) {
+        cursor.p += 1;
+        return true;
+      }
+      return check<typename T::value_type>(cursor);
+    } else if constexpr (is_variant<T>::value) {
+      return check_variant(cursor, static_cast<T *>(nullptr));
+    } else if constexpr (is_sequence<T>::value) {
+      const Header header = cursor.next();
+      if (header.type != mpack_type_array) {
+        return cursor.fail("Expected array", at);
+      }
+      cursor.p += header.size;
+      for (uint64_t i = 0; i < header.children; ++i) {
+        if (!check<typename T::value_type>(cursor)) {
+          return false;
+        }
+      }
+      return true;
+    } else if constexpr (is_keyed<T>::value) {
+      const Header header = cursor.next();
+      if (header.type != mpack_type_map) {
+        return cursor.fail("Expected a map", at);
+      }
+      cursor.p += header.size;
+      for (uint64_t i = 0; i < header.children / 2; ++i) {
+        if (!check<typename T::key_type>(cursor) || !check<typename T::mapped_type>(cursor)) {
+          return false;
+        }
+      }
+      return true;
+    } else if constexpr (has_type_tag<T>::value) {
+      const Header header = cursor.next();
+      if (!tag_reads_exact(TypeHandler<T>::tag, header.type) &&
+        !tag_reads_converted(TypeHandler<T>::tag, header.type))
+      {
+        return cursor.fail("Value does not match the schema type", at);
+      }
+      if (header.children == 0) {
+        cursor.p += header.size + header.payload;
+      } else {
+        cursor.skip();
+      }
+      return true;
+    } else {
+      // Handler without a declared tag: structure only
+      cursor.skip();
+      return true;
+    }
+  }
+
+  template<typename Fields, size_t... I>
+  static constexpr auto field_names(const Fields & fields, std::index_sequence<I...>)
+  {
+    return std::array<std::string_view, sizeof...(I)>{std::string_view(std::get<I>(fields).name)...};
+  }
+
+  template<typename T, typename Fields, size_t... I>
+  static bool check_field(Cursor & cursor, size_t field, const Fields &, std::index_sequence<I...>)
+  {
+    bool ok = true;
+    ((field == I ? (ok = check<field_member_t<std::tuple_element_t<I, Fields>>>(cursor)) : false), ...);
+    return ok;
+  }
+
+  template<typename T>
+  static bool check_object(Cursor & cursor)
+  {
+    static constexpr auto fields = T::get_fields();
+    using Indices = std::make_index_sequence<std::tuple_size_v<std::decay_t<decltype(fields)>>>;
+    static constexpr auto names = field_names(fields, Indices{});
+
+    const Header header = cursor.next();
+    if (header.type != mpack_type_map) {
+      return cursor.fail("Expected a map", cursor.p);
+    }
+    cursor.p += header.size;
+
+    for (uint64_t i = 0; i < header.children / 2; ++i) {
+      const Header key = cursor.next();
+      if (key.type != mpack_type_str) {
+        return cursor.fail("Expected string key in map", cursor.p);
+      }
+      const std::string_view name(reinterpret_cast<const char *>(cursor.p + key.size), key.payload);
+      cursor.p += key.size + key.payload;
+
+      size_t field = 0;
+      while (field < names.size() && names[field] != name) {
+        ++field;
+      }
+      if (field == names.size()) {
+        cursor.skip();
+      } else if (!check_field<T>(cursor, field, fields, Indices{})) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Accepts the value if any alternative does, like the variant reader
+  template<typename ... Types>
+  static bool check_variant(Cursor & cursor, std::variant<Types...> *)
+  {
+    const uint8_t * start = cursor.p;
+    bool ok = false;
+    ((ok || (cursor.p = start, cursor.error = nullptr, ok = check<Types>(cursor))), ...);
+    if (!ok) {
+      return cursor.fail("Could not match any variant type with the MessagePack tag", start);
+    }
+    return true;
+  }
+
+  static void raise(const Result & result)
+  {
+    if (!result) {
+      throw std::runtime_error(
+        std::string(result.error) + " at byte " + std::to_string(result.offset));
+    }
+  }
+
+  Limits limits_;
+};
+
+}  // namespace serialization
+#endif  // MPACK_VALIDATOR_H
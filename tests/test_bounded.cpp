@@ -0,0 +1,204 @@
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <random>
+#include <string>
+#include <variant>
+
+#include "mpack_bounded.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::EncodeCompactFloat;
+using serialization::EncodeContext;
+using serialization::EncodeFixedWidth;
+using serialization::encode_bounded;
+using serialization::fixed_string;
+using serialization::max_encoded_size_v;
+using serialization::static_vector;
+using test_util::encode;
+
+namespace
+{
+
+// A fixed-shape message with per-field flags
+struct Heartbeat : MsgPackSerializable<Heartbeat>
+{
+  uint32_t sequence = 0;
+  int64_t uptime = 0;
+  double load = 0;
+  bool healthy = false;
+  fixed_string<12> host;
+  std::array<int16_t, 3> temperatures{};
+  std::optional<uint8_t> fault;
+  MsgPackExtension<4> status{5};
+  static constexpr auto get_fields()
+  {
+    using namespace serialization;
+    return std::make_tuple(
+      make_field("seq", &Heartbeat::sequence, EncodeFixedWidth),
+      make_field("uptime", &Heartbeat::uptime),
+      make_field("load", &Heartbeat::load, EncodeCompactFloat),
+      make_field("healthy", &Heartbeat::healthy),
+      make_field("host", &Heartbeat::host),
+      make_field("temperatures", &Heartbeat::temperatures),
+      make_field("fault", &Heartbeat::fault),
+      make_field("status", &Heartbeat::status));
+  }
+};
+
+// Encodes through BoundedWriter, checking the result against the bound
+template<typename T>
+std::string bounded(const T & value, uint32_t flags = serialization::EncodeDefault)
+{
+  std::array<char, max_encoded_size_v<T>> buffer;
+  const size_t size = encode_bounded(buffer.data(), value, flags);
+  if (size > max_encoded_size_v<T>) {
+    throw std::runtime_error("encode_bounded exceeded max_encoded_size_v");
+  }
+  return std::string(buffer.data(), size);
+}
+
+// BoundedWriter must match the TypeHandler under every flag combination
+template<typename T>
+void check_matches(const T & value)
+{
+  for (uint32_t flags : {0u, 1u, 4u, 5u}) {
+    CHECK_EQ(bounded(value, flags), encode(value, EncodeContext{flags}));
+  }
+}
+
+template<typename T>
+void check_integer_limits()
+{
+  using limits = std::numeric_limits<T>;
+  for (int64_t delta = -2; delta <= 2; ++delta) {
+    check_matches(static_cast<T>(limits::min() + (delta < 0 ? 0 : delta)));
+    check_matches(static_cast<T>(limits::max() - (delta < 0 ? 0 : delta)));
+  }
+  for (int64_t v : {-129, -128, -33, -32, -1, 0, 1, 127, 128, 255, 256, 65535, 65536}) {
+    if (v >= static_cast<int64_t>(limits::min()) &&
+      (v < 0 || static_cast<uint64_t>(v) <= static_cast<uint64_t>(limits::max())))
+    {
+      check_matches(static_cast<T>(v));
+    }
+  }
+}
+
+}  // namespace
+
+static_assert(max_encoded_size_v<bool> == 1);
+static_assert(max_encoded_size_v<int32_t> == 5);
+static_assert(max_encoded_size_v<uint64_t> == 9);
+static_assert(max_encoded_size_v<double> == 9);
+static_assert(max_encoded_size_v<fixed_string<15>> == 16);
+static_assert(max_encoded_size_v<fixed_string<32>> == 34);
+static_assert(max_encoded_size_v<MsgPackExtension<3>> == 6);
+static_assert(max_encoded_size_v<std::array<uint8_t, 16>> == 3 + 16 * 2);
+static_assert(max_encoded_size_v<X90IO> == 1 + 5 + 16 + 5 + 9);
+static_assert(!serialization::is_bounded_v<std::string>);
+static_assert(!serialization::is_bounded_v<X90Error>);
+
+TEST(bounded_integers_match_type_handler)
+{
+  check_integer_limits<int8_t>();
+  check_integer_limits<int16_t>();
+  check_integer_limits<int32_t>();
+  check_integer_limits<int64_t>();
+  check_integer_limits<uint8_t>();
+  check_integer_limits<uint16_t>();
+  check_integer_limits<uint32_t>();
+  check_integer_limits<uint64_t>();
+  check_matches(true);
+  check_matches(false);
+}
+
+TEST(bounded_floats_match_type_handler)
+{
+  const double inf = std::numeric_limits<double>::infinity();
+  for (double v : {0.0, -0.0, 1.5, 3.0, -7.0, 0.1, 1e300, -1e300, 4294967296.0, -2147483649.0,
+      1e19, inf, -inf, std::nan("")})
+  {
+    check_matches(v);
+    check_matches(static_cast<float>(v));
+  }
+}
+
+TEST(bounded_containers_match_type_handler)
+{
+  for (size_t n : {0, 1, 31, 32, 40}) {
+    check_matches(fixed_string<40>(std::string(n, 's')));
+  }
+  check_matches(std::array<int16_t, 3>{-300, 0, 300});
+  check_matches(static_vector<uint32_t, 20>{1, 70000, 3});
+  static_vector<uint32_t, 20> seventeen;
+  for (uint32_t i = 0; i < 17; ++i) {
+    seventeen.push_back(i * 5000);
+  }
+  check_matches(seventeen);
+  check_matches(std::optional<int32_t>());
+  check_matches(std::optional<int32_t>(-5));
+  check_matches(std::variant<bool, double>(2.0));
+  check_matches(std::variant<bool, double>(true));
+  check_matches(serialization::TaggedVariant<int8_t, fixed_string<5>>(fixed_string<5>("abc")));
+  check_matches(MsgPackExtension<1>(3));
+  check_matches(MsgPackExtension<3>(-2));
+  check_matches(MsgPackExtension<20>(7));
+}
+
+TEST(bounded_reflected_types_match_serializer)
+{
+  X90IO io{};
+  io.name = "fifteen_chars__";
+  io.data = 12.5;
+  CHECK_EQ(bounded(io), test_util::encode_message(io));
+  CHECK_EQ(bounded(io), encode(io));
+
+  // Per-field flags combine with the call's flags
+  Heartbeat beat;
+  beat.sequence = 7;
+  beat.uptime = -123456789;
+  beat.load = 2.0;
+  beat.healthy = true;
+  beat.host = "node-a";
+  beat.temperatures = {40, -5, 300};
+  beat.fault = 3;
+  check_matches(beat);
+}
+
+TEST(bounded_random_values_match)
+{
+  std::mt19937_64 rng(42);
+  for (int i = 0; i < 2000; ++i) {
+    Heartbeat beat;
+    beat.sequence = static_cast<uint32_t>(rng());
+    beat.uptime = static_cast<int64_t>(rng()) >> (rng() % 64);
+    beat.load = std::ldexp(static_cast<double>(static_cast<int64_t>(rng())), static_cast<int>(rng() % 80) - 70);
+    beat.host = std::string(rng() % 13, 'h');
+    beat.temperatures[1] = static_cast<int16_t>(rng());
+    if (rng() % 2) {
+      beat.fault = static_cast<uint8_t>(rng());
+    }
+    check_matches(beat);
+  }
+}
+
+TEST(bounded_to_msgpack_and_write_bounded)
+{
+  X90IO io{};
+  io.name = "io";
+  io.data = false;
+  serialization::bounded_buffer<X90IO> buffer;
+  const size_t size = serialization::to_msgpack(buffer, io);
+  CHECK_EQ(std::string(buffer.data(), size), test_util::encode_message(io));
+
+  // write_bounded declines when the writer lacks room for the bound
+  char small[max_encoded_size_v<X90IO> - 1];
+  mpack_writer_t writer;
+  mpack_writer_init(&writer, small, sizeof(small));
+  CHECK(!serialization::write_bounded(&writer, io));
+  CHECK_EQ(mpack_writer_buffer_used(&writer), size_t{0});
+  mpack_writer_destroy(&writer);
+}
@@ -0,0 +1,168 @@
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mpack_checksum.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::ChecksumFrame;
+using serialization::crc32c;
+using serialization::crc32c_combine;
+using serialization::crc32c_copy;
+
+namespace
+{
+
+std::string random_bytes(size_t size, uint32_t seed)
+{
+  std::mt19937 rng(seed);
+  std::string bytes(size, '\0');
+  for (char & c : bytes) {
+    c = static_cast<char>(rng());
+  }
+  return bytes;
+}
+
+// Writes a long string, then fails
+class FailingMessage : public Serializable
+{
+protected:
+  using Serializable::do_serialize;
+  using Serializable::do_deserialize;
+
+  void do_serialize(mpack_writer_t * writer) const override
+  {
+    const std::string long_string(10000, 'x');
+    mpack_write_str(writer, long_string.data(), static_cast<uint32_t>(long_string.size()));
+    mpack_writer_flag_error(writer, mpack_error_bug);
+  }
+
+  void do_deserialize(mpack_reader_t *) override {}
+};
+
+}  // namespace
+
+TEST(checksum_known_values)
+{
+  // RFC 3720, appendix B.4
+  CHECK_EQ(crc32c("123456789", 9), uint32_t{0xe3069283});
+  CHECK_EQ(crc32c("", 0), uint32_t{0});
+  const std::string zeros(32, '\0');
+  CHECK_EQ(crc32c(zeros.data(), zeros.size()), uint32_t{0x8a9136aa});
+  const std::string ones(32, '\xff');
+  CHECK_EQ(crc32c(ones.data(), ones.size()), uint32_t{0x62a8ab43});
+  std::string ascending(32, '\0');
+  std::string descending(32, '\0');
+  for (size_t i = 0; i < 32; ++i) {
+    ascending[i] = static_cast<char>(i);
+    descending[i] = static_cast<char>(31 - i);
+  }
+  CHECK_EQ(crc32c(ascending.data(), ascending.size()), uint32_t{0x46dd794e});
+  CHECK_EQ(crc32c(descending.data(), descending.size()), uint32_t{0x113fdb5c});
+}
+
+TEST(checksum_hardware_and_software_agree)
+{
+  namespace detail = serialization::crc32c_detail;
+  const std::string bytes = random_bytes(300, 48);
+  for (size_t offset = 0; offset < 9; ++offset) {
+    for (size_t size = 0; offset + size <= bytes.size(); size += 1 + size / 8) {
+      const uint8_t * s = reinterpret_cast<const uint8_t *>(bytes.data() + offset);
+      const uint32_t software = detail::update_software(0xffffffffu, nullptr, s, size);
+      CHECK_EQ(~software, crc32c(bytes.data() + offset, size));
+#if MPACK_CRC32C_X86
+      if (__builtin_cpu_supports("sse4.2")) {
+        CHECK_EQ(detail::update_sse42(0xffffffffu, nullptr, s, size), software);
+      }
+#endif
+      // Copying gives the same checksum and an exact copy
+      std::string copy(size + 1, '#');
+      CHECK_EQ(crc32c_copy(&copy[0], bytes.data() + offset, size), ~software);
+      CHECK_EQ(copy, bytes.substr(offset, size) + "#");
+    }
+  }
+}
+
+TEST(checksum_continue_and_combine)
+{
+  const std::string bytes = random_bytes(10000, 7);
+  const uint32_t whole = crc32c(bytes.data(), bytes.size());
+  for (size_t split : {size_t{0}, size_t{1}, size_t{7}, size_t{4096}, size_t{9999}, size_t{10000}}) {
+    const uint32_t first = crc32c(bytes.data(), split);
+    const uint32_t second = crc32c(bytes.data() + split, bytes.size() - split);
+    CHECK_EQ(crc32c(bytes.data() + split, bytes.size() - split, first), whole);
+    CHECK_EQ(crc32c_combine(first, second, bytes.size() - split), whole);
+  }
+}
+
+TEST(checksum_frames_detect_corruption)
+{
+  for (size_t size : {size_t{0}, size_t{1}, size_t{13}, size_t{500}}) {
+    const std::string payload = random_bytes(size, static_cast<uint32_t>(size));
+    std::string sealed(ChecksumFrame::kHeaderSize + size, '\0');
+    ChecksumFrame::seal_copy(&sealed[0], payload.data(), size);
+    CHECK_EQ(sealed.substr(ChecksumFrame::kHeaderSize), payload);
+
+    // The three ways of sealing agree
+    std::string in_place = std::string(ChecksumFrame::kHeaderSize, '\0') + payload;
+    ChecksumFrame::seal(&in_place[0], size);
+    CHECK_EQ(in_place, sealed);
+    std::string with_crc = std::string(ChecksumFrame::kHeaderSize, '\0') + payload;
+    ChecksumFrame::seal_with(&with_crc[0], size, crc32c(payload.data(), size));
+    CHECK_EQ(with_crc, sealed);
+
+    const uint32_t word = ChecksumFrame::load_u32(sealed.data());
+    CHECK(ChecksumFrame::has_checksum(word));
+    CHECK_EQ(ChecksumFrame::payload_size(word), uint32_t(size));
+    CHECK_EQ(ChecksumFrame::header_size(word), ChecksumFrame::kHeaderSize);
+    CHECK(ChecksumFrame::verify(sealed.data(), size));
+
+    // Any single bit flip is caught, except the flag, which turns the frame
+    // into a plain one of a different shape
+    for (size_t bit = 0; bit < 8 * sealed.size(); ++bit) {
+      if (bit == 31) {
+        continue;
+      }
+      std::string corrupt = sealed;
+      corrupt[bit / 8] ^= static_cast<char>(1 << (bit % 8));
+      const uint32_t length = ChecksumFrame::payload_size(ChecksumFrame::load_u32(corrupt.data()));
+      if (length <= size) {
+        CHECK(!ChecksumFrame::verify(corrupt.data(), length));
+      }
+    }
+  }
+
+  std::string plain(4, '\0');
+  ChecksumFrame::store_u32(&plain[0], 1234);
+  CHECK_EQ(ChecksumFrame::load_u32(plain.data()), uint32_t{1234});
+  CHECK_EQ(plain, std::string("\xd2\x04\x00\x00", 4));
+  CHECK(!ChecksumFrame::has_checksum(1234));
+  CHECK_EQ(ChecksumFrame::header_size(1234), ChecksumFrame::kPlainHeaderSize);
+}
+
+TEST(checksum_encode_in_one_pass)
+{
+  // Larger than one 4 KiB chunk, appended after existing bytes
+  X90Msg msg{};
+  msg.endpoint_id = "endpoint";
+  for (int g = 0; g < 50; ++g) {
+    X90IOGroup group{};
+    group.name = std::string(100, 'g');
+    group.errors.push_back(X90Error("e", "type", std::string(50, 'm')));
+    msg.io_groups.push_back(group);
+  }
+  const std::string expected = test_util::encode_message(msg);
+  CHECK(expected.size() > 2 * serialization::checksum_detail::kChunkSize);
+
+  std::vector<char> out = {'a', 'b'};
+  const uint32_t crc = serialization::encode_crc32c(msg, out, serialization::EncodeContext{});
+  CHECK_EQ(std::string(out.begin(), out.end()), "ab" + expected);
+  CHECK_EQ(crc, crc32c(expected.data(), expected.size()));
+
+  // A failed encode leaves out as it was
+  CHECK_THROWS(serialization::encode_crc32c(FailingMessage(), out, serialization::EncodeContext{}));
+  CHECK_EQ(out.size(), expected.size() + 2);
+}
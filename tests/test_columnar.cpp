@@ -0,0 +1,186 @@
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mpack_columnar.h"
+#include "test_util.h"
+
+using serialization::ColumnarReader;
+using serialization::ColumnarWriter;
+using test_util::TempDir;
+
+namespace
+{
+
+struct Point
+{
+  double x = 0;
+  std::string label;
+  static constexpr auto get_fields()
+  {
+    using namespace serialization;
+    return std::make_tuple(make_field("x", &Point::x), make_field("label", &Point::label));
+  }
+};
+
+struct Frame
+{
+  int64_t id = 0;
+  std::string source;
+  std::vector<Point> points;
+  static constexpr auto get_fields()
+  {
+    using namespace serialization;
+    return std::make_tuple(
+      make_field("id", &Frame::id),
+      make_field("source", &Frame::source),
+      make_field("points", &Frame::points));
+  }
+};
+
+Frame make_frame(int i)
+{
+  Frame frame;
+  frame.id = i;
+  frame.source = "cam" + std::to_string(i % 2);
+  for (int p = 0; p < i % 3; ++p) {
+    frame.points.push_back({i + p * 0.5, "p" + std::to_string(p)});
+  }
+  return frame;
+}
+
+// Writes chunk bytes, a footer and the trailer pointing at it
+std::string write_archive(const TempDir & dir, const std::string & chunks, const std::string & footer)
+{
+  const std::string path = dir.file("hostile.mpc");
+  std::string trailer(8, '\0');
+  serialization::io_detail::store_le(&trailer[0], chunks.size(), 8);
+  std::ofstream(path, std::ios::binary) << chunks << footer << trailer << "MPC1";
+  return path;
+}
+
+}  // namespace
+
+TEST(columnar_round_trip_with_child_table)
+{
+  TempDir dir;
+  const std::string path = dir.file("frames.mpc");
+  {
+    ColumnarWriter<Frame> writer(path, 4);
+    for (int i = 0; i < 10; ++i) {
+      writer.append(make_frame(i));
+    }
+    CHECK_EQ(writer.size(), uint64_t{10});
+  }
+
+  ColumnarReader reader(path);
+  CHECK_EQ(reader.column_count(), size_t{5});
+  CHECK_EQ(reader.column_name(2), std::string("points.#parent"));
+  CHECK_EQ(reader.block_count(), size_t{3});
+  CHECK_THROWS(reader.column("points.y"));
+
+  std::vector<int64_t> ids;
+  reader.read_column(reader.column("id"), ids);
+  CHECK_EQ(ids.size(), size_t{10});
+  CHECK_EQ(ids[9], int64_t{9});
+
+  std::vector<uint64_t> parents;
+  std::vector<double> xs;
+  reader.read_column(reader.column("points.#parent"), parents);
+  reader.read_column(reader.column("points.x"), xs);
+  size_t row = 0;
+  for (int i = 0; i < 10; ++i) {
+    for (int p = 0; p < i % 3; ++p, ++row) {
+      CHECK_EQ(parents[row], uint64_t(i));
+      CHECK_EQ(xs[row], i + p * 0.5);
+    }
+  }
+  CHECK_EQ(parents.size(), row);
+
+  // Rows keep counting across blocks
+  std::vector<uint64_t> rows;
+  reader.scan<std::string>(reader.column("source"), 1, [&](uint64_t r, const std::string &) {rows.push_back(r);});
+  CHECK_EQ(rows.front(), uint64_t{4});
+  CHECK_EQ(rows.size(), size_t{4});
+}
+
+TEST(columnar_block_statistics)
+{
+  TempDir dir;
+  const std::string path = dir.file("frames.mpc");
+  {
+    ColumnarWriter<Frame> writer(path, 5);
+    for (int i = 0; i < 10; ++i) {
+      writer.append(make_frame(i));
+    }
+  }
+  ColumnarReader reader(path);
+  const size_t id = reader.column("id");
+  CHECK(reader.stats(id, 0).may_overlap(0, 4));
+  CHECK(!reader.stats(id, 0).may_overlap(5, 100));
+  CHECK(reader.stats(id, 1).may_overlap(7, 7));
+  const size_t source = reader.column("source");
+  CHECK(reader.stats(source, 0).may_contain("cam1"));
+  CHECK(!reader.stats(source, 0).may_contain("lidar"));
+  CHECK_EQ(reader.row_count(id, 1), uint64_t{5});
+}
+
+TEST(columnar_rejects_non_archives)
+{
+  TempDir dir;
+  std::ofstream(dir.file("empty.mpc"));
+  CHECK_THROWS(ColumnarReader(dir.file("empty.mpc")));
+  std::ofstream(dir.file("bad.mpc"), std::ios::binary) << std::string(8, '\0') << "MPC2";
+  CHECK_THROWS(ColumnarReader(dir.file("bad.mpc")));
+
+  // Footer offset past the end of the file
+  std::string trailer(8, '\xff');
+  std::ofstream(dir.file("offset.mpc"), std::ios::binary) << trailer << "MPC1";
+  CHECK_THROWS(ColumnarReader(dir.file("offset.mpc")));
+
+  // Unknown version
+  CHECK_THROWS(ColumnarReader(write_archive(dir, "", std::string("\x93\x02\x90\x90", 4))));
+  // Truncated footer
+  CHECK_THROWS(ColumnarReader(write_archive(dir, "", std::string("\x93\x01\x91", 3))));
+}
+
+TEST(columnar_hostile_footer_counts)
+{
+  TempDir dir;
+  // 2^32-1 column names in a footer of a few bytes
+  CHECK_THROWS(ColumnarReader(write_archive(dir, "", std::string("\x93\x01\xdd\xff\xff\xff\xff\x90", 8))));
+  // One column, 2^32-1 blocks
+  CHECK_THROWS(ColumnarReader(write_archive(
+    dir, "", std::string("\x93\x01\x91\xa1" "a\xdd\xff\xff\xff\xff\x91\x94\x00\x00\x00\xc0", 16))));
+}
+
+TEST(columnar_hostile_chunk_entries)
+{
+  TempDir dir;
+  const std::string chunk("\x01\x02\x03", 3);
+  const std::string prefix("\x93\x01\x91\xa1" "a\x91\x91\x94", 8);
+  // A well-formed entry reads back
+  {
+    ColumnarReader reader(write_archive(dir, chunk, prefix + std::string("\x00\x03\x03\xc0", 4)));
+    std::vector<int> values;
+    reader.read_column(0, values);
+    CHECK(values == std::vector<int>({1, 2, 3}));
+  }
+  // Offset past the footer
+  CHECK_THROWS(ColumnarReader(write_archive(dir, chunk, prefix + std::string("\x04\x01\x01\xc0", 4))));
+  // Length reaching into the footer
+  CHECK_THROWS(ColumnarReader(write_archive(dir, chunk, prefix + std::string("\x01\x03\x01\xc0", 4))));
+  // More values than bytes
+  CHECK_THROWS(ColumnarReader(write_archive(dir, chunk, prefix + std::string("\x00\x03\x04\xc0", 4))));
+  // Huge offset that would wrap offset + length
+  CHECK_THROWS(ColumnarReader(write_archive(
+    dir, chunk, prefix + std::string("\xcf\xff\xff\xff\xff\xff\xff\xff\xff\x03\x01\xc0", 12))));
+  // Count within bounds but values do not decode as the column type
+  {
+    ColumnarReader reader(write_archive(dir, chunk, prefix + std::string("\x00\x03\x03\xc0", 4)));
+    std::vector<std::string> values;
+    CHECK_THROWS(reader.read_column(0, values));
+  }
+}
@@ -0,0 +1,86 @@
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::EncodeCompactFloat;
+using test_util::decode;
+using test_util::decode_node;
+using test_util::encode;
+
+namespace
+{
+
+bool same_bits(double a, double b)
+{
+  return std::memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+}  // namespace
+
+TEST(compact_float_double_sizes)
+{
+  CHECK_EQ(encode(200.0).size(), size_t{9});
+  CHECK_EQ(encode(200.0, {EncodeCompactFloat}), std::string("\xcc\xc8", 2));
+  CHECK_EQ(encode(-3.0, {EncodeCompactFloat}), std::string("\xfd", 1));
+  CHECK_EQ(encode(0.5, {EncodeCompactFloat}).size(), size_t{5});
+  CHECK_EQ(encode(0.1, {EncodeCompactFloat}).size(), size_t{9});
+}
+
+TEST(compact_float_double_round_trip_is_bit_exact)
+{
+  const double values[] = {
+    0.0, -0.0, 1.0, -1.0, 0.5, 0.1, 1e-45, 3.4028234663852886e38, 1e300,
+    4294967295.0, 4294967296.0, -2147483648.0, -2147483649.0, 9007199254740992.0,
+    18446744073709549568.0, -9223372036854775808.0,
+    std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(),
+    std::numeric_limits<double>::denorm_min(),
+  };
+  for (double value : values) {
+    const std::string bytes = encode(value, {EncodeCompactFloat});
+    CHECK(bytes.size() <= encode(value).size());
+    CHECK(same_bits(decode<double>(bytes), value));
+    CHECK(same_bits(decode_node<double>(bytes), value));
+  }
+  const double nan = decode<double>(encode(std::nan(""), {EncodeCompactFloat}));
+  CHECK(std::isnan(nan));
+}
+
+TEST(compact_float_negative_zero_stays_a_float)
+{
+  const std::string bytes = encode(-0.0, {EncodeCompactFloat});
+  CHECK_EQ(static_cast<uint8_t>(bytes[0]), 0xca);
+  CHECK(std::signbit(decode<double>(bytes)));
+}
+
+TEST(compact_float_float32_as_int)
+{
+  CHECK_EQ(encode(3.0f, {EncodeCompactFloat}), std::string("\x03", 1));
+  CHECK_EQ(encode(2.5f, {EncodeCompactFloat}).size(), size_t{5});
+  CHECK_EQ(decode<float>(encode(3.0f, {EncodeCompactFloat})), 3.0f);
+  CHECK_EQ(decode<float>(encode(-70000.0f, {EncodeCompactFloat})), -70000.0f);
+}
+
+TEST(compact_float_message_is_smaller_and_equal)
+{
+  X90Msg msg{};
+  msg.endpoint_id = "Endpoint123";
+  X90IOGroup group{};
+  group.name = "Group1";
+  X90IO io;
+  io.name = "IO2";
+  io.data = 200.0;
+  group.ios.push_back(io);
+  msg.io_groups.push_back(group);
+
+  const std::string plain = test_util::encode_message(msg);
+  const std::string compact = test_util::encode_message(msg, {EncodeCompactFloat});
+  CHECK(compact.size() < plain.size());
+
+  X90Msg restored{};
+  test_util::decode_message(compact, restored);
+  CHECK_EQ(restored.io_groups.size(), size_t{1});
+  CHECK(std::get<double>(restored.io_groups[0].ios[0].data) == 200.0);
+}
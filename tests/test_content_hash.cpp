@@ -0,0 +1,171 @@
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mpack_content_hash.h"
+#include "mpack_string_dictionary.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::ContentHasher;
+using serialization::EncodeCanonical;
+using serialization::EncodeContext;
+
+namespace
+{
+
+class Tagged : public MsgPackSerializable<Tagged>
+{
+public:
+  std::unordered_map<std::string, double> values;
+  std::unordered_map<int32_t, std::string> names;
+  static constexpr auto get_fields()
+  {
+    using namespace serialization;
+    return std::make_tuple(make_field("values", &Tagged::values), make_field("names", &Tagged::names));
+  }
+};
+
+// The same entries, inserted in opposite orders into differently sized tables
+std::pair<Tagged, Tagged> equal_pair()
+{
+  Tagged a;
+  Tagged b;
+  b.values.reserve(1000);
+  b.names.reserve(1000);
+  for (int i = 0; i < 50; ++i) {
+    a.values["key" + std::to_string(i)] = i * 1.5;
+    a.names[i * 7 - 100] = "name" + std::to_string(i);
+  }
+  for (int i = 49; i >= 0; --i) {
+    b.values["key" + std::to_string(i)] = i * 1.5;
+    b.names[i * 7 - 100] = "name" + std::to_string(i);
+  }
+  return {a, b};
+}
+
+X90IOGroup make_group(const std::string & name)
+{
+  X90IOGroup group{};
+  group.name = name;
+  group.time_recorded = 1000;
+  for (int i = 0; i < 300; ++i) {
+    X90IO io{};
+    io.name = "io" + std::to_string(i);
+    io.data = i * 2.0;
+    group.ios.push_back(io);
+  }
+  return group;
+}
+
+// Writes a long string, then fails
+class FailingMessage : public Serializable
+{
+protected:
+  using Serializable::do_serialize;
+  using Serializable::do_deserialize;
+
+  void do_serialize(mpack_writer_t * writer) const override
+  {
+    const std::string long_string(10000, 'x');
+    mpack_write_str(writer, long_string.data(), static_cast<uint32_t>(long_string.size()));
+    mpack_writer_flag_error(writer, mpack_error_bug);
+  }
+
+  void do_deserialize(mpack_reader_t *) override {}
+};
+
+}  // namespace
+
+TEST(content_hash_xxh64_reference_values)
+{
+  CHECK_EQ(ContentHasher::hash("", 0), uint64_t{0xef46db3751d8e999});
+  CHECK_EQ(ContentHasher::hash("a", 1), uint64_t{0xd24ec4f1a98c6e5b});
+  CHECK_EQ(ContentHasher::hash("abc", 3), uint64_t{0x44bc2cf5ad770999});
+  const std::string long_input = "Nobody inspects the spammish repetition";
+  CHECK_EQ(ContentHasher::hash(long_input.data(), long_input.size()), uint64_t{0xfbcea83c8a378bf1});
+  CHECK_EQ(ContentHasher::hash("xxhash", 6), uint64_t{0x32dd38952c4bc720});
+  CHECK_EQ(ContentHasher::hash("xxhash", 6, 20141025), uint64_t{0xb559b98d844e0635});
+}
+
+TEST(content_hash_independent_of_splits)
+{
+  std::mt19937 rng(49);
+  std::string bytes(200, '\0');
+  for (char & c : bytes) {
+    c = static_cast<char>(rng());
+  }
+  for (size_t size : {size_t{0}, size_t{5}, size_t{31}, size_t{32}, size_t{33}, size_t{64}, size_t{200}}) {
+    const uint64_t expected = ContentHasher::hash(bytes.data(), size);
+    for (size_t split = 0; split <= size; ++split) {
+      ContentHasher hasher;
+      hasher.update(bytes.data(), split);
+      hasher.update(bytes.data() + split, size - split);
+      CHECK_EQ(hasher.digest(), expected);
+    }
+    ContentHasher bytewise;
+    for (size_t i = 0; i < size; ++i) {
+      bytewise.update(bytes.data() + i, 1);
+    }
+    CHECK_EQ(bytewise.digest(), expected);
+    // reset() starts over
+    bytewise.reset();
+    bytewise.update(bytes.data(), size);
+    CHECK_EQ(bytewise.digest(), expected);
+  }
+}
+
+TEST(content_hash_canonical_encoding_is_deterministic)
+{
+  const auto [a, b] = equal_pair();
+  const EncodeContext canonical{EncodeCanonical};
+  const std::string bytes = test_util::encode_message(a, canonical);
+  CHECK_EQ(test_util::encode_message(b, canonical), bytes);
+  CHECK_EQ(serialization::content_hash(a), serialization::content_hash(b));
+  CHECK_EQ(serialization::content_hash(a), ContentHasher::hash(bytes.data(), bytes.size()));
+
+  // Keys come out sorted and integral doubles shrink
+  Tagged small;
+  small.values = {{"b", 2.0}, {"a", 1.5}};
+  static const char kExpected[] = "\x82\xa6" "values\x82\xa1" "a\xca\x3f\xc0\x00\x00\xa1" "b\x02\xa5" "names\x80";
+  CHECK_EQ(test_util::encode_message(small, canonical), std::string(kExpected, sizeof(kExpected) - 1));
+
+  // Canonical bytes decode to the same object
+  Tagged decoded;
+  test_util::decode_message(bytes, decoded);
+  CHECK(decoded.values == a.values);
+  CHECK(decoded.names == a.names);
+}
+
+TEST(content_hash_deduplicates_groups)
+{
+  const X90IOGroup first = make_group("group");
+  const X90IOGroup same = make_group("group");
+  const X90IOGroup other = make_group("group2");
+  CHECK_EQ(serialization::content_hash(first), serialization::content_hash(same));
+  CHECK(serialization::content_hash(first) != serialization::content_hash(other));
+
+  // One pass gives the bytes and their hash; more than one 4 KiB chunk
+  std::vector<char> out = {'x'};
+  const uint64_t hash = serialization::encode_hashed(first, out);
+  const std::string expected = test_util::encode_message(first, EncodeContext{EncodeCanonical});
+  CHECK(expected.size() > serialization::content_hash_detail::kChunkSize);
+  CHECK_EQ(std::string(out.begin() + 1, out.end()), expected);
+  CHECK_EQ(hash, serialization::content_hash(first));
+}
+
+TEST(content_hash_errors)
+{
+  serialization::StringDictionary dictionary;
+  EncodeContext ctx{EncodeCanonical};
+  ctx.dictionary = &dictionary;
+  CHECK_THROWS(serialization::content_hash(make_group("g"), ctx));
+
+  std::vector<char> out = {'x'};
+  CHECK_THROWS(serialization::encode_hashed(FailingMessage(), out));
+  CHECK_EQ(out.size(), size_t{1});
+  CHECK_THROWS(serialization::content_hash(FailingMessage()));
+}
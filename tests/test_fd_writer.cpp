@@ -0,0 +1,186 @@
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mpack_fd_writer.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::ChecksumFrame;
+using serialization::FdWriter;
+using test_util::TempDir;
+
+namespace
+{
+
+X90Error make_error(size_t length)
+{
+  return X90Error("name", "type", std::string(length, 'e'));
+}
+
+FdWriter::FlushPolicy small_policy()
+{
+  FdWriter::FlushPolicy policy;
+  policy.buffer_bytes = 256;
+  policy.flush_bytes = 200;
+  policy.max_delay = std::chrono::hours(1);
+  return policy;
+}
+
+std::string read_file(const std::string & path)
+{
+  std::ifstream file(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file), {});
+}
+
+// Splits a stream of ChecksumFrame frames, checking each CRC
+std::vector<std::string> split_frames(const std::string & bytes)
+{
+  std::vector<std::string> payloads;
+  size_t pos = 0;
+  while (pos < bytes.size()) {
+    const uint32_t word = ChecksumFrame::load_u32(bytes.data() + pos);
+    const size_t header = ChecksumFrame::header_size(word);
+    const uint32_t length = ChecksumFrame::payload_size(word);
+    if (!ChecksumFrame::has_checksum(word) || pos + header + length > bytes.size() ||
+      !ChecksumFrame::verify(bytes.data() + pos, length))
+    {
+      throw std::runtime_error("bad frame");
+    }
+    payloads.emplace_back(bytes.data() + pos + header, length);
+    pos += header + length;
+  }
+  return payloads;
+}
+
+// A file descriptor closed on scope exit
+struct Fd
+{
+  int fd;
+  explicit Fd(int f) : fd(f) {}
+  ~Fd() { ::close(fd); }
+};
+
+}  // namespace
+
+TEST(fd_writer_messages_arrive_in_order)
+{
+  TempDir dir;
+  Fd file(::open(dir.file("out").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  std::string expected;
+  {
+    FdWriter writer(file.fd, small_policy());
+    // Small, buffer-sized and larger-than-buffer messages, through both paths
+    for (size_t length : {1, 10, 180, 250, 1000, 5, 4000, 3}) {
+      const X90Error error = make_error(length);
+      const std::string bytes = test_util::encode_message(error);
+      expected += bytes + bytes;
+      writer.write(error);
+      writer.write_raw(bytes.data(), bytes.size());
+    }
+    writer.flush();
+    CHECK_EQ(writer.messages(), uint64_t{16});
+    CHECK_EQ(writer.bytes_written(), uint64_t(expected.size()));
+    CHECK_EQ(writer.buffered(), size_t{0});
+    // Batched: far fewer writes than messages
+    CHECK(writer.write_calls() < 16);
+  }
+  CHECK_EQ(read_file(dir.file("out")), expected);
+}
+
+TEST(fd_writer_framed_messages_verify)
+{
+  TempDir dir;
+  Fd file(::open(dir.file("out").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  std::vector<std::string> expected;
+  {
+    FdWriter writer(file.fd, small_policy());
+    for (size_t length : {1, 240, 3000, 20}) {
+      const X90Error error = make_error(length);
+      const std::string bytes = test_util::encode_message(error);
+      writer.write_framed(error);
+      writer.write_framed(bytes.data(), bytes.size());
+      expected.push_back(bytes);
+      expected.push_back(bytes);
+    }
+    writer.flush();
+  }
+  CHECK(split_frames(read_file(dir.file("out"))) == expected);
+}
+
+TEST(fd_writer_flush_policy)
+{
+  TempDir dir;
+  Fd file(::open(dir.file("out").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  FdWriter::FlushPolicy policy = small_policy();
+  FdWriter writer(file.fd, policy);
+  writer.write(make_error(10));
+  CHECK(writer.buffered() > 0);
+  CHECK(!writer.flush_if_due());
+  CHECK_EQ(writer.write_calls(), uint64_t{0});
+
+  // Reaching flush_bytes writes everything out
+  writer.write(make_error(150));
+  CHECK_EQ(writer.buffered(), size_t{0});
+  CHECK_EQ(writer.write_calls(), uint64_t{1});
+
+  policy.max_delay = std::chrono::steady_clock::duration::zero();
+  FdWriter eager(file.fd, policy);
+  eager.write(make_error(1));
+  CHECK_EQ(eager.buffered(), size_t{0});
+}
+
+TEST(fd_writer_through_a_pipe)
+{
+  int fds[2];
+  CHECK(::pipe(fds) == 0);
+  Fd read_end(fds[0]);
+  std::string received;
+  std::thread reader([&received, fd = fds[0]] {
+    char chunk[4096];
+    ssize_t n;
+    while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) {
+      received.append(chunk, static_cast<size_t>(n));
+    }
+  });
+
+  std::string expected;
+  {
+    Fd write_end(fds[1]);
+    FdWriter writer(write_end.fd);
+    for (int i = 0; i < 200; ++i) {
+      const X90Error error = make_error(static_cast<size_t>(i * 37 % 2000));
+      expected += test_util::encode_message(error);
+      writer.write(error);
+    }
+    // Larger than the pipe buffer
+    const X90Error big = make_error(300000);
+    expected += test_util::encode_message(big);
+    writer.write(big);
+    writer.flush();
+  }
+  reader.join();
+  CHECK(received == expected);
+}
+
+TEST(fd_writer_reports_write_errors)
+{
+  TempDir dir;
+  std::ofstream(dir.file("readonly"));
+  Fd file(::open(dir.file("readonly").c_str(), O_RDONLY));
+  FdWriter writer(file.fd, small_policy());
+  writer.write(make_error(10));
+  CHECK_THROWS(writer.flush());
+  CHECK_THROWS(writer.write(make_error(10)));
+
+  FdWriter raw(file.fd, small_policy());
+  const std::string big(1000, 'x');
+  CHECK_THROWS(raw.write_raw(big.data(), big.size()));
+}
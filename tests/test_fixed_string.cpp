@@ -0,0 +1,71 @@
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "mpack_fixed_string.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::fixed_string;
+using test_util::decode;
+using test_util::decode_node;
+using test_util::encode;
+
+static_assert(std::is_trivially_copyable_v<fixed_string<15>>);
+static_assert(sizeof(fixed_string<15>::size_type) == 1);
+static_assert(sizeof(fixed_string<300>::size_type) == 2);
+
+TEST(fixed_string_assign_and_compare)
+{
+  fixed_string<8> s("abc");
+  CHECK_EQ(s.size(), size_t{3});
+  CHECK(s == "abc");
+  CHECK_EQ(std::string(s.c_str()), std::string("abc"));
+  s = std::string("12345678");
+  CHECK(s == "12345678");
+  CHECK_THROWS(s = "123456789");
+  CHECK(fixed_string<8>("a") < fixed_string<8>("b"));
+  s.clear();
+  CHECK(s.empty());
+}
+
+TEST(fixed_string_encodes_like_std_string)
+{
+  CHECK_EQ(encode(fixed_string<15>("IO1")), encode(std::string("IO1")));
+  CHECK_EQ(encode(fixed_string<40>(std::string(33, 'x'))), encode(std::string(33, 'x')));
+}
+
+TEST(fixed_string_round_trip_at_capacity)
+{
+  const std::string full(15, 'n');
+  CHECK(decode<fixed_string<15>>(encode(full)) == full);
+  CHECK(decode_node<fixed_string<15>>(encode(full)) == full);
+  CHECK(decode<fixed_string<15>>(encode(std::string())).empty());
+}
+
+TEST(fixed_string_rejects_longer_input)
+{
+  const std::string bytes = encode(std::string(16, 'n'));
+  CHECK_THROWS(decode<fixed_string<15>>(bytes));
+  CHECK_THROWS(decode_node<fixed_string<15>>(bytes));
+  CHECK_THROWS(decode<fixed_string<15>>(encode(int64_t{1})));
+  // Truncated str: header says 10 bytes, 2 follow
+  CHECK_THROWS(decode<fixed_string<15>>(std::string("\xaa" "ab", 3)));
+}
+
+TEST(fixed_string_x90_names_are_limited_to_15_bytes)
+{
+  X90IO io;
+  io.name = "fifteen_chars__";
+  io.data = true;
+  X90IO restored;
+  test_util::decode_message(test_util::encode_message(io), restored);
+  CHECK(restored.name == "fifteen_chars__");
+
+  // A producer that still sends a longer std::string name is rejected
+  std::string longer = test_util::encode_message(io);
+  const std::string name = encode(std::string("fifteen_chars__"));
+  longer.replace(longer.find(name), name.size(), encode(std::string("sixteen_chars___")));
+  CHECK_THROWS(test_util::decode_message(longer, restored));
+}
@@ -0,0 +1,33 @@
+#include <cstring>
+#include <exception>
+#include <iostream>
+
+#include "test_util.h"
+
+// Runs every registered test whose name starts with argv[1], or all of them
+int main(int argc, char ** argv)
+{
+  const char * prefix = argc > 1 ? argv[1] : "";
+  size_t run = 0;
+  size_t failed = 0;
+  for (const test_util::TestCase & test : test_util::registry()) {
+    if (std::strncmp(test.name, prefix, std::strlen(prefix)) != 0) {
+      continue;
+    }
+    ++run;
+    try {
+      test.fn();
+    } catch (const std::exception & e) {
+      ++failed;
+      std::cerr << "FAIL " << test.name << ": " << e.what() << '\n';
+      continue;
+    }
+    std::cout << "ok   " << test.name << '\n';
+  }
+  std::cout << run - failed << "/" << run << " tests passed\n";
+  if (run == 0) {
+    std::cerr << "No tests match \"" << prefix << "\"\n";
+    return 1;
+  }
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,84 @@
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+#include "mpack_flat_map.h"
+#include "test_util.h"
+
+using serialization::flat_map;
+using test_util::decode;
+using test_util::decode_node;
+using test_util::encode;
+
+namespace
+{
+
+// {"b": 1, "a": 2, "b": 3} as written by a producer that repeats a key
+const std::string kRepeatedKey("\x83\xa1" "b\x01\xa1" "a\x02\xa1" "b\x03", 10);
+
+}  // namespace
+
+TEST(maps_flat_map_lookup_and_order)
+{
+  flat_map<std::string, int> m{{"c", 3}, {"a", 1}, {"b", 2}};
+  CHECK_EQ(m.size(), size_t{3});
+  CHECK_EQ(m.begin()->first, std::string("a"));
+  CHECK_EQ(m.at("b"), 2);
+  CHECK(!m.contains("z"));
+  CHECK_THROWS(m.at("z"));
+  m["d"] = 4;
+  CHECK_EQ((m.end() - 1)->first, std::string("d"));
+  CHECK_EQ(m.erase("a"), size_t{1});
+  CHECK_EQ(m.begin()->first, std::string("b"));
+}
+
+TEST(maps_flat_map_round_trip_sorted)
+{
+  const flat_map<std::string, int64_t> m{{"x", -1}, {"alpha", 1}, {"mid", 7}};
+  const std::string bytes = encode(m);
+  CHECK(decode<flat_map<std::string, int64_t>>(bytes) == m);
+  CHECK(decode_node<flat_map<std::string, int64_t>>(bytes) == m);
+
+  // Unsorted input from another producer is sorted on decode
+  const std::string unsorted("\x82\xa1" "z\x01\xa1" "a\x02", 7);
+  const auto decoded = decode<flat_map<std::string, int>>(unsorted);
+  CHECK_EQ(decoded.begin()->first, std::string("a"));
+  CHECK_EQ(decoded.at("z"), 1);
+}
+
+TEST(maps_repeated_key_last_wins)
+{
+  CHECK_EQ((decode<flat_map<std::string, int>>(kRepeatedKey).at("b")), 3);
+  CHECK_EQ((decode_node<flat_map<std::string, int>>(kRepeatedKey).at("b")), 3);
+  CHECK_EQ((decode<std::map<std::string, int>>(kRepeatedKey).at("b")), 3);
+  CHECK_EQ((decode_node<std::map<std::string, int>>(kRepeatedKey).at("b")), 3);
+  CHECK_EQ((decode<std::unordered_map<std::string, int>>(kRepeatedKey).at("b")), 3);
+  CHECK_EQ((decode_node<std::unordered_map<std::string, int>>(kRepeatedKey).at("b")), 3);
+  CHECK_EQ((decode<std::map<std::string, int>>(kRepeatedKey).size()), size_t{2});
+}
+
+TEST(maps_std_map_and_unordered_map_round_trip)
+{
+  const std::map<int64_t, std::string> ordered{{3, "c"}, {-1, "neg"}, {1000, "k"}};
+  CHECK(decode<std::map<int64_t, std::string>>(encode(ordered)) == ordered);
+  CHECK(decode_node<std::map<int64_t, std::string>>(encode(ordered)) == ordered);
+
+  std::unordered_map<std::string, double> hashed;
+  for (int i = 0; i < 100; ++i) {
+    hashed["key" + std::to_string(i)] = i * 0.5;
+  }
+  CHECK(decode<std::unordered_map<std::string, double>>(encode(hashed)) == hashed);
+  CHECK(decode_node<std::unordered_map<std::string, double>>(encode(hashed)) == hashed);
+}
+
+TEST(maps_hostile_count_is_rejected)
+{
+  // map32 claiming 2^32-1 entries followed by one entry
+  const std::string hostile("\xdf\xff\xff\xff\xff\x01\x02", 7);
+  CHECK_THROWS((decode<flat_map<int, int>>(hostile)));
+  CHECK_THROWS((decode<std::map<int, int>>(hostile)));
+  CHECK_THROWS((decode<std::unordered_map<int, int>>(hostile)));
+  CHECK_THROWS((decode_node<flat_map<int, int>>(hostile)));
+  CHECK_THROWS((decode<std::map<int, int>>(std::string("\x91\x01", 2))));
+}
@@ -0,0 +1,187 @@
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mpack_message_log.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::MessageLogReader;
+using serialization::MessageLogWriter;
+using test_util::TempDir;
+
+namespace
+{
+
+X90Error make_record(int i)
+{
+  return X90Error("node_" + std::to_string(i), "type", std::string(i % 7 * 10, 'e'));
+}
+
+void check_record(const MessageLogReader & reader, uint64_t index, int i)
+{
+  X90Error decoded;
+  reader.read(index, decoded);
+  const X90Error expected = make_record(i);
+  CHECK_EQ(decoded.name, expected.name);
+  CHECK_EQ(decoded.error, expected.error);
+}
+
+std::string first_segment(const TempDir & dir, const char * ext)
+{
+  return dir.file(std::string("00000000000000000000") + ext);
+}
+
+void resize_file(const std::string & path, int delta)
+{
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) + delta);
+}
+
+// Flips one byte of a file in place
+void corrupt(const std::string & path, uint64_t offset)
+{
+  std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+  file.seekg(static_cast<std::streamoff>(offset));
+  char byte = static_cast<char>(file.get());
+  file.seekp(static_cast<std::streamoff>(offset));
+  file.put(static_cast<char>(byte ^ 0x5a));
+}
+
+}  // namespace
+
+TEST(message_log_round_trip_across_segments)
+{
+  TempDir dir;
+  {
+    MessageLogWriter writer(dir.path(), 256);
+    for (int i = 0; i < 50; ++i) {
+      CHECK_EQ(writer.append(make_record(i)), uint64_t(i));
+    }
+  }
+  CHECK(std::distance(std::filesystem::directory_iterator(dir.path()), {}) > 2);
+
+  MessageLogReader reader(dir.path());
+  CHECK_EQ(reader.first(), uint64_t{0});
+  CHECK_EQ(reader.size(), uint64_t{50});
+  for (int i = 0; i < 50; ++i) {
+    check_record(reader, i, i);
+  }
+  CHECK_THROWS(reader.record(50));
+
+  std::vector<uint64_t> replayed;
+  reader.replay([&](uint64_t index, std::string_view) {replayed.push_back(index);}, 45);
+  CHECK_EQ(replayed.size(), size_t{5});
+  CHECK_EQ(replayed.front(), uint64_t{45});
+}
+
+TEST(message_log_reopen_resumes_and_refresh_sees_new_records)
+{
+  TempDir dir;
+  {
+    MessageLogWriter writer(dir.path());
+    writer.append(make_record(0));
+    writer.append(make_record(1));
+  }
+  MessageLogReader reader(dir.path());
+  MessageLogWriter writer(dir.path());
+  CHECK_EQ(writer.size(), uint64_t{2});
+  CHECK_EQ(writer.append(make_record(2)), uint64_t{2});
+  const std::string raw = test_util::encode_message(make_record(3));
+  CHECK_EQ(writer.append_raw(raw.data(), raw.size()), uint64_t{3});
+  writer.sync();
+
+  CHECK_EQ(reader.size(), uint64_t{2});
+  reader.refresh();
+  CHECK_EQ(reader.size(), uint64_t{4});
+  check_record(reader, 2, 2);
+  CHECK_EQ(std::string(reader.record(3)), raw);
+}
+
+TEST(message_log_recovers_torn_tail)
+{
+  for (bool checksum : {false, true}) {
+    TempDir dir;
+    {
+      MessageLogWriter writer(dir.path(), 64ull << 20, checksum);
+      for (int i = 0; i < 3; ++i) {
+        writer.append(make_record(i));
+      }
+    }
+    // A crash halfway through the last frame
+    resize_file(first_segment(dir, ".log"), -2);
+    {
+      MessageLogWriter writer(dir.path(), 64ull << 20, checksum);
+      CHECK_EQ(writer.size(), uint64_t{2});
+      CHECK_EQ(writer.append(make_record(5)), uint64_t{2});
+    }
+    MessageLogReader reader(dir.path());
+    CHECK_EQ(reader.size(), uint64_t{3});
+    check_record(reader, 1, 1);
+    check_record(reader, 2, 5);
+  }
+}
+
+TEST(message_log_indexes_unindexed_frames_and_drops_torn_index)
+{
+  TempDir dir;
+  {
+    MessageLogWriter writer(dir.path());
+    for (int i = 0; i < 3; ++i) {
+      writer.append(make_record(i));
+    }
+  }
+  // The last frame made it to the log but not its index entry, and a
+  // partial entry follows
+  resize_file(first_segment(dir, ".idx"), -8);
+  resize_file(first_segment(dir, ".idx"), 3);
+  {
+    MessageLogWriter writer(dir.path());
+    CHECK_EQ(writer.size(), uint64_t{3});
+  }
+  CHECK_EQ(std::filesystem::file_size(first_segment(dir, ".idx")), uintmax_t{24});
+  MessageLogReader reader(dir.path());
+  check_record(reader, 2, 2);
+}
+
+TEST(message_log_checksum_catches_corruption)
+{
+  TempDir dir;
+  {
+    MessageLogWriter writer(dir.path(), 64ull << 20, true);
+    for (int i = 0; i < 4; ++i) {
+      writer.append(make_record(i));
+    }
+  }
+  const std::string log = first_segment(dir, ".log");
+
+  // A flipped byte in an earlier record fails that record only
+  corrupt(log, 12);
+  MessageLogReader reader(dir.path());
+  CHECK_THROWS(reader.record(0));
+  check_record(reader, 3, 3);
+
+  // A corrupted last record is dropped when the writer reopens
+  corrupt(log, std::filesystem::file_size(log) - 1);
+  {
+    MessageLogWriter writer(dir.path(), 64ull << 20, true);
+    CHECK_EQ(writer.size(), uint64_t{3});
+  }
+  reader.refresh();
+  CHECK_EQ(reader.size(), uint64_t{3});
+  check_record(reader, 2, 2);
+}
+
+TEST(message_log_plain_record_with_garbage_length)
+{
+  TempDir dir;
+  {
+    MessageLogWriter writer(dir.path());
+    writer.append(make_record(1));
+  }
+  // Length prefix pointing far past the end of the segment
+  corrupt(first_segment(dir, ".log"), 2);
+  MessageLogReader reader(dir.path());
+  CHECK_THROWS(reader.record(0));
+}
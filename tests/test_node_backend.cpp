@@ -0,0 +1,115 @@
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mpack_node_backend.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::MessageTree;
+
+namespace
+{
+
+X90Msg make_message(size_t groups)
+{
+  X90Msg msg{};
+  msg.endpoint_id = "endpoint";
+  msg.current_time = 1622547800;
+  for (size_t g = 0; g < groups; ++g) {
+    X90IOGroup group{};
+    group.name = "group" + std::to_string(g);
+    group.time_recorded = 1000 + g;
+    group.is_fail = g % 3 == 0;
+    for (int i = 0; i < 3; ++i) {
+      X90IO io{};
+      io.name = "io" + std::to_string(i);
+      io.data = i * 2.5;
+      group.ios.push_back(io);
+    }
+    group.errors.push_back(X90Error("e" + std::to_string(g), "type", "message"));
+    msg.io_groups.push_back(group);
+  }
+  return msg;
+}
+
+}  // namespace
+
+TEST(node_backend_decode_matches_reader)
+{
+  const std::string bytes = test_util::encode_message(make_message(5));
+  MessageTree tree(1);
+  tree.parse(bytes.data(), bytes.size());
+  CHECK(tree.pool_capacity() > 1);
+  CHECK_EQ(tree.size(), bytes.size());
+
+  X90Msg from_tree;
+  tree.decode(from_tree);
+  CHECK_EQ(test_util::encode_message(from_tree), bytes);
+
+  // The same tree decodes again, and by sub-tree
+  X90Msg again;
+  tree.decode(again);
+  CHECK_EQ(again.io_groups.size(), size_t{5});
+  std::vector<X90IOGroup> groups;
+  tree.decode(tree.find(tree.root(), "IOGroups"), groups);
+  CHECK_EQ(groups[4].name, std::string("group4"));
+  CHECK(mpack_node_is_missing(tree.find(tree.root(), "Absent")));
+
+  tree.trim(4);
+  CHECK_EQ(tree.pool_capacity(), size_t{4});
+  CHECK_THROWS(tree.root());
+}
+
+TEST(node_backend_rejects_bad_input)
+{
+  MessageTree tree;
+  CHECK_THROWS(tree.root());
+  const std::string bytes = test_util::encode_message(make_message(2));
+  CHECK_THROWS(tree.parse(bytes.data(), bytes.size() - 1));
+  CHECK_THROWS(tree.parse("\xc1", 1));
+
+  // Parses, but CurrentTime holds a string
+  const std::string wrong("\x81\xab" "CurrentTime\xa1" "x", 15);
+  tree.parse(wrong.data(), wrong.size());
+  X90Msg msg;
+  CHECK_THROWS(tree.decode(msg));
+}
+
+TEST(node_backend_parallel_decode_matches_sequential)
+{
+  const X90Msg source = make_message(37);
+  const std::string bytes = test_util::encode_message(source);
+  MessageTree tree;
+  tree.parse(bytes.data(), bytes.size());
+  for (size_t threads : {1, 2, 4, 64}) {
+    std::vector<X90IOGroup> groups;
+    tree.parallel_decode({"IOGroups"}, groups, threads);
+    CHECK_EQ(groups.size(), size_t{37});
+    for (size_t i = 0; i < groups.size(); ++i) {
+      CHECK_EQ(test_util::encode_message(groups[i]), test_util::encode_message(source.io_groups[i]));
+    }
+  }
+
+  const std::string empty = test_util::encode_message(make_message(0));
+  tree.parse(empty.data(), empty.size());
+  std::vector<X90IOGroup> groups(3);
+  tree.parallel_decode({"IOGroups"}, groups, 4);
+  CHECK(groups.empty());
+}
+
+TEST(node_backend_parallel_decode_errors)
+{
+  const std::string bytes = test_util::encode_message(make_message(4));
+  MessageTree tree;
+  tree.parse(bytes.data(), bytes.size());
+  std::vector<X90IOGroup> groups;
+  CHECK_THROWS(tree.parallel_decode({"Missing"}, groups, 2));
+  CHECK_THROWS(tree.parallel_decode({"EndpointId"}, groups, 2));
+
+  // An element that fails to decode surfaces from its worker
+  static const char kBad[] = "\x81\xa8" "IOGroups\x92\x80\x81\xac" "TimeRecorded\xa1" "x";
+  tree.parse(kBad, sizeof(kBad) - 1);
+  CHECK_THROWS(tree.parallel_decode({"IOGroups"}, groups, 2));
+}
@@ -0,0 +1,207 @@
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mpack_checksum.h"
+#include "mpack_patch.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::EncodeContext;
+using serialization::EncodeFixedWidth;
+using serialization::FieldPatcher;
+
+namespace
+{
+
+// Fixed width chosen per field
+class Reading : public MsgPackSerializable<Reading>
+{
+public:
+  int8_t offset = 0;
+  uint16_t count = 0;
+  int32_t delta = 0;
+  uint32_t plain = 0;
+  double value = 0.0;
+  static constexpr auto get_fields()
+  {
+    using namespace serialization;
+    return std::make_tuple(
+      make_field("offset", &Reading::offset, EncodeFixedWidth),
+      make_field("count", &Reading::count, EncodeFixedWidth),
+      make_field("delta", &Reading::delta, EncodeFixedWidth),
+      make_field("plain", &Reading::plain),
+      make_field("value", &Reading::value));
+  }
+};
+
+X90Msg make_message(size_t groups)
+{
+  X90Msg msg{};
+  msg.endpoint_id = "endpoint";
+  msg.current_time = 5;
+  for (size_t g = 0; g < groups; ++g) {
+    X90IOGroup group{};
+    group.name = "group" + std::to_string(g);
+    group.time_recorded = g;
+    X90IO io{};
+    io.name = "io";
+    io.data = 1.0;
+    group.ios.push_back(io);
+    msg.io_groups.push_back(group);
+  }
+  return msg;
+}
+
+}  // namespace
+
+TEST(patch_x90_times_in_place)
+{
+  X90Msg msg = make_message(4);
+  const EncodeContext fixed{EncodeFixedWidth};
+  std::string bytes = test_util::encode_message(msg, fixed);
+
+  FieldPatcher patcher({{"CurrentTime"}, {"IOGroups", "*", "TimeRecorded"}, {"Missing"}});
+  patcher.locate(bytes.data(), bytes.size());
+  CHECK_EQ(patcher.sites(0).size(), size_t{1});
+  CHECK_EQ(patcher.sites(1).size(), size_t{4});
+  CHECK(patcher.sites(2).empty());
+  CHECK_EQ(static_cast<uint8_t>(bytes[patcher.sites(0)[0]]), uint8_t{0xcf});
+
+  // The offsets found once serve every later patch of the same layout
+  for (uint64_t now : {uint64_t{1622547800}, ~uint64_t{0}, uint64_t{0}}) {
+    patcher.patch_uint(&bytes[0], 0, now);
+    patcher.patch_uint(&bytes[0], 1, now + 1);
+    msg.current_time = now;
+    for (X90IOGroup & group : msg.io_groups) {
+      group.time_recorded = now + 1;
+    }
+    CHECK_EQ(bytes, test_util::encode_message(msg, fixed));
+    X90Msg decoded;
+    test_util::decode_message(bytes, decoded);
+    CHECK_EQ(decoded.current_time, now);
+    CHECK_EQ(decoded.io_groups[3].time_recorded, now + 1);
+  }
+
+  // Without the flag, small values are fixints and cannot be patched
+  const std::string compact = test_util::encode_message(make_message(1));
+  std::string copy = compact;
+  patcher.locate(copy.data(), copy.size());
+  CHECK_THROWS(patcher.patch_uint(&copy[0], 0, 1));
+  CHECK_EQ(copy, compact);
+}
+
+TEST(patch_per_field_widths_and_ranges)
+{
+  Reading reading;
+  reading.offset = -3;
+  reading.count = 7;
+  reading.delta = 100;
+  reading.plain = 1;
+  reading.value = 0.5;
+  std::string bytes = test_util::encode_message(reading);
+
+  FieldPatcher patcher({{"offset"}, {"count"}, {"delta"}, {"plain"}, {"value"}});
+  patcher.locate(bytes.data(), bytes.size());
+  const auto lead = [&](size_t path) {return static_cast<uint8_t>(bytes[patcher.sites(path)[0]]);};
+  CHECK_EQ(lead(0), uint8_t{0xd0});
+  CHECK_EQ(lead(1), uint8_t{0xcd});
+  CHECK_EQ(lead(2), uint8_t{0xd2});
+  CHECK_EQ(lead(3), uint8_t{0x01});
+  CHECK_EQ(lead(4), uint8_t{0xcb});
+
+  patcher.patch_int(&bytes[0], 0, -128);
+  patcher.patch_uint(&bytes[0], 1, 65535);
+  patcher.patch_int(&bytes[0], 2, -2000000000);
+  patcher.patch_double(&bytes[0], 4, -1.25);
+  Reading decoded;
+  test_util::decode_message(bytes, decoded);
+  CHECK_EQ(int(decoded.offset), -128);
+  CHECK_EQ(decoded.count, uint16_t{65535});
+  CHECK_EQ(decoded.delta, int32_t{-2000000000});
+  CHECK_EQ(decoded.value, -1.25);
+
+  // Out of range for the field's width, or of the wrong kind
+  const std::string before = bytes;
+  CHECK_THROWS(patcher.patch_int(&bytes[0], 0, 128));
+  CHECK_THROWS(patcher.patch_int(&bytes[0], 0, -129));
+  CHECK_THROWS(patcher.patch_uint(&bytes[0], 1, 65536));
+  CHECK_THROWS(patcher.patch_int(&bytes[0], 1, -1));
+  CHECK_THROWS(patcher.patch_uint(&bytes[0], 2, uint64_t{1} << 63));
+  CHECK_THROWS(patcher.patch_uint(&bytes[0], 3, 2));
+  CHECK_THROWS(patcher.patch_double(&bytes[0], 2, 1.0));
+  CHECK_THROWS(patcher.patch_uint(&bytes[0], 4, 1));
+  CHECK_EQ(bytes, before);
+
+  // Signed and unsigned fields take either kind of value that fits
+  patcher.patch_uint(&bytes[0], 0, 127);
+  patcher.patch_int(&bytes[0], 1, 9);
+  test_util::decode_message(bytes, decoded);
+  CHECK_EQ(int(decoded.offset), 127);
+  CHECK_EQ(decoded.count, uint16_t{9});
+}
+
+TEST(patch_locate_paths)
+{
+  // {"a": {"x": 0xcc 1}, "list": [{"x": 0xcc 2}, 5, {"y": 0}], "b": [0xcc 3]}
+  static const char kMessage[] =
+    "\x83\xa1" "a\x81\xa1" "x\xcc\x01"
+    "\xa4" "list\x93\x81\xa1" "x\xcc\x02\x05\x81\xa1" "y\x00"
+    "\xa1" "b\x91\xcc\x03";
+  const std::string bytes(kMessage, sizeof(kMessage) - 1);
+  FieldPatcher patcher({{"a", "x"}, {"list", "*", "x"}, {"a"}, {"b", "*"}, {"a", "x", "deeper"}, {"list", "x"}, {}});
+  patcher.locate(bytes.data(), bytes.size());
+  CHECK(patcher.sites(0) == std::vector<size_t>({6}));
+  CHECK(patcher.sites(1) == std::vector<size_t>({17}));
+  CHECK(patcher.sites(2) == std::vector<size_t>({3}));
+  CHECK(patcher.sites(3) == std::vector<size_t>({27}));
+  CHECK(patcher.sites(4).empty());
+  CHECK(patcher.sites(5).empty());
+  CHECK(patcher.sites(6) == std::vector<size_t>({0}));
+  CHECK_THROWS(patcher.sites(7));
+
+  // locate() replaces earlier results
+  static const char kEmpty[] = "\x80";
+  patcher.locate(kEmpty, sizeof(kEmpty) - 1);
+  CHECK(patcher.sites(0).empty());
+  CHECK_EQ(patcher.sites(6).size(), size_t{1});
+}
+
+TEST(patch_rejects_hostile_input)
+{
+  const std::string bytes = test_util::encode_message(make_message(3), EncodeContext{EncodeFixedWidth});
+  FieldPatcher patcher({{"CurrentTime"}, {"IOGroups", "*", "TimeRecorded"}});
+  for (size_t size = 0; size < bytes.size(); ++size) {
+    CHECK_THROWS(patcher.locate(bytes.data(), size));
+  }
+
+  static const char kInvalid[] = "\x82\xa3" "Bad\xc1\xab" "CurrentTime\xcf\x00\x00\x00\x00\x00\x00\x00\x00";
+  CHECK_THROWS(patcher.locate(kInvalid, sizeof(kInvalid) - 1));
+  // An array32 claiming 4G groups
+  static const char kHuge[] = "\x81\xa8" "IOGroups\xdd\xff\xff\xff\xff\x80";
+  CHECK_THROWS(patcher.locate(kHuge, sizeof(kHuge) - 1));
+  // A str32 key longer than the message
+  static const char kLongKey[] = "\x81\xdb\x00\x00\x10\x00" "Cur";
+  CHECK_THROWS(patcher.locate(kLongKey, sizeof(kLongKey) - 1));
+}
+
+TEST(patch_then_reseal_checksum_frame)
+{
+  using serialization::ChecksumFrame;
+  const std::string payload = test_util::encode_message(make_message(2), EncodeContext{EncodeFixedWidth});
+  std::string frame(ChecksumFrame::kHeaderSize + payload.size(), '\0');
+  ChecksumFrame::seal_copy(&frame[0], payload.data(), payload.size());
+
+  FieldPatcher patcher({{"CurrentTime"}});
+  char * body = &frame[ChecksumFrame::kHeaderSize];
+  patcher.locate(body, payload.size());
+  patcher.patch_uint(body, 0, 42);
+  CHECK(!ChecksumFrame::verify(frame.data(), payload.size()));
+  ChecksumFrame::seal(&frame[0], payload.size());
+  CHECK(ChecksumFrame::verify(frame.data(), payload.size()));
+
+  X90Msg decoded;
+  test_util::decode_message(frame.substr(ChecksumFrame::kHeaderSize), decoded);
+  CHECK_EQ(decoded.current_time, uint64_t{42});
+}
@@ -0,0 +1,239 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mpack_pipeline.h"
+#include "mpack_string_dictionary.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::MessageBatch;
+using serialization::Pipeline;
+using serialization::WorkStealingPool;
+
+namespace
+{
+
+std::string make_message(size_t i)
+{
+  return test_util::encode_message(X90Error(std::to_string(i), "type", std::string(i % 50, 'e')));
+}
+
+Pipeline<X90Error>::Options small_batches()
+{
+  Pipeline<X90Error>::Options options;
+  options.batch_size = 7;
+  options.queue_capacity = 2;
+  return options;
+}
+
+// Collects every message the sink receives
+struct Collector
+{
+  std::mutex mutex;
+  std::vector<std::string> messages;
+  size_t batches = 0;
+
+  Pipeline<X90Error>::Sink sink()
+  {
+    return [this](const MessageBatch & batch) {
+             std::lock_guard<std::mutex> lock(mutex);
+             ++batches;
+             for (size_t i = 0; i < batch.size(); ++i) {
+               messages.emplace_back(batch[i]);
+             }
+           };
+  }
+};
+
+}  // namespace
+
+TEST(pipeline_message_batch)
+{
+  MessageBatch batch;
+  CHECK(batch.empty());
+  batch.append("ab", 2);
+  batch.append(std::string_view());
+  batch.append("cde", 3);
+  CHECK_EQ(batch.size(), size_t{3});
+  CHECK_EQ(std::string(batch[0]), std::string("ab"));
+  CHECK_EQ(batch[1].size(), size_t{0});
+  CHECK_EQ(std::string(batch[2]), std::string("cde"));
+  CHECK_EQ(std::string(batch.data(), batch.bytes()), std::string("abcde"));
+  batch.clear();
+  CHECK(batch.empty());
+  CHECK_EQ(batch.bytes(), size_t{0});
+}
+
+TEST(pipeline_pool_runs_every_task)
+{
+  std::atomic<size_t> count{0};
+  {
+    WorkStealingPool pool(4);
+    CHECK_EQ(pool.size(), size_t{4});
+    for (int i = 0; i < 100; ++i) {
+      // Tasks spawning tasks on their own worker, stolen by the others
+      pool.submit([&pool, &count] {
+          for (int j = 0; j < 10; ++j) {
+            pool.submit([&count] {++count;});
+          }
+          ++count;
+        });
+    }
+    // The destructor runs everything still queued
+  }
+  CHECK_EQ(count.load(), size_t{1100});
+}
+
+TEST(pipeline_delivers_in_push_order)
+{
+  WorkStealingPool pool(4);
+  Collector collector;
+  Pipeline<X90Error> pipeline(
+    pool, [](X90Error & error) {error.type = "seen"; return true;}, collector.sink(), small_batches());
+  for (size_t i = 0; i < 5000; ++i) {
+    pipeline.push(make_message(i));
+  }
+  pipeline.finish();
+
+  CHECK_EQ(collector.messages.size(), size_t{5000});
+  CHECK_EQ(collector.batches, size_t{(5000 + 6) / 7});
+  for (size_t i = 0; i < collector.messages.size(); ++i) {
+    X90Error error;
+    test_util::decode_message(collector.messages[i], error);
+    CHECK_EQ(error.name, std::to_string(i));
+    CHECK(error.type == "seen");
+    CHECK_EQ(error.error.size(), i % 50);
+  }
+
+  // The pipeline carries on after finish()
+  pipeline.push(make_message(1));
+  pipeline.finish();
+  CHECK_EQ(collector.messages.size(), size_t{5001});
+}
+
+TEST(pipeline_transform_drops_messages)
+{
+  WorkStealingPool pool(3);
+  Collector collector;
+  Pipeline<X90Error> pipeline(
+    pool, [](X90Error & error) {return std::stoul(error.name) % 3 == 0;}, collector.sink(),
+    small_batches());
+  // Concurrent producers; each one's messages stay in its own order
+  std::vector<std::thread> producers;
+  for (size_t p = 0; p < 3; ++p) {
+    producers.emplace_back([&pipeline, p] {
+        for (size_t i = p; i < 3000; i += 3) {
+          pipeline.push(make_message(i));
+        }
+      });
+  }
+  for (std::thread & producer : producers) {
+    producer.join();
+  }
+  pipeline.finish();
+
+  // Only producer 0's messages pass the filter
+  CHECK_EQ(collector.messages.size(), size_t{1000});
+  for (size_t i = 0; i < collector.messages.size(); ++i) {
+    CHECK_EQ(collector.messages[i], make_message(3 * i));
+  }
+}
+
+TEST(pipeline_surfaces_the_first_error)
+{
+  WorkStealingPool pool(2);
+
+  // A message that does not decode
+  {
+    Collector collector;
+    Pipeline<X90Error> pipeline(pool, [](X90Error &) {return true;}, collector.sink(), small_batches());
+    pipeline.push(make_message(1));
+    pipeline.push("\x81\xa4" "Name\x05", 7);
+    CHECK_THROWS(pipeline.finish());
+    CHECK_THROWS(pipeline.push(make_message(2)));
+    CHECK_THROWS(pipeline.flush());
+  }
+
+  // A throwing transform; later batches are dropped
+  {
+    Collector collector;
+    Pipeline<X90Error> pipeline(
+      pool, [](X90Error & error) {
+        if (error.name == "100") {
+          throw std::runtime_error("transform failed");
+        }
+        return true;
+      }, collector.sink(), small_batches());
+    std::string what;
+    try {
+      for (size_t i = 0; i < 1000; ++i) {
+        pipeline.push(make_message(i));
+      }
+      pipeline.finish();
+    } catch (const std::runtime_error & e) {
+      what = e.what();
+    }
+    CHECK_EQ(what, std::string("transform failed"));
+    CHECK(collector.messages.size() <= 100);
+  }
+
+  // A throwing sink
+  {
+    Pipeline<X90Error> pipeline(
+      pool, [](X90Error &) {return true;},
+      [](const MessageBatch &) {throw std::runtime_error("sink failed");}, small_batches());
+    pipeline.push(make_message(1));
+    CHECK_THROWS(pipeline.finish());
+  }
+
+  // Pipelines cannot share a session dictionary between workers
+  serialization::StringDictionary dictionary;
+  Pipeline<X90Error>::Options options;
+  options.encode.dictionary = &dictionary;
+  CHECK_THROWS(Pipeline<X90Error>(pool, [](X90Error &) {return true;}, [](const MessageBatch &) {}, options));
+}
+
+TEST(pipeline_slow_sink_blocks_push)
+{
+  WorkStealingPool pool(4);
+  std::mutex mutex;
+  std::condition_variable released_cv;
+  bool released = false;
+  Pipeline<X90Error>::Options options = small_batches();
+  options.max_batches_in_flight = 4;
+  std::atomic<size_t> sunk{0};
+  Pipeline<X90Error> pipeline(
+    pool, [](X90Error &) {return true;},
+    [&](const MessageBatch & batch) {
+      std::unique_lock<std::mutex> lock(mutex);
+      released_cv.wait(lock, [&released] {return released;});
+      sunk += batch.size();
+    }, options);
+
+  std::atomic<size_t> pushed{0};
+  std::thread producer([&pipeline, &pushed] {
+      for (size_t i = 0; i < 1000; ++i) {
+        pipeline.push(make_message(i));
+        ++pushed;
+      }
+      pipeline.finish();
+    });
+
+  // With the sink stalled, push() stops once four batches are in flight
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  CHECK(pushed.load() <= 5 * 7);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    released = true;
+  }
+  released_cv.notify_all();
+  producer.join();
+  CHECK_EQ(sunk.load(), size_t{1000});
+}
@@ -0,0 +1,184 @@
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mpack_resumable.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::ResumableDecoder;
+
+namespace
+{
+
+using Status = ResumableDecoder::Status;
+
+X90Msg make_message(size_t groups, size_t error_length = 7)
+{
+  X90Msg msg{};
+  msg.endpoint_id = "endpoint";
+  msg.current_time = 1622547800;
+  for (size_t g = 0; g < groups; ++g) {
+    X90IOGroup group{};
+    group.name = "group" + std::to_string(g);
+    group.time_recorded = 1000 + g;
+    group.is_fail = g % 2 == 0;
+    group.set_status(X90Status::WARN);
+    // Past the inline capacity of 8 for some groups
+    for (size_t i = 0; i < 3 + 4 * g; ++i) {
+      X90IO io{};
+      io.name = "io" + std::to_string(i);
+      if (i % 2 == 0) {
+        io.data = i * 2.5;
+      } else {
+        io.data = true;
+      }
+      group.ios.push_back(io);
+    }
+    group.errors.push_back(X90Error("e" + std::to_string(g), "type", std::string(error_length, 'm')));
+    msg.io_groups.push_back(group);
+  }
+  return msg;
+}
+
+// Decodes bytes fed in chunks of at most chunk bytes; returns the re-encoding
+std::string decode_chunked(const std::string & bytes, size_t chunk, size_t * max_buffered = nullptr)
+{
+  X90Msg msg;
+  ResumableDecoder decoder(msg);
+  for (size_t pos = 0; pos < bytes.size(); pos += chunk) {
+    const size_t size = std::min(chunk, bytes.size() - pos);
+    const bool last = pos + size == bytes.size();
+    size_t consumed = 0;
+    const Status status = decoder.feed(bytes.data() + pos, size, &consumed);
+    CHECK(status == (last ? Status::Done : Status::NeedMore));
+    CHECK_EQ(consumed, size);
+    if (max_buffered != nullptr) {
+      *max_buffered = std::max(*max_buffered, decoder.buffered());
+    }
+  }
+  CHECK(decoder.done());
+  return test_util::encode_message(msg);
+}
+
+}  // namespace
+
+TEST(resumable_round_trip_in_any_chunking)
+{
+  const std::string bytes = test_util::encode_message(make_message(4));
+  for (size_t chunk : {size_t{1}, size_t{2}, size_t{5}, size_t{33}, bytes.size()}) {
+    CHECK_EQ(decode_chunked(bytes, chunk), bytes);
+  }
+
+  // Two chunks split at every byte
+  for (size_t split = 1; split < bytes.size(); ++split) {
+    X90Msg msg;
+    ResumableDecoder decoder(msg);
+    CHECK(decoder.feed(bytes.data(), split) == Status::NeedMore);
+    CHECK(decoder.feed(bytes.data() + split, bytes.size() - split) == Status::Done);
+    CHECK_EQ(test_util::encode_message(msg), bytes);
+  }
+}
+
+TEST(resumable_holds_only_the_pending_leaf)
+{
+  // Byte at a time, the buffer never holds more than the largest leaf value
+  const std::string bytes = test_util::encode_message(make_message(3, 5000));
+  size_t max_buffered = 0;
+  CHECK_EQ(decode_chunked(bytes, 1, &max_buffered), bytes);
+  CHECK(max_buffered > 4000);
+  CHECK(max_buffered < 5010);
+
+  // Frames track the nesting: message, group vector, group, IO vector, IO
+  X90Msg msg;
+  ResumableDecoder decoder(msg);
+  size_t max_depth = 0;
+  for (char c : bytes) {
+    decoder.feed(&c, 1);
+    max_depth = std::max(max_depth, decoder.depth());
+  }
+  CHECK_EQ(max_depth, size_t{5});
+  CHECK_EQ(decoder.depth(), size_t{0});
+}
+
+TEST(resumable_reports_consumed_bytes_and_restarts)
+{
+  const std::string first = test_util::encode_message(make_message(1));
+  const std::string second = test_util::encode_message(make_message(2));
+  const std::string stream = first + second;
+
+  X90Msg a;
+  ResumableDecoder decoder(a);
+  size_t consumed = 0;
+  CHECK(decoder.feed(stream.data(), 10, &consumed) == Status::NeedMore);
+  CHECK_EQ(consumed, size_t{10});
+  CHECK(decoder.feed(stream.data() + 10, stream.size() - 10, &consumed) == Status::Done);
+  CHECK_EQ(consumed, first.size() - 10);
+  CHECK_THROWS(decoder.feed(stream.data(), 1));
+
+  X90Msg b;
+  decoder.start(b);
+  CHECK(decoder.feed(second.data(), second.size(), &consumed) == Status::Done);
+  CHECK_EQ(consumed, second.size());
+  CHECK_EQ(test_util::encode_message(b), second);
+
+  // start() drops a partial message
+  X90Msg c;
+  decoder.start(c);
+  decoder.feed(first.data(), first.size() / 2);
+  decoder.start(c);
+  CHECK_EQ(decoder.buffered(), size_t{0});
+  CHECK(decoder.feed(first.data(), first.size()) == Status::Done);
+}
+
+TEST(resumable_skips_unknown_fields)
+{
+  // {"Extra": {"a": [1, 2]}, "Name": "n", "Other": nil}
+  static const char kMessage[] = "\x83\xa5" "Extra\x81\xa1" "a\x92\x01\x02\xa4" "Name\xa1" "n\xa5" "Other\xc0";
+  const std::string bytes(kMessage, sizeof(kMessage) - 1);
+  for (size_t chunk : {size_t{1}, bytes.size()}) {
+    X90Error error;
+    ResumableDecoder decoder(error);
+    Status status = Status::NeedMore;
+    for (size_t pos = 0; pos < bytes.size(); pos += chunk) {
+      status = decoder.feed(bytes.data() + pos, std::min(chunk, bytes.size() - pos));
+    }
+    CHECK(status == Status::Done);
+    CHECK_EQ(error.name, std::string("n"));
+  }
+}
+
+TEST(resumable_rejects_hostile_input)
+{
+  auto feed = [](const std::string & bytes) {
+      X90Msg msg;
+      ResumableDecoder decoder(msg);
+      return decoder.feed(bytes.data(), bytes.size());
+    };
+
+  // Wrong container types
+  CHECK_THROWS(feed(std::string("\x90", 1)));
+  static const char kGroupsNotArray[] = "\x81\xa8" "IOGroups\x80";
+  CHECK_THROWS(feed(std::string(kGroupsNotArray, sizeof(kGroupsNotArray) - 1)));
+  // A key that is not a string
+  static const char kIntKey[] = "\x81\x01\x02";
+  CHECK_THROWS(feed(std::string(kIntKey, sizeof(kIntKey) - 1)));
+  // A leaf of the wrong type
+  static const char kWrongLeaf[] = "\x81\xab" "CurrentTime\xa1" "x";
+  CHECK_THROWS(feed(std::string(kWrongLeaf, sizeof(kWrongLeaf) - 1)));
+  // Invalid msgpack inside a skipped value
+  static const char kInvalid[] = "\x81\xa3" "Bad\x91\xc1";
+  CHECK_THROWS(feed(std::string(kInvalid, sizeof(kInvalid) - 1)));
+
+  // An array32 announcing 4G groups reserves only what the bytes can hold
+  static const char kHuge[] = "\x81\xa8" "IOGroups\xdd\xff\xff\xff\xff\x80\x80";
+  X90Msg msg;
+  ResumableDecoder decoder(msg);
+  CHECK(decoder.feed(kHuge, sizeof(kHuge) - 1) == Status::NeedMore);
+  CHECK_EQ(msg.io_groups.size(), size_t{3});
+  CHECK(msg.io_groups.capacity() < 16);
+
+  ResumableDecoder idle;
+  CHECK_THROWS(idle.feed(kHuge, 1));
+}
@@ -0,0 +1,123 @@
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "mpack_small_vector.h"
+#include "test_util.h"
+
+using serialization::small_vector;
+using serialization::static_vector;
+using test_util::decode;
+using test_util::decode_node;
+using test_util::encode;
+
+namespace
+{
+
+// Counts live instances so leaks and double destruction show up
+struct Counted
+{
+  static int live;
+  std::string value;
+
+  Counted() { ++live; }
+  Counted(std::string v) : value(std::move(v)) { ++live; }
+  Counted(const Counted & other) : value(other.value) { ++live; }
+  Counted(Counted && other) noexcept : value(std::move(other.value)) { ++live; }
+  Counted & operator=(const Counted &) = default;
+  Counted & operator=(Counted &&) = default;
+  ~Counted() { --live; }
+
+  bool operator==(const Counted & other) const { return value == other.value; }
+};
+
+int Counted::live = 0;
+
+}  // namespace
+
+TEST(small_vector_spills_past_inline_capacity)
+{
+  {
+    small_vector<Counted, 2> v;
+    v.emplace_back("a");
+    v.emplace_back("b");
+    CHECK(v.is_inline());
+    v.emplace_back("c");
+    CHECK(!v.is_inline());
+    CHECK_EQ(v.size(), size_t{3});
+    CHECK_EQ(v[0].value, std::string("a"));
+    CHECK_EQ(v[2].value, std::string("c"));
+    CHECK_EQ(Counted::live, 3);
+
+    // Pushing an element of the vector itself while it grows
+    v.push_back(v[0]);
+    v.push_back(v[0]);
+    CHECK_EQ(v[4].value, std::string("a"));
+
+    small_vector<Counted, 2> copy = v;
+    CHECK(copy == v);
+    small_vector<Counted, 2> moved = std::move(copy);
+    CHECK(moved == v);
+    CHECK(copy.empty());
+
+    v.resize(1);
+    CHECK_EQ(v.size(), size_t{1});
+    v.pop_back();
+    CHECK(v.empty());
+  }
+  CHECK_EQ(Counted::live, 0);
+}
+
+TEST(small_vector_inline_move_and_assign)
+{
+  {
+    small_vector<Counted, 4> a{Counted("x"), Counted("y")};
+    small_vector<Counted, 4> b = std::move(a);
+    CHECK(b.is_inline());
+    CHECK_EQ(b[1].value, std::string("y"));
+    small_vector<Counted, 4> c{Counted("1"), Counted("2"), Counted("3"), Counted("4"), Counted("5")};
+    b = std::move(c);
+    CHECK_EQ(b.size(), size_t{5});
+    c = b;
+    CHECK(c == b);
+  }
+  CHECK_EQ(Counted::live, 0);
+}
+
+TEST(small_vector_static_vector_never_grows)
+{
+  static_vector<int, 2> v{1, 2};
+  CHECK_THROWS(v.push_back(3));
+  CHECK_THROWS(v.resize(3));
+  CHECK_THROWS(v.reserve(3));
+  CHECK_EQ(v.size(), size_t{2});
+  CHECK_THROWS(v.at(2));
+}
+
+TEST(small_vector_round_trip_both_backends)
+{
+  small_vector<std::string, 2> names{"a", "bb", "ccc"};
+  CHECK(decode<small_vector<std::string, 2>>(encode(names)) == names);
+  CHECK(decode_node<small_vector<std::string, 2>>(encode(names)) == names);
+
+  static_vector<int64_t, 3> ints{-1, 0, 300};
+  CHECK(decode<static_vector<int64_t, 3>>(encode(ints)) == ints);
+  CHECK(decode_node<static_vector<int64_t, 3>>(encode(ints)) == ints);
+}
+
+TEST(small_vector_static_vector_rejects_long_arrays)
+{
+  const std::string four = encode(small_vector<int, 4>{1, 2, 3, 4});
+  CHECK_THROWS(decode<static_vector<int, 3>>(four));
+  CHECK_THROWS(decode_node<static_vector<int, 3>>(four));
+}
+
+TEST(small_vector_hostile_count_is_rejected)
+{
+  // array32 claiming 2^32-1 elements followed by two
+  const std::string hostile("\xdd\xff\xff\xff\xff\x01\x02", 7);
+  CHECK_THROWS(decode<small_vector<int, 2>>(hostile));
+  CHECK_THROWS(decode_node<small_vector<int, 2>>(hostile));
+  CHECK_THROWS(decode<static_vector<int, 2>>(hostile));
+}
@@ -0,0 +1,133 @@
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "mpack_soa.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::soa_vector;
+using test_util::decode;
+using test_util::decode_node;
+using test_util::encode;
+
+namespace
+{
+
+X90IOGroup make_group(int i)
+{
+  X90IOGroup group{};
+  group.name = "group_" + std::to_string(i);
+  group.time_recorded = 1000 + i;
+  group.is_fail = i % 2 == 1;
+  X90IO io{};
+  io.name = "io";
+  io.data = i * 1.5;
+  group.ios.push_back(io);
+  group.set_status(X90Status::WARN);
+  return group;
+}
+
+std::vector<X90IOGroup> make_groups(int n)
+{
+  std::vector<X90IOGroup> groups;
+  for (int i = 0; i < n; ++i) {
+    groups.push_back(make_group(i));
+  }
+  return groups;
+}
+
+}  // namespace
+
+static_assert(std::is_same_v<
+    std::remove_reference_t<decltype(soa_vector<X90IOGroup>().get<&X90IOGroup::is_fail>())>,
+    std::vector<uint8_t>>);
+
+TEST(soa_push_back_and_columns)
+{
+  soa_vector<X90IOGroup> groups;
+  for (const auto & group : make_groups(3)) {
+    groups.push_back(group);
+  }
+  CHECK_EQ(groups.size(), size_t{3});
+  CHECK_EQ(groups.field_count(), size_t{6});
+  CHECK_EQ(groups.get<&X90IOGroup::time_recorded>()[2], uint64_t{1002});
+  CHECK_EQ(groups.get<0>()[1], std::string("group_1"));
+  CHECK_EQ(groups.get<&X90IOGroup::is_fail>()[1], uint8_t{1});
+  CHECK_EQ(test_util::encode_message(groups.at(2)), test_util::encode_message(make_group(2)));
+  CHECK_THROWS(groups.at(3));
+}
+
+TEST(soa_wire_format_matches_vector)
+{
+  const std::vector<X90IOGroup> rows = make_groups(4);
+  soa_vector<X90IOGroup> columns;
+  for (const auto & group : rows) {
+    columns.push_back(group);
+  }
+  const std::string bytes = encode(rows);
+  CHECK_EQ(encode(columns), bytes);
+
+  const auto from_reader = decode<soa_vector<X90IOGroup>>(bytes);
+  const auto from_node = decode_node<soa_vector<X90IOGroup>>(bytes);
+  CHECK_EQ(encode(from_reader), bytes);
+  CHECK_EQ(encode(from_node), bytes);
+}
+
+TEST(soa_read_stream_and_unknown_fields)
+{
+  std::string stream;
+  for (const auto & group : make_groups(5)) {
+    stream += test_util::encode_message(group);
+  }
+  // A producer that adds a field and leaves out the rest
+  static const char kNewer[] = "\x82\xa4" "Name\xa3" "new\xa5" "Extra\x93\x01\x02\x03";
+  stream.append(kNewer, sizeof(kNewer) - 1);
+
+  soa_vector<X90IOGroup> groups;
+  groups.read_stream(stream.data(), stream.size());
+  CHECK_EQ(groups.size(), size_t{6});
+  CHECK_EQ(groups.get<&X90IOGroup::name>()[5], std::string("new"));
+  CHECK_EQ(groups.get<&X90IOGroup::time_recorded>()[5], uint64_t{0});
+  CHECK_EQ(groups.get<&X90IOGroup::time_recorded>()[4], uint64_t{1004});
+}
+
+TEST(soa_failed_row_is_rolled_back)
+{
+  soa_vector<X90IOGroup> groups;
+  groups.push_back(make_group(0));
+  // TimeRecorded holds a string
+  const std::string bad("\x81\xac" "TimeRecorded\xa1" "x", 16);
+  mpack_reader_t reader;
+  mpack_reader_init_data(&reader, bad.data(), bad.size());
+  groups.read_one(&reader);
+  CHECK(mpack_reader_destroy(&reader) != mpack_ok);
+  CHECK_EQ(groups.size(), size_t{1});
+
+  mpack_node_data_t pool[8];
+  mpack_tree_t tree;
+  mpack_tree_init_pool(&tree, bad.data(), bad.size(), pool, 8);
+  mpack_tree_parse(&tree);
+  try {
+    groups.read_one(mpack_tree_root(&tree));
+  } catch (const std::runtime_error &) {
+    // Fields after the failed one read as nil and may throw instead
+  }
+  CHECK(mpack_tree_destroy(&tree) != mpack_ok);
+  CHECK_EQ(groups.size(), size_t{1});
+
+  CHECK_THROWS(groups.read_stream(bad.data(), bad.size()));
+  // Truncated stream
+  const std::string message = test_util::encode_message(make_group(1));
+  CHECK_THROWS(groups.read_stream(message.data(), message.size() - 1));
+}
+
+TEST(soa_hostile_count_is_rejected)
+{
+  const std::string hostile("\xdd\xff\xff\xff\xff\x80", 6);
+  CHECK_THROWS(decode<soa_vector<X90IOGroup>>(hostile));
+  CHECK_THROWS(decode_node<soa_vector<X90IOGroup>>(hostile));
+  CHECK_THROWS(decode<soa_vector<X90IOGroup>>(std::string("\x81\x80", 2)));
+}
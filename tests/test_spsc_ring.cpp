@@ -0,0 +1,204 @@
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "mpack_spsc_ring.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::SpscRing;
+
+namespace
+{
+
+// A payload whose bytes identify it
+std::string make_payload(size_t seq, size_t size)
+{
+  std::string payload(size, '\0');
+  for (size_t i = 0; i < size; ++i) {
+    payload[i] = static_cast<char>(seq * 31 + i);
+  }
+  return payload;
+}
+
+std::string pop_front(SpscRing & ring)
+{
+  const std::string_view message = ring.front();
+  CHECK(message.data() != nullptr);
+  std::string copy(message);
+  ring.pop();
+  return copy;
+}
+
+}  // namespace
+
+TEST(spsc_ring_fifo_across_wraps)
+{
+  SpscRing ring(100);
+  CHECK_EQ(ring.capacity(), size_t{128});
+  CHECK_EQ(ring.max_message_size(), size_t{60});
+  CHECK(ring.empty());
+  CHECK(ring.front().data() == nullptr);
+
+  // Sizes that do not divide the capacity: records land at every offset
+  // and regularly need a skip marker before the end
+  size_t pushed = 0;
+  size_t popped = 0;
+  for (size_t round = 0; round < 1000; ++round) {
+    while (ring.try_push_raw(make_payload(pushed, pushed * 7 % 61).data(), pushed * 7 % 61)) {
+      ++pushed;
+    }
+    CHECK(!ring.empty());
+    const size_t target = popped + 1 + round % 3;
+    while (popped < target && popped < pushed) {
+      CHECK_EQ(pop_front(ring), make_payload(popped, popped * 7 % 61));
+      ++popped;
+    }
+  }
+  while (popped < pushed) {
+    CHECK_EQ(pop_front(ring), make_payload(popped, popped * 7 % 61));
+    ++popped;
+  }
+  CHECK(ring.empty());
+  CHECK(pushed > 1000);
+}
+
+TEST(spsc_ring_reserve_and_commit)
+{
+  SpscRing ring(64);
+  CHECK_THROWS(ring.reserve(ring.max_message_size() + 1));
+
+  char * data = ring.reserve(20);
+  CHECK(data != nullptr);
+  std::memcpy(data, "hello", 5);
+  CHECK_THROWS(ring.commit(21));
+  // Nothing is visible before the commit
+  CHECK(ring.front().data() == nullptr);
+  ring.commit(5);
+  CHECK_EQ(std::string(ring.front()), std::string("hello"));
+
+  // 12 + 28 bytes in use; a 28-byte record at offset 40 needs the 24 bytes
+  // before the end skipped, more than is free
+  CHECK(ring.try_push_raw("0123456789abcdefghijklmnopqrstuvwx", 24));
+  CHECK(ring.reserve(24) == nullptr);
+  ring.pop();
+  CHECK(ring.reserve(24) == nullptr);
+  // Once the consumer has caught up the record wraps behind a skip marker
+  ring.pop();
+  data = ring.reserve(24);
+  CHECK(data == ring.reserve(24));
+  ring.commit(0);
+  CHECK(ring.front().data() != nullptr);
+  CHECK_EQ(ring.front().size(), size_t{0});
+  ring.pop();
+  CHECK(ring.empty());
+}
+
+TEST(spsc_ring_encodes_in_place)
+{
+  SpscRing ring(128);
+  X90IO io{};
+  io.name = "io";
+  io.data = 2.5;
+  // Bounded type: reserves its bound and commits what was written
+  CHECK(ring.try_push(io));
+  CHECK_EQ(pop_front(ring), test_util::encode_message(io));
+}
+
+TEST(spsc_ring_retries_after_the_wrap)
+{
+  // Move the head to offset 104 with a record still unread before it
+  SpscRing ring(128);
+  const std::string filler(44, 'f');
+  CHECK(ring.try_push_raw(filler.data(), filler.size()));
+  CHECK(ring.try_push_raw(filler.data(), filler.size()));
+  pop_front(ring);
+  pop_front(ring);
+  CHECK(ring.try_push_raw("abcd", 4));
+
+  // Too large for the 20 bytes before the end: encoded again after the wrap
+  const X90Error error("name", "type", std::string(20, 'e'));
+  const std::string encoded = test_util::encode_message(error);
+  CHECK(encoded.size() > 20);
+  CHECK(encoded.size() <= ring.max_message_size());
+  CHECK(ring.try_push(error));
+  CHECK_EQ(pop_front(ring), std::string("abcd"));
+  CHECK_EQ(pop_front(ring), encoded);
+  CHECK(ring.empty());
+}
+
+TEST(spsc_ring_failed_encode_leaves_no_record)
+{
+  SpscRing ring(128);
+  const std::string filler(44, 'f');
+  CHECK(ring.try_push_raw(filler.data(), filler.size()));
+  CHECK(ring.try_push_raw(filler.data(), filler.size()));
+  pop_front(ring);
+  pop_front(ring);
+  CHECK(ring.try_push_raw("abcd", 4));
+
+  // Fits nowhere while "abcd" is unread: the skip marker written for the
+  // second attempt is never published
+  const X90Error big("name", "type", std::string(55, 'e'));
+  CHECK(!ring.try_push(big));
+  CHECK(ring.try_push_raw("12345678", 8));
+  CHECK_EQ(pop_front(ring), std::string("abcd"));
+  CHECK_EQ(pop_front(ring), std::string("12345678"));
+  CHECK(ring.empty());
+
+  // With the ring empty, a message over the maximum can never fit
+  const X90Error huge("name", "type", std::string(200, 'e'));
+  CHECK_THROWS(ring.try_push(huge));
+}
+
+TEST(spsc_ring_drain_releases_once)
+{
+  SpscRing ring(256);
+  for (size_t i = 0; i < 5; ++i) {
+    const std::string payload = make_payload(i, i + 1);
+    CHECK(ring.try_push_raw(payload.data(), payload.size()));
+  }
+  std::vector<std::string> seen;
+  CHECK_EQ(ring.drain([&seen](std::string_view m) {seen.emplace_back(m);}, 3), size_t{3});
+  CHECK_EQ(ring.drain([&seen](std::string_view m) {seen.emplace_back(m);}), size_t{2});
+  CHECK_EQ(seen.size(), size_t{5});
+  for (size_t i = 0; i < seen.size(); ++i) {
+    CHECK_EQ(seen[i], make_payload(i, i + 1));
+  }
+  CHECK(ring.empty());
+  CHECK_EQ(ring.drain([](std::string_view) {}), size_t{0});
+}
+
+TEST(spsc_ring_two_threads)
+{
+  constexpr size_t kMessages = 200000;
+  SpscRing ring(1024);
+  std::thread producer([&ring] {
+      for (size_t seq = 0; seq < kMessages; ++seq) {
+        const std::string payload = make_payload(seq, seq % 300);
+        while (!ring.try_push_raw(payload.data(), payload.size())) {
+          std::this_thread::yield();
+        }
+      }
+    });
+
+  size_t received = 0;
+  bool in_order = true;
+  while (received < kMessages) {
+    const size_t count = ring.drain(
+      [&received, &in_order](std::string_view message) {
+        in_order = in_order && message == make_payload(received, received % 300);
+        ++received;
+      });
+    if (count == 0) {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  CHECK(in_order);
+  CHECK(ring.empty());
+}
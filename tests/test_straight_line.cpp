@@ -0,0 +1,134 @@
+#include <cstdint>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "mpack_bounded.h"
+#include "mpack_string_dictionary.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::EncodeCompactFloat;
+using serialization::EncodeContext;
+using serialization::max_encoded_size_v;
+
+namespace
+{
+
+// X90IO through the regular MsgPackSerializable encoder
+class PlainIO : public MsgPackSerializable<PlainIO>
+{
+public:
+  serialization::fixed_string<15> name;
+  std::variant<bool, double> data;
+  static constexpr auto get_fields()
+  {
+    using namespace serialization;
+    return std::make_tuple(make_field("name", &PlainIO::name), make_field("data", &PlainIO::data));
+  }
+};
+
+std::vector<std::pair<X90IO, PlainIO>> samples()
+{
+  std::vector<std::pair<X90IO, PlainIO>> out;
+  const std::variant<bool, double> values[] = {true, false, 0.0, -0.0, 2.0, 12.5, 1e300, -3.0};
+  const char * names[] = {"", "io", "fifteen_chars__"};
+  for (const char * name : names) {
+    for (const auto & value : values) {
+      X90IO io{};
+      io.name = name;
+      io.data = value;
+      PlainIO plain{};
+      plain.name = name;
+      plain.data = value;
+      out.emplace_back(io, plain);
+    }
+  }
+  return out;
+}
+
+// Encodes through a writer with a small buffer that flushes into out
+std::string encode_flushing(const Serializable & obj, size_t buffer_size, size_t prefix)
+{
+  std::string out;
+  std::vector<char> buffer(buffer_size);
+  mpack_writer_t writer;
+  mpack_writer_init(&writer, buffer.data(), buffer.size());
+  mpack_writer_set_context(&writer, &out);
+  mpack_writer_set_flush(
+    &writer, [](mpack_writer_t * w, const char * data, size_t count) {
+      static_cast<std::string *>(mpack_writer_context(w))->append(data, count);
+    });
+  for (size_t i = 0; i < prefix; ++i) {
+    mpack_write_nil(&writer);
+  }
+  obj.serialize(&writer, EncodeContext{});
+  mpack_writer_flush_message(&writer);
+  if (mpack_writer_destroy(&writer) != mpack_ok) {
+    throw std::runtime_error("encode failed");
+  }
+  return out.substr(prefix);
+}
+
+}  // namespace
+
+TEST(straight_line_output_matches_regular_encoder)
+{
+  for (const auto & [io, plain] : samples()) {
+    CHECK_EQ(test_util::encode_message(io), test_util::encode_message(plain));
+    CHECK_EQ(
+      test_util::encode_message(io, EncodeContext{EncodeCompactFloat}),
+      test_util::encode_message(plain, EncodeContext{EncodeCompactFloat}));
+  }
+}
+
+TEST(straight_line_falls_back_near_end_of_buffer)
+{
+  // Every position of the object relative to the end of a flushing buffer
+  const auto cases = samples();
+  const auto & [io, plain] = cases.back();
+  const std::string expected = test_util::encode_message(plain);
+  for (size_t prefix = 0; prefix < 2 * max_encoded_size_v<X90IO>; ++prefix) {
+    CHECK_EQ(encode_flushing(io, max_encoded_size_v<X90IO> + 4, prefix), expected);
+  }
+
+  // A fixed buffer with room for the value but not the bound
+  char exact[64];
+  mpack_writer_t writer;
+  mpack_writer_init(&writer, exact, expected.size());
+  io.serialize(&writer, EncodeContext{});
+  CHECK_EQ(mpack_writer_buffer_used(&writer), expected.size());
+  CHECK(mpack_writer_destroy(&writer) == mpack_ok);
+  CHECK_EQ(std::string(exact, expected.size()), expected);
+
+  // And one too small for the value at all
+  mpack_writer_init(&writer, exact, expected.size() - 1);
+  io.serialize(&writer, EncodeContext{});
+  CHECK(mpack_writer_destroy(&writer) != mpack_ok);
+}
+
+TEST(straight_line_nested_and_dictionary_paths)
+{
+  X90IOGroup group{};
+  group.name = "group";
+  for (const auto & sample : samples()) {
+    group.ios.push_back(sample.first);
+    if (group.ios.size() == 8) {
+      break;
+    }
+  }
+  X90IOGroup decoded;
+  test_util::decode_message(test_util::encode_message(group), decoded);
+  CHECK_EQ(decoded.ios.size(), size_t{8});
+  CHECK(decoded.ios[7].name == group.ios[7].name);
+
+  // With a session dictionary the regular encoder runs and writes references
+  serialization::StringDictionary dictionary;
+  const std::string key_message = test_util::encode_message(samples().back().second);
+  dictionary.record_message(key_message.data(), key_message.size());
+  EncodeContext ctx;
+  ctx.dictionary = &dictionary;
+  const X90IO io = samples().back().first;
+  const std::string with_refs = test_util::encode_message(io, ctx);
+  CHECK(with_refs.size() < test_util::encode_message(io).size());
+}
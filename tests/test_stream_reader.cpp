@@ -0,0 +1,293 @@
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mpack_stream_reader.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::ChecksumFrame;
+using serialization::FdReader;
+using serialization::MessageScanner;
+using serialization::StreamDecoder;
+
+namespace
+{
+
+X90Error make_error(size_t length)
+{
+  return X90Error("name", "type", std::string(length, 'e'));
+}
+
+// Concatenated messages of varied size, plus each one on its own
+std::vector<std::string> make_messages()
+{
+  std::vector<std::string> messages;
+  for (size_t length : {0, 3, 40, 300, 70000, 1}) {
+    messages.push_back(test_util::encode_message(make_error(length)));
+  }
+  X90Msg msg{};
+  msg.endpoint_id = "endpoint";
+  X90IOGroup group{};
+  group.name = "group";
+  msg.io_groups.push_back(group);
+  messages.push_back(test_util::encode_message(msg));
+  return messages;
+}
+
+std::string plain_frame(const std::string & payload)
+{
+  std::string frame(ChecksumFrame::kPlainHeaderSize, '\0');
+  ChecksumFrame::store_u32(frame.data(), static_cast<uint32_t>(payload.size()));
+  return frame + payload;
+}
+
+std::string checksum_frame(const std::string & payload)
+{
+  std::string frame(ChecksumFrame::kHeaderSize + payload.size(), '\0');
+  ChecksumFrame::seal_copy(frame.data(), payload.data(), payload.size());
+  return frame;
+}
+
+// Feeds stream in chunks of at most chunk bytes, collecting the messages
+std::vector<std::string> feed_chunked(StreamDecoder & decoder, const std::string & stream, size_t chunk)
+{
+  std::vector<std::string> out;
+  for (size_t pos = 0; pos < stream.size(); pos += chunk) {
+    const size_t size = std::min(chunk, stream.size() - pos);
+    decoder.feed(stream.data() + pos, size, [&out](std::string_view message) {out.emplace_back(message);});
+  }
+  return out;
+}
+
+// A file descriptor closed on scope exit
+struct Fd
+{
+  int fd;
+  explicit Fd(int f) : fd(f) {}
+  ~Fd() { ::close(fd); }
+};
+
+}  // namespace
+
+TEST(stream_reader_scanner_resumes_byte_at_a_time)
+{
+  for (const std::string & message : make_messages()) {
+    MessageScanner scanner;
+    for (size_t size = 0; size < message.size(); ++size) {
+      CHECK_EQ(scanner.scan(message.data(), size), size_t{0});
+    }
+    CHECK_EQ(scanner.scan(message.data(), message.size()), message.size());
+    // Reset after a complete object: trailing bytes are not consumed
+    const std::string twice = message + message;
+    CHECK_EQ(scanner.scan(twice.data(), twice.size()), message.size());
+  }
+
+  MessageScanner scanner;
+  static const char kInvalid[] = "\x92\x01\xc1";
+  CHECK_THROWS(scanner.scan(kInvalid, sizeof(kInvalid) - 1));
+}
+
+TEST(stream_reader_structural_every_split_point)
+{
+  const std::vector<std::string> messages = make_messages();
+  std::string stream;
+  for (const std::string & message : messages) {
+    stream += message;
+  }
+
+  for (size_t chunk : {size_t{1}, size_t{2}, size_t{7}, size_t{64}, size_t{4096}, stream.size()}) {
+    StreamDecoder decoder;
+    CHECK(feed_chunked(decoder, stream, chunk) == messages);
+    CHECK_EQ(decoder.buffered(), size_t{0});
+  }
+
+  // Two chunks, split at every byte of the first three messages
+  const size_t limit = messages[0].size() + messages[1].size() + messages[2].size();
+  for (size_t split = 0; split <= limit; ++split) {
+    StreamDecoder decoder;
+    std::vector<std::string> out;
+    auto collect = [&out](std::string_view message) {out.emplace_back(message);};
+    decoder.feed(stream.data(), split, collect);
+    decoder.feed(stream.data() + split, stream.size() - split, collect);
+    CHECK(out == messages);
+  }
+}
+
+TEST(stream_reader_whole_messages_are_not_copied)
+{
+  const std::string first = test_util::encode_message(make_error(10));
+  const std::string second = test_util::encode_message(make_error(20));
+  const std::string stream = first + second + second.substr(0, 5);
+  StreamDecoder decoder;
+  std::vector<const char *> starts;
+  decoder.feed(stream.data(), stream.size(), [&starts](std::string_view message) {starts.push_back(message.data());});
+  CHECK_EQ(starts.size(), size_t{2});
+  CHECK(starts[0] == stream.data());
+  CHECK(starts[1] == stream.data() + first.size());
+  // Only the split tail is held
+  CHECK_EQ(decoder.buffered(), size_t{5});
+  decoder.reset();
+  CHECK_EQ(decoder.buffered(), size_t{0});
+}
+
+TEST(stream_reader_typed_feed_decodes)
+{
+  const std::vector<std::string> messages = make_messages();
+  std::string stream;
+  for (size_t i = 0; i < 6; ++i) {
+    stream += messages[i];
+  }
+  StreamDecoder decoder;
+  X90Error error;
+  std::vector<size_t> lengths;
+  for (size_t pos = 0; pos < stream.size(); pos += 1000) {
+    decoder.feed(
+      stream.data() + pos, std::min<size_t>(1000, stream.size() - pos), error,
+      [&lengths](const X90Error & e) {lengths.push_back(e.error.size());});
+  }
+  CHECK(lengths == std::vector<size_t>({0, 3, 40, 300, 70000, 1}));
+}
+
+TEST(stream_reader_failed_message_does_not_wedge_the_stream)
+{
+  // The middle message holds a map of the wrong shape for X90Error
+  const std::string good = test_util::encode_message(make_error(4));
+  static const char kWrong[] = "\x81\xa4" "Name\x05";
+  const std::string stream = good + std::string(kWrong, sizeof(kWrong) - 1) + good;
+
+  for (size_t split : {size_t{0}, good.size() + 2, good.size() + 7, stream.size() - 1}) {
+    StreamDecoder decoder;
+    X90Error error;
+    size_t decoded = 0;
+    auto count = [&decoded](const X90Error &) {++decoded;};
+    size_t failures = 0;
+    for (auto [pos, size] : {std::pair<size_t, size_t>{0, split}, {split, stream.size() - split}, {0, 0}}) {
+      try {
+        decoder.feed(stream.data() + pos, size, error, count);
+      } catch (const std::runtime_error &) {
+        ++failures;
+      }
+    }
+    CHECK_EQ(failures, size_t{1});
+    CHECK_EQ(decoded, size_t{2});
+    CHECK_EQ(decoder.buffered(), size_t{0});
+  }
+}
+
+TEST(stream_reader_structural_size_limit)
+{
+  // A str32 header announcing 1 GiB fails before any payload arrives
+  static const char kHostileStr[] = "\xdb\x40\x00\x00\x00";
+  StreamDecoder decoder(StreamDecoder::Framing::Structural, 1024);
+  CHECK_THROWS(decoder.feed(kHostileStr, sizeof(kHostileStr) - 1, [](std::string_view) {}));
+
+  // Neither does an array32 of nils grow the buffer past the limit
+  StreamDecoder arrays(StreamDecoder::Framing::Structural, 1024);
+  static const char kHostileArray[] = "\xdd\xff\xff\xff\xff";
+  arrays.feed(kHostileArray, sizeof(kHostileArray) - 1, [](std::string_view) {});
+  const std::string nils(512, '\xc0');
+  arrays.feed(nils.data(), nils.size(), [](std::string_view) {});
+  CHECK_THROWS(arrays.feed(nils.data(), nils.size(), [](std::string_view) {}));
+
+  StreamDecoder bad;
+  CHECK_THROWS(bad.feed("\xc1", 1, [](std::string_view) {}));
+}
+
+TEST(stream_reader_length_prefixed_frames)
+{
+  const std::vector<std::string> messages = make_messages();
+  std::string stream;
+  for (size_t i = 0; i < messages.size(); ++i) {
+    stream += i % 2 == 0 ? plain_frame(messages[i]) : checksum_frame(messages[i]);
+  }
+  for (size_t chunk : {size_t{1}, size_t{3}, size_t{100}, stream.size()}) {
+    StreamDecoder decoder(StreamDecoder::Framing::LengthPrefixed);
+    CHECK(feed_chunked(decoder, stream, chunk) == messages);
+    CHECK_EQ(decoder.buffered(), size_t{0});
+  }
+
+  // An empty frame is a message of its own
+  StreamDecoder empty(StreamDecoder::Framing::LengthPrefixed);
+  CHECK_EQ(feed_chunked(empty, plain_frame(""), 1).size(), size_t{1});
+}
+
+TEST(stream_reader_length_prefixed_corruption)
+{
+  const std::string payload = test_util::encode_message(make_error(50));
+  std::string frame = checksum_frame(payload);
+  frame[ChecksumFrame::kHeaderSize + 10] ^= 0x01;
+  for (size_t chunk : {size_t{1}, frame.size()}) {
+    StreamDecoder decoder(StreamDecoder::Framing::LengthPrefixed);
+    CHECK_THROWS(feed_chunked(decoder, frame, chunk));
+  }
+
+  // The length word alone is enough to reject an oversized frame
+  StreamDecoder limited(StreamDecoder::Framing::LengthPrefixed, 1024);
+  std::string hostile(ChecksumFrame::kPlainHeaderSize, '\0');
+  ChecksumFrame::store_u32(hostile.data(), 1u << 30);
+  CHECK_THROWS(limited.feed(hostile.data(), hostile.size(), [](std::string_view) {}));
+}
+
+TEST(stream_reader_fd_reader_reads_until_eof)
+{
+  test_util::TempDir dir;
+  const std::vector<std::string> messages = make_messages();
+  std::string stream;
+  for (size_t i = 0; i < 6; ++i) {
+    stream += messages[i];
+  }
+  {
+    Fd out(::open(dir.file("stream").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    CHECK(::write(out.fd, stream.data(), stream.size()) == static_cast<ssize_t>(stream.size()));
+  }
+
+  Fd in(::open(dir.file("stream").c_str(), O_RDONLY));
+  // A buffer smaller than most messages forces refills mid-message
+  FdReader reader(in.fd, 16);
+  X90Error error;
+  std::vector<size_t> lengths;
+  while (reader.read(error)) {
+    lengths.push_back(error.error.size());
+  }
+  CHECK(lengths == std::vector<size_t>({0, 3, 40, 300, 70000, 1}));
+  CHECK_EQ(reader.bytes_read(), uint64_t(stream.size()));
+  CHECK_THROWS(reader.read(error));
+
+  // Empty stream
+  Fd none(::open(dir.file("empty").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  Fd empty(::open(dir.file("empty").c_str(), O_RDONLY));
+  FdReader empty_reader(empty.fd);
+  CHECK(!empty_reader.read(error));
+}
+
+TEST(stream_reader_fd_reader_truncated_and_bad_input)
+{
+  const std::string first = test_util::encode_message(make_error(10));
+  const std::string second = test_util::encode_message(make_error(100));
+  for (size_t cut : {size_t{1}, size_t{20}, second.size() - 1}) {
+    int fds[2];
+    CHECK(::pipe(fds) == 0);
+    Fd read_end(fds[0]);
+    {
+      Fd write_end(fds[1]);
+      const std::string bytes = first + second.substr(0, cut);
+      CHECK(::write(write_end.fd, bytes.data(), bytes.size()) == static_cast<ssize_t>(bytes.size()));
+    }
+    FdReader reader(read_end.fd, 64);
+    X90Error error;
+    CHECK(reader.read(error));
+    CHECK_THROWS(reader.read(error));
+    // The reader stays failed
+    CHECK_THROWS(reader.read(error));
+  }
+
+  FdReader closed(-1);
+  X90Error error;
+  CHECK_THROWS(closed.read(error));
+}
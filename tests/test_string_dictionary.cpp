@@ -0,0 +1,203 @@
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mpack_dictionary_stream.h"
+#include "test_util.h"
+
+using serialization::DictionaryStreamDecoder;
+using serialization::DictionaryStreamEncoder;
+using serialization::StringDictionary;
+
+namespace
+{
+
+// A label written by a handler that ignores the dictionary
+struct RawLabel
+{
+  std::string text;
+};
+
+}  // namespace
+
+namespace serialization
+{
+template<>
+struct TypeHandler<RawLabel>
+{
+  static void write(mpack_writer_t * writer, const RawLabel & value)
+  {
+    mpack_write_str(writer, value.text.data(), static_cast<uint32_t>(value.text.size()));
+  }
+
+  static void read(mpack_reader_t * reader, RawLabel & value)
+  {
+    TypeHandler<std::string>::read(reader, value.text);
+  }
+
+  static void read(mpack_node_t node, RawLabel & value, const DecodeContext & ctx)
+  {
+    read_value(node, value.text, ctx);
+  }
+};
+}  // namespace serialization
+
+namespace
+{
+
+// Producer view of a message, with fields the consumer does not know
+struct Wide : MsgPackSerializable<Wide>
+{
+  std::string frame;
+  std::vector<std::string> tags;
+  RawLabel label;
+  std::string topic;
+  static constexpr auto get_fields()
+  {
+    using namespace serialization;
+    return std::make_tuple(
+      make_field("frame", &Wide::frame),
+      make_field("tags", &Wide::tags),
+      make_field("label", &Wide::label),
+      make_field("topic", &Wide::topic));
+  }
+};
+
+// Consumer view: only the last field
+struct Narrow : MsgPackSerializable<Narrow>
+{
+  std::string topic;
+  static constexpr auto get_fields()
+  {
+    using namespace serialization;
+    return std::make_tuple(make_field("topic", &Narrow::topic));
+  }
+};
+
+Wide make_wide(int i)
+{
+  Wide msg;
+  msg.frame = "frame_" + std::to_string(i % 3);
+  msg.tags = {"tag_alpha", "tag_" + std::to_string(i)};
+  msg.label.text = "label_" + std::to_string(i % 2);
+  msg.topic = "topic_" + std::to_string(i % 4);
+  return msg;
+}
+
+}  // namespace
+
+TEST(string_dictionary_repeated_strings_become_references)
+{
+  DictionaryStreamEncoder encoder;
+  DictionaryStreamDecoder decoder;
+  std::array<char, 512> buffer;
+  size_t sizes[2];
+  for (int round = 0; round < 2; ++round) {
+    const Wide msg = make_wide(0);
+    sizes[round] = encoder.encode(buffer, msg);
+    CHECK(sizes[round] > 0);
+    Wide decoded;
+    decoder.decode(buffer.data(), sizes[round], decoded);
+    CHECK_EQ(decoded.frame, msg.frame);
+    CHECK(decoded.tags == msg.tags);
+    CHECK_EQ(decoded.label.text, msg.label.text);
+    CHECK_EQ(decoded.topic, msg.topic);
+  }
+  // The first message is written in full, the second refers back to it
+  CHECK(sizes[1] < sizes[0]);
+  CHECK_EQ(encoder.dictionary().size(), decoder.dictionary().size());
+}
+
+TEST(string_dictionary_stays_in_sync_across_skipped_fields)
+{
+  DictionaryStreamEncoder encoder;
+  DictionaryStreamDecoder decoder;
+  std::array<char, 512> buffer;
+  for (int i = 0; i < 40; ++i) {
+    const Wide msg = make_wide(i);
+    const size_t size = encoder.encode(buffer, msg);
+    CHECK(size > 0);
+    Narrow decoded;
+    decoder.decode(buffer.data(), size, decoded);
+    // A drifted table would resolve topic to some other string
+    CHECK_EQ(decoded.topic, msg.topic);
+    CHECK_EQ(encoder.dictionary().size(), decoder.dictionary().size());
+  }
+  for (size_t i = 0; i < encoder.dictionary().size(); ++i) {
+    CHECK_EQ(encoder.dictionary().at(i), decoder.dictionary().at(i));
+  }
+}
+
+TEST(string_dictionary_failed_messages_leave_table_unchanged)
+{
+  DictionaryStreamEncoder encoder;
+  DictionaryStreamDecoder decoder;
+  std::array<char, 512> buffer;
+  Wide decoded;
+  decoder.decode(buffer.data(), encoder.encode(buffer, make_wide(1)), decoded);
+  const size_t entries = encoder.dictionary().size();
+
+  // Too small a buffer fails the encode without recording anything
+  std::array<char, 8> small;
+  CHECK_EQ(encoder.encode(small, make_wide(7)), size_t{0});
+  CHECK_EQ(encoder.dictionary().size(), entries);
+
+  // A truncated message fails the decode without recording anything
+  const size_t next = encoder.encode(buffer, make_wide(5));
+  CHECK_THROWS(decoder.decode(buffer.data(), next - 1, decoded));
+  CHECK_EQ(decoder.dictionary().size(), entries);
+  decoder.decode(buffer.data(), next, decoded);
+  CHECK_EQ(decoded.topic, make_wide(5).topic);
+  CHECK_EQ(encoder.dictionary().size(), decoder.dictionary().size());
+}
+
+TEST(string_dictionary_rejects_unknown_reference)
+{
+  DictionaryStreamDecoder decoder;
+  // {"topic": ext 127 [0x05]} before anything was recorded
+  const std::string bytes("\x81\xa5" "topic\xd4\x7f\x05", 10);
+  Narrow decoded;
+  CHECK_THROWS(decoder.decode(bytes.data(), bytes.size(), decoded));
+  // Reference of an unsupported width
+  const std::string wide_ref("\x81\xa5" "topic\xc7\x03\x7f\x00\x00\x00", 13);
+  CHECK_THROWS(decoder.decode(wide_ref.data(), wide_ref.size(), decoded));
+}
+
+TEST(string_dictionary_record_message_rule)
+{
+  StringDictionary dictionary(4, 3);
+  // ["abc", "abcd", {"long_key": "abcd"}, bin "binary", "second", "third"]
+  static const char kMessage[] =
+    "\x96\xa3" "abc\xa4" "abcd\x81\xa8" "long_key\xa4" "abcd\xc4\x06" "binary"
+    "\xa6" "second\xa5" "third";
+  const std::string message(kMessage, sizeof(kMessage) - 1);
+  dictionary.record_message(message.data(), message.size());
+  CHECK_EQ(dictionary.size(), size_t{3});
+  CHECK_EQ(dictionary.at(0), std::string("abcd"));
+  CHECK_EQ(dictionary.at(1), std::string("long_key"));
+  CHECK_EQ(dictionary.at(2), std::string("second"));
+  CHECK_EQ(dictionary.lookup("second"), size_t{2});
+  CHECK_EQ(dictionary.lookup("third"), StringDictionary::npos);
+  CHECK_THROWS(dictionary.at(3));
+
+  CHECK_THROWS(dictionary.record_message(message.data(), message.size() - 3));
+  dictionary.truncate(1);
+  CHECK_EQ(dictionary.lookup("long_key"), StringDictionary::npos);
+  CHECK_EQ(dictionary.lookup("abcd"), size_t{0});
+}
+
+TEST(string_dictionary_reset_restarts_both_sides)
+{
+  DictionaryStreamEncoder encoder;
+  DictionaryStreamDecoder decoder;
+  std::array<char, 512> buffer;
+  Narrow decoded;
+  decoder.decode(buffer.data(), encoder.encode(buffer, make_wide(2)), decoded);
+  encoder.reset();
+  decoder.reset();
+  CHECK_EQ(encoder.dictionary().size(), size_t{0});
+  decoder.decode(buffer.data(), encoder.encode(buffer, make_wide(2)), decoded);
+  CHECK_EQ(decoded.topic, make_wide(2).topic);
+}
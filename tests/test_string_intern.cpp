@@ -0,0 +1,109 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mpack_string_intern.h"
+#include "test_util.h"
+
+using serialization::DecodeContext;
+using serialization::InternedString;
+using serialization::StringInterner;
+using test_util::decode;
+using test_util::decode_node;
+using test_util::encode;
+
+TEST(string_intern_same_bytes_same_handle)
+{
+  StringInterner interner(16);
+  const InternedString a = interner.intern("cmd_vel");
+  const InternedString b = interner.intern(std::string("cmd_") + "vel");
+  CHECK(a == b);
+  CHECK(a.data() == b.data());
+  CHECK(a != interner.intern("odom"));
+  CHECK_EQ(a.view(), std::string_view("cmd_vel"));
+  CHECK_EQ(a.hash(), std::hash<std::string_view>()("cmd_vel"));
+  CHECK(interner.intern("") == InternedString());
+  CHECK_EQ(interner.size(), size_t{2});
+}
+
+TEST(string_intern_find_does_not_insert)
+{
+  StringInterner interner(16);
+  CHECK(interner.find("absent").empty());
+  CHECK_EQ(interner.size(), size_t{0});
+  const InternedString a = interner.intern("present");
+  CHECK(interner.find("present") == a);
+}
+
+TEST(string_intern_handles_survive_growth)
+{
+  StringInterner interner(16);
+  std::vector<InternedString> handles;
+  for (int i = 0; i < 5000; ++i) {
+    handles.push_back(interner.intern("name_" + std::to_string(i)));
+  }
+  // One string larger than a quarter block gets its own allocation
+  const std::string big(40000, 'b');
+  const InternedString large = interner.intern(big);
+  CHECK_EQ(interner.size(), size_t{5001});
+  for (int i = 0; i < 5000; ++i) {
+    const std::string name = "name_" + std::to_string(i);
+    CHECK(interner.find(name) == handles[i]);
+    CHECK_EQ(std::string(handles[i].view()), name);
+  }
+  CHECK(interner.intern(big) == large);
+  CHECK_EQ(large.size(), big.size());
+}
+
+TEST(string_intern_concurrent_interning_agrees)
+{
+  StringInterner interner(16);
+  constexpr int kThreads = 4;
+  constexpr int kStrings = 2000;
+  std::vector<std::vector<InternedString>> results(kThreads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kStrings; ++i) {
+        results[t].push_back(interner.intern("topic/" + std::to_string(i)));
+      }
+    });
+  }
+  for (auto & thread : threads) {
+    thread.join();
+  }
+  CHECK_EQ(interner.size(), size_t{kStrings});
+  for (int t = 1; t < kThreads; ++t) {
+    CHECK(results[t] == results[0]);
+  }
+}
+
+TEST(string_intern_round_trip_into_context_interner)
+{
+  StringInterner interner;
+  DecodeContext ctx;
+  ctx.interner = &interner;
+  const std::string bytes = encode(std::string("frame_id"));
+  const InternedString a = decode<InternedString>(bytes, ctx);
+  const InternedString b = decode_node<InternedString>(bytes, ctx);
+  CHECK(a == b);
+  CHECK(a == interner.find("frame_id"));
+  CHECK_EQ(encode(a), bytes);
+  CHECK_EQ(interner.size(), size_t{1});
+}
+
+TEST(string_intern_rejects_bad_input)
+{
+  StringInterner interner;
+  DecodeContext ctx;
+  ctx.interner = &interner;
+  CHECK_THROWS(decode<InternedString>(encode(int64_t{3}), ctx));
+  CHECK_THROWS(decode_node<InternedString>(encode(int64_t{3}), ctx));
+  CHECK_THROWS(decode<InternedString>(std::string("\xa4" "ab", 3), ctx));
+
+  ctx.flags = serialization::DecodeValidateUtf8;
+  const std::string invalid("\xa2\xc3\x28", 3);
+  CHECK_THROWS(decode<InternedString>(invalid, ctx));
+  CHECK_THROWS(decode_node<InternedString>(invalid, ctx));
+  CHECK_EQ(interner.size(), size_t{0});
+}
@@ -0,0 +1,46 @@
+#include <cstdint>
+#include <string>
+
+#include "test_util.h"
+
+using serialization::TaggedVariant;
+using test_util::decode;
+using test_util::decode_node;
+using test_util::encode;
+
+TEST(tagged_variant_wire_format)
+{
+  using V = TaggedVariant<int32_t, int64_t, std::string>;
+  CHECK_EQ(encode(V(int64_t{5})), std::string("\x92\x01\x05", 3));
+  CHECK_EQ(encode(V(std::string("a"))), std::string("\x92\x02\xa1" "a", 4));
+}
+
+TEST(tagged_variant_keeps_alternatives_sharing_a_type)
+{
+  using V = TaggedVariant<int32_t, int64_t>;
+  const V as_32 = int32_t{9};
+  const V as_64 = int64_t{9};
+  CHECK_EQ(decode<V>(encode(as_32)).index(), size_t{0});
+  CHECK_EQ(decode<V>(encode(as_64)).index(), size_t{1});
+  CHECK_EQ(decode_node<V>(encode(as_64)).index(), size_t{1});
+  CHECK_EQ(std::get<int64_t>(decode_node<V>(encode(as_64)).as_variant()), int64_t{9});
+}
+
+TEST(tagged_variant_rejects_bad_index_and_shape)
+{
+  using V = TaggedVariant<int32_t, std::string>;
+  CHECK_THROWS(decode<V>(std::string("\x92\x02\x05", 3)));
+  CHECK_THROWS(decode<V>(std::string("\x93\x00\x05\x05", 4)));
+  CHECK_THROWS(decode<V>(std::string("\x05", 1)));
+  CHECK_THROWS(decode_node<V>(std::string("\x92\x02\x05", 3)));
+  CHECK_THROWS(decode_node<V>(std::string("\x91\x00", 2)));
+  // Index 0 is int32_t, so a str value is a type error
+  CHECK_THROWS(decode<V>(std::string("\x92\x00\xa1" "a", 4)));
+}
+
+TEST(tagged_variant_value_out_of_range_for_alternative)
+{
+  using V = TaggedVariant<int8_t, int64_t>;
+  CHECK_THROWS(decode<V>(std::string("\x92\x00\xcd\x01\x00", 5)));
+  CHECK_THROWS(decode_node<V>(std::string("\x92\x00\xcd\x01\x00", 5)));
+}
@@ -0,0 +1,95 @@
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "mpack_thread_context.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::ThreadContext;
+
+namespace
+{
+
+ThreadContext::Limits small_limits()
+{
+  ThreadContext::Limits limits;
+  limits.initial_buffer_bytes = 64;
+  limits.max_buffer_bytes = 1024;
+  limits.max_tree_nodes = 32;
+  return limits;
+}
+
+X90Error make_error(size_t length)
+{
+  return X90Error("name", "type", std::string(length, 'e'));
+}
+
+}  // namespace
+
+TEST(thread_context_encode_decode_round_trip)
+{
+  ThreadContext context(small_limits());
+  // Grows from 64 bytes to fit, within the cap
+  const X90Error error = make_error(300);
+  const std::string_view bytes = context.encode(error);
+  CHECK_EQ(std::string(bytes), test_util::encode_message(error));
+
+  X90Error decoded;
+  context.decode(bytes.data(), bytes.size(), decoded);
+  CHECK_EQ(decoded.error, error.error);
+  CHECK_THROWS(context.decode(bytes.data(), bytes.size() - 1, decoded));
+
+  serialization::MessageTree & tree = context.parse(bytes.data(), bytes.size());
+  X90Error from_tree;
+  tree.decode(from_tree);
+  CHECK_EQ(from_tree.name, error.name);
+}
+
+TEST(thread_context_oversized_buffers_are_freed_on_next_use)
+{
+  ThreadContext context(small_limits());
+  context.encode(make_error(10));
+  const size_t warm = context.retained_bytes();
+
+  // One message over the cap is still encoded in full
+  const X90Error big = make_error(5000);
+  CHECK_EQ(std::string(context.encode(big)), test_util::encode_message(big));
+  CHECK(context.retained_bytes() > 5000);
+
+  // The next call starts again from the initial size
+  context.encode(make_error(10));
+  CHECK(context.retained_bytes() <= warm);
+
+  context.scratch(10000);
+  CHECK(context.retained_bytes() > 10000);
+  context.trim();
+  CHECK(context.retained_bytes() <= warm);
+  context.release();
+  CHECK(context.retained_bytes() <= sizeof(mpack_node_data_t));
+}
+
+TEST(thread_context_tree_pool_is_capped)
+{
+  ThreadContext context(small_limits());
+  X90Msg msg{};
+  for (int i = 0; i < 20; ++i) {
+    X90IOGroup group{};
+    group.name = "g";
+    msg.io_groups.push_back(group);
+  }
+  const std::string bytes = test_util::encode_message(msg);
+  CHECK(context.parse(bytes.data(), bytes.size()).pool_capacity() > 32);
+  const std::string small = test_util::encode_message(make_error(1));
+  CHECK(context.parse(small.data(), small.size()).pool_capacity() <= 32);
+}
+
+TEST(thread_context_local_is_per_thread)
+{
+  ThreadContext * main_context = &ThreadContext::local();
+  CHECK(main_context == &ThreadContext::local());
+  ThreadContext * other = nullptr;
+  std::thread([&other] {other = &ThreadContext::local();}).join();
+  CHECK(other != main_context);
+}
@@ -0,0 +1,198 @@
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mpack_utf8.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::DecodeContext;
+using serialization::DecodeValidateUtf8;
+using serialization::utf8_valid;
+
+namespace
+{
+
+using Validate = serialization::utf8_detail::ValidateFn;
+
+// Decodes code points the long way, per RFC 3629
+bool reference_valid(const uint8_t * s, size_t size)
+{
+  static const uint32_t kMinimum[] = {0, 0, 0x80, 0x800, 0x10000};
+  size_t i = 0;
+  while (i < size) {
+    const uint8_t lead = s[i];
+    size_t length;
+    uint32_t code_point;
+    if (lead < 0x80) {
+      ++i;
+      continue;
+    } else if ((lead & 0xe0) == 0xc0) {
+      length = 2;
+      code_point = lead & 0x1fu;
+    } else if ((lead & 0xf0) == 0xe0) {
+      length = 3;
+      code_point = lead & 0x0fu;
+    } else if ((lead & 0xf8) == 0xf0) {
+      length = 4;
+      code_point = lead & 0x07u;
+    } else {
+      return false;
+    }
+    if (size - i < length) {
+      return false;
+    }
+    for (size_t k = 1; k < length; ++k) {
+      if ((s[i + k] & 0xc0) != 0x80) {
+        return false;
+      }
+      code_point = (code_point << 6) | (s[i + k] & 0x3fu);
+    }
+    if (code_point < kMinimum[length] || code_point > 0x10ffff ||
+      (code_point >= 0xd800 && code_point <= 0xdfff))
+    {
+      return false;
+    }
+    i += length;
+  }
+  return true;
+}
+
+// Every implementation this CPU can run
+std::vector<std::pair<const char *, Validate>> implementations()
+{
+  std::vector<std::pair<const char *, Validate>> out = {{"scalar", &serialization::utf8_detail::validate_scalar}};
+#if MPACK_UTF8_X86
+  if (__builtin_cpu_supports("ssse3")) {
+    out.emplace_back("ssse3", &serialization::utf8_detail::validate_ssse3);
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    out.emplace_back("avx2", &serialization::utf8_detail::validate_avx2);
+  }
+#endif
+  return out;
+}
+
+// Checks every implementation, and utf8_valid(), against the reference
+void check_all(const std::string & bytes)
+{
+  const uint8_t * s = reinterpret_cast<const uint8_t *>(bytes.data());
+  const bool expected = reference_valid(s, bytes.size());
+  for (const auto & [name, validate] : implementations()) {
+    if (validate(s, bytes.size()) != expected) {
+      test_util::fail(__FILE__, __LINE__, std::string(name) + " disagrees on " + test_util::describe(bytes));
+    }
+  }
+  CHECK_EQ(utf8_valid(bytes.data(), bytes.size()), expected);
+}
+
+}  // namespace
+
+TEST(utf8_known_sequences)
+{
+  CHECK(utf8_valid("", 0));
+  const std::string valid[] = {
+    "plain ascii", "\xc2\x80", "\xdf\xbf", "\xe0\xa0\x80", "\xed\x9f\xbf", "\xee\x80\x80",
+    "\xef\xbf\xbf", "\xf0\x90\x80\x80", "\xf4\x8f\xbf\xbf", "caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80",
+  };
+  for (const std::string & s : valid) {
+    CHECK(utf8_valid(s.data(), s.size()));
+  }
+  const std::string invalid[] = {
+    "\x80", "\xbf", "\xc0\x80", "\xc1\xbf", "\xc2", "\xe0\x80\x80", "\xe0\x9f\xbf",
+    "\xed\xa0\x80", "\xed\xbf\xbf", "\xf0\x80\x80\x80", "\xf0\x8f\xbf\xbf", "\xf4\x90\x80\x80",
+    "\xf5\x80\x80\x80", "\xff", "\xe2\x82", "\xf0\x9f\x98", "\xc3\xa9\xa9",
+  };
+  for (const std::string & s : invalid) {
+    CHECK(!utf8_valid(s.data(), s.size()));
+  }
+}
+
+TEST(utf8_implementations_agree_exhaustively)
+{
+  // Every one and two byte string, and three and four byte strings built
+  // from every lead with continuation bytes at the edges of their ranges
+  for (int a = 0; a < 256; ++a) {
+    check_all(std::string(1, static_cast<char>(a)));
+    for (int b = 0; b < 256; ++b) {
+      check_all(std::string{static_cast<char>(a), static_cast<char>(b)});
+    }
+  }
+  const int edges[] = {0x00, 0x7f, 0x80, 0x8f, 0x90, 0x9f, 0xa0, 0xbf, 0xc0, 0xf4, 0xff};
+  for (int a = 0xc0; a < 256; ++a) {
+    for (int b : edges) {
+      for (int c : edges) {
+        check_all(std::string{static_cast<char>(a), static_cast<char>(b), static_cast<char>(c)});
+        for (int d : edges) {
+          check_all(
+            std::string{static_cast<char>(a), static_cast<char>(b), static_cast<char>(c), static_cast<char>(d)});
+        }
+      }
+    }
+  }
+}
+
+TEST(utf8_sequences_across_block_boundaries)
+{
+  // Multi-byte sequences, whole or cut short, at every offset of 96 bytes
+  // of ASCII so they straddle the 16 and 32 byte SIMD blocks
+  const std::string sequences[] = {
+    "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xed\xa0\x80", "\xe0\x80\xaf", "\xf4\x90\x80\x80",
+    "\xe2\x82", "\xf0\x9f\x98", "\xc3", "\x80",
+  };
+  for (const std::string & sequence : sequences) {
+    for (size_t offset = 0; offset + sequence.size() <= 96; ++offset) {
+      std::string bytes(96, 'a');
+      bytes.replace(offset, sequence.size(), sequence);
+      check_all(bytes);
+      // Ending exactly after the sequence, also mid-block
+      check_all(bytes.substr(0, offset + sequence.size()));
+    }
+  }
+}
+
+TEST(utf8_random_strings)
+{
+  std::mt19937 rng(47);
+  const std::string pieces[] = {"a", "z", " ", "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xd0\xaf"};
+  for (int round = 0; round < 3000; ++round) {
+    std::string bytes;
+    const size_t length = rng() % 200;
+    while (bytes.size() < length) {
+      bytes += pieces[rng() % (sizeof(pieces) / sizeof(pieces[0]))];
+    }
+    // Valid as built; corrupt one byte in most rounds
+    if (round % 4 != 0 && !bytes.empty()) {
+      bytes[rng() % bytes.size()] = static_cast<char>(rng());
+    }
+    check_all(bytes);
+  }
+}
+
+TEST(utf8_opt_in_string_decode)
+{
+  const X90Error bad("caf\xc3", "type", "message");
+  const std::string bytes = test_util::encode_message(bad);
+  DecodeContext validating;
+  validating.flags = DecodeValidateUtf8;
+
+  // Accepted as bytes by default, rejected when asked for
+  X90Error decoded;
+  test_util::decode_message(bytes, decoded);
+  CHECK_EQ(decoded.name, bad.name);
+  CHECK_THROWS(test_util::decode_message(bytes, decoded, validating));
+  CHECK_THROWS(test_util::decode_node<X90Error>(bytes, validating));
+
+  // fixed_string fields too
+  const X90Error bad_type("name", "\xff", "message");
+  const std::string type_bytes = test_util::encode_message(bad_type);
+  CHECK_THROWS(test_util::decode_message(type_bytes, decoded, validating));
+
+  const X90Error good("caf\xc3\xa9", "t\xc3\xa9", std::string(100, 'x') + "\xe2\x82\xac");
+  const std::string good_bytes = test_util::encode_message(good);
+  test_util::decode_message(good_bytes, decoded, validating);
+  CHECK_EQ(decoded.error, good.error);
+}
@@ -0,0 +1,238 @@
+#ifndef MPACK_TEST_UTIL_H
+#define MPACK_TEST_UTIL_H
+
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mpack/mpack.h"
+#include "mpack_serialize_typehandlers.h"
+#include "mpack_serializer.h"
+
+/**
+ * Minimal test registry: TEST(name) defines a test, CHECK* abort the test
+ * on failure. test_main.cpp runs every test whose name starts with the
+ * first command line argument, so ctest can run one feature at a time.
+ */
+namespace test_util
+{
+
+struct Failure : std::runtime_error
+{
+  using std::runtime_error::runtime_error;
+};
+
+struct TestCase
+{
+  const char * name;
+  void (* fn)();
+};
+
+inline std::vector<TestCase> & registry()
+{
+  static std::vector<TestCase> tests;
+  return tests;
+}
+
+struct Registrar
+{
+  Registrar(const char * name, void (* fn)()) { registry().push_back({name, fn}); }
+};
+
+[[noreturn]] inline void fail(const char * file, int line, const std::string & what)
+{
+  std::ostringstream out;
+  out << file << ":" << line << ": " << what;
+  throw Failure(out.str());
+}
+
+template<typename T>
+std::string describe(const T & value)
+{
+  std::ostringstream out;
+  if constexpr (std::is_same_v<T, std::string>) {
+    out << '"';
+    for (unsigned char c : value) {
+      if (c >= 0x20 && c < 0x7f) {
+        out << c;
+      } else {
+        static const char digits[] = "0123456789abcdef";
+        out << "\\x" << digits[c >> 4] << digits[c & 15];
+      }
+    }
+    out << '"';
+  } else if constexpr (std::is_enum_v<T>) {
+    out << static_cast<long long>(value);
+  } else if constexpr (std::is_integral_v<T> && sizeof(T) == 1) {
+    out << static_cast<int>(value);
+  } else {
+    out << value;
+  }
+  return out.str();
+}
+
+// Encodes one value through its TypeHandler
+template<typename T>
+std::string encode(const T & value, const serialization::EncodeContext & ctx = {})
+{
+  char * data = nullptr;
+  size_t size = 0;
+  mpack_writer_t writer;
+  mpack_writer_init_growable(&writer, &data, &size);
+  serialization::write_value(&writer, value, ctx);
+  if (mpack_writer_destroy(&writer) != mpack_ok) {
+    throw std::runtime_error("encode failed");
+  }
+  std::string bytes(data, size);
+  std::free(data);
+  return bytes;
+}
+
+// Decodes one value with the reader backend; throws on any mpack error
+template<typename T>
+T decode(const std::string & bytes, const serialization::DecodeContext & ctx = {})
+{
+  T value{};
+  mpack_reader_t reader;
+  mpack_reader_init_data(&reader, bytes.data(), bytes.size());
+  try {
+    serialization::read_value(&reader, value, ctx);
+  } catch (...) {
+    mpack_reader_destroy(&reader);
+    throw;
+  }
+  if (mpack_reader_destroy(&reader) != mpack_ok) {
+    throw std::runtime_error("decode failed");
+  }
+  return value;
+}
+
+// Decodes one value with the node backend; throws on any mpack error
+template<typename T>
+T decode_node(const std::string & bytes, const serialization::DecodeContext & ctx = {})
+{
+  std::vector<mpack_node_data_t> pool(bytes.size() + 1);
+  mpack_tree_t tree;
+  mpack_tree_init_pool(&tree, bytes.data(), bytes.size(), pool.data(), pool.size());
+  mpack_tree_parse(&tree);
+  T value{};
+  if (mpack_tree_error(&tree) == mpack_ok) {
+    try {
+      serialization::read_value(mpack_tree_root(&tree), value, ctx);
+    } catch (...) {
+      mpack_tree_destroy(&tree);
+      throw;
+    }
+  }
+  if (mpack_tree_destroy(&tree) != mpack_ok) {
+    throw std::runtime_error("decode failed");
+  }
+  return value;
+}
+
+// Encodes a reflected message
+inline std::string encode_message(const Serializable & obj, const serialization::EncodeContext & ctx = {})
+{
+  char * data = nullptr;
+  size_t size = 0;
+  mpack_writer_t writer;
+  mpack_writer_init_growable(&writer, &data, &size);
+  obj.serialize(&writer, ctx);
+  if (mpack_writer_destroy(&writer) != mpack_ok) {
+    throw std::runtime_error("encode failed");
+  }
+  std::string bytes(data, size);
+  std::free(data);
+  return bytes;
+}
+
+// Decodes a reflected message with the reader backend
+inline void decode_message(
+  const std::string & bytes, Serializable & obj,
+  const serialization::DecodeContext & ctx = {})
+{
+  mpack_reader_t reader;
+  mpack_reader_init_data(&reader, bytes.data(), bytes.size());
+  try {
+    obj.deserialize(&reader, ctx);
+  } catch (...) {
+    mpack_reader_destroy(&reader);
+    throw;
+  }
+  if (mpack_reader_destroy(&reader) != mpack_ok) {
+    throw std::runtime_error("decode failed");
+  }
+}
+
+// Fresh directory under the system temp directory, removed with its contents
+class TempDir
+{
+public:
+  TempDir()
+  {
+    std::string path = (std::filesystem::temp_directory_path() / "mpack_test_XXXXXX").string();
+    if (::mkdtemp(&path[0]) == nullptr) {
+      throw std::runtime_error("mkdtemp failed");
+    }
+    path_ = path;
+  }
+
+  TempDir(const TempDir &) = delete;
+  TempDir & operator=(const TempDir &) = delete;
+
+  ~TempDir()
+  {
+    std::error_code ignored;
+    std::filesystem::remove_all(path_, ignored);
+  }
+
+  const std::string & path() const { return path_; }
+  std::string file(const std::string & name) const { return (std::filesystem::path(path_) / name).string(); }
+
+private:
+  std::string path_;
+};
+
+}  // namespace test_util
+
+#define TEST(name) \
+  static void name(); \
+  static const test_util::Registrar name##_registrar(#name, &name); \
+  static void name()
+
+#define CHECK(...) \
+  do { \
+    if (!(__VA_ARGS__)) { \
+      test_util::fail(__FILE__, __LINE__, "CHECK(" #__VA_ARGS__ ") failed"); \
+    } \
+  } while (0)
+
+#define CHECK_EQ(a, b) \
+  do { \
+    const auto check_a_ = (a); \
+    const auto check_b_ = (b); \
+    if (!(check_a_ == check_b_)) { \
+      test_util::fail( \
+        __FILE__, __LINE__, "CHECK_EQ(" #a ", " #b ") failed: " + \
+        test_util::describe(check_a_) + " != " + test_util::describe(check_b_)); \
+    } \
+  } while (0)
+
+#define CHECK_THROWS(...) \
+  do { \
+    bool check_threw_ = false; \
+    try { \
+      (void)(__VA_ARGS__); \
+    } catch (const std::exception &) { \
+      check_threw_ = true; \
+    } \
+    if (!check_threw_) { \
+      test_util::fail(__FILE__, __LINE__, "CHECK_THROWS(" #__VA_ARGS__ ") did not throw"); \
+    } \
+  } while (0)
+
+#endif  // MPACK_TEST_UTIL_H
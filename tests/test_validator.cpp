@@ -0,0 +1,228 @@
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mpack_stream_reader.h"
+#include "mpack_validator.h"
+#include "test_util.h"
+#include "x90_msg.h"
+
+using serialization::MessageScanner;
+using serialization::MessageValidator;
+
+namespace
+{
+
+// One value of every msgpack type in an array16
+static const char kEveryType[] =
+  "\xdc\x00\x14"
+  "\xc0\xc2\xc3\x7f\xe0"
+  "\xcc\xff" "\xcd\x01\x00" "\xce\x00\x01\x00\x00" "\xcf\x00\x00\x00\x01\x00\x00\x00\x00"
+  "\xd0\x80" "\xd1\x80\x00" "\xd2\x80\x00\x00\x00" "\xd3\x80\x00\x00\x00\x00\x00\x00\x00"
+  "\xca\x3f\x80\x00\x00" "\xcb\x3f\xf0\x00\x00\x00\x00\x00\x00"
+  "\xd9\x03" "abc" "\xc4\x02" "xy" "\xd4\x01" "z" "\xc7\x02\x05" "pq"
+  "\xde\x00\x01\xa1" "k\x80";
+
+class Sample : public MsgPackSerializable<Sample>
+{
+public:
+  std::optional<int32_t> maybe;
+  std::vector<uint32_t> counts;
+  std::map<std::string, double> values;
+  static constexpr auto get_fields()
+  {
+    using namespace serialization;
+    return std::make_tuple(
+      make_field("maybe", &Sample::maybe), make_field("counts", &Sample::counts),
+      make_field("values", &Sample::values));
+  }
+};
+
+X90Msg make_message()
+{
+  X90Msg msg{};
+  msg.endpoint_id = "endpoint";
+  msg.current_time = 1622547800;
+  for (int g = 0; g < 2; ++g) {
+    X90IOGroup group{};
+    group.name = "group";
+    group.time_recorded = 1000;
+    X90IO io{};
+    io.name = "io";
+    io.data = 2.5;
+    group.ios.push_back(io);
+    io.data = true;
+    group.ios.push_back(io);
+    group.errors.push_back(X90Error("e", "type", "message"));
+    msg.io_groups.push_back(group);
+  }
+  return msg;
+}
+
+std::string nested_arrays(size_t depth)
+{
+  return std::string(depth, '\x91') + '\xc0';
+}
+
+}  // namespace
+
+TEST(validator_accepts_well_formed_input)
+{
+  MessageValidator validator;
+  CHECK(validator.validate(kEveryType, sizeof(kEveryType) - 1));
+
+  const std::string message = test_util::encode_message(make_message());
+  CHECK(validator.validate(message.data(), message.size()));
+  CHECK(validator.validate_as<X90Msg>(message.data(), message.size()));
+  validator.check_as<X90Msg>(message.data(), message.size());
+
+  Sample sample;
+  sample.maybe = -5;
+  sample.counts = {1, 2, 300000};
+  sample.values = {{"a", 1.5}, {"b", -2.0}};
+  const std::string encoded = test_util::encode_message(sample);
+  CHECK(validator.validate_as<Sample>(encoded.data(), encoded.size()));
+  sample.maybe.reset();
+  const std::string with_nil = test_util::encode_message(sample);
+  CHECK(validator.validate_as<Sample>(with_nil.data(), with_nil.size()));
+}
+
+TEST(validator_rejects_every_truncation_and_trailing_bytes)
+{
+  MessageValidator validator;
+  const std::string every(kEveryType, sizeof(kEveryType) - 1);
+  const std::string message = test_util::encode_message(make_message());
+  for (const std::string & bytes : {every, message}) {
+    for (size_t size = 0; size < bytes.size(); ++size) {
+      const MessageValidator::Result result = validator.validate(bytes.data(), size);
+      CHECK(!result);
+      CHECK(result.offset <= size);
+    }
+    const std::string trailing = bytes + '\xc0';
+    const MessageValidator::Result result = validator.validate(trailing.data(), trailing.size());
+    CHECK(!result);
+    CHECK_EQ(result.offset, bytes.size());
+  }
+
+  static const char kInvalid[] = "\x92\x01\xc1";
+  const MessageValidator::Result invalid = validator.validate(kInvalid, sizeof(kInvalid) - 1);
+  CHECK(!invalid);
+  CHECK_EQ(invalid.offset, size_t{2});
+}
+
+TEST(validator_limits)
+{
+  MessageValidator validator;
+  const std::string deep = nested_arrays(32);
+  CHECK(validator.validate(deep.data(), deep.size()));
+  const std::string deeper = nested_arrays(33);
+  CHECK(!validator.validate(deeper.data(), deeper.size()));
+
+  // The depth limit is capped whatever is configured
+  MessageValidator::Limits limits;
+  limits.max_depth = 100000;
+  MessageValidator capped(limits);
+  const std::string at_cap = nested_arrays(MessageValidator::kMaxDepthLimit);
+  CHECK(capped.validate(at_cap.data(), at_cap.size()));
+  const std::string past_cap = nested_arrays(MessageValidator::kMaxDepthLimit + 1);
+  CHECK(!capped.validate(past_cap.data(), past_cap.size()));
+
+  limits = MessageValidator::Limits{};
+  limits.max_bytes = 8;
+  limits.max_string_bytes = 4;
+  limits.max_entries = 3;
+  MessageValidator small(limits);
+  CHECK(small.validate("\x93\x01\x02\x03", 4));
+  CHECK(!small.validate("\x94\x01\x02\x03\x04", 5));
+  CHECK(small.validate("\xa4" "abcd", 5));
+  CHECK(!small.validate("\xa5" "abcde", 6));
+  CHECK(!small.validate("\xc4\x05" "abcde", 7));
+  CHECK(!small.validate("\x99\x01\x02\x03\x04\x05\x06\x07\x08\x09", 10));
+  // Maps count entries, not keys and values
+  CHECK(small.validate("\x83\x01\x01\x02\x02\x03\x03", 7));
+
+  // A header claiming more values than there are bytes
+  static const char kHuge[] = "\xdd\xff\xff\xff\xff\xc0";
+  limits = MessageValidator::Limits{};
+  limits.max_entries = ~size_t{0};
+  const MessageValidator::Result huge = MessageValidator(limits).validate(kHuge, sizeof(kHuge) - 1);
+  CHECK(!huge);
+  CHECK_EQ(std::string(huge.error), std::string("Container count exceeds the remaining bytes"));
+  static const char kHugeStr[] = "\xdb\x7f\xff\xff\xff";
+  CHECK(!validator.validate(kHugeStr, sizeof(kHugeStr) - 1));
+}
+
+TEST(validator_schema_mismatches)
+{
+  MessageValidator validator;
+  // Name holds an int
+  static const char kWrongField[] = "\x81\xa4" "Name\x05";
+  MessageValidator::Result result = validator.validate_as<X90Error>(kWrongField, sizeof(kWrongField) - 1);
+  CHECK(!result);
+  CHECK_EQ(result.offset, size_t{6});
+  CHECK_THROWS(validator.check_as<X90Error>(kWrongField, sizeof(kWrongField) - 1));
+
+  static const char kIntKey[] = "\x81\x01\x02";
+  result = validator.validate_as<X90Error>(kIntKey, sizeof(kIntKey) - 1);
+  CHECK(!result);
+  CHECK_EQ(result.offset, size_t{1});
+
+  // Neither bool nor double
+  static const char kBadVariant[] = "\x81\xa4" "data\xa1" "x";
+  result = validator.validate_as<X90IO>(kBadVariant, sizeof(kBadVariant) - 1);
+  CHECK(!result);
+  CHECK_EQ(result.offset, size_t{6});
+
+  // Unknown keys are skipped whatever they hold
+  static const char kUnknown[] = "\x82\xa5" "Extra\x92\x81\xa1" "a\x90\xc0\xa4" "Name\xa1" "n";
+  CHECK(validator.validate_as<X90Error>(kUnknown, sizeof(kUnknown) - 1));
+
+  // Sequence and keyed map elements are checked; ints read as double
+  static const char kNegativeCount[] = "\x81\xa6" "counts\x92\x01\xff";
+  CHECK(!validator.validate_as<Sample>(kNegativeCount, sizeof(kNegativeCount) - 1));
+  static const char kIntValue[] = "\x81\xa6" "values\x81\xa1" "a\x05";
+  CHECK(validator.validate_as<Sample>(kIntValue, sizeof(kIntValue) - 1));
+  static const char kStrValue[] = "\x81\xa6" "values\x81\xa1" "a\xa1" "x";
+  CHECK(!validator.validate_as<Sample>(kStrValue, sizeof(kStrValue) - 1));
+  static const char kNotArray[] = "\x81\xa6" "counts\x80";
+  CHECK(!validator.validate_as<Sample>(kNotArray, sizeof(kNotArray) - 1));
+
+  // Structural errors come first
+  CHECK_THROWS(validator.check("\x91", 1));
+}
+
+TEST(validator_agrees_with_the_decoder_on_mutations)
+{
+  MessageValidator validator;
+  const std::string message = test_util::encode_message(make_message());
+  size_t valid = 0;
+  for (size_t pos = 0; pos < message.size(); ++pos) {
+    for (int value : {0x00, 0x01, 0x7f, 0x80, 0x90, 0xa0, 0xc0, 0xc1, 0xcb, 0xdc, 0xdd, 0xff}) {
+      std::string mutated = message;
+      mutated[pos] = static_cast<char>(value);
+      const MessageValidator::Result result = validator.validate(mutated.data(), mutated.size());
+      if (!result) {
+        continue;
+      }
+      // Structurally valid: the scanner finds the same single value
+      MessageScanner scanner;
+      CHECK_EQ(scanner.scan(mutated.data(), mutated.size()), mutated.size());
+      if (!validator.validate_as<X90Msg>(mutated.data(), mutated.size())) {
+        continue;
+      }
+      // Schema-valid: decoding only fails on capacity limits
+      ++valid;
+      X90Msg decoded;
+      try {
+        test_util::decode_message(mutated, decoded);
+      } catch (const std::length_error &) {
+      } catch (const std::runtime_error & e) {
+        CHECK_EQ(std::string(e.what()), std::string("String exceeds fixed_string capacity"));
+      }
+    }
+  }
+  CHECK(valid > 0);
+}
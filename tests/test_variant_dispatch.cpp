@@ -0,0 +1,82 @@
+#include <cstdint>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "test_util.h"
+
+using serialization::EncodeCompactFloat;
+using test_util::decode;
+using test_util::decode_node;
+using test_util::encode;
+
+TEST(variant_dispatch_exact_matches)
+{
+  using V = std::variant<bool, int64_t, double, std::string>;
+  CHECK_EQ(decode<V>(encode(true)).index(), size_t{0});
+  CHECK_EQ(std::get<int64_t>(decode<V>(encode(int64_t{-7}))), int64_t{-7});
+  CHECK_EQ(std::get<int64_t>(decode<V>(encode(uint64_t{7}))), int64_t{7});
+  CHECK_EQ(std::get<double>(decode<V>(encode(2.5))), 2.5);
+  CHECK_EQ(std::get<std::string>(decode<V>(encode(std::string("abc")))), std::string("abc"));
+}
+
+TEST(variant_dispatch_converting_match)
+{
+  // No integer alternative, so an int is read by the double alternative
+  using V = std::variant<bool, double>;
+  const V value = decode<V>(encode(uint64_t{200}));
+  CHECK_EQ(value.index(), size_t{1});
+  CHECK_EQ(std::get<double>(value), 200.0);
+}
+
+TEST(variant_dispatch_first_alternative_wins)
+{
+  using V = std::variant<int32_t, int64_t>;
+  CHECK_EQ(decode<V>(encode(int64_t{5})).index(), size_t{0});
+}
+
+TEST(variant_dispatch_replaces_held_alternative)
+{
+  using V = std::variant<std::string, std::vector<int64_t>>;
+  V value = std::string("old");
+  mpack_reader_t reader;
+  const std::string bytes = encode(std::vector<int64_t>{1, 2, 3});
+  mpack_reader_init_data(&reader, bytes.data(), bytes.size());
+  serialization::read_value(&reader, value, {});
+  CHECK(mpack_reader_destroy(&reader) == mpack_ok);
+  CHECK_EQ(std::get<1>(value).size(), size_t{3});
+  CHECK_EQ(std::get<1>(value)[2], int64_t{3});
+}
+
+TEST(variant_dispatch_no_match_throws)
+{
+  using V = std::variant<int64_t, double>;
+  CHECK_THROWS(decode<V>(encode(std::string("x"))));
+  CHECK_THROWS(decode_node<V>(encode(std::string("x"))));
+}
+
+TEST(variant_dispatch_node_backend_agrees)
+{
+  using V = std::variant<bool, int64_t, double, std::string>;
+  const std::string values[] = {
+    encode(false), encode(int64_t{-3}), encode(uint64_t{3}), encode(1.5), encode(1.5f),
+    encode(std::string("s")),
+  };
+  for (const std::string & bytes : values) {
+    CHECK(decode<V>(bytes) == decode_node<V>(bytes));
+  }
+}
+
+TEST(variant_dispatch_compact_float_keeps_alternative)
+{
+  // 3.0 written as fixint would decode as int64_t, so it is written in full
+  using V = std::variant<int64_t, double>;
+  const V value = 3.0;
+  const V restored = decode<V>(encode(value, {EncodeCompactFloat}));
+  CHECK_EQ(restored.index(), size_t{1});
+  CHECK_EQ(std::get<double>(restored), 3.0);
+
+  // With no other numeric alternative the compact form is safe and used
+  using W = std::variant<bool, double>;
+  CHECK_EQ(encode(W(3.0), {EncodeCompactFloat}).size(), size_t{1});
+}